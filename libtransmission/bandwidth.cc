@@ -89,7 +89,6 @@ Bandwidth::Bandwidth(Bandwidth* newParent)
     , children_{}
     , peer_{ nullptr }
 {
-    this->children_ = {};
     this->band_[TR_UP].honor_parent_limits_ = true;
     this->band_[TR_DOWN].honor_parent_limits_ = true;
     this->setParent(newParent);
@@ -105,16 +104,20 @@ void Bandwidth::setParent(Bandwidth* newParent)
 
     if (this->parent_ != nullptr)
     {
-        this->parent_->children_.erase(this);
+        auto& siblings = this->parent_->children_;
+        auto const it = std::find(std::begin(siblings), std::end(siblings), this);
+        TR_ASSERT(it != std::end(siblings));
+        *it = siblings.back();
+        siblings.pop_back();
         this->parent_ = nullptr;
     }
 
     if (newParent != nullptr)
     {
         TR_ASSERT(newParent->parent_ != this);
-        TR_ASSERT(newParent->children_.find(this) == newParent->children_.end()); // does not exist
+        TR_ASSERT(std::find(std::begin(newParent->children_), std::end(newParent->children_), this) == std::end(newParent->children_)); // does not exist
 
-        newParent->children_.insert(this);
+        newParent->children_.push_back(this);
         this->parent_ = newParent;
     }
 }
@@ -123,23 +126,46 @@ void Bandwidth::setParent(Bandwidth* newParent)
 ****
 ***/
 
-void Bandwidth::allocateBandwidth(
-    tr_priority_t parent_priority,
-    tr_direction dir,
-    unsigned int period_msec,
-    std::vector<tr_peerIo*>& peer_pool)
+uint64_t Bandwidth::refill(tr_direction dir, uint64_t now)
 {
-    TR_ASSERT(tr_isDirection(dir));
+    Band* const band = &this->band_[dir];
+    uint64_t const burst = this->getBurst_Bytes(dir);
 
-    tr_priority_t const priority_ = std::max(parent_priority, this->priority);
+    if (band->refilled_at_msec_ == 0 || now < band->refilled_at_msec_)
+    {
+        /* a new bucket starts out full. If the clock went backwards, just start over from now */
+        if (band->refilled_at_msec_ == 0)
+        {
+            band->tokens_ = burst;
+        }
 
-    /* set the available bandwidth */
-    if (this->band_[dir].is_limited_)
+        band->refilled_at_msec_ = now;
+    }
+    else
     {
-        uint64_t const nextPulseSpeed = this->band_[dir].desired_speed_bps_;
-        this->band_[dir].bytes_left_ = nextPulseSpeed * period_msec / 1000U;
+        uint64_t const earned = uint64_t{ band->desired_speed_bps_ } * (now - band->refilled_at_msec_) / 1000U;
+
+        band->tokens_ = std::min(band->tokens_ + earned, burst);
+
+        if (band->tokens_ == burst)
+        {
+            band->refilled_at_msec_ = now;
+        }
+        else if (earned > 0)
+        {
+            /* only move ahead by the time that was paid out, so that
+               the fractions of a byte earned at low speeds aren't lost */
+            band->refilled_at_msec_ += earned * 1000U / band->desired_speed_bps_;
+        }
     }
 
+    return band->tokens_;
+}
+
+void Bandwidth::allocateBandwidth(tr_priority_t parent_priority, std::vector<tr_peerIo*>& peer_pool)
+{
+    tr_priority_t const priority_ = std::max(parent_priority, this->priority);
+
     /* add this bandwidth's peer, if any, to the peer pool */
     if (this->peer_ != nullptr)
     {
@@ -150,52 +176,78 @@ void Bandwidth::allocateBandwidth(
     // traverse & repeat for the subtree
     for (auto child : this->children_)
     {
-        child->allocateBandwidth(priority_, dir, period_msec, peer_pool);
+        child->allocateBandwidth(priority_, peer_pool);
     }
 }
 
-void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir)
+void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir, size_t first)
 {
-    /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
-     * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
-     * and/or peers that can use it */
+    /* First phase of IO. Distributes the bandwidth fairly to keep faster
+     * peers from starving the others: deficit round-robin. Each pass offers
+     * every peer a quantum on top of its deficit, which is whatever it was
+     * offered before and couldn't use because the bandwidth ran out. Keep
+     * going around until we run out of bandwidth and/or peers that can use it */
     dbgmsg("%lu peers to go round-robin for %s", peerArray.size(), dir == TR_UP ? "upload" : "download");
 
+    /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
+     * frame right away and leave enough buffered data for the next frame to go
+     * out in a timely manner. */
+    size_t constexpr Quantum = 3000;
+    size_t constexpr MaxDeficit = 4 * Quantum;
+
+    /* when the bandwidth runs out partway through a pass, the same peers
+     * shouldn't always be the ones that miss out */
     size_t n = peerArray.size();
+    if (n > 0)
+    {
+        std::rotate(std::begin(peerArray), std::begin(peerArray) + first % n, std::end(peerArray));
+    }
+
     while (n > 0)
     {
-        int const i = tr_rand_int_weak(n); /* pick a peer at random */
+        for (size_t i = 0; i < n;)
+        {
+            tr_peerIo* const io = peerArray[i];
+            size_t& deficit = io->bandwidth->band_[dir].deficit_;
+            size_t const offer = deficit + Quantum;
+            int const bytesUsed = tr_peerIoFlush(io, dir, offer);
 
-        /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
-         * frame right away and leave enough buffered data for the next frame to go
-         * out in a timely manner. */
-        size_t const increment = 3000;
+            dbgmsg("peer #%zu of %zu used %d of %zu bytes in this pass", i, n, bytesUsed, offer);
 
-        int const bytesUsed = tr_peerIoFlush(peerArray[i], dir, increment);
+            if (bytesUsed == (int)offer)
+            {
+                deficit = 0;
+                ++i;
+                continue;
+            }
 
-        dbgmsg("peer #%d of %zu used %d bytes in this pass", i, n, bytesUsed);
+            /* peer is done for now. If it ran out of bandwidth rather than
+             * data, it's owed the rest of its offer next time */
+            deficit = tr_peerIoHasBandwidthLeft(io, dir) ? 0 : std::min(offer - std::max(bytesUsed, 0), MaxDeficit);
 
-        if (bytesUsed != (int)increment)
-        {
-            /* peer is done writing for now; move it to the end of the list */
+            /* move it to the end of the list */
             std::swap(peerArray[i], peerArray[n - 1]);
             --n;
         }
     }
 }
 
-void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
+void Bandwidth::allocate(tr_direction dir)
 {
-    std::vector<tr_peerIo*> tmp;
-    std::vector<tr_peerIo*> low;
-    std::vector<tr_peerIo*> normal;
-    std::vector<tr_peerIo*> high;
+    TR_ASSERT(tr_isDirection(dir));
+
+    auto& tmp = this->peer_pool_;
+    auto& low = this->low_;
+    auto& normal = this->normal_;
+    auto& high = this->high_;
 
-    /* allocateBandwidth () is a helper function with two purposes:
-     * 1. allocate bandwidth to b and its subtree
-     * 2. accumulate an array of all the peerIos from b and its subtree. */
-    this->allocateBandwidth(TR_PRI_LOW, dir, period_msec, tmp);
+    tmp.clear();
+    low.clear();
+    normal.clear();
+    high.clear();
+
+    /* allocateBandwidth () accumulates an array of all the peerIos from b and its subtree. */
+    this->allocateBandwidth(TR_PRI_LOW, tmp);
 
     for (auto io : tmp)
     {
@@ -221,9 +273,10 @@ void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
      * peers from starving the others. Loop through the peers, giving each a
      * small chunk of bandwidth. Keep looping until we run out of bandwidth
      * and/or peers that can use it */
-    phaseOne(high, dir);
-    phaseOne(normal, dir);
-    phaseOne(low, dir);
+    size_t const first = this->allocate_count_++;
+    phaseOne(high, dir, first);
+    phaseOne(normal, dir, first);
+    phaseOne(low, dir, first);
 
     /* Second phase of IO. To help us scale in high bandwidth situations,
      * enable on-demand IO for peers with bandwidth left to burn.
@@ -244,51 +297,56 @@ void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
 ****
 ***/
 
-unsigned int Bandwidth::clamp(uint64_t now, tr_direction dir, unsigned int byteCount) const
+unsigned int Bandwidth::getLimit_Bps(tr_direction dir) const
+{
+    TR_ASSERT(tr_isDirection(dir));
+
+    unsigned int limit = 0;
+
+    for (Bandwidth const* b = this; b != nullptr; b = b->band_[dir].honor_parent_limits_ ? b->parent_ : nullptr)
+    {
+        if (b->band_[dir].is_limited_ && (limit == 0 || b->band_[dir].desired_speed_bps_ < limit))
+        {
+            limit = b->band_[dir].desired_speed_bps_;
+        }
+    }
+
+    return limit;
+}
+
+bool Bandwidth::isLimitedInSubtree(tr_direction dir) const
 {
     TR_ASSERT(tr_isDirection(dir));
 
     if (this->band_[dir].is_limited_)
     {
-        byteCount = std::min(byteCount, this->band_[dir].bytes_left_);
+        return true;
+    }
 
-        /* if we're getting close to exceeding the speed limit,
-         * clamp down harder on the bytes available */
-        if (byteCount > 0)
-        {
-            double current;
-            double desired;
-            double r;
+    return std::any_of(
+        std::begin(this->children_),
+        std::end(this->children_),
+        [dir](Bandwidth const* child) { return child->isLimitedInSubtree(dir); });
+}
 
+unsigned int Bandwidth::clamp(uint64_t now, tr_direction dir, unsigned int byteCount)
+{
+    TR_ASSERT(tr_isDirection(dir));
+
+    /* every limited bucket up to the first bandwidth that ignores its parent's limits */
+    for (Bandwidth* b = this; b != nullptr && byteCount > 0; b = b->band_[dir].honor_parent_limits_ ? b->parent_ : nullptr)
+    {
+        if (b->band_[dir].is_limited_)
+        {
             if (now == 0)
             {
                 now = tr_time_msec();
             }
 
-            current = this->getRawSpeed_Bps(now, TR_DOWN);
-            desired = this->getDesiredSpeed_Bps(TR_DOWN);
-            r = desired >= 1 ? current / desired : 0;
-
-            if (r > 1.0)
-            {
-                byteCount = 0;
-            }
-            else if (r > 0.9)
-            {
-                byteCount = static_cast<unsigned int>(byteCount * 0.8);
-            }
-            else if (r > 0.8)
-            {
-                byteCount = static_cast<unsigned int>(byteCount * 0.9);
-            }
+            byteCount = static_cast<unsigned int>(std::min(uint64_t{ byteCount }, b->refill(dir, now)));
         }
     }
 
-    if (this->parent_ != nullptr && this->band_[dir].honor_parent_limits_ && byteCount > 0)
-    {
-        byteCount = this->parent_->clamp(now, dir, byteCount);
-    }
-
     return byteCount;
 }
 
@@ -296,38 +354,26 @@ void Bandwidth::notifyBandwidthConsumed(tr_direction dir, size_t byteCount, bool
 {
     TR_ASSERT(tr_isDirection(dir));
 
-    Band* band = &this->band_[dir];
-
-    if (band->is_limited_ && isPieceData)
+    if (now == 0)
     {
-        band->bytes_left_ -= std::min(size_t{ band->bytes_left_ }, byteCount);
+        now = tr_time_msec();
     }
 
-#ifdef DEBUG_DIRECTION
-
-    if (dir == DEBUG_DIRECTION && band_->isLimited)
+    for (Bandwidth* b = this; b != nullptr; b = b->parent_)
     {
-        fprintf(
-            stderr,
-            "%p consumed %5zu bytes of %5s data... was %6zu, now %6zu left\n",
-            this,
-            byteCount,
-            isPieceData ? "piece" : "raw",
-            oldBytesLeft,
-            band_->bytesLeft);
-    }
+        Band* band = &b->band_[dir];
 
-#endif
-
-    notifyBandwidthConsumedBytes(now, &band->raw_, byteCount);
+        if (band->is_limited_ && isPieceData)
+        {
+            uint64_t const tokens = b->refill(dir, now);
+            band->tokens_ = tokens - std::min(tokens, uint64_t{ byteCount });
+        }
 
-    if (isPieceData)
-    {
-        notifyBandwidthConsumedBytes(now, &band->piece_, byteCount);
-    }
+        notifyBandwidthConsumedBytes(now, &band->raw_, byteCount);
 
-    if (this->parent_ != nullptr)
-    {
-        this->parent_->notifyBandwidthConsumed(dir, byteCount, isPieceData, now);
+        if (isPieceData)
+        {
+            notifyBandwidthConsumedBytes(now, &band->piece_, byteCount);
+        }
     }
 }
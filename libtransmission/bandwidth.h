@@ -13,7 +13,7 @@
 #endif
 
 #include <array>
-#include <unordered_set>
+#include <vector>
 
 #include "transmission.h"
 #include "tr-assert.h"
@@ -53,17 +53,25 @@ struct tr_peerIo;
  *
  * CONSTRAINING
  *
- *   Call Bandwidth::allocate() periodically. tr_bandwidth knows its current
- *   speed and will decide how many bytes to make available over the
- *   user-specified period to reach the user-specified desired speed.
- *   If appropriate, it notifies its peer-ios that new bandwidth is available.
- *
- *   Bandwidth::allocate() operates on the tr_bandwidth subtree, so usually
- *   you'll only need to invoke it for the top-level tr_session bandwidth.
+ *   Each limited bandwidth object has a token bucket per direction. It fills
+ *   up at the desired speed as time goes by, up to its burst size, and every
+ *   byte of piece data that's read or sent takes a token out of it and out of
+ *   the buckets of the limited bandwidths above it.
  *
  *   The peer-ios all have a pointer to their associated tr_bandwidth object,
  *   and call Bandwidth::clamp() before performing I/O to see how much
- *   bandwidth they can safely use.
+ *   bandwidth they can safely use: the fewest tokens left in any limited
+ *   bucket between them and the top of the tree (or the first bandwidth that
+ *   doesn't honor its parent's limits). Since siblings draw on their parent's
+ *   bucket as they need it, tokens that an idle peer or torrent leaves unused
+ *   are there for the busy ones.
+ *
+ *   While any of the subtree is limited, call Bandwidth::allocate() often,
+ *   every few tens of msec. It hands the tokens out among the peer-ios in the
+ *   subtree in deficit round-robin order and, if appropriate, notifies them
+ *   that they can do on-demand I/O until the next call. Unlimited peer-ios
+ *   never run out, so they can wait longer between calls. Usually you'll
+ *   only need to invoke it for the top-level tr_session bandwidth.
  */
 struct Bandwidth
 {
@@ -95,9 +103,9 @@ public:
     void notifyBandwidthConsumed(tr_direction dir, size_t byteCount, bool isPieceData, uint64_t now);
 
     /**
-     * @brief allocate the next period_msec's worth of bandwidth for the peer-ios to consume
+     * @brief share the bandwidth that's available now among the subtree's peer-ios
      */
-    void allocate(tr_direction dir, unsigned int period_msec);
+    void allocate(tr_direction dir);
 
     void setParent(Bandwidth* newParent);
 
@@ -114,11 +122,13 @@ public:
     /**
      * @brief clamps byteCount down to a number that this bandwidth will allow to be consumed
     */
-    [[nodiscard]] unsigned int clamp(tr_direction dir, unsigned int byteCount) const
+    [[nodiscard]] unsigned int clamp(tr_direction dir, unsigned int byteCount)
     {
         return this->clamp(0, dir, byteCount);
     }
 
+    [[nodiscard]] unsigned int clamp(uint64_t now, tr_direction dir, unsigned int byteCount);
+
     /** @brief Get the raw total of bytes read or sent by this bandwidth subtree. */
     [[nodiscard]] unsigned int getRawSpeed_Bps(uint64_t const now, tr_direction const dir) const
     {
@@ -157,6 +167,27 @@ public:
         return this->band_[dir].desired_speed_bps_;
     }
 
+    /**
+     * @brief Get the speed that this bandwidth's own limit and the limits it honors above it hold it to.
+     * @return the lowest of those desired speeds, or 0 if nothing limits it
+     */
+    [[nodiscard]] unsigned int getLimit_Bps(tr_direction dir) const;
+
+    /**
+     * @brief Set how many bytes this bandwidth may save up while it's idle.
+     * Zero, the default, means DEFAULT_BURST_MSEC at the desired speed.
+     */
+    constexpr void setBurst_Bytes(tr_direction dir, unsigned int burstBytes)
+    {
+        this->band_[dir].burst_bytes_ = burstBytes;
+    }
+
+    [[nodiscard]] constexpr unsigned int getBurst_Bytes(tr_direction dir) const
+    {
+        Band const& band = this->band_[dir];
+        return band.burst_bytes_ != 0 ? band.burst_bytes_ : band.desired_speed_bps_ * DEFAULT_BURST_MSEC / 1000U;
+    }
+
     /**
      * @brief Set whether or not this bandwidth should throttle its peer-io's speeds
      */
@@ -176,6 +207,11 @@ public:
         return this->band_[dir].is_limited_;
     }
 
+    /**
+     * @return true if this bandwidth or any of its subtree throttles its peer-ios speeds
+     */
+    [[nodiscard]] bool isLimitedInSubtree(tr_direction dir) const;
+
     /**
      * Almost all the time we do want to honor a parents' bandwidth cap, so that
      * (for example) a peer is constrained by a per-torrent cap and the global cap.
@@ -201,6 +237,7 @@ public:
     static constexpr size_t INTERVAL_MSEC = HISTORY_MSEC;
     static constexpr size_t GRANULARITY_MSEC = 200;
     static constexpr size_t HISTORY_SIZE = (INTERVAL_MSEC / GRANULARITY_MSEC);
+    static constexpr uint64_t DEFAULT_BURST_MSEC = 100U;
 
     struct RateControl
     {
@@ -219,8 +256,11 @@ public:
     {
         bool is_limited_;
         bool honor_parent_limits_;
-        unsigned int bytes_left_;
         unsigned int desired_speed_bps_;
+        unsigned int burst_bytes_;
+        uint64_t tokens_;
+        uint64_t refilled_at_msec_;
+        size_t deficit_;
         RateControl raw_;
         RateControl piece_;
     };
@@ -230,21 +270,25 @@ private:
 
     static void notifyBandwidthConsumedBytes(uint64_t now, RateControl* r, size_t size);
 
-    [[nodiscard]] unsigned int clamp(uint64_t now, tr_direction dir, unsigned int byteCount) const;
+    /* adds the tokens earned since the bucket was last refilled and returns how many there are */
+    uint64_t refill(tr_direction dir, uint64_t now);
 
-    static void phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir);
+    static void phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir, size_t first);
 
-    void allocateBandwidth(
-        tr_priority_t parent_priority,
-        tr_direction dir,
-        unsigned int period_msec,
-        std::vector<tr_peerIo*>& peer_pool);
+    void allocateBandwidth(tr_priority_t parent_priority, std::vector<tr_peerIo*>& peer_pool);
 
     tr_priority_t priority = 0;
     std::array<Band, 2> band_;
     Bandwidth* parent_;
-    std::unordered_set<Bandwidth*> children_;
+    std::vector<Bandwidth*> children_;
     tr_peerIo* peer_;
+
+    /* scratch space for allocate(), kept so that it needn't be reallocated every time */
+    std::vector<tr_peerIo*> peer_pool_;
+    std::vector<tr_peerIo*> low_;
+    std::vector<tr_peerIo*> normal_;
+    std::vector<tr_peerIo*> high_;
+    size_t allocate_count_ = 0;
 };
 
 /* @} */
@@ -9,6 +9,12 @@
 #include <algorithm>
 #include <cstring> /* memset */
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "transmission.h"
 #include "bitfield.h"
 #include "tr-assert.h"
@@ -18,99 +24,139 @@
 *****
 ****/
 
-static constexpr int8_t const trueBitCount[256] = {
-    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, //
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, //
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, //
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, //
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, //
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, //
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, //
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, //
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, //
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, //
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, //
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, //
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, //
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, //
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, //
-    4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8, //
-};
+/* The bits are kept in the wire's byte order, but they're counted and
+   searched 64 at a time: word `i` holds bits [64 * i, 64 * i + 64) with
+   the first one in its most significant bit. */
+
+static constexpr size_t WordBits = 64;
 
-static constexpr size_t countArray(tr_bitfield const* b)
+static constexpr int popcount64(uint64_t v)
 {
-    size_t ret = 0;
-    size_t i = b->alloc_count;
+#if defined(__POPCNT__)
+    return __builtin_popcountll(v);
+#else
+    /* without the instruction, the builtin is a function call that's slower than this */
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
 
-    while (i > 0)
+/* v mustn't be 0 */
+static constexpr int countLeadingZeros64(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+
+    for (; (v & (uint64_t{ 1 } << 63)) == 0; v <<= 1)
     {
-        ret += trueBitCount[b->bits[--i]];
+        ++n;
     }
 
-    return ret;
+    return n;
+#endif
 }
 
-static constexpr size_t countRange(tr_bitfield const* b, size_t begin, size_t end)
+/* bits [begin, end) of a word, where 0 <= begin < end <= 64 */
+static constexpr uint64_t wordMask(size_t begin, size_t end)
 {
-    size_t ret = 0;
-    size_t const first_byte = begin >> 3U;
-    size_t const last_byte = (end - 1) >> 3U;
+    return (~uint64_t{ 0 } >> begin) & ~(end == WordBits ? 0 : ~uint64_t{ 0 } >> end);
+}
 
-    if (b->bit_count == 0)
+/* bits past the end of the array are 0 */
+static uint64_t getWord(tr_bitfield const* b, size_t i)
+{
+    size_t const first_byte = i * 8;
+    uint64_t word = 0;
+
+    if (first_byte + 8 <= b->alloc_count)
     {
-        return 0;
+        /* compilers turn this into a single load and byte swap */
+        uint8_t const* const bytes = b->bits + first_byte;
+
+        for (size_t j = 0; j < 8; ++j)
+        {
+            word = word << 8 | bytes[j];
+        }
+    }
+    else
+    {
+        for (size_t j = 0; j < 8; ++j)
+        {
+            word = word << 8 | (first_byte + j < b->alloc_count ? b->bits[first_byte + j] : 0);
+        }
     }
 
-    if (first_byte >= b->alloc_count)
+    return word;
+}
+
+static constexpr size_t allocedBits(tr_bitfield const* b)
+{
+    return b->alloc_count * 8;
+}
+
+/* counts the bits in whole words, where byte order doesn't matter */
+static size_t countBytes(uint8_t const* bytes, size_t n_words)
+{
+    size_t ret = 0;
+
+    for (size_t i = 0; i < n_words; ++i)
     {
-        return 0;
+        uint64_t word;
+        memcpy(&word, bytes + i * 8, sizeof(word));
+        ret += popcount64(word);
     }
 
-    TR_ASSERT(begin < end);
-    TR_ASSERT(b->bits != nullptr);
+    return ret;
+}
+
+static size_t countArray(tr_bitfield const* b)
+{
+    size_t const n_words = b->alloc_count / 8;
+    size_t ret = countBytes(b->bits, n_words);
 
-    if (first_byte == last_byte)
+    if (n_words * 8 < b->alloc_count)
     {
-        uint8_t val = b->bits[first_byte];
+        ret += popcount64(getWord(b, n_words));
+    }
 
-        int i = begin - (first_byte * 8);
-        val <<= i;
-        val >>= i;
-        i = (last_byte + 1) * 8 - end;
-        val >>= i;
-        val <<= i;
+    return ret;
+}
 
-        ret += trueBitCount[val];
+static size_t countRange(tr_bitfield const* b, size_t begin, size_t end)
+{
+    if (b->bit_count == 0)
+    {
+        return 0;
     }
-    else
+
+    end = std::min(end, allocedBits(b));
+
+    if (begin >= end)
     {
-        size_t const walk_end = std::min(b->alloc_count, last_byte);
+        return 0;
+    }
 
-        /* first byte */
-        size_t const first_shift = begin - (first_byte * 8);
-        uint8_t val = b->bits[first_byte];
-        val <<= first_shift;
-        val >>= first_shift;
-        ret += trueBitCount[val];
+    TR_ASSERT(b->bits != nullptr);
 
-        /* middle bytes */
-        for (size_t i = first_byte + 1; i < walk_end; ++i)
-        {
-            ret += trueBitCount[b->bits[i]];
-        }
+    size_t const first_word = begin / WordBits;
+    size_t const last_word = (end - 1) / WordBits;
+    size_t const last_word_end = end - last_word * WordBits;
 
-        /* last byte */
-        if (last_byte < b->alloc_count)
-        {
-            size_t const last_shift = (last_byte + 1) * 8 - end;
-            val = b->bits[last_byte];
-            val >>= last_shift;
-            val <<= last_shift;
-            ret += trueBitCount[val];
-        }
+    if (first_word == last_word)
+    {
+        return popcount64(getWord(b, first_word) & wordMask(begin % WordBits, last_word_end));
     }
 
-    TR_ASSERT(ret <= (begin - end));
+    /* the words in between are all inside of the array */
+    size_t ret = popcount64(getWord(b, first_word) & wordMask(begin % WordBits, WordBits));
+    ret += countBytes(b->bits + (first_word + 1) * 8, last_word - first_word - 1);
+    ret += popcount64(getWord(b, last_word) & wordMask(0, last_word_end));
+
+    TR_ASSERT(ret <= (end - begin));
     return ret;
 }
 
@@ -149,6 +195,240 @@ bool tr_bitfieldHas(tr_bitfield const* b, size_t n)
     return (b->bits[n >> 3U] << (n & 7U) & 0x80) != 0;
 }
 
+static size_t findNext(tr_bitfield const* b, size_t begin, size_t end, bool set)
+{
+    /* unset bits past the end of the array can be found without reading it */
+    size_t const search_end = set ? std::min(end, allocedBits(b)) : end;
+    uint64_t const flip = set ? 0 : ~uint64_t{ 0 };
+
+    for (size_t i = begin / WordBits, n = search_end > begin ? (search_end - 1) / WordBits + 1 : 0; i < n; ++i)
+    {
+        auto word = getWord(b, i) ^ flip;
+
+        if (i == begin / WordBits)
+        {
+            word &= wordMask(begin % WordBits, WordBits);
+        }
+
+        if (word != 0)
+        {
+            return std::min(i * WordBits + countLeadingZeros64(word), end);
+        }
+    }
+
+    return end;
+}
+
+size_t tr_bitfieldFindNextSet(tr_bitfield const* b, size_t begin, size_t end)
+{
+    if (begin >= end || tr_bitfieldHasNone(b))
+    {
+        return end;
+    }
+
+    if (tr_bitfieldHasAll(b))
+    {
+        return begin;
+    }
+
+    return findNext(b, begin, end, true);
+}
+
+size_t tr_bitfieldFindNextUnset(tr_bitfield const* b, size_t begin, size_t end)
+{
+    if (begin >= end || tr_bitfieldHasAll(b))
+    {
+        return end;
+    }
+
+    if (tr_bitfieldHasNone(b))
+    {
+        return begin;
+    }
+
+    return findNext(b, begin, end, false);
+}
+
+bool tr_bitfieldHasAnyNotIn(tr_bitfield const* a, tr_bitfield const* b)
+{
+    if (tr_bitfieldHasNone(a) || tr_bitfieldHasAll(b))
+    {
+        return false;
+    }
+
+    if (tr_bitfieldHasAll(a))
+    {
+        return a->bit_count == 0 || tr_bitfieldCountRange(b, 0, a->bit_count) < a->bit_count;
+    }
+
+    if (tr_bitfieldHasNone(b))
+    {
+        return true;
+    }
+
+    for (size_t i = 0, n = (a->alloc_count + 7) / 8; i < n; ++i)
+    {
+        if ((getWord(a, i) & ~getWord(b, i)) != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/***
+****  Adding a bitfield to an array of counters, e.g. pieces' replication counts.
+****  Each byte of bits is spread out into 16-bit lanes (the MSB going to the first
+****  lane) and turned into an all-ones mask, i.e. -1, where the bit is set, so
+****  subtracting the masks from the counters increments them and adding decrements.
+***/
+
+namespace
+{
+
+enum class CountDelta
+{
+    Incr,
+    Decr
+};
+
+template<CountDelta Delta>
+constexpr uint16_t addDelta(uint16_t count, bool has)
+{
+    return Delta == CountDelta::Incr ? uint16_t(count + (has ? 1 : 0)) : uint16_t(count - (has ? 1 : 0));
+}
+
+#if defined(__AVX2__)
+
+/* handles the full 16-bit words of `bits`; returns how many bytes it handled */
+template<CountDelta Delta>
+size_t addBitsToCountsVector(uint8_t const* bits, size_t n_bytes, uint16_t* counts)
+{
+    auto const masks = _mm256_setr_epi16(
+        int16_t(0x8000),
+        0x4000,
+        0x2000,
+        0x1000,
+        0x0800,
+        0x0400,
+        0x0200,
+        0x0100,
+        0x80,
+        0x40,
+        0x20,
+        0x10,
+        0x08,
+        0x04,
+        0x02,
+        0x01);
+
+    size_t i = 0;
+
+    for (; i + 2 <= n_bytes; i += 2, counts += 16)
+    {
+        if ((bits[i] | bits[i + 1]) == 0)
+        {
+            continue;
+        }
+
+        auto const word = _mm256_set1_epi16(int16_t(bits[i] << 8 | bits[i + 1]));
+        auto const has = _mm256_cmpeq_epi16(_mm256_and_si256(word, masks), masks);
+        auto* const out = reinterpret_cast<__m256i*>(counts);
+        auto const in = _mm256_loadu_si256(out);
+        _mm256_storeu_si256(out, Delta == CountDelta::Incr ? _mm256_sub_epi16(in, has) : _mm256_add_epi16(in, has));
+    }
+
+    return i;
+}
+
+#elif defined(__SSE2__)
+
+/* handles the full bytes of `bits`; returns how many bytes it handled */
+template<CountDelta Delta>
+size_t addBitsToCountsVector(uint8_t const* bits, size_t n_bytes, uint16_t* counts)
+{
+    auto const masks = _mm_setr_epi16(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+
+    for (size_t i = 0; i < n_bytes; ++i, counts += 8)
+    {
+        if (bits[i] == 0)
+        {
+            continue;
+        }
+
+        auto const byte = _mm_set1_epi16(bits[i]);
+        auto const has = _mm_cmpeq_epi16(_mm_and_si128(byte, masks), masks);
+        auto* const out = reinterpret_cast<__m128i*>(counts);
+        auto const in = _mm_loadu_si128(out);
+        _mm_storeu_si128(out, Delta == CountDelta::Incr ? _mm_sub_epi16(in, has) : _mm_add_epi16(in, has));
+    }
+
+    return n_bytes;
+}
+
+#else
+
+template<CountDelta /*Delta*/>
+constexpr size_t addBitsToCountsVector(uint8_t const* /*bits*/, size_t /*n_bytes*/, uint16_t* /*counts*/)
+{
+    return 0;
+}
+
+#endif
+
+template<CountDelta Delta>
+void addBitsToCounts(tr_bitfield const* b, uint16_t* counts, size_t n)
+{
+    if (tr_bitfieldHasAll(b))
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            counts[i] = addDelta<Delta>(counts[i], true);
+        }
+
+        return;
+    }
+
+    if (tr_bitfieldHasNone(b))
+    {
+        return;
+    }
+
+    /* bits past the end of the array aren't set */
+    n = std::min(n, b->alloc_count * 8);
+    auto const n_bytes = n / 8;
+    auto const vector_bytes = addBitsToCountsVector<Delta>(b->bits, n_bytes, counts);
+
+    for (size_t i = vector_bytes; i < n_bytes; ++i)
+    {
+        if (auto const byte = b->bits[i]; byte != 0)
+        {
+            for (size_t bit = 0; bit < 8; ++bit)
+            {
+                counts[i * 8 + bit] = addDelta<Delta>(counts[i * 8 + bit], (byte << bit & 0x80) != 0);
+            }
+        }
+    }
+
+    for (size_t i = n_bytes * 8; i < n; ++i)
+    {
+        counts[i] = addDelta<Delta>(counts[i], (b->bits[i >> 3U] << (i & 7U) & 0x80) != 0);
+    }
+}
+
+} // namespace
+
+void tr_bitfieldIncrCounts(tr_bitfield const* b, uint16_t* counts, size_t n)
+{
+    addBitsToCounts<CountDelta::Incr>(b, counts, n);
+}
+
+void tr_bitfieldDecrCounts(tr_bitfield const* b, uint16_t* counts, size_t n)
+{
+    addBitsToCounts<CountDelta::Decr>(b, counts, n);
+}
+
 /***
 ****
 ***/
@@ -516,3 +796,41 @@ void tr_bitfieldRemRange(tr_bitfield* b, size_t begin, size_t end)
 
     tr_bitfieldDecTrueCount(b, diff);
 }
+
+/* Clears the bits that are set in `other`, i.e. b &= ~other */
+void tr_bitfieldRemBitfield(tr_bitfield* b, tr_bitfield const* other)
+{
+    if (tr_bitfieldHasNone(b) || tr_bitfieldHasNone(other))
+    {
+        return;
+    }
+
+    if (tr_bitfieldHasAll(other))
+    {
+        if (other->bit_count == 0 || other->bit_count >= b->bit_count)
+        {
+            tr_bitfieldSetHasNone(b);
+        }
+        else
+        {
+            tr_bitfieldRemRange(b, 0, other->bit_count);
+        }
+
+        return;
+    }
+
+    /* a magnet's have-all can't be spelled out until we know its size */
+    if (b->bit_count == 0 && tr_bitfieldHasAll(b))
+    {
+        return;
+    }
+
+    tr_bitfieldEnsureBitsAlloced(b, b->bit_count);
+
+    for (size_t i = 0, n = std::min(b->alloc_count, other->alloc_count); i < n; ++i)
+    {
+        b->bits[i] &= ~other->bits[i];
+    }
+
+    tr_bitfieldRebuildTrueCount(b);
+}
@@ -47,6 +47,8 @@ void tr_bitfieldAddRange(tr_bitfield*, size_t begin, size_t end);
 
 void tr_bitfieldRemRange(tr_bitfield*, size_t begin, size_t end);
 
+void tr_bitfieldRemBitfield(tr_bitfield*, tr_bitfield const* other);
+
 /***
 ****  life cycle
 ***/
@@ -89,3 +91,16 @@ constexpr bool tr_bitfieldHasNone(tr_bitfield const* b)
 }
 
 bool tr_bitfieldHas(tr_bitfield const* b, size_t n);
+
+/* the first set (or unset) bit in [begin, end), or `end` if there isn't one */
+size_t tr_bitfieldFindNextSet(tr_bitfield const* b, size_t begin, size_t end);
+
+size_t tr_bitfieldFindNextUnset(tr_bitfield const* b, size_t begin, size_t end);
+
+/* true if a bit that's set in `a` isn't set in `b` */
+bool tr_bitfieldHasAnyNotIn(tr_bitfield const* a, tr_bitfield const* b);
+
+/* adds 1 to (or subtracts 1 from) counts[i] for each bit i < n that's set */
+void tr_bitfieldIncrCounts(tr_bitfield const* b, uint16_t* counts, size_t n);
+
+void tr_bitfieldDecrCounts(tr_bitfield const* b, uint16_t* counts, size_t n);
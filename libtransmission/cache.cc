@@ -6,16 +6,29 @@
  *
  */
 
-#include <stdlib.h> /* qsort() */
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include <event2/buffer.h>
 
 #include "transmission.h"
 #include "cache.h"
+#include "crypto-utils.h"
+#include "elevator.h"
+#include "error.h"
+#include "file.h"
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
-#include "ptrarray.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "trevent.h"
@@ -25,96 +38,1103 @@
 
 #define dbgmsg(...) tr_logAddDeepNamed(MY_NAME, __VA_ARGS__)
 
+enum
+{
+    MAX_READER_THREADS = 4,
+    /* a couple of reads at a time lets the disk reorder them itself
+     * without having so many in flight that the elevator can't help */
+    MAX_READS_PER_DEVICE = 2,
+    /* neighboring blocks are read together, up to this much at a time */
+    MAX_READ_BATCH_BYTES = 1024 * 1024,
+    /* the cache isn't considered full until it holds at least this many blocks,
+     * however small its limit is */
+    MIN_FULL_BLOCKS = 64
+};
+
 /****
 *****
 ****/
 
 struct cache_block
 {
-    tr_torrent* tor;
-
+    tr_block_index_t block;
     tr_piece_index_t piece;
     uint32_t offset;
     uint32_t length;
 
-    time_t time;
-    tr_block_index_t block;
+    /* once a block has been handed to the writer thread, its evbuf
+     * belongs to the writer job and must not be modified anymore.
+     * It stays readable from the cache until the job is reaped. */
+    bool is_flushing;
+
+    /* the job that's writing this block, once it's flushing */
+    struct cache_job* job;
+
+    /* if an older copy of this block was already on its way to disk
+     * when this one arrived, the job that's writing the older copy */
+    struct cache_job* prev_job;
 
     struct evbuffer* evbuf;
 };
 
-struct tr_cache
+/* a run of contiguous blocks that are waiting to be flushed */
+struct cache_run
+{
+    tr_block_index_t last;
+    time_t time;
+};
+
+struct cache_torrent
+{
+    tr_torrent* tor;
+
+    std::unordered_map<tr_block_index_t, cache_block*> blocks;
+
+    /* runs of unflushed blocks, keyed by their first and last blocks */
+    std::unordered_map<tr_block_index_t, cache_run> runs;
+    std::unordered_map<tr_block_index_t, tr_block_index_t> run_tails;
+
+    size_t pending_jobs = 0;
+};
+
+/* the SHA-1 of a piece's leading blocks, fed as they're written so that
+ * pieces which arrive in order don't have to be read back to be checked */
+struct cache_piece_hash
+{
+    tr_sha1_ctx_t sha;
+    uint32_t next_offset;
+};
+
+/* a block that was read from disk to be uploaded. Peers' outbufs may
+ * reference `data` until it's been sent, so it's never modified */
+struct cache_read_block
+{
+    std::vector<uint8_t> data;
+};
+
+using cache_read_block_ptr = std::shared_ptr<cache_read_block const>;
+
+/* recently-uploaded blocks, so that a popular block is read from disk once
+ * no matter how many peers it's sent to. Keyed by torrent id and block */
+struct cache_read_blocks
+{
+    struct entry
+    {
+        cache_read_block_ptr block;
+        std::list<uint64_t>::iterator lru_pos;
+    };
+
+    std::unordered_map<uint64_t, entry> blocks;
+    std::list<uint64_t> lru; /* most recently used first */
+    size_t bytes = 0;
+};
+
+struct cache_read_waiter
+{
+    tr_cache_read_func callback;
+    void* user_data;
+};
+
+/* a block that's being read into the read cache by a reader thread */
+struct cache_read_job
+{
+    tr_session* session;
+    int torrent_id;
+    uint64_t key;
+    uint64_t device;
+    std::vector<tr_io_span> spans;
+    std::shared_ptr<cache_read_block> block;
+    std::vector<cache_read_waiter> waiters;
+    int err = 0;
+
+    /* true if the block was overwritten while it was being read */
+    bool is_stale = false;
+};
+
+/* each device's reads, keyed by torrent id and block like the read cache */
+struct cache_read_queue
+{
+    tr_elevator<uint64_t, cache_read_job*> jobs;
+    int n_readers = 0;
+};
+
+/* a run that's been handed off to the writer thread */
+struct cache_job
+{
+    tr_session* session;
+    tr_torrent* tor;
+    int torrent_id;
+    uint64_t device = 0;
+    std::vector<cache_block*> blocks;
+    std::vector<tr_io_span> spans;
+    size_t length = 0;
+    int err = 0;
+    tr_file_index_t err_file = 0;
+
+    /* Older jobs with copies of the same blocks have to be written first,
+     * or the older data would win. These are guarded by the cache's lock:
+     * how many of those older jobs haven't been written yet,
+     * and the newer jobs that are waiting on this one */
+    int n_blockers = 0;
+    std::vector<cache_job*> blocked;
+    bool is_written = false;
+};
+
+/* cache_blocks are carved out of slabs and recycled through a free list,
+ * each one keeping its evbuffer, so that caching a block doesn't cost an
+ * evbuffer_new() and a tr_new() apiece */
+struct cache_block_pool
 {
-    tr_ptrArray blocks;
-    int max_blocks;
-    size_t max_bytes;
+    static auto constexpr SlabSize = 64;
 
-    size_t disk_writes;
-    size_t disk_write_bytes;
-    size_t cache_writes;
-    size_t cache_write_bytes;
+    std::vector<std::unique_ptr<cache_block[]>> slabs;
+    std::vector<cache_block*> free_blocks;
+};
+
+struct tr_cache
+{
+    std::unordered_map<int, cache_torrent> torrents;
+    std::unordered_map<int, std::unordered_map<tr_piece_index_t, cache_piece_hash>> piece_hashes;
+    cache_block_pool pool;
+    cache_read_blocks reads;
+    int max_blocks = 0;
+    size_t max_bytes = 0;
+
+    /* blocks waiting to be handed off to the writer */
+    int unflushed_blocks = 0;
+
+    /* blocks that have been handed off to the writer but not reaped yet */
+    int flushing_blocks = 0;
+
+    /* bytes held by written blocks, flushed or not. They share
+     * `max_bytes` with the read cache */
+    size_t write_bytes = 0;
+
+    size_t disk_writes = 0;
+    size_t disk_write_bytes = 0;
+    size_t cache_writes = 0;
+    size_t cache_write_bytes = 0;
+    size_t read_hits = 0;
+    size_t read_misses = 0;
+
+    /* writer thread. Everything below is guarded by `lock`.
+     * Runs are written in elevator order by device, torrent, and block */
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    tr_elevator<std::tuple<uint64_t, int, tr_block_index_t>, cache_job*> work;
+    std::deque<cache_job*> done;
+    bool is_closing = false;
+
+    /* reader threads. `pending_reads` belongs to the libevent thread;
+     * the read queues are guarded by `lock` too */
+    std::unordered_map<uint64_t, cache_read_job*> pending_reads;
+    std::vector<std::thread> readers;
+    std::condition_variable read_cv;
+    std::unordered_map<uint64_t, cache_read_queue> read_queues;
+
+    tr_cache_io_stats io_stats = {};
 };
 
 /****
-*****
+*****  Writer thread
 ****/
 
-struct run_info
+/* write `len` bytes from the buffers in `iov`, starting at `*pos`
+ * and advancing it past what was written */
+static bool writeSpan(
+    tr_sys_file_t fd,
+    uint64_t offset,
+    uint64_t len,
+    std::vector<tr_sys_file_iovec>& iov,
+    size_t* pos,
+    tr_error** error)
 {
-    int pos;
-    int rank;
-    time_t last_block_time;
-    bool is_multi_piece;
-    bool is_piece_done;
-    unsigned int len;
-};
+    while (len > 0)
+    {
+        /* find the buffers that belong to this span, trimming the last one to fit */
+        size_t end = *pos;
+        uint64_t span_len = 0;
+
+        while (span_len < len)
+        {
+            span_len += iov[end++].iov_len;
+        }
+
+        size_t const overhang = span_len - len;
+        iov[end - 1].iov_len -= overhang;
+
+        uint64_t n = 0;
+        bool const ok = tr_sys_file_write_at_v(fd, &iov[*pos], end - *pos, offset, &n, error);
+
+        iov[end - 1].iov_len += overhang;
+
+        if (!ok)
+        {
+            return false;
+        }
+
+        if (n == 0)
+        {
+            tr_error_set_literal(error, EIO, tr_strerror(EIO));
+            return false;
+        }
+
+        offset += n;
+        len -= n;
+
+        /* skip past whatever got written */
+        while (n > 0 && n >= iov[*pos].iov_len)
+        {
+            n -= iov[*pos].iov_len;
+            ++*pos;
+        }
+
+        if (n > 0)
+        {
+            iov[*pos].iov_base = static_cast<char*>(iov[*pos].iov_base) + n;
+            iov[*pos].iov_len -= n;
+        }
+    }
+
+    return true;
+}
+
+static void writeJob(cache_job* job)
+{
+    /* point straight at the blocks' evbuffer segments instead of copying them out */
+    auto iov = std::vector<tr_sys_file_iovec>{};
+    auto segments = std::vector<evbuffer_iovec>{};
+
+    for (auto const* b : job->blocks)
+    {
+        auto const n = evbuffer_peek(b->evbuf, b->length, nullptr, nullptr, 0);
+        segments.resize(n);
+        evbuffer_peek(b->evbuf, b->length, nullptr, std::data(segments), n);
+
+        size_t left = b->length;
+
+        for (auto const& segment : segments)
+        {
+            size_t const len = std::min(left, segment.iov_len);
+            iov.push_back({ segment.iov_base, len });
+            left -= len;
+        }
+    }
+
+    size_t pos = 0;
+
+    for (auto const& span : job->spans)
+    {
+        tr_error* error = nullptr;
+
+        if (job->err == 0 && !writeSpan(span.fd, span.file_offset, span.length, iov, &pos, &error))
+        {
+            job->err = error->code;
+            job->err_file = span.file_index;
+            tr_error_free(error);
+        }
+
+        tr_sys_file_close(span.fd, nullptr);
+    }
+}
+
+static void onJobsWritten(void* vsession);
+
+static void writerThreadFunc(tr_cache* cache)
+{
+    auto lock = std::unique_lock(cache->lock);
+
+    for (;;)
+    {
+        cache->work_cv.wait(lock, [cache]() { return cache->is_closing || !std::empty(cache->work); });
+
+        if (std::empty(cache->work))
+        {
+            break;
+        }
+
+        /* the oldest job is never blocked, so there's always one to take */
+        auto* const job = *cache->work.pop([](auto const& /*key*/, cache_job* const& candidate)
+                                           { return candidate->n_blockers == 0; });
+
+        lock.unlock();
+        writeJob(job);
+        lock.lock();
+
+        ++cache->io_stats.runs_written;
+
+        job->is_written = true;
+
+        for (auto* blocked : job->blocked)
+        {
+            --blocked->n_blockers;
+        }
 
-/* return a count of how many contiguous blocks there are starting at this pos */
-static int getBlockRun(tr_cache const* cache, int pos, struct run_info* info)
+        /* have the libevent thread reap the job without waiting for the next write */
+        if (std::empty(cache->done))
+        {
+            tr_runInEventThread(job->session, onJobsWritten, job->session);
+        }
+
+        cache->done.push_back(job);
+        cache->done_cv.notify_all();
+    }
+}
+
+/****
+*****  Block pool
+****/
+
+static cache_block* blockNew(tr_cache* cache)
+{
+    auto& pool = cache->pool;
+
+    if (std::empty(pool.free_blocks))
+    {
+        auto& slab = pool.slabs.emplace_back(std::make_unique<cache_block[]>(cache_block_pool::SlabSize));
+
+        for (int i = cache_block_pool::SlabSize - 1; i >= 0; --i)
+        {
+            slab[i].evbuf = evbuffer_new();
+            pool.free_blocks.push_back(&slab[i]);
+        }
+    }
+
+    auto* const b = pool.free_blocks.back();
+    pool.free_blocks.pop_back();
+    return b;
+}
+
+static void blockFree(tr_cache* cache, cache_block* b)
+{
+    cache->write_bytes -= b->length;
+    evbuffer_drain(b->evbuf, evbuffer_get_length(b->evbuf));
+    cache->pool.free_blocks.push_back(b);
+}
+
+/****
+*****  Read cache
+****/
+
+static uint64_t readKey(int torrent_id, tr_block_index_t block)
+{
+    return (uint64_t(uint32_t(torrent_id)) << 32) | block;
+}
+
+/* odd-sized requests don't go through the read cache */
+static bool isWholeBlock(tr_torrent const* torrent, tr_block_index_t block, uint32_t offset, uint32_t len)
+{
+    return offset % torrent->blockSize == 0 && len == tr_torBlockCountBytes(torrent, block);
+}
+
+static void eraseReadBlock(cache_read_blocks& reads, std::unordered_map<uint64_t, cache_read_blocks::entry>::iterator it)
+{
+    reads.bytes -= std::size(it->second.block->data);
+    reads.lru.erase(it->second.lru_pos);
+    reads.blocks.erase(it);
+}
+
+static std::unordered_map<uint64_t, cache_read_blocks::entry>::iterator addReadBlock(
+    tr_cache* cache,
+    uint64_t key,
+    cache_read_block_ptr block)
+{
+    auto& reads = cache->reads;
+
+    reads.bytes += std::size(block->data);
+    reads.lru.push_front(key);
+    return reads.blocks.emplace(key, cache_read_blocks::entry{ std::move(block), std::begin(reads.lru) }).first;
+}
+
+/* forget a block that's being overwritten. Peers that already have
+ * the old copy in their outbufs keep it alive until it's sent */
+static void dropReadBlock(tr_cache* cache, int torrent_id, tr_block_index_t block)
+{
+    auto& reads = cache->reads;
+    auto const key = readKey(torrent_id, block);
+    auto const it = reads.blocks.find(key);
+
+    if (it != std::end(reads.blocks))
+    {
+        eraseReadBlock(reads, it);
+    }
+
+    if (auto const pending = cache->pending_reads.find(key); pending != std::end(cache->pending_reads))
+    {
+        pending->second->is_stale = true;
+    }
+}
+
+static void dropReadBlocks(tr_cache* cache, int torrent_id)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    struct cache_block const* const* blocks = (struct cache_block const* const*)tr_ptrArrayBase(&cache->blocks);
-    struct cache_block const* ref = blocks[pos];
-    tr_block_index_t block = ref->block;
-    int len = 0;
+    auto& reads = cache->reads;
+
+    for (auto& [key, job] : cache->pending_reads)
+    {
+        if (job->torrent_id == torrent_id)
+        {
+            job->is_stale = true;
+        }
+    }
+
+    for (auto it = std::begin(reads.blocks); it != std::end(reads.blocks);)
+    {
+        auto const next = std::next(it);
+
+        if ((it->first >> 32) == uint32_t(torrent_id))
+        {
+            eraseReadBlock(reads, it);
+        }
+
+        it = next;
+    }
+}
+
+/* the read cache gets whatever room the written blocks aren't using */
+static void trimReadBlocks(tr_cache* cache)
+{
+    auto& reads = cache->reads;
+
+    while (reads.bytes + cache->write_bytes > cache->max_bytes && !std::empty(reads.lru))
+    {
+        eraseReadBlock(reads, reads.blocks.find(reads.lru.back()));
+    }
+}
+
+/* evbuffer_add_reference() cleanup callback */
+static void unrefReadBlock(void const* /*data*/, size_t /*datalen*/, void* vblock)
+{
+    delete static_cast<cache_read_block_ptr*>(vblock);
+}
+
+/****
+*****  Reader threads
+****/
+
+/* read into the buffers in `iov` until they're full.
+ * returns 0 on success, or an errno on failure */
+static int readSpan(tr_sys_file_t fd, uint64_t offset, std::vector<tr_sys_file_iovec>& iov)
+{
+    size_t pos = 0;
+
+    while (pos < std::size(iov))
+    {
+        uint64_t n = 0;
+        tr_error* error = nullptr;
+
+        if (!tr_sys_file_read_at_v(fd, &iov[pos], std::size(iov) - pos, offset, &n, &error))
+        {
+            int const err = error->code;
+            tr_error_free(error);
+            return err;
+        }
+
+        /* the file is shorter than the torrent says it is */
+        if (n == 0)
+        {
+            return EIO;
+        }
+
+        offset += n;
+
+        /* skip past whatever got filled */
+        while (n > 0 && n >= iov[pos].iov_len)
+        {
+            n -= iov[pos].iov_len;
+            ++pos;
+        }
+
+        if (n > 0)
+        {
+            iov[pos].iov_base = static_cast<uint8_t*>(iov[pos].iov_base) + n;
+            iov[pos].iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+/* read a run of neighboring blocks. Wherever they sit next to each
+ * other in the same file, they're read with a single call.
+ * returns how many reads it took */
+static size_t readBatch(std::vector<cache_read_job*> const& jobs)
+{
+    struct read_part
+    {
+        cache_read_job* job;
+        tr_io_span const* span;
+        uint8_t* buf;
+    };
+
+    auto parts = std::vector<read_part>{};
+
+    for (auto* job : jobs)
+    {
+        uint8_t* buf = std::data(job->block->data);
+
+        for (auto const& span : job->spans)
+        {
+            parts.push_back({ job, &span, buf });
+            buf += span.length;
+        }
+    }
+
+    size_t n_reads = 0;
+    auto iov = std::vector<tr_sys_file_iovec>{};
+
+    for (size_t begin = 0, end = 0; begin < std::size(parts); begin = end)
+    {
+        tr_io_span const& first = *parts[begin].span;
+        uint64_t len = 0;
+
+        iov.clear();
+
+        for (end = begin; end < std::size(parts); ++end)
+        {
+            tr_io_span const& span = *parts[end].span;
+
+            if (span.file_index != first.file_index || span.file_offset != first.file_offset + len)
+            {
+                break;
+            }
+
+            iov.push_back({ parts[end].buf, size_t(span.length) });
+            len += span.length;
+        }
+
+        ++n_reads;
+
+        if (int const err = readSpan(first.fd, first.file_offset, iov); err != 0)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                parts[i].job->err = err;
+            }
+        }
+    }
+
+    return n_reads;
+}
+
+/* tell everyone who was waiting on the read how it went.
+ * `tor` is nullptr if the torrent or the cache went away */
+static void finishReadJob(cache_read_job* job, tr_torrent* tor)
+{
+    for (auto const& span : job->spans)
+    {
+        tr_sys_file_close(span.fd, nullptr);
+    }
+
+    for (auto const& waiter : job->waiters)
+    {
+        (*waiter.callback)(tor, job->err, waiter.user_data);
+    }
+
+    delete job;
+}
+
+static void onReadDone(void* vjob)
+{
+    auto* const job = static_cast<cache_read_job*>(vjob);
+    tr_cache* const cache = job->session->cache;
+    tr_torrent* tor = nullptr;
+
+    if (cache != nullptr)
+    {
+        if (auto const it = cache->pending_reads.find(job->key); it != std::end(cache->pending_reads) && it->second == job)
+        {
+            cache->pending_reads.erase(it);
+        }
+
+        tor = tr_torrentFindFromId(job->session, job->torrent_id);
+
+        if (tor != nullptr && job->err == 0 && !job->is_stale && cache->reads.blocks.count(job->key) == 0)
+        {
+            addReadBlock(cache, job->key, std::move(job->block));
+        }
+    }
+
+    /* let the waiters use the block before trimming the read cache,
+     * so that they don't have to fall back to reading it themselves */
+    finishReadJob(job, tor);
+
+    if (cache != nullptr)
+    {
+        trimReadBlocks(cache);
+    }
+}
+
+/* the next job from a device that isn't already busy,
+ * along with any queued-up blocks that come right after it */
+static bool takeReadBatch(tr_cache* cache, std::vector<cache_read_job*>& setme)
+{
+    for (auto& [device, queue] : cache->read_queues)
+    {
+        if (queue.n_readers >= MAX_READS_PER_DEVICE || std::empty(queue.jobs))
+        {
+            continue;
+        }
+
+        setme.push_back(*queue.jobs.pop());
+        size_t bytes = std::size(setme.back()->block->data);
+
+        while (bytes < MAX_READ_BATCH_BYTES)
+        {
+            auto const next_key = setme.back()->key + 1;
+            auto const next = queue.jobs.pop_next([next_key](uint64_t key, cache_read_job* const& /*job*/)
+                                                  { return key == next_key; });
+
+            if (!next)
+            {
+                break;
+            }
+
+            setme.push_back(*next);
+            bytes += std::size((*next)->block->data);
+        }
+
+        ++queue.n_readers;
+        return true;
+    }
+
+    return false;
+}
+
+static void readerThreadFunc(tr_cache* cache)
+{
+    auto lock = std::unique_lock(cache->lock);
+    auto batch = std::vector<cache_read_job*>{};
+
+    for (;;)
+    {
+        batch.clear();
+        cache->read_cv.wait(lock, [cache, &batch]() { return cache->is_closing || takeReadBatch(cache, batch); });
+
+        if (cache->is_closing)
+        {
+            break;
+        }
+
+        /* the jobs belong to the libevent thread once they're posted */
+        auto const device = batch.front()->device;
+
+        lock.unlock();
+        size_t const n_reads = readBatch(batch);
+
+        for (auto* job : batch)
+        {
+            tr_runInEventThread(job->session, onReadDone, job);
+        }
+
+        lock.lock();
+
+        --cache->read_queues.at(device).n_readers;
+        cache->io_stats.blocks_read += std::size(batch);
+        cache->io_stats.reads += n_reads;
+        cache->read_cv.notify_all();
+    }
+}
+
+/****
+*****  Piece hashes
+****/
+
+static void dropPieceHashes(tr_cache* cache, int torrent_id)
+{
+    auto const it = cache->piece_hashes.find(torrent_id);
+
+    if (it != std::end(cache->piece_hashes))
+    {
+        for (auto& [piece, ph] : it->second)
+        {
+            tr_sha1_final(ph.sha, nullptr);
+        }
+
+        cache->piece_hashes.erase(it);
+    }
+}
+
+static void dropPieceHash(tr_cache* cache, int torrent_id, tr_piece_index_t piece)
+{
+    auto const hashes = cache->piece_hashes.find(torrent_id);
+
+    if (hashes == std::end(cache->piece_hashes))
+    {
+        return;
+    }
+
+    if (auto const it = hashes->second.find(piece); it != std::end(hashes->second))
+    {
+        tr_sha1_final(it->second.sha, nullptr);
+        hashes->second.erase(it);
+    }
+
+    if (std::empty(hashes->second))
+    {
+        cache->piece_hashes.erase(hashes);
+    }
+}
+
+/* called when a block leaves the cache. The piece's hash can never
+ * get past a block that hasn't been hashed and isn't cached anymore */
+static void pieceHashEvictBlock(tr_cache* cache, int torrent_id, cache_block const* b)
+{
+    auto const hashes = cache->piece_hashes.find(torrent_id);
+
+    if (hashes == std::end(cache->piece_hashes))
+    {
+        return;
+    }
+
+    if (auto const it = hashes->second.find(b->piece); it != std::end(hashes->second) && b->offset >= it->second.next_offset)
+    {
+        dropPieceHash(cache, torrent_id, b->piece);
+    }
+}
+
+static void pieceHashAddBlock(cache_piece_hash& ph, cache_block const* b)
+{
+    auto segments = std::vector<evbuffer_iovec>(evbuffer_peek(b->evbuf, b->length, nullptr, nullptr, 0));
+    evbuffer_peek(b->evbuf, b->length, nullptr, std::data(segments), std::size(segments));
+
+    size_t left = b->length;
+
+    for (auto const& segment : segments)
+    {
+        size_t const len = std::min(left, segment.iov_len);
+        tr_sha1_update(ph.sha, segment.iov_base, len);
+        left -= len;
+    }
+
+    ph.next_offset += b->length;
+}
+
+static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
+{
+    auto const ct = cache->torrents.find(torrent->uniqueId);
+
+    if (ct == std::end(cache->torrents))
+    {
+        return nullptr;
+    }
+
+    auto const it = ct->second.blocks.find(_tr_block(torrent, piece, offset));
+    return it != std::end(ct->second.blocks) ? it->second : nullptr;
+}
+
+/* called after a block's been written to the cache */
+static void pieceHashUpdate(tr_cache* cache, tr_torrent* tor, tr_piece_index_t piece, uint32_t offset)
+{
+    /* e.g. a duplicate block from the endgame. There's nothing left to check */
+    if (tr_torrentPieceIsComplete(tor, piece))
+    {
+        return;
+    }
+
+    auto& hashes = cache->piece_hashes[tor->uniqueId];
+    auto it = hashes.find(piece);
+
+    if (offset == 0)
+    {
+        /* (re)start the piece */
+        if (it != std::end(hashes))
+        {
+            tr_sha1_final(it->second.sha, nullptr);
+        }
+
+        it = hashes.insert_or_assign(piece, cache_piece_hash{ tr_sha1_init(), 0 }).first;
+    }
+    else if (it == std::end(hashes) || offset > it->second.next_offset)
+    {
+        /* out of order; it gets picked up from the cache when the gap is filled */
+        return;
+    }
+    else if (offset < it->second.next_offset)
+    {
+        /* a block that's already been hashed got overwritten */
+        dropPieceHash(cache, tor->uniqueId, piece);
+        return;
+    }
+
+    /* hash this block along with any that arrived ahead of it */
+    auto& ph = it->second;
+    uint32_t const piece_size = tr_torPieceCountBytes(tor, piece);
+
+    while (ph.next_offset < piece_size)
+    {
+        cache_block const* const b = findBlock(cache, tor, piece, ph.next_offset);
+
+        if (b == nullptr)
+        {
+            break;
+        }
+
+        pieceHashAddBlock(ph, b);
+    }
+}
+
+/****
+*****  Reaping finished jobs on the libevent thread
+****/
+
+static void freeJob(tr_cache* cache, cache_job* job)
+{
+    for (auto* b : job->blocks)
+    {
+        blockFree(cache, b);
+    }
+
+    delete job;
+}
+
+static void maybeForgetTorrent(tr_cache* cache, int torrent_id)
+{
+    auto const it = cache->torrents.find(torrent_id);
+
+    if (it != std::end(cache->torrents) && std::empty(it->second.blocks) && it->second.pending_jobs == 0)
+    {
+        cache->torrents.erase(it);
+    }
+}
+
+static int reapJob(tr_cache* cache, cache_job* job)
+{
+    auto& ct = cache->torrents[job->torrent_id];
+    tr_torrent* const tor = job->tor;
+
+    for (auto* b : job->blocks)
+    {
+        auto const it = ct.blocks.find(b->block);
+
+        /* a newer copy of the block may have arrived while this one was being written */
+        if (it != std::end(ct.blocks) && it->second == b)
+        {
+            ct.blocks.erase(it);
+            pieceHashEvictBlock(cache, job->torrent_id, b);
+        }
+        else if (it != std::end(ct.blocks) && it->second->prev_job == job)
+        {
+            it->second->prev_job = nullptr;
+        }
+    }
+
+    --ct.pending_jobs;
+    cache->flushing_blocks -= std::size(job->blocks);
+
+    if (job->err != 0)
+    {
+        /* what got hashed never made it to disk */
+        dropPieceHashes(cache, job->torrent_id);
+
+        tr_file const* file = &tor->info.files[job->err_file];
+        tr_logAddTorErr(tor, "write failed for \"%s\": %s", file->name, tr_strerror(job->err));
+
+        if (tor->error != TR_STAT_LOCAL_ERROR)
+        {
+            char* path = tr_buildPath(tor->downloadDir, file->name, nullptr);
+            tr_torrentSetLocalError(tor, "%s (%s)", tr_strerror(job->err), path);
+            tr_free(path);
+        }
+    }
+
+    ++cache->disk_writes;
+    cache->disk_write_bytes += job->length;
+
+    int const err = job->err;
+    freeJob(cache, job);
+    maybeForgetTorrent(cache, tor->uniqueId);
+    return err;
+}
+
+/* process the jobs the writer thread has finished.
+ * returns 0 on success, or the first errno encountered */
+static int cacheReap(tr_cache* cache)
+{
+    auto done = std::deque<cache_job*>{};
+
+    {
+        auto const lock = std::lock_guard(cache->lock);
+        std::swap(done, cache->done);
+    }
+
+    int err = 0;
+
+    for (auto* job : done)
+    {
+        int const job_err = reapJob(cache, job);
+
+        if (err == 0)
+        {
+            err = job_err;
+        }
+    }
+
+    return err;
+}
+
+/* block until `test` is satisfied, reaping finished jobs as they come in */
+template<typename Test>
+static int cacheWaitFor(tr_cache* cache, Test test)
+{
+    int err = cacheReap(cache);
+
+    while (!test())
+    {
+        {
+            auto lock = std::unique_lock(cache->lock);
+            cache->done_cv.wait(lock, [cache]() { return !std::empty(cache->done); });
+        }
+
+        int const reap_err = cacheReap(cache);
+
+        if (err == 0)
+        {
+            err = reap_err;
+        }
+    }
+
+    return err;
+}
+
+static int cacheWaitForTorrent(tr_cache* cache, int torrent_id)
+{
+    return cacheWaitFor(
+        cache,
+        [cache, torrent_id]()
+        {
+            auto const it = cache->torrents.find(torrent_id);
+            return it == std::end(cache->torrents) || it->second.pending_jobs == 0;
+        });
+}
+
+/****
+*****  Runs
+****/
+
+static void runAddBlock(cache_torrent& ct, tr_block_index_t block, time_t now)
+{
+    auto first = block;
+    auto last = block;
+
+    /* join the run that ends right before this block */
+    if (block > 0)
+    {
+        auto const left = ct.run_tails.find(block - 1);
+
+        if (left != std::end(ct.run_tails))
+        {
+            first = left->second;
+            ct.run_tails.erase(left);
+        }
+    }
+
+    /* join the run that starts right after this block */
+    auto const right = ct.runs.find(block + 1);
+
+    if (right != std::end(ct.runs))
+    {
+        last = right->second.last;
+        ct.runs.erase(right);
+        ct.run_tails.erase(last);
+    }
+
+    ct.runs[first] = { last, now };
+    ct.run_tails[last] = first;
+}
+
+/* hand a run of blocks off to the writer thread.
+ * returns 0 on success, or an errno on failure */
+static int flushRun(tr_cache* cache, cache_torrent& ct, tr_block_index_t first)
+{
+    auto const it = ct.runs.find(first);
+    TR_ASSERT(it != std::end(ct.runs));
+
+    tr_block_index_t const last = it->second.last;
+    ct.runs.erase(it);
+    ct.run_tails.erase(last);
+
+    auto* const job = new cache_job{};
+    job->session = ct.tor->session;
+    job->tor = ct.tor;
+    job->torrent_id = ct.tor->uniqueId;
+    job->blocks.reserve(last + 1 - first);
+
+    for (tr_block_index_t i = first; i <= last; ++i)
+    {
+        auto* const b = ct.blocks.at(i);
+        TR_ASSERT(!b->is_flushing);
+
+        b->is_flushing = true;
+        b->job = job;
+        job->blocks.push_back(b);
+        job->length += b->length;
+    }
+
+    cache->unflushed_blocks -= std::size(job->blocks);
+
+    cache_block const* const b = job->blocks.front();
+    int const err = tr_ioPrepareWrite(ct.tor, b->piece, b->offset, job->length, job->spans);
 
-    for (int i = pos; i < n; ++i)
+    if (err != 0)
     {
-        struct cache_block const* b = blocks[i];
-
-        if (b->block != block)
+        /* nowhere to write it; drop the data like a failed write would */
+        for (auto* fb : job->blocks)
         {
-            break;
+            ct.blocks.erase(fb->block);
+            pieceHashEvictBlock(cache, job->torrent_id, fb);
         }
 
-        if (b->tor != ref->tor)
-        {
-            break;
-        }
+        freeJob(cache, job);
+        return err;
+    }
+
+    ++ct.pending_jobs;
+    cache->flushing_blocks += std::size(job->blocks);
+
+    auto info = tr_sys_path_info{};
 
-        ++block;
-        ++len;
+    if (tr_sys_file_get_info(job->spans.front().fd, &info, nullptr))
+    {
+        job->device = info.device;
     }
 
-    if (info != nullptr)
     {
-        struct cache_block const* b = blocks[pos + len - 1];
-        info->last_block_time = b->time;
-        info->is_piece_done = tr_torrentPieceIsComplete(b->tor, b->piece);
-        info->is_multi_piece = b->piece != blocks[pos]->piece;
-        info->len = len;
-        info->pos = pos;
+        auto const lock = std::lock_guard(cache->lock);
+        for (auto* const b : job->blocks)
+        {
+            cache_job* const prev = b->prev_job;
+
+            /* neighboring blocks usually share the same older job, so only count it once */
+            if (prev != nullptr && !prev->is_written && (std::empty(prev->blocked) || prev->blocked.back() != job))
+            {
+                prev->blocked.push_back(job);
+                ++job->n_blockers;
+            }
+        }
+
+        cache->work.push({ job->device, job->torrent_id, first }, job);
     }
 
-    return len;
+    cache->work_cv.notify_one();
+    return 0;
 }
 
+struct run_info
+{
+    int torrent_id;
+    tr_block_index_t first;
+    tr_block_index_t len;
+    int rank;
+    bool is_multi_piece;
+    bool is_piece_done;
+};
+
 /* higher rank comes before lower rank */
-static int compareRuns(void const* va, void const* vb)
+static bool compareRuns(run_info const& a, run_info const& b)
 {
-    auto* a = static_cast<struct run_info const*>(va);
-    auto* b = static_cast<struct run_info const*>(vb);
-    return b->rank - a->rank;
+    return a.rank > b.rank;
 }
 
 enum
@@ -124,85 +1144,57 @@ enum
     SESSIONFLAG = 0x4000
 };
 
-/* Calculte runs
+/* Calculate runs
  *   - Stale runs, runs sitting in cache for a long time or runs not growing, get priority.
- *     Returns number of runs.
  */
-static int calcRuns(tr_cache const* cache, struct run_info* runs)
+static std::vector<run_info> calcRuns(tr_cache const* cache)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    int i = 0;
+    auto runs = std::vector<run_info>{};
     time_t const now = tr_time();
 
-    for (int pos = 0; pos < n; pos += runs[i++].len)
+    for (auto const& [torrent_id, ct] : cache->torrents)
     {
-        int rank = getBlockRun(cache, pos, &runs[i]);
+        tr_torrent const* const tor = ct.tor;
 
-        /* This adds ~2 to the relative length of a run for every minute it has
-         * languished in the cache. */
-        rank += (now - runs[i].last_block_time) / 32;
-
-        /* Flushing stale blocks should be a top priority as the probability of them
-         * growing is very small, for blocks on piece boundaries, and nonexistant for
-         * blocks inside pieces. */
-        rank |= runs[i].is_piece_done ? DONEFLAG : 0;
-
-        /* Move the multi piece runs higher */
-        rank |= runs[i].is_multi_piece ? MULTIFLAG : 0;
+        for (auto const& [first, run] : ct.runs)
+        {
+            auto info = run_info{};
+            auto const last_piece = tr_torBlockPiece(tor, run.last);
 
-        runs[i].rank = rank;
-    }
+            info.torrent_id = torrent_id;
+            info.first = first;
+            info.len = run.last + 1 - first;
+            info.is_piece_done = tr_torrentPieceIsComplete(tor, last_piece);
+            info.is_multi_piece = tr_torBlockPiece(tor, first) != last_piece;
 
-    qsort(runs, i, sizeof(struct run_info), compareRuns);
-    return i;
-}
+            /* This adds ~2 to the relative length of a run for every minute it has
+             * languished in the cache. */
+            int rank = info.len + (now - run.time) / 32;
 
-static int flushContiguous(tr_cache* cache, int pos, int n)
-{
-    int err = 0;
-    uint8_t* buf = tr_new(uint8_t, n * MAX_BLOCK_SIZE);
-    uint8_t* walk = buf;
-    struct cache_block** blocks = (struct cache_block**)tr_ptrArrayBase(&cache->blocks);
+            /* Flushing stale blocks should be a top priority as the probability of them
+             * growing is very small, for blocks on piece boundaries, and nonexistant for
+             * blocks inside pieces. */
+            rank |= info.is_piece_done ? DONEFLAG : 0;
 
-    struct cache_block* b = blocks[pos];
-    tr_torrent* tor = b->tor;
-    tr_piece_index_t const piece = b->piece;
-    uint32_t const offset = b->offset;
+            /* Move the multi piece runs higher */
+            rank |= info.is_multi_piece ? MULTIFLAG : 0;
 
-    for (int i = 0; i < n; ++i)
-    {
-        b = blocks[pos + i];
-        evbuffer_copyout(b->evbuf, walk, b->length);
-        walk += b->length;
-        evbuffer_free(b->evbuf);
-        tr_free(b);
+            info.rank = rank;
+            runs.push_back(info);
+        }
     }
 
-    tr_ptrArrayErase(&cache->blocks, pos, pos + n);
-
-    err = tr_ioWrite(tor, piece, offset, walk - buf, buf);
-    tr_free(buf);
-
-    ++cache->disk_writes;
-    cache->disk_write_bytes += walk - buf;
-    return err;
+    std::sort(std::begin(runs), std::end(runs), compareRuns);
+    return runs;
 }
 
-static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
+static int flushRuns(tr_cache* cache, std::vector<run_info> const& runs, size_t n)
 {
     int err = 0;
 
-    for (int i = 0; err == 0 && i < n; i++)
+    for (size_t i = 0; err == 0 && i < n; ++i)
     {
-        err = flushContiguous(cache, runs[i].pos, runs[i].len);
-
-        for (int j = i + 1; j < n; j++)
-        {
-            if (runs[j].pos > runs[i].pos)
-            {
-                runs[j].pos -= runs[i].len;
-            }
-        }
+        err = flushRun(cache, cache->torrents.at(runs[i].torrent_id), runs[i].first);
     }
 
     return err;
@@ -210,31 +1202,50 @@ static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
 
 static int cacheTrim(tr_cache* cache)
 {
-    int err = 0;
+    int err = cacheReap(cache);
 
-    if (tr_ptrArraySize(&cache->blocks) > cache->max_blocks)
+    /* If the writer is already a cache's worth behind, the blocks stay where
+     * they are and the cache goes over its limit for a while. The libevent
+     * thread never waits on the disk; instead, peers stop being asked for
+     * more blocks once the cache is full. See tr_cacheIsFull() */
+    if (err == 0 && cache->unflushed_blocks > cache->max_blocks && cache->flushing_blocks <= cache->max_blocks)
     {
         /* Amount of cache that should be removed by the flush. This influences how large
          * runs can grow as well as how often flushes will happen. */
         int const cacheCutoff = 1 + cache->max_blocks / 4;
-        struct run_info* runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
+        auto const runs = calcRuns(cache);
+        size_t i = 0;
         int j = 0;
 
-        calcRuns(cache, runs);
-
-        while (j < cacheCutoff)
+        while (j < cacheCutoff && i < std::size(runs))
         {
             j += runs[i++].len;
         }
 
         err = flushRuns(cache, runs, i);
-        tr_free(runs);
     }
 
     return err;
 }
 
+/* invoked in the libevent thread when the writer has finished some jobs */
+static void onJobsWritten(void* vsession)
+{
+    tr_cache* const cache = static_cast<tr_session*>(vsession)->cache;
+
+    /* the cache may have been freed while this was queued.
+     * Write errors are reported per torrent as the jobs are reaped */
+    if (cache != nullptr)
+    {
+        cacheTrim(cache);
+    }
+}
+
+bool tr_cacheIsFull(tr_cache const* cache)
+{
+    return cache->unflushed_blocks + cache->flushing_blocks > std::max(2 * cache->max_blocks, int{ MIN_FULL_BLOCKS });
+}
+
 /***
 ****
 ***/
@@ -254,6 +1265,8 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes)
     tr_formatter_mem_B(buf, cache->max_bytes, sizeof(buf));
     tr_logAddNamedDbg(MY_NAME, "Maximum cache size set to %s (%d blocks)", buf, cache->max_blocks);
 
+    trimReadBlocks(cache);
+
     return cacheTrim(cache);
 }
 
@@ -262,56 +1275,94 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
     return cache->max_bytes;
 }
 
+tr_cache_io_stats tr_cacheGetIoStats(tr_cache* cache)
+{
+    auto const lock = std::lock_guard(cache->lock);
+    auto stats = cache->io_stats;
+
+    stats.write_sweeps = cache->work.sweeps();
+
+    for (auto const& [device, queue] : cache->read_queues)
+    {
+        stats.read_sweeps += queue.jobs.sweeps();
+    }
+
+    return stats;
+}
+
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* const cache = new tr_cache{};
     cache->max_bytes = max_bytes;
     cache->max_blocks = getMaxBlocks(max_bytes);
+    cache->writer = std::thread(writerThreadFunc, cache);
+
+    auto const n_readers = std::clamp(int(std::thread::hardware_concurrency()), 1, int{ MAX_READER_THREADS });
+
+    for (int i = 0; i < n_readers; ++i)
+    {
+        cache->readers.emplace_back(readerThreadFunc, cache);
+    }
+
     return cache;
 }
 
 void tr_cacheFree(tr_cache* cache)
 {
-    TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
+    {
+        auto const lock = std::lock_guard(cache->lock);
+        cache->is_closing = true;
+    }
 
-    tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
-}
+    cache->work_cv.notify_one();
+    cache->writer.join();
 
-/***
-****
-***/
+    cache->read_cv.notify_all();
 
-static int cache_block_compare(void const* va, void const* vb)
-{
-    auto const* a = static_cast<struct cache_block const*>(va);
-    auto const* b = static_cast<struct cache_block const*>(vb);
+    for (auto& reader : cache->readers)
+    {
+        reader.join();
+    }
 
-    /* primary key: torrent id */
-    if (a->tor->uniqueId != b->tor->uniqueId)
+    /* let whoever's waiting on reads that never got started know they're not coming */
+    for (auto& [device, queue] : cache->read_queues)
     {
-        return a->tor->uniqueId < b->tor->uniqueId ? -1 : 1;
+        while (auto job = queue.jobs.pop())
+        {
+            (*job)->err = ECANCELED;
+            finishReadJob(*job, nullptr);
+        }
     }
 
-    /* secondary key: block # */
-    if (a->block != b->block)
+    /* every torrent has been flushed and closed by now, so just free what's left */
+    for (auto* job : cache->done)
     {
-        return a->block < b->block ? -1 : 1;
+        freeJob(cache, job);
     }
 
-    /* they're equal */
-    return 0;
-}
+    while (!std::empty(cache->piece_hashes))
+    {
+        dropPieceHashes(cache, std::begin(cache->piece_hashes)->first);
+    }
 
-static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
-{
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = _tr_block(torrent, piece, offset);
-    return static_cast<struct cache_block*>(tr_ptrArrayFindSorted(&cache->blocks, &key, cache_block_compare));
+    TR_ASSERT(std::empty(cache->work));
+    TR_ASSERT(cache->unflushed_blocks == 0);
+
+    for (auto& slab : cache->pool.slabs)
+    {
+        for (int i = 0; i < cache_block_pool::SlabSize; ++i)
+        {
+            evbuffer_free(slab[i].evbuf);
+        }
+    }
+
+    delete cache;
 }
 
+/***
+****
+***/
+
 int tr_cacheWriteBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -322,33 +1373,100 @@ int tr_cacheWriteBlock(
 {
     TR_ASSERT(tr_amInEventThread(torrent->session));
 
-    struct cache_block* cb = findBlock(cache, torrent, piece, offset);
+    auto& ct = cache->torrents[torrent->uniqueId];
+    ct.tor = torrent;
 
-    if (cb == nullptr)
+    tr_block_index_t const block = _tr_block(torrent, piece, offset);
+    cache_block*& cb = ct.blocks[block];
+
+    dropReadBlock(cache, torrent->uniqueId, block);
+
+    /* if the old copy is already on its way to disk, leave it alone
+     * and queue up a fresh one to be written after it */
+    if (cb == nullptr || cb->is_flushing)
     {
-        cb = tr_new(struct cache_block, 1);
-        cb->tor = torrent;
+        cache_job* const cb_prev_job = cb != nullptr ? cb->job : nullptr;
+
+        cb = blockNew(cache);
+        cb->block = block;
         cb->piece = piece;
         cb->offset = offset;
         cb->length = length;
-        cb->block = _tr_block(torrent, piece, offset);
-        cb->evbuf = evbuffer_new();
-        tr_ptrArrayInsertSorted(&cache->blocks, cb, cache_block_compare);
+        cb->is_flushing = false;
+        cb->job = nullptr;
+        cb->prev_job = cb_prev_job;
+
+        ++cache->unflushed_blocks;
+        cache->write_bytes += length;
+        runAddBlock(ct, block, tr_time());
+        trimReadBlocks(cache);
     }
 
     TR_ASSERT(cb->length == length);
 
-    cb->time = tr_time();
-
     evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
     evbuffer_remove_buffer(writeme, cb->evbuf, cb->length);
 
     cache->cache_writes++;
     cache->cache_write_bytes += cb->length;
 
+    pieceHashUpdate(cache, torrent, piece, offset);
+
     return cacheTrim(cache);
 }
 
+bool tr_cacheTakePieceHash(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint8_t* setme)
+{
+    auto const hashes = cache->piece_hashes.find(torrent->uniqueId);
+
+    if (hashes == std::end(cache->piece_hashes))
+    {
+        return false;
+    }
+
+    auto const it = hashes->second.find(piece);
+
+    if (it == std::end(hashes->second))
+    {
+        return false;
+    }
+
+    bool const is_done = it->second.next_offset == tr_torPieceCountBytes(torrent, piece);
+
+    if (is_done)
+    {
+        tr_sha1_final(it->second.sha, setme);
+        hashes->second.erase(it);
+    }
+
+    dropPieceHash(cache, torrent->uniqueId, piece);
+    return is_done;
+}
+
+void tr_cacheDropPieceHash(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    dropPieceHash(cache, torrent->uniqueId, piece);
+}
+
+bool tr_cacheCopyBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme)
+{
+    struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
+
+    if (cb == nullptr)
+    {
+        return false;
+    }
+
+    evbuffer_copyout(cb->evbuf, setme, len);
+    return true;
+}
+
 int tr_cacheReadBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -358,26 +1476,181 @@ int tr_cacheReadBlock(
     uint8_t* setme)
 {
     int err = 0;
-    struct cache_block* cb = findBlock(cache, torrent, piece, offset);
 
-    if (cb != nullptr)
+    if (!tr_cacheCopyBlock(cache, torrent, piece, offset, len, setme))
+    {
+        err = tr_ioRead(torrent, piece, offset, len, setme);
+    }
+
+    return err;
+}
+
+/* copy a block into `out` the old-fashioned way */
+static int copyBlockToBuffer(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    struct evbuffer* out)
+{
+    struct evbuffer_iovec iovec[1];
+
+    evbuffer_reserve_space(out, len, iovec, 1);
+    int const err = tr_cacheReadBlock(cache, torrent, piece, offset, len, static_cast<uint8_t*>(iovec[0].iov_base));
+    iovec[0].iov_len = err == 0 ? len : 0;
+    evbuffer_commit_space(out, iovec, 1);
+
+    return err;
+}
+
+int tr_cacheReadBlockToBuffer(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    struct evbuffer* out,
+    bool by_reference)
+{
+    TR_ASSERT(tr_amInEventThread(torrent->session));
+
+    tr_block_index_t const block = _tr_block(torrent, piece, offset);
+
+    /* odd-sized requests aren't worth sharing, and
+     * blocks that haven't been flushed yet are already in memory */
+    if (!isWholeBlock(torrent, block, offset, len) || findBlock(cache, torrent, piece, offset) != nullptr)
     {
-        evbuffer_copyout(cb->evbuf, setme, len);
+        return copyBlockToBuffer(cache, torrent, piece, offset, len, out);
+    }
+
+    auto& reads = cache->reads;
+    auto const key = readKey(torrent->uniqueId, block);
+    auto it = reads.blocks.find(key);
+
+    if (it != std::end(reads.blocks))
+    {
+        ++cache->read_hits;
+        reads.lru.splice(std::begin(reads.lru), reads.lru, it->second.lru_pos);
     }
     else
     {
-        err = tr_ioRead(torrent, piece, offset, len, setme);
+        ++cache->read_misses;
+
+        /* This blocks the libevent thread on the disk. It only happens if the
+         * caller didn't wait for tr_cacheReadBlockAsync() or that read failed */
+        auto read_block = std::make_shared<cache_read_block>();
+        read_block->data.resize(len);
+
+        int const err = tr_ioRead(torrent, piece, offset, len, std::data(read_block->data));
+
+        if (err != 0)
+        {
+            return err;
+        }
+
+        it = addReadBlock(cache, key, std::move(read_block));
     }
 
-    return err;
+    auto const& read_block = it->second.block;
+
+    if (by_reference)
+    {
+        evbuffer_add_reference(
+            out,
+            std::data(read_block->data),
+            std::size(read_block->data),
+            unrefReadBlock,
+            new cache_read_block_ptr{ read_block });
+    }
+    else
+    {
+        evbuffer_add(out, std::data(read_block->data), std::size(read_block->data));
+    }
+
+    trimReadBlocks(cache);
+    return 0;
+}
+
+bool tr_cacheBlockNeedsRead(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
+{
+    tr_block_index_t const block = _tr_block(torrent, piece, offset);
+
+    return isWholeBlock(torrent, block, offset, len) && findBlock(cache, torrent, piece, offset) == nullptr &&
+        cache->reads.blocks.count(readKey(torrent->uniqueId, block)) == 0;
+}
+
+int tr_cacheReadBlockAsync(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    tr_cache_read_func callback,
+    void* user_data)
+{
+    TR_ASSERT(tr_amInEventThread(torrent->session));
+
+    tr_block_index_t const block = _tr_block(torrent, piece, offset);
+
+    if (!isWholeBlock(torrent, block, offset, len))
+    {
+        return EINVAL;
+    }
+
+    /* if someone else is already waiting on this block, wait with them */
+    auto const key = readKey(torrent->uniqueId, block);
+    auto const pending = cache->pending_reads.find(key);
+
+    if (pending != std::end(cache->pending_reads) && !pending->second->is_stale)
+    {
+        pending->second->waiters.push_back({ callback, user_data });
+        return 0;
+    }
+
+    auto spans = std::vector<tr_io_span>{};
+
+    if (int const err = tr_ioPrepareRead(torrent, piece, offset, len, spans); err != 0)
+    {
+        return err;
+    }
+
+    auto* const job = new cache_read_job{};
+    job->session = torrent->session;
+    job->torrent_id = torrent->uniqueId;
+    job->key = key;
+    job->spans = std::move(spans);
+    job->block = std::make_shared<cache_read_block>();
+    job->block->data.resize(len);
+    job->waiters.push_back({ callback, user_data });
+
+    auto info = tr_sys_path_info{};
+
+    if (tr_sys_file_get_info(job->spans.front().fd, &info, nullptr))
+    {
+        job->device = info.device;
+    }
+
+    /* this replaces any stale read of the block, which
+     * still finishes but doesn't get any new waiters */
+    cache->pending_reads[key] = job;
+
+    {
+        auto const lock = std::lock_guard(cache->lock);
+        cache->read_queues[job->device].jobs.push(key, job);
+    }
+
+    cache->read_cv.notify_one();
+    return 0;
 }
 
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
 {
     int err = 0;
     struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
+    tr_block_index_t const block = _tr_block(torrent, piece, offset);
 
-    if (cb == nullptr)
+    if (cb == nullptr && cache->reads.blocks.count(readKey(torrent->uniqueId, block)) == 0)
     {
         err = tr_ioPrefetch(torrent, piece, offset, len);
     }
@@ -389,89 +1662,86 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
 ****
 ***/
 
-static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
-{
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = block;
-    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
-}
-
 int tr_cacheFlushDone(tr_cache* cache)
 {
-    int err = 0;
+    int err = cacheReap(cache);
 
-    if (tr_ptrArraySize(&cache->blocks) > 0)
+    if (err == 0 && cache->unflushed_blocks > 0)
     {
-        int i;
-        int n;
-        struct run_info* runs;
-
-        runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        i = 0;
-        n = calcRuns(cache, runs);
+        auto runs = calcRuns(cache);
+        size_t i = 0;
 
-        while (i < n && (runs[i].is_piece_done || runs[i].is_multi_piece))
+        while (i < std::size(runs) && (runs[i].is_piece_done || runs[i].is_multi_piece))
         {
             runs[i++].rank |= SESSIONFLAG;
         }
 
         err = flushRuns(cache, runs, i);
-        tr_free(runs);
     }
 
     return err;
 }
 
-int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t i)
+/* hand off all of a torrent's runs that intersect [first...last], then wait for them to land */
+static int flushTorrentRange(tr_cache* cache, tr_torrent* torrent, tr_block_index_t first, tr_block_index_t last)
 {
-    int pos;
-    int err = 0;
-    tr_block_index_t first;
-    tr_block_index_t last;
-
-    tr_torGetFileBlockRange(torrent, i, &first, &last);
-    pos = findBlockPos(cache, torrent, first);
-    dbgmsg("flushing file %d from cache to disk: blocks [%zu...%zu]", (int)i, (size_t)first, (size_t)last);
+    int err = cacheReap(cache);
+    auto const it = cache->torrents.find(torrent->uniqueId);
 
-    /* flush out all the blocks in that file */
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
+    if (it == std::end(cache->torrents))
     {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+        return err;
+    }
 
-        if (b->tor != torrent)
+    auto& ct = it->second;
+    auto firsts = std::vector<tr_block_index_t>{};
+
+    for (auto const& [run_first, run] : ct.runs)
+    {
+        if (run_first <= last && run.last >= first)
         {
-            break;
+            firsts.push_back(run_first);
         }
+    }
 
-        if (b->block < first || b->block > last)
+    /* write them in file order */
+    std::sort(std::begin(firsts), std::end(firsts));
+
+    for (auto const run_first : firsts)
+    {
+        if (err == 0)
         {
-            break;
+            err = flushRun(cache, ct, run_first);
         }
+    }
 
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
+    int const wait_err = cacheWaitForTorrent(cache, torrent->uniqueId);
+
+    if (err == 0)
+    {
+        err = wait_err;
     }
 
+    maybeForgetTorrent(cache, torrent->uniqueId);
     return err;
 }
 
-int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
+int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t i)
 {
-    int err = 0;
-    int const pos = findBlockPos(cache, torrent, 0);
+    tr_block_index_t first;
+    tr_block_index_t last;
 
-    /* flush out all the blocks in that torrent */
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
-    {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+    tr_torGetFileBlockRange(torrent, i, &first, &last);
+    dbgmsg("flushing file %d from cache to disk: blocks [%zu...%zu]", (int)i, (size_t)first, (size_t)last);
 
-        if (b->tor != torrent)
-        {
-            break;
-        }
+    return flushTorrentRange(cache, torrent, first, last);
+}
 
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
-    }
+int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
+{
+    /* the files may change under us while the torrent's stopped, so start the pieces over */
+    dropPieceHashes(cache, torrent->uniqueId);
+    dropReadBlocks(cache, torrent->uniqueId);
 
-    return err;
+    return flushTorrentRange(cache, torrent, 0, torrent->blockCount);
 }
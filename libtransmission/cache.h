@@ -33,6 +33,27 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes);
 
 int64_t tr_cacheGetLimit(tr_cache const*);
 
+/* how the cache's disk I/O has been scheduled */
+struct tr_cache_io_stats
+{
+    /* blocks read by the reader threads, and how many reads that took */
+    size_t blocks_read;
+    size_t reads;
+
+    /* runs written by the writer thread */
+    size_t runs_written;
+
+    /* how many times the elevators have gone back around to the start */
+    size_t read_sweeps;
+    size_t write_sweeps;
+};
+
+tr_cache_io_stats tr_cacheGetIoStats(tr_cache* cache);
+
+/* true if the writer has fallen so far behind that no more blocks
+ * should be requested from peers until it catches up */
+bool tr_cacheIsFull(tr_cache const* cache);
+
 int tr_cacheWriteBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -41,6 +62,14 @@ int tr_cacheWriteBlock(
     uint32_t len,
     struct evbuffer* writeme);
 
+/* If every block of the piece was written to the cache in order, this
+ * sets `setme` to the SHA-1 they were hashed to as they came in and
+ * returns true. Either way, the cache forgets the piece's hash. */
+bool tr_cacheTakePieceHash(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint8_t* setme);
+
+/* forget whatever the cache has hashed of the piece so far, e.g. because it was bad */
+void tr_cacheDropPieceHash(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece);
+
 int tr_cacheReadBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -49,6 +78,64 @@ int tr_cacheReadBlock(
     uint32_t len,
     uint8_t* setme);
 
+/* copies a block out of the cache without falling back to disk.
+ * returns false if the block isn't in the cache */
+bool tr_cacheCopyBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme);
+
+/**
+ * Appends a block to `out` so that it can be uploaded to a peer.
+ *
+ * Blocks read from disk for this are kept in a read cache shared by every
+ * peer, so a popular block is only read once. If `by_reference` is true,
+ * `out` references the cached copy instead of getting a copy of its own;
+ * don't use that if `out` is going to be modified in place, e.g. encrypted.
+ *
+ * If the block isn't in memory, it's read from disk right here on the calling
+ * thread. To keep that off the libevent thread, check tr_cacheBlockNeedsRead()
+ * and wait for tr_cacheReadBlockAsync() first. Requests that aren't for a whole
+ * block can't be read asynchronously, and neither can a block whose async read
+ * failed, so those are still read synchronously.
+ *
+ * returns 0 or an errno
+ */
+int tr_cacheReadBlockToBuffer(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    struct evbuffer* out,
+    bool by_reference);
+
+/* true if tr_cacheReadBlockToBuffer() would have to go to disk for the block */
+bool tr_cacheBlockNeedsRead(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
+
+/* invoked in the libevent thread when a tr_cacheReadBlockAsync() read is done.
+ * `tor` is nullptr if the torrent or the cache went away in the meantime */
+using tr_cache_read_func = void (*)(tr_torrent* tor, int err, void* user_data);
+
+/**
+ * Reads a block into the read cache on one of the cache's reader threads,
+ * so that the libevent thread doesn't have to wait on the disk for it.
+ *
+ * returns 0 if the read was queued, in which case `callback` will be invoked
+ * exactly once, or an errno if it wasn't
+ */
+int tr_cacheReadBlockAsync(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    tr_cache_read_func callback,
+    void* user_data);
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
 /***
@@ -10,6 +10,10 @@
    implement missing (or duplicate) functionality without exposing internal
    details in header files. */
 
+#ifdef TR_CRYPTO_RC4_FALLBACK
+#include <arc4.h>
+#endif
+
 #include "transmission.h"
 #include "crypto-utils.h"
 #include "tr-assert.h"
@@ -74,6 +78,46 @@ void tr_dh_secret_free(tr_dh_secret_t handle)
 
 #endif /* TR_CRYPTO_DH_SECRET_FALLBACK */
 
+#ifdef TR_CRYPTO_RC4_FALLBACK
+
+/* Backends without a (usable) RC4 implementation of their own share the
+   portable one that MSE has always used. */
+
+tr_rc4_ctx_t tr_rc4_new(void)
+{
+    return tr_new0(struct arc4_context, 1);
+}
+
+void tr_rc4_free(tr_rc4_ctx_t handle)
+{
+    tr_free(handle);
+}
+
+void tr_rc4_set_key(tr_rc4_ctx_t handle, uint8_t const* key, size_t key_length)
+{
+    TR_ASSERT(handle != nullptr);
+    TR_ASSERT(key != nullptr);
+
+    arc4_init(static_cast<struct arc4_context*>(handle), key, key_length);
+}
+
+void tr_rc4_process(tr_rc4_ctx_t handle, void const* input, void* output, size_t length)
+{
+    TR_ASSERT(handle != nullptr);
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    TR_ASSERT(input != nullptr);
+    TR_ASSERT(output != nullptr);
+
+    arc4_process(static_cast<struct arc4_context*>(handle), input, output, length);
+}
+
+#endif /* TR_CRYPTO_RC4_FALLBACK */
+
 #ifdef TR_CRYPTO_X509_FALLBACK
 
 tr_x509_store_t tr_ssl_get_x509_store([[maybe_unused]] tr_ssl_ctx_t handle)
@@ -11,12 +11,20 @@
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 #endif
 
+#include <algorithm> /* std::min() */
+#include <climits> /* INT_MAX */
+
+#include <arc4.h>
+
 #include <openssl/bn.h>
 #include <openssl/crypto.h>
 #include <openssl/dh.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#include <openssl/provider.h>
+#endif
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
@@ -185,6 +193,140 @@ static void openssl_evp_cipher_context_free(EVP_CIPHER_CTX* handle)
 
 #endif
 
+/* OpenSSL's RC4 is hand-tuned assembly on most platforms, several times
+   faster than the portable arc4 code, so prefer it when it can be had.
+   OpenSSL 3 only ships RC4 in the "legacy" provider; load that into a
+   private library context so the default one keeps its implicit setup. */
+static EVP_CIPHER const* openssl_get_rc4(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+    static EVP_CIPHER const* const cipher = []() -> EVP_CIPHER const*
+    {
+        OSSL_LIB_CTX* const libctx = OSSL_LIB_CTX_new();
+
+        if (libctx != nullptr && OSSL_PROVIDER_load(libctx, "legacy") != nullptr)
+        {
+            EVP_CIPHER* const rc4 = EVP_CIPHER_fetch(libctx, "RC4", nullptr);
+
+            if (rc4 != nullptr)
+            {
+                return rc4;
+            }
+        }
+
+        ERR_clear_error();
+        OSSL_LIB_CTX_free(libctx);
+        return nullptr;
+    }();
+
+    return cipher;
+#else
+    return EVP_rc4();
+#endif
+}
+
+struct tr_rc4
+{
+    EVP_CIPHER_CTX* evp;
+    struct arc4_context arc4;
+};
+
+tr_rc4_ctx_t tr_rc4_new(void)
+{
+    auto* handle = tr_new0(struct tr_rc4, 1);
+    EVP_CIPHER const* const cipher = openssl_get_rc4();
+
+    if (cipher != nullptr)
+    {
+        handle->evp = EVP_CIPHER_CTX_new();
+
+        if (handle->evp != nullptr && EVP_CipherInit_ex(handle->evp, cipher, nullptr, nullptr, nullptr, 1) != 1)
+        {
+            ERR_clear_error();
+            EVP_CIPHER_CTX_free(handle->evp);
+            handle->evp = nullptr;
+        }
+    }
+
+    return handle;
+}
+
+void tr_rc4_free(tr_rc4_ctx_t raw_handle)
+{
+    auto* handle = static_cast<struct tr_rc4*>(raw_handle);
+
+    if (handle == nullptr)
+    {
+        return;
+    }
+
+    if (handle->evp != nullptr)
+    {
+        EVP_CIPHER_CTX_free(handle->evp);
+    }
+
+    tr_free(handle);
+}
+
+void tr_rc4_set_key(tr_rc4_ctx_t raw_handle, uint8_t const* key, size_t key_length)
+{
+    auto* handle = static_cast<struct tr_rc4*>(raw_handle);
+
+    TR_ASSERT(handle != nullptr);
+    TR_ASSERT(key != nullptr);
+
+    if (handle->evp != nullptr)
+    {
+        if (check_result(EVP_CIPHER_CTX_set_key_length(handle->evp, (int)key_length)) &&
+            check_result(EVP_CipherInit_ex(handle->evp, nullptr, nullptr, key, nullptr, -1)))
+        {
+            return;
+        }
+
+        EVP_CIPHER_CTX_free(handle->evp);
+        handle->evp = nullptr;
+    }
+
+    arc4_init(&handle->arc4, key, key_length);
+}
+
+void tr_rc4_process(tr_rc4_ctx_t raw_handle, void const* input, void* output, size_t length)
+{
+    auto* handle = static_cast<struct tr_rc4*>(raw_handle);
+
+    TR_ASSERT(handle != nullptr);
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    TR_ASSERT(input != nullptr);
+    TR_ASSERT(output != nullptr);
+
+    if (handle->evp == nullptr)
+    {
+        arc4_process(&handle->arc4, input, output, length);
+        return;
+    }
+
+    auto const* in = static_cast<unsigned char const*>(input);
+    auto* out = static_cast<unsigned char*>(output);
+
+    while (length > 0)
+    {
+        int const chunk_length = (int)std::min(length, size_t{ INT_MAX });
+        int output_length;
+
+        check_result(EVP_CipherUpdate(handle->evp, out, &output_length, in, chunk_length));
+        TR_ASSERT(output_length == chunk_length);
+
+        in += chunk_length;
+        out += chunk_length;
+        length -= chunk_length;
+    }
+}
+
 /***
 ****
 ***/
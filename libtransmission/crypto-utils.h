@@ -23,6 +23,8 @@
 
 /** @brief Opaque SHA1 context type. */
 using tr_sha1_ctx_t = void*;
+/** @brief Opaque RC4 context type. */
+using tr_rc4_ctx_t = void*;
 /** @brief Opaque DH context type. */
 using tr_dh_ctx_t = void*;
 /** @brief Opaque DH secret key type. */
@@ -54,6 +56,29 @@ bool tr_sha1_update(tr_sha1_ctx_t handle, void const* data, size_t data_length);
  */
 bool tr_sha1_final(tr_sha1_ctx_t handle, uint8_t* hash);
 
+/**
+ * @brief Allocate and initialize new RC4 cipher context.
+ */
+tr_rc4_ctx_t tr_rc4_new(void);
+
+/**
+ * @brief Free RC4 cipher context.
+ */
+void tr_rc4_free(tr_rc4_ctx_t handle);
+
+/**
+ * @brief Set RC4 cipher key.
+ */
+void tr_rc4_set_key(tr_rc4_ctx_t handle, uint8_t const* key, size_t key_length);
+
+/**
+ * @brief Process memory block with RC4 cipher.
+ *
+ * The keystream continues across calls, so a message may be processed in
+ * as many pieces as is convenient. Input and output may be the same buffer.
+ */
+void tr_rc4_process(tr_rc4_ctx_t handle, void const* input, void* output, size_t length);
+
 /**
  * @brief Allocate and initialize new Diffie-Hellman (DH) key exchange context.
  */
@@ -8,8 +8,6 @@
 
 #include <string.h> /* memcpy(), memmove(), memset() */
 
-#include <arc4.h>
-
 #include "transmission.h"
 #include "crypto.h"
 #include "crypto-utils.h"
@@ -65,8 +63,8 @@ void tr_cryptoDestruct(tr_crypto* crypto)
 {
     tr_dh_secret_free(crypto->mySecret);
     tr_dh_free(crypto->dh);
-    tr_free(crypto->enc_key);
-    tr_free(crypto->dec_key);
+    tr_rc4_free(crypto->enc_key);
+    tr_rc4_free(crypto->dec_key);
 }
 
 /**
@@ -91,25 +89,27 @@ uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len)
 ***
 **/
 
-static void init_rc4(tr_crypto const* crypto, struct arc4_context** setme, char const* key)
+static void init_rc4(tr_crypto const* crypto, tr_rc4_ctx_t* setme, char const* key)
 {
     TR_ASSERT(crypto->torrentHashIsSet);
 
     if (*setme == nullptr)
     {
-        *setme = tr_new0(struct arc4_context, 1);
+        *setme = tr_rc4_new();
     }
 
     uint8_t buf[SHA_DIGEST_LENGTH];
 
     if (tr_cryptoSecretKeySha1(crypto, key, 4, crypto->torrentHash, SHA_DIGEST_LENGTH, buf))
     {
-        arc4_init(*setme, buf, SHA_DIGEST_LENGTH);
-        arc4_discard(*setme, 1024);
+        /* MSE discards the first 1024 bytes of keystream */
+        uint8_t discard[1024] = { 0 };
+        tr_rc4_set_key(*setme, buf, SHA_DIGEST_LENGTH);
+        tr_rc4_process(*setme, discard, discard, sizeof(discard));
     }
 }
 
-static void crypt_rc4(struct arc4_context* key, size_t buf_len, void const* buf_in, void* buf_out)
+static void crypt_rc4(tr_rc4_ctx_t key, size_t buf_len, void const* buf_in, void* buf_out)
 {
     if (key == nullptr)
     {
@@ -121,7 +121,7 @@ static void crypt_rc4(struct arc4_context* key, size_t buf_len, void const* buf_
         return;
     }
 
-    arc4_process(key, buf_in, buf_out, buf_len);
+    tr_rc4_process(key, buf_in, buf_out, buf_len);
 }
 
 void tr_cryptoDecryptInit(tr_crypto* crypto)
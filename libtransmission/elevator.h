@@ -0,0 +1,125 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <map>
+#include <optional>
+#include <utility> // std::move
+
+/**
+ * A queue that hands out its items in elevator (C-SCAN) order: upwards by key
+ * from wherever the last item was, then back around to the lowest key once
+ * there's nothing left above. Items with equal keys come out in the order
+ * they went in.
+ *
+ * tr_cache uses it to keep each disk's head sweeping in one direction instead
+ * of seeking back and forth between whichever reads and writes came in first.
+ */
+template<typename Key, typename T>
+class tr_elevator
+{
+public:
+    using container = std::multimap<Key, T>;
+
+    [[nodiscard]] bool empty() const
+    {
+        return std::empty(items_);
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return std::size(items_);
+    }
+
+    [[nodiscard]] typename container::const_iterator begin() const
+    {
+        return std::begin(items_);
+    }
+
+    [[nodiscard]] typename container::const_iterator end() const
+    {
+        return std::end(items_);
+    }
+
+    /* how many times the elevator has gone back around to the lowest key */
+    [[nodiscard]] size_t sweeps() const
+    {
+        return sweeps_;
+    }
+
+    void push(Key const& key, T item)
+    {
+        items_.emplace(key, std::move(item));
+    }
+
+    /* takes the next item in elevator order that `accept(key, item)` will take */
+    template<typename Accept>
+    std::optional<T> pop(Accept accept)
+    {
+        auto const start = head_ ? items_.lower_bound(*head_) : std::begin(items_);
+
+        for (auto it = start; it != std::end(items_); ++it)
+        {
+            if (accept(it->first, it->second))
+            {
+                return take(it);
+            }
+        }
+
+        for (auto it = std::begin(items_); it != start; ++it)
+        {
+            if (accept(it->first, it->second))
+            {
+                ++sweeps_;
+                return take(it);
+            }
+        }
+
+        return {};
+    }
+
+    std::optional<T> pop()
+    {
+        return pop([](Key const& /*key*/, T const& /*item*/) { return true; });
+    }
+
+    /* takes the item right after the last one, if `accept` will take it.
+     * Unlike pop(), this never goes back around, so it's good for gathering
+     * up a run of neighbors to be handled together. */
+    template<typename Accept>
+    std::optional<T> pop_next(Accept accept)
+    {
+        auto const it = head_ ? items_.lower_bound(*head_) : std::end(items_);
+
+        if (it == std::end(items_) || !accept(it->first, it->second))
+        {
+            return {};
+        }
+
+        return take(it);
+    }
+
+private:
+    T take(typename container::iterator it)
+    {
+        head_ = it->first;
+        auto item = std::move(it->second);
+        items_.erase(it);
+        return item;
+    }
+
+    container items_;
+    std::optional<Key> head_;
+    size_t sweeps_ = 0;
+};
@@ -13,6 +13,7 @@
 #include <array>
 #include <cerrno>
 #include <climits> /* PATH_MAX */
+#include <cstddef> /* offsetof() */
 #include <cstdint> /* SIZE_MAX */
 #include <cstdio>
 #include <cstdlib>
@@ -24,6 +25,7 @@
 #include <sys/mman.h> /* mmap(), munmap() */
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h> /* preadv(), pwritev() */
 #include <unistd.h> /* lseek(), write(), ftruncate(), pread(), pwrite(), pathconf(), etc */
 #include <vector>
 
@@ -73,6 +75,10 @@
 #define O_CLOEXEC 0
 #endif
 
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
@@ -131,6 +137,7 @@ static void stat_to_sys_path_info(struct stat const* sb, tr_sys_path_info* info)
 
     info->size = (uint64_t)sb->st_size;
     info->last_modified_at = sb->st_mtime;
+    info->device = (uint64_t)sb->st_dev;
 }
 
 static void set_file_for_single_pass(tr_sys_file_t handle)
@@ -684,6 +691,24 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+#ifdef F_DUPFD_CLOEXEC
+    tr_sys_file_t ret = fcntl(handle, F_DUPFD_CLOEXEC, 0);
+#else
+    tr_sys_file_t ret = dup(handle);
+#endif
+
+    if (ret == TR_BAD_SYS_FILE)
+    {
+        set_system_error(error, errno);
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -818,6 +843,73 @@ bool tr_sys_file_read_at(
     return ret;
 }
 
+bool tr_sys_file_read_at_v(
+    tr_sys_file_t handle,
+    tr_sys_file_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    bool ret = false;
+    ssize_t my_bytes_read;
+
+    TR_STATIC_ASSERT(sizeof(*bytes_read) >= sizeof(my_bytes_read), "");
+
+#ifdef HAVE_PREADV
+
+    TR_STATIC_ASSERT(sizeof(tr_sys_file_iovec) == sizeof(struct iovec), "");
+    TR_STATIC_ASSERT(offsetof(tr_sys_file_iovec, iov_base) == offsetof(struct iovec, iov_base), "");
+    TR_STATIC_ASSERT(offsetof(tr_sys_file_iovec, iov_len) == offsetof(struct iovec, iov_len), "");
+
+    my_bytes_read = preadv(handle, reinterpret_cast<struct iovec const*>(iov), std::min(iov_count, size_t{ IOV_MAX }), offset);
+
+#else
+
+    /* one positional read per buffer, stopping at the first short one */
+    my_bytes_read = 0;
+
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t n;
+
+        if (!tr_sys_file_read_at(handle, iov[i].iov_base, iov[i].iov_len, offset + my_bytes_read, &n, error))
+        {
+            return false;
+        }
+
+        my_bytes_read += n;
+
+        if (n < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+
+#endif
+
+    if (my_bytes_read != -1)
+    {
+        if (bytes_read != nullptr)
+        {
+            *bytes_read = my_bytes_read;
+        }
+
+        ret = true;
+    }
+    else
+    {
+        set_system_error(error, errno);
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_write(tr_sys_file_t handle, void const* buffer, uint64_t size, uint64_t* bytes_written, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -899,6 +991,77 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    tr_sys_file_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    bool ret = false;
+    ssize_t my_bytes_written;
+
+    TR_STATIC_ASSERT(sizeof(*bytes_written) >= sizeof(my_bytes_written), "");
+
+#ifdef HAVE_PWRITEV
+
+    TR_STATIC_ASSERT(sizeof(tr_sys_file_iovec) == sizeof(struct iovec), "");
+    TR_STATIC_ASSERT(offsetof(tr_sys_file_iovec, iov_base) == offsetof(struct iovec, iov_base), "");
+    TR_STATIC_ASSERT(offsetof(tr_sys_file_iovec, iov_len) == offsetof(struct iovec, iov_len), "");
+
+    my_bytes_written = pwritev(
+        handle,
+        reinterpret_cast<struct iovec const*>(iov),
+        std::min(iov_count, size_t{ IOV_MAX }),
+        offset);
+
+#else
+
+    /* one positional write per buffer, stopping at the first short one */
+    my_bytes_written = 0;
+
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t n;
+
+        if (!tr_sys_file_write_at(handle, iov[i].iov_base, iov[i].iov_len, offset + my_bytes_written, &n, error))
+        {
+            return false;
+        }
+
+        my_bytes_written += n;
+
+        if (n < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+
+#endif
+
+    if (my_bytes_written != -1)
+    {
+        if (bytes_written != nullptr)
+        {
+            *bytes_written = my_bytes_written;
+        }
+
+        ret = true;
+    }
+    else
+    {
+        set_system_error(error, errno);
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -971,6 +971,22 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+    tr_sys_file_t ret = TR_BAD_SYS_FILE;
+    HANDLE const process = GetCurrentProcess();
+
+    if (!DuplicateHandle(process, handle, process, &ret, 0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+        set_system_error(error, GetLastError());
+        ret = TR_BAD_SYS_FILE;
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -987,6 +1003,7 @@ bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error
             attributes.nFileSizeHigh,
             &attributes.ftLastWriteTime,
             info);
+        info->device = attributes.dwVolumeSerialNumber;
     }
     else
     {
@@ -1102,6 +1119,45 @@ bool tr_sys_file_read_at(
     return ret;
 }
 
+bool tr_sys_file_read_at_v(
+    tr_sys_file_t handle,
+    tr_sys_file_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+
+    uint64_t my_bytes_read = 0;
+
+    /* one positional read per buffer, stopping at the first short one */
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t n;
+
+        if (!tr_sys_file_read_at(handle, iov[i].iov_base, iov[i].iov_len, offset + my_bytes_read, &n, error))
+        {
+            return false;
+        }
+
+        my_bytes_read += n;
+
+        if (n < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+
+    if (bytes_read != nullptr)
+    {
+        *bytes_read = my_bytes_read;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_write(tr_sys_file_t handle, void const* buffer, uint64_t size, uint64_t* bytes_written, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -1176,6 +1232,45 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    tr_sys_file_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+
+    uint64_t my_bytes_written = 0;
+
+    /* one positional write per buffer, stopping at the first short one */
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t n;
+
+        if (!tr_sys_file_write_at(handle, iov[i].iov_base, iov[i].iov_len, offset + my_bytes_written, &n, error))
+        {
+            return false;
+        }
+
+        my_bytes_written += n;
+
+        if (n < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+
+    if (bytes_written != nullptr)
+    {
+        *bytes_written = my_bytes_written;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
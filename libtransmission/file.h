@@ -112,11 +112,20 @@ enum tr_sys_path_type_t
     TR_SYS_PATH_IS_OTHER
 };
 
+/** @brief Buffer for vectored I/O. Laid out like POSIX `struct iovec`. */
+struct tr_sys_file_iovec
+{
+    void* iov_base;
+    size_t iov_len;
+};
+
 struct tr_sys_path_info
 {
     tr_sys_path_type_t type = {};
     uint64_t size = 0;
     time_t last_modified_at = 0;
+    /* identifies the filesystem the path lives on, or 0 if unknown */
+    uint64_t device = 0;
 };
 
 /**
@@ -333,6 +342,21 @@ tr_sys_file_t tr_sys_file_open_temp(char* path_template, struct tr_error** error
  */
 bool tr_sys_file_close(tr_sys_file_t handle, struct tr_error** error);
 
+/**
+ * @brief Portability wrapper for `dup()`.
+ *
+ * The new descriptor refers to the same open file as `handle` and has to be
+ * closed separately with @ref tr_sys_file_close.
+ *
+ * @param[in]  handle Valid file descriptor.
+ * @param[out] error  Pointer to error object. Optional, pass `nullptr` if you
+ *                    are not interested in error details.
+ *
+ * @return Duplicated file descriptor on success, `TR_BAD_SYS_FILE` otherwise
+ *         (with `error` set accordingly).
+ */
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fstat()`.
  *
@@ -403,6 +427,31 @@ bool tr_sys_file_read_at(
     uint64_t* bytes_read,
     struct tr_error** error);
 
+/**
+ * @brief Portability wrapper for `preadv()`.
+ *
+ * Like other wrappers, this may read less than the buffers' total size, in
+ * which case the caller should call it again for the remaining data.
+ *
+ * @param[in]  handle     Valid file descriptor.
+ * @param[in]  iov        Buffers to store the data being read.
+ * @param[in]  iov_count  Number of buffers in `iov`.
+ * @param[in]  offset     File offset in bytes to start reading from.
+ * @param[out] bytes_read Number of bytes actually read. Optional, pass
+ *                        `nullptr` if you are not interested.
+ * @param[out] error      Pointer to error object. Optional, pass `nullptr` if
+ *                        you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_read_at_v(
+    tr_sys_file_t handle,
+    struct tr_sys_file_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `write()`.
  *
@@ -446,6 +495,31 @@ bool tr_sys_file_write_at(
     uint64_t* bytes_written,
     struct tr_error** error);
 
+/**
+ * @brief Portability wrapper for `pwritev()`.
+ *
+ * Like other wrappers, this may write less than the buffers' total size, in
+ * which case the caller should call it again for the remaining data.
+ *
+ * @param[in]  handle        Valid file descriptor.
+ * @param[in]  iov           Buffers to get data being written from.
+ * @param[in]  iov_count     Number of buffers in `iov`.
+ * @param[in]  offset        File offset in bytes to start writing from.
+ * @param[out] bytes_written Number of bytes actually written. Optional, pass
+ *                           `nullptr` if you are not interested.
+ * @param[out] error         Pointer to error object. Optional, pass `nullptr`
+ *                          if you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    struct tr_sys_file_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fsync()`.
  *
@@ -37,36 +37,13 @@ enum
     TR_IO_WRITE
 };
 
-/* returns 0 on success, or an errno on failure */
-static int readOrWriteBytes(
-    tr_session* session,
-    tr_torrent* tor,
-    int ioMode,
-    tr_file_index_t fileIndex,
-    uint64_t fileOffset,
-    void* buf,
-    size_t buflen)
+/* returns an fd on success, or TR_BAD_SYS_FILE and an errno in `err` on failure */
+static tr_sys_file_t checkoutFile(tr_session* session, tr_torrent* tor, tr_file_index_t fileIndex, bool doWrite, int* err)
 {
-    tr_sys_file_t fd;
-    int err = 0;
-    bool const doWrite = ioMode >= TR_IO_WRITE;
-    tr_info const* const info = &tor->info;
-    tr_file const* const file = &info->files[fileIndex];
-
-    TR_ASSERT(fileIndex < info->fileCount);
-    TR_ASSERT(file->length == 0 || fileOffset < file->length);
-    TR_ASSERT(fileOffset + buflen <= file->length);
-
-    if (file->length == 0)
-    {
-        return 0;
-    }
+    tr_file const* const file = &tor->info.files[fileIndex];
+    tr_sys_file_t fd = tr_fdFileGetCached(session, tr_torrentId(tor), fileIndex, doWrite);
 
-    /***
-    ****  Find the fd
-    ***/
-
-    fd = tr_fdFileGetCached(session, tr_torrentId(tor), fileIndex, doWrite);
+    *err = 0;
 
     if (fd == TR_BAD_SYS_FILE)
     {
@@ -80,7 +57,7 @@ static int readOrWriteBytes(
             /* we can't read a file that doesn't exist... */
             if (!doWrite)
             {
-                err = ENOENT;
+                *err = ENOENT;
             }
 
             /* figure out where the file should go, so we can create it */
@@ -89,7 +66,7 @@ static int readOrWriteBytes(
                                                                               tr_strdup(file->name);
         }
 
-        if (err == 0)
+        if (*err == 0)
         {
             /* open (and maybe create) the file */
             char* filename = tr_buildPath(base, subpath, nullptr);
@@ -99,8 +76,8 @@ static int readOrWriteBytes(
             if ((fd = tr_fdFileCheckout(session, tor->uniqueId, fileIndex, filename, doWrite, prealloc, file->length)) ==
                 TR_BAD_SYS_FILE)
             {
-                err = errno;
-                tr_logAddTorErr(tor, "tr_fdFileCheckout failed for \"%s\": %s", filename, tr_strerror(err));
+                *err = errno;
+                tr_logAddTorErr(tor, "tr_fdFileCheckout failed for \"%s\": %s", filename, tr_strerror(*err));
             }
             else if (doWrite)
             {
@@ -114,6 +91,39 @@ static int readOrWriteBytes(
         tr_free(subpath);
     }
 
+    return fd;
+}
+
+/* returns 0 on success, or an errno on failure */
+static int readOrWriteBytes(
+    tr_session* session,
+    tr_torrent* tor,
+    int ioMode,
+    tr_file_index_t fileIndex,
+    uint64_t fileOffset,
+    void* buf,
+    size_t buflen)
+{
+    int err = 0;
+    bool const doWrite = ioMode >= TR_IO_WRITE;
+    tr_info const* const info = &tor->info;
+    tr_file const* const file = &info->files[fileIndex];
+
+    TR_ASSERT(fileIndex < info->fileCount);
+    TR_ASSERT(file->length == 0 || fileOffset < file->length);
+    TR_ASSERT(fileOffset + buflen <= file->length);
+
+    if (file->length == 0)
+    {
+        return 0;
+    }
+
+    /***
+    ****  Find the fd
+    ***/
+
+    tr_sys_file_t const fd = checkoutFile(session, tor, fileIndex, doWrite, &err);
+
     /***
     ****  Use the fd
     ***/
@@ -252,6 +262,97 @@ int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uin
     return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len);
 }
 
+static int prepareSpans(
+    tr_torrent* tor,
+    bool doWrite,
+    tr_piece_index_t pieceIndex,
+    uint32_t begin,
+    uint32_t len,
+    std::vector<tr_io_span>& setme)
+{
+    int err = 0;
+    tr_file_index_t fileIndex;
+    uint64_t fileOffset;
+    tr_info const* info = &tor->info;
+
+    if (pieceIndex >= tor->info.pieceCount)
+    {
+        return EINVAL;
+    }
+
+    tr_ioFindFileLocation(tor, pieceIndex, begin, &fileIndex, &fileOffset);
+
+    while (len != 0 && err == 0)
+    {
+        tr_file const* file = &info->files[fileIndex];
+        uint64_t const bytesThisPass = std::min(uint64_t{ len }, uint64_t{ file->length - fileOffset });
+
+        if (bytesThisPass != 0)
+        {
+            tr_sys_file_t fd = checkoutFile(tor->session, tor, fileIndex, doWrite, &err);
+
+            if (err == 0)
+            {
+                tr_error* error = nullptr;
+
+                /* the fd cache may close its copy at any time, so hand out our own */
+                if ((fd = tr_sys_file_dup(fd, &error)) == TR_BAD_SYS_FILE)
+                {
+                    err = error->code;
+                    tr_error_free(error);
+                }
+                else
+                {
+                    setme.push_back({ fd, fileIndex, fileOffset, bytesThisPass });
+                }
+            }
+        }
+
+        len -= bytesThisPass;
+        fileIndex++;
+        fileOffset = 0;
+
+        if (err != 0 && doWrite && tor->error != TR_STAT_LOCAL_ERROR)
+        {
+            char* path = tr_buildPath(tor->downloadDir, file->name, nullptr);
+            tr_torrentSetLocalError(tor, "%s (%s)", tr_strerror(err), path);
+            tr_free(path);
+        }
+    }
+
+    if (err != 0)
+    {
+        for (auto const& span : setme)
+        {
+            tr_sys_file_close(span.fd, nullptr);
+        }
+
+        setme.clear();
+    }
+
+    return err;
+}
+
+int tr_ioPrepareRead(
+    tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t begin,
+    uint32_t len,
+    std::vector<tr_io_span>& setme)
+{
+    return prepareSpans(tor, false, pieceIndex, begin, len, setme);
+}
+
+int tr_ioPrepareWrite(
+    tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t begin,
+    uint32_t len,
+    std::vector<tr_io_span>& setme)
+{
+    return prepareSpans(tor, true, pieceIndex, begin, len, setme);
+}
+
 /****
 *****
 ****/
@@ -12,6 +12,10 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <vector>
+
+#include "file.h" /* tr_sys_file_t */
+
 struct tr_torrent;
 
 /**
@@ -33,6 +37,47 @@ int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin,
  */
 int tr_ioWrite(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, uint32_t len, uint8_t const* writeme);
 
+/**
+ * One file's share of a read or write that spans several files.
+ * @see tr_ioPrepareRead()
+ * @see tr_ioPrepareWrite()
+ */
+struct tr_io_span
+{
+    tr_sys_file_t fd;
+    tr_file_index_t file_index;
+    uint64_t file_offset;
+    uint64_t length;
+};
+
+/**
+ * Opens (and if necessary, creates) the files that the block range specified
+ * by the piece index, offset, and length falls into, so that the write itself
+ * can be done outside of the libevent thread.
+ *
+ * Each span gets its own duplicate of the file descriptor which the caller
+ * must close with tr_sys_file_close() when it's done writing.
+ *
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioPrepareWrite(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    uint32_t len,
+    std::vector<tr_io_span>& setme);
+
+/**
+ * Like tr_ioPrepareWrite(), but opens the files read-only and fails with
+ * ENOENT instead of creating them if they don't exist.
+ */
+int tr_ioPrepareRead(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    uint32_t len,
+    std::vector<tr_io_span>& setme);
+
 /**
  * @brief Test to see if the piece matches its metainfo's SHA1 checksum.
  */
@@ -9,6 +9,12 @@
 #include <limits.h>
 #include <ctype.h>
 
+#if defined(__SSE2__) && defined(__GNUC__) && \
+    !defined(JSONSL_USE_WCHAR) && !defined(JSONSL_USE_METRICS)
+#define JSONSL_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef JSONSL_USE_METRICS
 #define XMETRICS \
     X(STRINGY_INSIGNIFICANT) \
@@ -147,6 +153,37 @@ void jsonsl_destroy(jsonsl_t jsn)
 #define FASTPARSE_EXHAUSTED 1
 #define FASTPARSE_BREAK 0
 
+#ifdef JSONSL_USE_SSE2
+/*
+ * Checks 16 bytes at a time for anything that is_simple_char() rejects,
+ * i.e. a quote, a backslash, or a control character below 0x14.
+ *
+ * @return how many leading bytes are simple. This stops at the first
+ * 16-byte block that isn't, and leaves the tail for the caller to check.
+ */
+static size_t
+jsonsl__str_skip_simple(const jsonsl_uchar_t *bytes, size_t nbytes)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl_max = _mm_set1_epi8(0x13);
+    size_t ii;
+
+    for (ii = 0; ii + 16 <= nbytes; ii += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(bytes + ii));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                         _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(chunk, ctrl_max), chunk));
+        int mask = _mm_movemask_epi8(special);
+        if (mask != 0) {
+            return ii + __builtin_ctz(mask);
+        }
+    }
+    return ii;
+}
+#endif /* JSONSL_USE_SSE2 */
+
 /*
  * This function is meant to accelerate string parsing, reducing the main loop's
  * check if we are indeed a string.
@@ -163,8 +200,11 @@ jsonsl__str_fastparse(jsonsl_t jsn,
                       const jsonsl_uchar_t **bytes_p, size_t *nbytes_p)
 {
     const jsonsl_uchar_t *bytes = *bytes_p;
-    const jsonsl_uchar_t *end;
-    for (end = bytes + *nbytes_p; bytes != end; bytes++) {
+    const jsonsl_uchar_t *end = bytes + *nbytes_p;
+#ifdef JSONSL_USE_SSE2
+    bytes += jsonsl__str_skip_simple(bytes, *nbytes_p);
+#endif /* JSONSL_USE_SSE2 */
+    for (; bytes != end; bytes++) {
         if (
 #ifdef JSONSL_USE_WCHAR
                 *bytes >= 0x100 ||
@@ -202,6 +202,38 @@ void tr_netSetCongestionControl([[maybe_unused]] tr_socket_t s, [[maybe_unused]]
 #endif
 }
 
+bool tr_netSetNotSentLowat([[maybe_unused]] tr_socket_t s, [[maybe_unused]] unsigned int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+
+    return setsockopt(s, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void const*)&bytes, sizeof(bytes)) != -1;
+
+#else
+
+    return false;
+
+#endif
+}
+
+bool tr_netSetZeroCopy([[maybe_unused]] tr_socket_t s)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+
+    int const one = 1;
+
+    if (setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, (void const*)&one, sizeof(one)) != -1)
+    {
+        return true;
+    }
+
+    char err_buf[512];
+    tr_logAddNamedInfo("Net", "Can't enable zero-copy sends: %s", tr_net_strerror(err_buf, sizeof(err_buf), sockerrno));
+
+#endif
+
+    return false;
+}
+
 bool tr_address_from_sockaddr_storage(tr_address* setme_addr, tr_port* setme_port, struct sockaddr_storage const* from)
 {
     if (from->ss_family == AF_INET)
@@ -138,6 +138,13 @@ void tr_netSetTOS(tr_socket_t s, int tos, tr_address_type type);
 
 void tr_netSetCongestionControl(tr_socket_t s, char const* algorithm);
 
+/* limit how much unsent data the kernel will queue for the socket.
+ * returns false if the platform doesn't support it */
+bool tr_netSetNotSentLowat(tr_socket_t s, unsigned int bytes);
+
+/* allow MSG_ZEROCOPY sends on the socket. returns false if it's unsupported */
+bool tr_netSetZeroCopy(tr_socket_t s);
+
 void tr_netClose(tr_session* session, tr_socket_t s);
 
 void tr_netCloseSocket(tr_socket_t fd);
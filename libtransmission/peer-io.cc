@@ -8,9 +8,19 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <cstdint>
 #include <cstring>
 
+#ifndef _WIN32
+#include <sys/socket.h> /* sendmsg() */
+#include <sys/uio.h> /* struct iovec */
+#endif
+
+#ifdef __linux__
+#include <linux/errqueue.h> /* struct sock_extended_err */
+#endif
+
 #include <event2/event.h>
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -40,6 +50,10 @@
 #define EPIPE WSAECONNRESET
 #endif
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define TR_HAVE_MSG_ZEROCOPY
+#endif
+
 /* The amount of read bufferring that we allow for uTP sockets. */
 
 #define UTP_READ_BUFFER_SIZE (256 * 1024)
@@ -88,65 +102,67 @@ static size_t guessPacketOverhead(size_t d)
 
 struct tr_datatype
 {
-    struct tr_datatype* next;
     size_t length;
     bool isPieceData;
 };
 
-static struct tr_datatype* datatype_pool = nullptr;
-
-static struct tr_datatype* datatype_new(void)
+static struct tr_datatype* peer_io_datatype_at(tr_peerIo const* io, size_t i)
 {
-    struct tr_datatype* ret;
+    TR_ASSERT(i < io->outbuf_datatypes_count);
 
-    if (datatype_pool == nullptr)
-    {
-        ret = tr_new(struct tr_datatype, 1);
-    }
-    else
-    {
-        ret = datatype_pool;
-        datatype_pool = datatype_pool->next;
-    }
-
-    *ret = {};
-    return ret;
+    return &io->outbuf_datatypes[(io->outbuf_datatypes_head + i) & (io->outbuf_datatypes_capacity - 1)];
 }
 
-static void datatype_free(struct tr_datatype* datatype)
+static struct tr_datatype* peer_io_front_datatype(tr_peerIo const* io)
 {
-    datatype->next = datatype_pool;
-    datatype_pool = datatype;
+    return io->outbuf_datatypes_count == 0 ? nullptr : peer_io_datatype_at(io, 0);
 }
 
 static void peer_io_pull_datatype(tr_peerIo* io)
 {
-    struct tr_datatype* tmp;
+    TR_ASSERT(io->outbuf_datatypes_count > 0);
 
-    if ((tmp = io->outbuf_datatypes) != nullptr)
-    {
-        io->outbuf_datatypes = tmp->next;
-        datatype_free(tmp);
-    }
+    io->outbuf_datatypes_head = (io->outbuf_datatypes_head + 1) & (io->outbuf_datatypes_capacity - 1);
+    --io->outbuf_datatypes_count;
 }
 
-static void peer_io_push_datatype(tr_peerIo* io, struct tr_datatype* datatype)
+static void peer_io_push_datatype(tr_peerIo* io, size_t length, bool isPieceData)
 {
-    struct tr_datatype* tmp;
+    if (length == 0)
+    {
+        return;
+    }
 
-    if ((tmp = io->outbuf_datatypes) != nullptr)
+    /* runs of the same type share a record, so a stream of blocks
+     * needs at most two records per block no matter how it's written */
+    if (io->outbuf_datatypes_count != 0)
     {
-        while (tmp->next != nullptr)
+        struct tr_datatype* const back = peer_io_datatype_at(io, io->outbuf_datatypes_count - 1);
+
+        if (back->isPieceData == isPieceData)
         {
-            tmp = tmp->next;
+            back->length += length;
+            return;
         }
-
-        tmp->next = datatype;
     }
-    else
+
+    if (io->outbuf_datatypes_count == io->outbuf_datatypes_capacity)
     {
-        io->outbuf_datatypes = datatype;
+        size_t const old_capacity = io->outbuf_datatypes_capacity;
+        size_t const new_capacity = old_capacity == 0 ? 8 : old_capacity * 2;
+
+        io->outbuf_datatypes = tr_renew(struct tr_datatype, io->outbuf_datatypes, new_capacity);
+        io->outbuf_datatypes_capacity = new_capacity;
+
+        /* the ring was full, so if it wrapped, move the wrapped part up past the old end */
+        if (io->outbuf_datatypes_head != 0)
+        {
+            std::copy_n(io->outbuf_datatypes, io->outbuf_datatypes_head, io->outbuf_datatypes + old_capacity);
+        }
     }
+
+    ++io->outbuf_datatypes_count;
+    *peer_io_datatype_at(io, io->outbuf_datatypes_count - 1) = { length, isPieceData };
 }
 
 /***
@@ -155,16 +171,17 @@ static void peer_io_push_datatype(tr_peerIo* io, struct tr_datatype* datatype)
 
 static void didWriteWrapper(tr_peerIo* io, unsigned int bytes_transferred)
 {
-    while (bytes_transferred != 0 && tr_isPeerIo(io) && io->outbuf_datatypes != nullptr)
-    {
-        struct tr_datatype* next = io->outbuf_datatypes;
+    struct tr_datatype const* next;
 
+    while (bytes_transferred != 0 && tr_isPeerIo(io) && (next = peer_io_front_datatype(io)) != nullptr)
+    {
         unsigned int const payload = std::min(uint64_t{ next->length }, uint64_t{ bytes_transferred });
+        bool const isPieceData = next->isPieceData;
         /* For uTP sockets, the overhead is computed in utp_on_overhead. */
         unsigned int const overhead = io->socket.type == TR_PEER_SOCKET_TYPE_TCP ? guessPacketOverhead(payload) : 0;
         uint64_t const now = tr_time_msec();
 
-        io->bandwidth->notifyBandwidthConsumed(TR_UP, payload, next->isPieceData, now);
+        io->bandwidth->notifyBandwidthConsumed(TR_UP, payload, isPieceData, now);
 
         if (overhead > 0)
         {
@@ -173,15 +190,17 @@ static void didWriteWrapper(tr_peerIo* io, unsigned int bytes_transferred)
 
         if (io->didWrite != nullptr)
         {
-            io->didWrite(io, payload, next->isPieceData, io->userData);
+            io->didWrite(io, payload, isPieceData, io->userData);
         }
 
+        /* didWrite may have queued more data and grown the ring, so look up the front again */
         if (tr_isPeerIo(io))
         {
+            struct tr_datatype* const front = peer_io_front_datatype(io);
             bytes_transferred -= payload;
-            next->length -= payload;
+            front->length -= payload;
 
-            if (next->length == 0)
+            if (front->length == 0)
             {
                 peer_io_pull_datatype(io);
             }
@@ -263,6 +282,305 @@ static void canReadWrapper(tr_peerIo* io)
     tr_peerIoUnref(io);
 }
 
+/***
+****  MSG_ZEROCOPY
+***/
+
+/* Data sent with MSG_ZEROCOPY has to stay put until the kernel is done
+ * with it, so instead of draining sent chains from `outbuf` we move them
+ * into `buf`, and release them in send order as the socket's error queue
+ * reports the sends complete.
+ *
+ * The error queue is read whenever libevent wakes the peer-io up, and by
+ * `timer` while sends are outstanding, since an idle socket may not wake up
+ * for a long time. If the peer-io closes the socket with sends outstanding,
+ * this takes the socket over and lingers in the session's list until the
+ * last of them completes, so that `buf` isn't freed from under the kernel. */
+struct tr_peer_zerocopy
+{
+    static auto constexpr MaxSends = uint32_t{ 32 };
+
+    /* pinning pages costs more than copying small sends */
+    static auto constexpr MinBytes = size_t{ 16384 };
+
+    /* how often to read the error queue while sends are outstanding */
+    static auto constexpr ReapMsec = 100;
+
+    /* how long a closed socket may wait for its sends before it's reset */
+    static auto constexpr LingerMsec = 30000;
+
+    tr_session* session;
+    tr_socket_t fd;
+    struct event* timer;
+    struct evbuffer* buf;
+    uint32_t lengths[MaxSends]; /* bytes of `buf` held by each send, indexed by id % MaxSends */
+    uint32_t done_mask; /* bit (id % MaxSends) is set once send `id` has completed */
+    uint32_t oldest_id; /* oldest send that's still holding data */
+    uint32_t next_id; /* the id the kernel will give our next zero-copy send */
+    uint64_t linger_deadline; /* nonzero once the peer-io has let go of the socket */
+    bool kernel_copied; /* the kernel fell back to copying, so it isn't worth it */
+};
+
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+static void zerocopy_timer_cb(evutil_socket_t, short, void*);
+
+#endif
+
+static void maybeEnableZeroCopy([[maybe_unused]] tr_peerIo* io)
+{
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+    if (io->session->peerSocketZeroCopy && io->socket.type == TR_PEER_SOCKET_TYPE_TCP &&
+        tr_netSetZeroCopy(io->socket.handle.tcp))
+    {
+        auto* const zc = tr_new0(struct tr_peer_zerocopy, 1);
+        zc->session = io->session;
+        zc->fd = io->socket.handle.tcp;
+        zc->timer = evtimer_new(io->session->event_base, zerocopy_timer_cb, zc);
+        zc->buf = evbuffer_new();
+        io->zerocopy = zc;
+    }
+
+#endif
+}
+
+static void zerocopy_free(struct tr_peer_zerocopy* zc)
+{
+    event_free(zc->timer);
+    evbuffer_free(zc->buf);
+    tr_free(zc);
+}
+
+static bool zerocopy_is_idle(struct tr_peer_zerocopy const* zc)
+{
+    return zc->oldest_id == zc->next_id;
+}
+
+static void zerocopy_reap(struct tr_peer_zerocopy* zc)
+{
+    if (zc == nullptr || zerocopy_is_idle(zc))
+    {
+        return;
+    }
+
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+    for (;;)
+    {
+        char control[128];
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE) == -1)
+        {
+            break;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) &&
+                (cmsg->cmsg_level != SOL_IPV6 || cmsg->cmsg_type != IPV6_RECVERR))
+            {
+                continue;
+            }
+
+            auto err = sock_extended_err{};
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0)
+            {
+                zc->kernel_copied = true;
+            }
+
+            /* the notification covers sends [ee_info..ee_data] */
+            for (uint32_t id = zc->oldest_id; id != zc->next_id; ++id)
+            {
+                if (id - err.ee_info <= err.ee_data - err.ee_info)
+                {
+                    zc->done_mask |= 1U << (id % tr_peer_zerocopy::MaxSends);
+                }
+            }
+        }
+    }
+
+#endif
+
+    while (!zerocopy_is_idle(zc))
+    {
+        uint32_t const bit = 1U << (zc->oldest_id % tr_peer_zerocopy::MaxSends);
+
+        if ((zc->done_mask & bit) == 0)
+        {
+            break;
+        }
+
+        zc->done_mask &= ~bit;
+        evbuffer_drain(zc->buf, zc->lengths[zc->oldest_id % tr_peer_zerocopy::MaxSends]);
+        ++zc->oldest_id;
+    }
+}
+
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+static bool zerocopy_can_send(tr_peerIo const* io)
+{
+    auto const* const zc = io->zerocopy;
+
+    return zc != nullptr && !zc->kernel_copied && zc->next_id - zc->oldest_id < tr_peer_zerocopy::MaxSends;
+}
+
+/* Move the `n_sent` bytes of a zero-copy send out of `outbuf`.
+ * `iovecs` has to cover whole chains, since those are what get moved. */
+static void zerocopy_hold(tr_peerIo* io, struct iovec const* iovecs, int n_iovecs, size_t n_sent)
+{
+    auto* const zc = io->zerocopy;
+    size_t held = 0;
+    int i = 0;
+
+    while (i < n_iovecs && held + iovecs[i].iov_len <= n_sent)
+    {
+        held += iovecs[i].iov_len;
+        ++i;
+    }
+
+    evbuffer_remove_buffer(io->outbuf, zc->buf, held);
+
+    if (held < n_sent)
+    {
+        /* a short write stopped partway through a chain. Hold all of that
+         * chain, and put a copy of its unsent tail back at the front */
+        auto const* const tail = static_cast<char const*>(iovecs[i].iov_base) + (n_sent - held);
+        size_t const tail_len = iovecs[i].iov_len - (n_sent - held);
+
+        evbuffer_remove_buffer(io->outbuf, zc->buf, iovecs[i].iov_len);
+        evbuffer_prepend(io->outbuf, tail, tail_len);
+        held += iovecs[i].iov_len;
+    }
+
+    zc->lengths[zc->next_id % tr_peer_zerocopy::MaxSends] = held;
+    ++zc->next_id;
+
+    if (evtimer_pending(zc->timer, nullptr) == 0)
+    {
+        tr_timerAddMsec(zc->timer, tr_peer_zerocopy::ReapMsec);
+    }
+}
+
+/* Close a socket that the peer-io has let go of. If its sends still
+ * haven't completed, reset the connection: that makes the kernel drop
+ * the data it's still holding, so it's safe to free `buf` afterwards. */
+static void zerocopy_close_lingering(struct tr_peer_zerocopy* zc)
+{
+    if (!zerocopy_is_idle(zc))
+    {
+        struct linger const abort_on_close = { 1, 0 };
+        setsockopt(zc->fd, SOL_SOCKET, SO_LINGER, &abort_on_close, sizeof(abort_on_close));
+    }
+
+    tr_netClose(zc->session, zc->fd);
+    zc->session->zeroCopyLingering.erase(zc);
+    zerocopy_free(zc);
+}
+
+static void zerocopy_timer_cb([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vzc)
+{
+    auto* const zc = static_cast<struct tr_peer_zerocopy*>(vzc);
+    bool const is_lingering = zc->linger_deadline != 0;
+
+    zerocopy_reap(zc);
+
+    if (is_lingering && (zerocopy_is_idle(zc) || tr_time_msec() >= zc->linger_deadline))
+    {
+        zerocopy_close_lingering(zc);
+    }
+    else if (!zerocopy_is_idle(zc))
+    {
+        tr_timerAddMsec(zc->timer, tr_peer_zerocopy::ReapMsec);
+    }
+}
+
+#endif
+
+/* Called when the peer-io is about to close its TCP socket. Returns true
+ * if the socket had sends outstanding, in which case it's been handed to
+ * the session to close once the kernel is done with them. */
+static bool zerocopy_release(tr_peerIo* io)
+{
+    auto* const zc = io->zerocopy;
+
+    if (zc == nullptr)
+    {
+        return false;
+    }
+
+    io->zerocopy = nullptr;
+    zerocopy_reap(zc);
+
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+    if (!zerocopy_is_idle(zc))
+    {
+        /* let the peer know we're done as soon as the data's gone out */
+        shutdown(zc->fd, SHUT_WR);
+        zc->linger_deadline = tr_time_msec() + tr_peer_zerocopy::LingerMsec;
+        zc->session->zeroCopyLingering.insert(zc);
+        return true;
+    }
+
+#endif
+
+    zerocopy_free(zc);
+    return false;
+}
+
+void tr_peerIoCloseLingering([[maybe_unused]] tr_session* session)
+{
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+    while (!std::empty(session->zeroCopyLingering))
+    {
+        zerocopy_close_lingering(*std::begin(session->zeroCopyLingering));
+    }
+
+#endif
+}
+
+/***
+****
+***/
+
+static unsigned int getDesiredOutputBufferSize(tr_peerIo const* io, uint64_t now);
+
+/* Don't let the kernel queue much more unsent data than we would ourselves.
+ * The target moves with our upload speed, so only update it when it's moved
+ * by more than a quarter. */
+static void maybeSetNotSentLowat(tr_peerIo* io, uint64_t now)
+{
+    auto constexpr Unsupported = UINT_MAX;
+    unsigned int const current = io->notsent_lowat;
+
+    if (current == Unsupported)
+    {
+        return;
+    }
+
+    unsigned int const desired = getDesiredOutputBufferSize(io, now);
+
+    if (current != 0 && desired >= current - current / 4 && desired <= current + current / 4)
+    {
+        return;
+    }
+
+    io->notsent_lowat = tr_netSetNotSentLowat(io->socket.handle.tcp, desired) ? desired : Unsupported;
+}
+
 static void event_read_cb(evutil_socket_t fd, [[maybe_unused]] short event, void* vio)
 {
     auto* io = static_cast<tr_peerIo*>(vio);
@@ -281,6 +599,8 @@ static void event_read_cb(evutil_socket_t fd, [[maybe_unused]] short event, void
 
     io->pendingEvents &= ~EV_READ;
 
+    zerocopy_reap(io->zerocopy);
+
     curlen = evbuffer_get_length(io->inbuf);
     howmuch = curlen >= max ? 0 : max - curlen;
     howmuch = io->bandwidth->clamp(TR_DOWN, howmuch);
@@ -340,12 +660,16 @@ static void event_read_cb(evutil_socket_t fd, [[maybe_unused]] short event, void
     }
 }
 
+#ifdef _WIN32
+
 static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
 {
     int e;
     int n;
     char errstr[256];
 
+    maybeSetNotSentLowat(io, tr_time_msec());
+
     EVUTIL_SET_SOCKET_ERROR(0);
     n = evbuffer_write_atmost(io->outbuf, fd, howmuch);
     e = EVUTIL_SOCKET_ERROR();
@@ -354,6 +678,122 @@ static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
     return n;
 }
 
+#else
+
+/* Send as much of the first `howmuch` bytes of `outbuf` as the socket will
+ * take, gathering its chains into a single sendmsg() */
+static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
+{
+    auto constexpr MaxIovecs = int{ 64 };
+    struct evbuffer_iovec segments[MaxIovecs];
+    struct iovec iovecs[MaxIovecs];
+    char errstr[256];
+
+    maybeSetNotSentLowat(io, tr_time_msec());
+
+    int n_iovecs = std::min(evbuffer_peek(io->outbuf, howmuch, nullptr, segments, MaxIovecs), MaxIovecs);
+    size_t len = 0;
+    bool partial = false; /* true if the last iovec stops partway through its chain */
+
+    for (int i = 0; i < n_iovecs; ++i)
+    {
+        iovecs[i].iov_base = segments[i].iov_base;
+        iovecs[i].iov_len = std::min(segments[i].iov_len, howmuch - len);
+        len += iovecs[i].iov_len;
+
+        if (iovecs[i].iov_len < segments[i].iov_len)
+        {
+            partial = true;
+            n_iovecs = i + 1;
+            break;
+        }
+    }
+
+    int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+
+    bool zerocopy = false;
+
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+    if (zerocopy_can_send(io))
+    {
+        /* only whole chains can be held for the kernel, so leave a partial one for next time */
+        size_t const whole_len = partial ? len - iovecs[n_iovecs - 1].iov_len : len;
+
+        if (whole_len >= tr_peer_zerocopy::MinBytes)
+        {
+            zerocopy = true;
+            n_iovecs -= partial ? 1 : 0;
+            len = whole_len;
+        }
+    }
+
+#endif
+
+    struct msghdr msg = {};
+    msg.msg_iov = iovecs;
+    msg.msg_iovlen = n_iovecs;
+
+    EVUTIL_SET_SOCKET_ERROR(0);
+    auto n = ssize_t{};
+
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+    if (zerocopy)
+    {
+        n = sendmsg(fd, &msg, flags | MSG_ZEROCOPY);
+
+        /* ENOBUFS means we're out of memory for pinning pages; copy instead */
+        if (n == -1 && EVUTIL_SOCKET_ERROR() == ENOBUFS)
+        {
+            zerocopy = false;
+            EVUTIL_SET_SOCKET_ERROR(0);
+        }
+    }
+
+#endif
+
+    if (!zerocopy)
+    {
+        n = sendmsg(fd, &msg, flags);
+    }
+
+    int const e = EVUTIL_SOCKET_ERROR();
+
+    if (n > 0)
+    {
+#ifdef TR_HAVE_MSG_ZEROCOPY
+
+        if (zerocopy)
+        {
+            zerocopy_hold(io, iovecs, n_iovecs, n);
+        }
+        else
+
+#endif
+        {
+            evbuffer_drain(io->outbuf, n);
+        }
+    }
+
+    dbgmsg(
+        io,
+        "wrote %zd of %zu to peer%s (%s)",
+        n,
+        len,
+        zerocopy ? " with MSG_ZEROCOPY" : "",
+        (n == -1 ? tr_net_strerror(errstr, sizeof(errstr), e) : ""));
+    EVUTIL_SET_SOCKET_ERROR(e);
+
+    return (int)n;
+}
+
+#endif
+
 static void event_write_cb(evutil_socket_t fd, [[maybe_unused]] short event, void* vio)
 {
     auto* io = static_cast<tr_peerIo*>(vio);
@@ -370,6 +810,8 @@ static void event_write_cb(evutil_socket_t fd, [[maybe_unused]] short event, voi
 
     io->pendingEvents &= ~EV_WRITE;
 
+    zerocopy_reap(io->zerocopy);
+
     dbgmsg(io, "libevent says this peer is ready to write");
 
     /* Write as much as possible, since the socket is non-blocking, write() will
@@ -668,6 +1110,7 @@ static tr_peerIo* tr_peerIoNew(
     io->bandwidth = new Bandwidth(parent);
     io->bandwidth->setPeer(io);
     dbgmsg(io, "bandwidth is %p; its parent is %p", (void*)&io->bandwidth, (void*)parent);
+    maybeEnableZeroCopy(io);
 
     switch (socket.type)
     {
@@ -865,7 +1308,11 @@ static void io_close_socket(tr_peerIo* io)
         break;
 
     case TR_PEER_SOCKET_TYPE_TCP:
-        tr_netClose(io->session, io->socket.handle.tcp);
+        if (!zerocopy_release(io))
+        {
+            tr_netClose(io->session, io->socket.handle.tcp);
+        }
+
         break;
 
 #ifdef WITH_UTP
@@ -882,6 +1329,7 @@ static void io_close_socket(tr_peerIo* io)
     }
 
     io->socket = {};
+    io->notsent_lowat = 0;
 
     if (io->event_read != nullptr)
     {
@@ -912,10 +1360,7 @@ static void io_dtor(void* vio)
     io_close_socket(io);
     tr_cryptoDestruct(&io->crypto);
 
-    while (io->outbuf_datatypes != nullptr)
-    {
-        peer_io_pull_datatype(io);
-    }
+    tr_free(io->outbuf_datatypes);
 
     memset(io, ~0, sizeof(tr_peerIo));
     tr_free(io);
@@ -1020,6 +1465,7 @@ int tr_peerIoReconnect(tr_peerIo* io)
     event_enable(io, pendingEvents);
     tr_netSetTOS(io->socket.handle.tcp, session->peerSocketTOS, io->addr.type);
     maybeSetCongestionAlgorithm(io->socket.handle.tcp, session->peer_congestion_algorithm);
+    maybeEnableZeroCopy(io);
 
     return 0;
 }
@@ -1116,57 +1562,85 @@ void tr_peerIoSetEncryption(tr_peerIo* io, tr_encryption_type encryption_type)
 ***
 **/
 
-static inline void processBuffer(
+/* Runs `size` bytes of `buffer`, starting at `offset`, through `callback`.
+ * The bytes are processed in place, or written to the contiguous `out`
+ * if it's not nullptr. Segments are peeked a batch at a time so that large
+ * blocks don't cost one evbuffer_peek() per chain. */
+static void processBuffer(
     tr_crypto* crypto,
     struct evbuffer* buffer,
     size_t offset,
     size_t size,
+    uint8_t* out,
     void (*callback)(tr_crypto*, size_t, void const*, void*))
 {
+    auto constexpr MaxIovecs = int{ 16 };
     struct evbuffer_ptr pos;
-    struct evbuffer_iovec iovec;
+    struct evbuffer_iovec iovecs[MaxIovecs];
 
     evbuffer_ptr_set(buffer, &pos, offset, EVBUFFER_PTR_SET);
 
-    do
+    while (size > 0)
     {
-        if (evbuffer_peek(buffer, size, &pos, &iovec, 1) <= 0)
+        int const n_iovecs = std::min(evbuffer_peek(buffer, size, &pos, iovecs, MaxIovecs), MaxIovecs);
+
+        if (n_iovecs <= 0)
         {
             break;
         }
 
-        callback(crypto, iovec.iov_len, iovec.iov_base, iovec.iov_base);
+        size_t batch_size = 0;
 
-        TR_ASSERT(size >= iovec.iov_len);
-        size -= iovec.iov_len;
-    } while (evbuffer_ptr_set(buffer, &pos, iovec.iov_len, EVBUFFER_PTR_ADD) == 0);
+        for (int i = 0; i < n_iovecs && batch_size < size; ++i)
+        {
+            size_t const len = std::min(iovecs[i].iov_len, size - batch_size);
 
-    TR_ASSERT(size == 0);
-}
+            if (out != nullptr)
+            {
+                callback(crypto, len, iovecs[i].iov_base, out);
+                out += len;
+            }
+            else
+            {
+                callback(crypto, len, iovecs[i].iov_base, iovecs[i].iov_base);
+            }
 
-static void addDatatype(tr_peerIo* io, size_t byteCount, bool isPieceData)
-{
-    struct tr_datatype* d;
-    d = datatype_new();
-    d->isPieceData = isPieceData;
-    d->length = byteCount;
-    peer_io_push_datatype(io, d);
-}
+            batch_size += len;
+        }
 
-static inline void maybeEncryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_t offset, size_t size)
-{
-    if (io->encryption_type == PEER_ENCRYPTION_RC4)
-    {
-        processBuffer(&io->crypto, buf, offset, size, &tr_cryptoEncrypt);
+        size -= batch_size;
+
+        if (size == 0 || evbuffer_ptr_set(buffer, &pos, batch_size, EVBUFFER_PTR_ADD) != 0)
+        {
+            break;
+        }
     }
+
+    TR_ASSERT(size == 0);
 }
 
 void tr_peerIoWriteBuf(tr_peerIo* io, struct evbuffer* buf, bool isPieceData)
 {
     size_t const byteCount = evbuffer_get_length(buf);
-    maybeEncryptBuffer(io, buf, 0, byteCount);
-    evbuffer_add_buffer(io->outbuf, buf);
-    addDatatype(io, byteCount, isPieceData);
+
+    if (io->encryption_type == PEER_ENCRYPTION_RC4 && byteCount != 0)
+    {
+        /* Encrypt straight into the output buffer instead of in place.
+         * That's a single pass over the data, and it leaves `buf` untouched
+         * so it can hold references to shared memory, e.g. cache blocks. */
+        struct evbuffer_iovec iovec;
+        evbuffer_reserve_space(io->outbuf, byteCount, &iovec, 1);
+        processBuffer(&io->crypto, buf, 0, byteCount, static_cast<uint8_t*>(iovec.iov_base), &tr_cryptoEncrypt);
+        iovec.iov_len = byteCount;
+        evbuffer_commit_space(io->outbuf, &iovec, 1);
+        evbuffer_drain(buf, byteCount);
+    }
+    else
+    {
+        evbuffer_add_buffer(io->outbuf, buf);
+    }
+
+    peer_io_push_datatype(io, byteCount, isPieceData);
 }
 
 void tr_peerIoWriteBytes(tr_peerIo* io, void const* bytes, size_t byteCount, bool isPieceData)
@@ -1187,7 +1661,7 @@ void tr_peerIoWriteBytes(tr_peerIo* io, void const* bytes, size_t byteCount, boo
 
     evbuffer_commit_space(io->outbuf, &iovec, 1);
 
-    addDatatype(io, byteCount, isPieceData);
+    peer_io_push_datatype(io, byteCount, isPieceData);
 }
 
 /***
@@ -1221,14 +1695,6 @@ void evbuffer_add_uint64(struct evbuffer* outbuf, uint64_t addme_hll)
 ****
 ***/
 
-static inline void maybeDecryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_t offset, size_t size)
-{
-    if (io->encryption_type == PEER_ENCRYPTION_RC4)
-    {
-        processBuffer(&io->crypto, buf, offset, size, &tr_cryptoDecrypt);
-    }
-}
-
 void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount)
 {
     TR_ASSERT(tr_isPeerIo(io));
@@ -1236,13 +1702,13 @@ void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuf
 
     size_t const old_length = evbuffer_get_length(outbuf);
 
-    /* append it to outbuf */
-    struct evbuffer* tmp = evbuffer_new();
-    evbuffer_remove_buffer(inbuf, tmp, byteCount);
-    evbuffer_add_buffer(outbuf, tmp);
-    evbuffer_free(tmp);
+    /* move the chains over, then decrypt them where they landed */
+    evbuffer_remove_buffer(inbuf, outbuf, byteCount);
 
-    maybeDecryptBuffer(io, outbuf, old_length, byteCount);
+    if (io->encryption_type == PEER_ENCRYPTION_RC4)
+    {
+        processBuffer(&io->crypto, outbuf, old_length, byteCount, nullptr, &tr_cryptoDecrypt);
+    }
 }
 
 void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size_t byteCount)
@@ -1449,16 +1915,16 @@ int tr_peerIoFlushOutgoingProtocolMsgs(tr_peerIo* io)
 
     /* count up how many bytes are used by non-piece-data messages
        at the front of our outbound queue */
-    for (struct tr_datatype const* it = io->outbuf_datatypes; it != nullptr; it = it->next)
+    for (size_t i = 0; i < io->outbuf_datatypes_count; ++i)
     {
+        struct tr_datatype const* it = peer_io_datatype_at(io, i);
+
         if (it->isPieceData)
         {
             break;
         }
-        else
-        {
-            byteCount += it->length;
-        }
+
+        byteCount += it->length;
     }
 
     return tr_peerIoFlush(io, TR_UP, byteCount);
@@ -29,6 +29,7 @@ struct evbuffer;
 struct Bandwidth;
 struct tr_datatype;
 struct tr_peerIo;
+struct tr_peer_zerocopy;
 
 /**
  * @addtogroup networked_io Networked IO
@@ -98,7 +99,18 @@ struct tr_peerIo
 
     struct evbuffer* inbuf;
     struct evbuffer* outbuf;
+    /* what's queued in outbuf, as run-length records in write order.
+     * a ring buffer whose capacity is zero or a power of two */
     struct tr_datatype* outbuf_datatypes;
+    size_t outbuf_datatypes_capacity;
+    size_t outbuf_datatypes_head;
+    size_t outbuf_datatypes_count;
+
+    /* nullptr unless the socket does MSG_ZEROCOPY sends */
+    struct tr_peer_zerocopy* zerocopy;
+
+    /* the socket's current TCP_NOTSENT_LOWAT, or 0 if it hasn't been set */
+    unsigned int notsent_lowat;
 
     struct event* event_read;
     struct event* event_write;
@@ -132,6 +144,9 @@ void tr_peerIoUnrefImpl(char const* file, int line, tr_peerIo* io);
 
 #define tr_peerIoUnref(io) tr_peerIoUnrefImpl(__FILE__, __LINE__, (io))
 
+/* closes the sockets that are still waiting for zero-copy sends to complete */
+void tr_peerIoCloseLingering(tr_session* session);
+
 #define PEER_IO_MAGIC_NUMBER 206745
 
 constexpr bool tr_isPeerIo(tr_peerIo const* io)
@@ -32,7 +32,9 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "piece-picker.h"
 #include "ptrarray.h"
+#include "request-table.h"
 #include "session.h"
 #include "stats.h" /* tr_statsAddUploaded, tr_statsAddDownloaded */
 #include "torrent.h"
@@ -50,8 +52,12 @@ enum
     /* an optimistically unchoked peer is immune from rechoking
        for this many calls to rechokeUploads(). */
     OPTIMISTIC_UNCHOKE_MULTIPLIER = 4,
-    /* how frequently to reallocate bandwidth */
+    /* how frequently to do the torrents' upkeep */
     BANDWIDTH_PERIOD_MSEC = 500,
+    /* how frequently to hand out the bandwidth that's refilled since the last time
+       while a speed limit is on. This is short so that limited output stays smooth
+       instead of coming in big bursts; otherwise BANDWIDTH_PERIOD_MSEC is plenty */
+    ALLOCATE_PERIOD_MSEC = 20,
     /* how frequently to age out old piece request lists */
     REFILL_UPKEEP_PERIOD_MSEC = (10 * 1000),
     /* how frequently to decide which peers live and die */
@@ -119,6 +125,18 @@ struct peer_atom
     time_t shelf_date;
     tr_peer* peer; /* will be nullptr if not connected */
     tr_address addr;
+
+    /* bumped each time the atom is (re)queued as a connection candidate,
+     * so that older entries for it in the swarm's queues can be ignored */
+    uint32_t candidate_serial;
+};
+
+/* an entry in one of tr_swarm's connection candidate queues */
+struct peer_candidate_entry
+{
+    uint64_t key;
+    uint32_t serial;
+    struct peer_atom* atom;
 };
 
 #ifndef TR_ENABLE_ASSERTS
@@ -141,27 +159,6 @@ static char const* tr_atomAddrStr(struct peer_atom const* atom)
     return atom != nullptr ? tr_address_and_port_to_string(addrstr, sizeof(addrstr), &atom->addr, atom->port) : "[no atom]";
 }
 
-struct block_request
-{
-    tr_block_index_t block;
-    tr_peer* peer;
-    time_t sentAt;
-};
-
-struct weighted_piece
-{
-    tr_piece_index_t index;
-    int16_t salt;
-    int16_t requestCount;
-};
-
-enum piece_sort_state
-{
-    PIECES_UNSORTED,
-    PIECES_SORTED_BY_INDEX,
-    PIECES_SORTED_BY_WEIGHT
-};
-
 /** @brief Opaque, per-torrent data structure for peer connection information */
 class tr_swarm
 {
@@ -180,6 +177,14 @@ public:
     tr_ptrArray peers = {}; /* tr_peerMsgs */
     tr_ptrArray webseeds = {}; /* tr_webseed */
 
+    /* min-heaps of the atoms we might want to connect to.
+       `candidates' holds those we could connect to now, keyed by score;
+       `reconnectQueue' holds those waiting out their reconnect interval,
+       keyed by when that interval ends */
+    std::vector<peer_candidate_entry> candidates;
+    std::vector<peer_candidate_entry> reconnectQueue;
+    bool candidatesAreForSeed = false; /* tr_torrentIsSeed() when the queues were built */
+
     tr_peerMgr* const manager;
     tr_torrent* const tor;
 
@@ -191,13 +196,13 @@ public:
     bool isRunning = false;
     bool needsCompletenessCheck = true;
 
-    struct block_request* requests = nullptr;
-    int requestCount = 0;
-    int requestAlloc = 0;
+    tr_request_table<tr_peer> requests;
+
+    /* the pieces we want, in the order we want them */
+    tr_piece_picker pieces;
 
-    struct weighted_piece* pieces = nullptr;
-    int pieceCount = 0;
-    enum piece_sort_state pieceSortState = PIECES_UNSORTED;
+    /* how many of each piece's blocks we've got requested */
+    std::vector<uint16_t> pieceRequests;
 
     /* An array of pieceCount items stating how many peers have each piece.
        This is used to help us for downloading pieces "rarest first."
@@ -206,6 +211,10 @@ public:
     uint16_t* pieceReplication = nullptr;
     size_t pieceReplicationSize = 0;
 
+    /* true if whole bitfields have been added to or removed from pieceReplication
+       since `pieces` last saw it. It's caught up before the next time it's used */
+    bool pieceReplicationChanged = false;
+
     int interestedCount = 0;
     int maxPeers = 0;
     time_t lastCancel = 0;
@@ -222,6 +231,7 @@ struct tr_peerMgr
     tr_session* session;
     tr_ptrArray incomingHandshakes; /* tr_handshake */
     struct event* bandwidthTimer;
+    struct event* allocateTimer;
     struct event* rechokeTimer;
     struct event* refillUpkeepTimer;
     struct event* atomTimer;
@@ -251,7 +261,9 @@ tr_peer::tr_peer(tr_torrent const* tor, peer_atom* atom_in)
     tr_bitfieldConstruct(&blame, tor->blockCount);
 }
 
-static void peerDeclinedAllRequests(tr_swarm*, tr_peer const*);
+static void peerDeclinedAllRequests(tr_swarm*, tr_peer*);
+static void swarmQueueCandidate(tr_swarm*, struct peer_atom*);
+static void swarmRebuildCandidates(tr_swarm*);
 
 tr_peer::~tr_peer()
 {
@@ -408,21 +420,10 @@ static void replicationNew(tr_swarm* s)
     s->pieceReplicationSize = piece_count;
     s->pieceReplication = tr_new0(uint16_t, piece_count);
 
-    for (tr_piece_index_t piece_i = 0; piece_i < piece_count; ++piece_i)
+    for (int peer_i = 0; peer_i < n; ++peer_i)
     {
-        uint16_t r = 0;
-
-        for (int peer_i = 0; peer_i < n; ++peer_i)
-        {
-            auto const* const peer = static_cast<tr_peer const*>(tr_ptrArrayNth(&s->peers, peer_i));
-
-            if (tr_bitfieldHas(&peer->have, piece_i))
-            {
-                ++r;
-            }
-        }
-
-        s->pieceReplication[piece_i] = r;
+        auto const* const peer = static_cast<tr_peer const*>(tr_ptrArrayNth(&s->peers, peer_i));
+        tr_bitfieldIncrCounts(&peer->have, s->pieceReplication, piece_count);
     }
 }
 
@@ -444,9 +445,6 @@ static void swarmFree(void* vs)
 
     replicationFree(s);
 
-    tr_free(s->requests);
-    tr_free(s->pieces);
-
     delete s;
 }
 
@@ -502,6 +500,7 @@ static void deleteTimers(struct tr_peerMgr* m)
 {
     deleteTimer(&m->atomTimer);
     deleteTimer(&m->bandwidthTimer);
+    deleteTimer(&m->allocateTimer);
     deleteTimer(&m->rechokeTimer);
     deleteTimer(&m->refillUpkeepTimer);
 }
@@ -531,6 +530,8 @@ void tr_peerMgrFree(tr_peerMgr* manager)
 
 void tr_peerMgrOnBlocklistChanged(tr_peerMgr* mgr)
 {
+    managerLock(mgr);
+
     /* we cache whether or not a peer is blocklisted...
        since the blocklist has changed, erase that cached value */
     for (auto* tor : mgr->session->torrents)
@@ -542,7 +543,13 @@ void tr_peerMgrOnBlocklistChanged(tr_peerMgr* mgr)
             auto* const atom = static_cast<struct peer_atom*>(tr_ptrArrayNth(&s->pool, i));
             atom->blocklisted = -1;
         }
+
+        /* peers that were dropped from the queues for being blocklisted
+           may not be anymore */
+        swarmRebuildCandidates(s);
     }
+
+    managerUnlock(mgr);
 }
 
 static bool isAtomBlocklisted(tr_session const* session, struct peer_atom* atom)
@@ -569,6 +576,7 @@ static void atomSetSeed(tr_swarm* s, struct peer_atom* atom)
     tordbg(s, "marking peer %s as a seed", tr_atomAddrStr(atom));
     atom->flags |= ADDED_F_SEED_FLAG;
     s->poolIsAllSeedsDirty = true;
+    swarmQueueCandidate(s, atom);
 }
 
 bool tr_peerMgrPeerIsSeed(tr_torrent const* tor, tr_address const* addr)
@@ -610,142 +618,42 @@ void tr_peerMgrSetUtpFailed(tr_torrent* tor, tr_address const* addr, bool failed
 ***
 *** There are two data structures associated with managing block requests:
 ***
-*** 1. tr_swarm::requests, an array of "struct block_request" which keeps
-***    track of which blocks have been requested, and when, and by which peers.
-***    This is list is used for (a) cancelling requests that have been pending
+*** 1. tr_swarm::requests, a tr_request_table which keeps track of which
+***    blocks have been requested, and when, and by which peers.
+***    This is used for (a) cancelling requests that have been pending
 ***    for too long and (b) avoiding duplicate requests before endgame.
 ***
-*** 2. tr_swarm::pieces, an array of "struct weighted_piece" which lists the
-***    pieces that we want to request. It's used to decide which blocks to
-***    return next when tr_peerMgrGetBlockRequests() is called.
+*** 2. tr_swarm::pieces, a tr_piece_picker which keeps the pieces that we
+***    want to request in the order we want them. It's used to decide which
+***    blocks to return next when tr_peerMgrGetNextRequests() is called.
 **/
 
 /**
-*** struct block_request
+*** tr_swarm::requests
 **/
 
-static constexpr int compareReqByBlock(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct block_request const*>(va);
-    auto const* const b = static_cast<struct block_request const*>(vb);
-
-    /* primary key: block */
-    if (a->block < b->block)
-    {
-        return -1;
-    }
-
-    if (a->block > b->block)
-    {
-        return 1;
-    }
-
-    /* secondary key: peer */
-    if (a->peer < b->peer)
-    {
-        return -1;
-    }
-
-    if (a->peer > b->peer)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-
 static void requestListAdd(tr_swarm* s, tr_block_index_t block, tr_peer* peer)
 {
-    struct block_request key;
-
-    /* ensure enough room is available... */
-    if (s->requestCount + 1 >= s->requestAlloc)
-    {
-        int const CHUNK_SIZE = 128;
-        s->requestAlloc += CHUNK_SIZE;
-        s->requests = tr_renew(struct block_request, s->requests, s->requestAlloc);
-    }
-
-    /* populate the record we're inserting */
-    key.block = block;
-    key.peer = peer;
-    key.sentAt = tr_time();
-
-    /* insert the request to our array... */
-    {
-        bool exact;
-        int const
-            pos = tr_lowerBound(&key, s->requests, s->requestCount, sizeof(struct block_request), compareReqByBlock, &exact);
-        TR_ASSERT(!exact);
-        memmove(s->requests + pos + 1, s->requests + pos, sizeof(struct block_request) * (s->requestCount++ - pos));
-        s->requests[pos] = key;
-    }
-
-    if (peer != nullptr)
-    {
-        ++peer->pendingReqsToPeer;
-        TR_ASSERT(peer->pendingReqsToPeer >= 0);
-    }
-}
-
-static struct block_request* requestListLookup(tr_swarm* s, tr_block_index_t block, tr_peer const* peer)
-{
-    struct block_request key;
-    key.block = block;
-    key.peer = (tr_peer*)peer;
-
-    return static_cast<struct block_request*>(
-        bsearch(&key, s->requests, s->requestCount, sizeof(struct block_request), compareReqByBlock));
-}
-
-/**
- * Find the peers are we currently requesting the block
- * with index @a block from and append them to @a peerArr.
- */
-static auto getBlockRequestPeers(tr_swarm* s, tr_block_index_t block)
-{
-    auto peers = std::vector<tr_peer*>{};
-
-    auto const key = block_request{ block, nullptr, 0 };
-    bool exact;
-    int const pos = tr_lowerBound(&key, s->requests, s->requestCount, sizeof(struct block_request), compareReqByBlock, &exact);
-
-    TR_ASSERT(!exact); /* shouldn't have a request with .peer == nullptr */
+    [[maybe_unused]] bool const added = s->requests.add(block, peer, tr_time());
+    TR_ASSERT(added);
 
-    for (int i = pos; i < s->requestCount; ++i)
-    {
-        if (s->requests[i].block != block)
-        {
-            break;
-        }
-
-        peers.push_back(s->requests[i].peer);
-    }
-
-    return peers;
+    ++peer->pendingReqsToPeer;
+    TR_ASSERT(peer->pendingReqsToPeer >= 0);
 }
 
-static void decrementPendingReqCount(struct block_request const* b)
+static void decrementPendingReqCount(tr_peer* peer)
 {
-    if ((b->peer != nullptr) && (b->peer->pendingReqsToPeer > 0))
+    if ((peer != nullptr) && (peer->pendingReqsToPeer > 0))
     {
-        --b->peer->pendingReqsToPeer;
+        --peer->pendingReqsToPeer;
     }
 }
 
-static void requestListRemove(tr_swarm* s, tr_block_index_t block, tr_peer const* peer)
+static void requestListRemove(tr_swarm* s, tr_block_index_t block, tr_peer* peer)
 {
-    struct block_request const* b = requestListLookup(s, block, peer);
-
-    if (b != nullptr)
+    if (s->requests.remove(block, peer))
     {
-        int const pos = b - s->requests;
-        TR_ASSERT(pos < s->requestCount);
-
-        decrementPendingReqCount(b);
-
-        tr_removeElementFromArray(s->requests, pos, sizeof(struct block_request), s->requestCount);
-        --s->requestCount;
+        decrementPendingReqCount(peer);
     }
 }
 
@@ -773,13 +681,11 @@ static bool testForEndgame(tr_swarm const* s)
 {
     /* we consider ourselves to be in endgame if the number of bytes
        we've got requested is >= the number of bytes left to download */
-    return (uint64_t)s->requestCount * s->tor->blockSize >= tr_torrentGetLeftUntilDone(s->tor);
+    return (uint64_t)std::size(s->requests) * s->tor->blockSize >= tr_torrentGetLeftUntilDone(s->tor);
 }
 
 static void updateEndgame(tr_swarm* s)
 {
-    TR_ASSERT(s->requestCount >= 0);
-
     if (!testForEndgame(s))
     {
         /* not in endgame */
@@ -804,7 +710,7 @@ static void updateEndgame(tr_swarm* s)
         numDownloading += countActiveWebseeds(s);
 
         /* average number of pending requests per downloading peer */
-        s->endgame = s->requestCount / std::max(numDownloading, 1);
+        s->endgame = int(std::size(s->requests)) / std::max(numDownloading, 1);
     }
 }
 
@@ -814,136 +720,29 @@ static void updateEndgame(tr_swarm* s)
 *****
 ****/
 
-static constexpr void invalidatePieceSorting(tr_swarm* s)
+/* `remaining` is set to how many of the piece's missing blocks haven't been requested yet */
+static tr_piece_picker::State getPieceState(tr_swarm const* s, tr_piece_index_t piece, uint32_t* remaining)
 {
-    s->pieceSortState = PIECES_UNSORTED;
-}
-
-static tr_torrent const* weightTorrent;
-
-static uint16_t const* weightReplication;
-
-static void setComparePieceByWeightTorrent(tr_swarm* s)
-{
-    if (!replicationExists(s))
-    {
-        replicationNew(s);
-    }
-
-    weightTorrent = s->tor;
-    weightReplication = s->pieceReplication;
-}
-
-/* we try to create a "weight" s.t. high-priority pieces come before others,
- * and that partially-complete pieces come before empty ones. */
-static int comparePieceByWeight(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct weighted_piece const*>(va);
-    auto const* const b = static_cast<struct weighted_piece const*>(vb);
-    int ia;
-    int ib;
-    int missing;
-    int pending;
-    tr_torrent const* tor = weightTorrent;
-    uint16_t const* rep = weightReplication;
-
-    /* primary key: weight */
-    missing = tr_torrentMissingBlocksInPiece(tor, a->index);
-    pending = a->requestCount;
-    ia = missing > pending ? missing - pending : tor->blockCountInPiece + pending;
-    missing = tr_torrentMissingBlocksInPiece(tor, b->index);
-    pending = b->requestCount;
-    ib = missing > pending ? missing - pending : tor->blockCountInPiece + pending;
-
-    if (ia < ib)
-    {
-        return -1;
-    }
+    tr_block_index_t first;
+    tr_block_index_t last;
+    tr_torGetPieceBlockRange(s->tor, piece, &first, &last);
 
-    if (ia > ib)
-    {
-        return 1;
-    }
-
-    /* secondary key: higher priorities go first */
-    ia = tor->info.pieces[a->index].priority;
-    ib = tor->info.pieces[b->index].priority;
-
-    if (ia > ib)
-    {
-        return -1;
-    }
-
-    if (ia < ib)
-    {
-        return 1;
-    }
+    size_t const missing = tr_torrentMissingBlocksInPiece(s->tor, piece);
+    size_t const pending = s->pieceRequests[piece];
 
-    /* tertiary key: rarest first. */
-    ia = rep[a->index];
-    ib = rep[b->index];
+    *remaining = missing > pending ? uint32_t(missing - pending) : 0;
 
-    if (ia < ib)
+    if (missing <= pending)
     {
-        return -1;
+        return tr_piece_picker::State::Requested;
     }
 
-    if (ia > ib)
-    {
-        return 1;
-    }
-
-    /* quaternary key: random */
-    if (a->salt < b->salt)
-    {
-        return -1;
-    }
-
-    if (a->salt > b->salt)
-    {
-        return 1;
-    }
-
-    /* okay, they're equal */
-    return 0;
-}
-
-static int comparePieceByIndex(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct weighted_piece const*>(va);
-    auto const* const b = static_cast<struct weighted_piece const*>(vb);
-
-    if (a->index < b->index)
-    {
-        return -1;
-    }
-
-    if (a->index > b->index)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-
-static void pieceListSort(tr_swarm* s, enum piece_sort_state state)
-{
-    TR_ASSERT(state == PIECES_SORTED_BY_INDEX || state == PIECES_SORTED_BY_WEIGHT);
-
-    if ((s->pieceCount > 0) && (s->pieces != nullptr))
+    if (pending > 0 || missing < last + 1 - first)
     {
-        if (state == PIECES_SORTED_BY_WEIGHT)
-        {
-            setComparePieceByWeightTorrent(s);
-            qsort(s->pieces, s->pieceCount, sizeof(struct weighted_piece), comparePieceByWeight);
-        }
-        else
-        {
-            qsort(s->pieces, s->pieceCount, sizeof(struct weighted_piece), comparePieceByIndex);
-        }
+        return tr_piece_picker::State::Partial;
     }
 
-    s->pieceSortState = state;
+    return tr_piece_picker::State::Untouched;
 }
 
 /**
@@ -952,24 +751,10 @@ static void pieceListSort(tr_swarm* s, enum piece_sort_state state)
  */
 #if 1
 
-#define assertWeightedPiecesAreSorted(t)
 #define assertReplicationCountIsExact(t)
 
 #else
 
-static void assertWeightedPiecesAreSorted(Torrent* t)
-{
-    if (t->endgame == 0)
-    {
-        setComparePieceByWeightTorrent(t);
-
-        for (int i = 0; i < t->pieceCount - 1; ++i)
-        {
-            TR_ASSERT(comparePieceByWeight(&t->pieces[i], &t->pieces[i + 1]) <= 0);
-        }
-    }
-}
-
 static void assertReplicationCountIsExact(Torrent* t)
 {
     /* This assert might fail due to errors of implementations in other
@@ -1002,170 +787,83 @@ static void assertReplicationCountIsExact(Torrent* t)
 
 #endif
 
-static constexpr weighted_piece* pieceListLookup(tr_swarm* s, tr_piece_index_t index)
+static bool pieceListExists(tr_swarm const* s)
 {
-    for (int i = 0; i < s->pieceCount; ++i)
-    {
-        if (s->pieces[i].index == index)
-        {
-            return &s->pieces[i];
-        }
-    }
-
-    return nullptr;
+    return s->pieces.pieceCount() == s->tor->info.pieceCount && s->pieceReplicationSize == s->tor->info.pieceCount;
 }
 
 static void pieceListRebuild(tr_swarm* s)
 {
-    if (!tr_torrentIsSeed(s->tor))
-    {
-        tr_piece_index_t* pool;
-        tr_piece_index_t poolCount = 0;
-        tr_torrent const* tor = s->tor;
-        tr_info const* inf = tr_torrentInfo(tor);
-        struct weighted_piece* pieces;
-        int pieceCount;
-
-        /* build the new list */
-        pool = tr_new(tr_piece_index_t, inf->pieceCount);
-
-        for (tr_piece_index_t i = 0; i < inf->pieceCount; ++i)
-        {
-            if (!inf->pieces[i].dnd && !tr_torrentPieceIsComplete(tor, i))
-            {
-                pool[poolCount++] = i;
-            }
-        }
-
-        pieceCount = poolCount;
-        pieces = tr_new0(struct weighted_piece, pieceCount);
-
-        for (tr_piece_index_t i = 0; i < poolCount; ++i)
-        {
-            struct weighted_piece* piece = pieces + i;
-            piece->index = pool[i];
-            piece->requestCount = 0;
-            piece->salt = tr_rand_int_weak(4096);
-        }
-
-        /* if we already had a list of pieces, merge it into
-         * the new list so we don't lose its requestCounts */
-        if (s->pieces != nullptr)
-        {
-            struct weighted_piece const* o = s->pieces;
-            struct weighted_piece const* const oend = o + s->pieceCount;
-            struct weighted_piece* n = pieces;
-            struct weighted_piece const* const nend = n + pieceCount;
-
-            pieceListSort(s, PIECES_SORTED_BY_INDEX);
-
-            while (o != oend && n != nend)
-            {
-                if (o->index < n->index)
-                {
-                    ++o;
-                }
-                else if (o->index > n->index)
-                {
-                    ++n;
-                }
-                else
-                {
-                    *n++ = *o++;
-                }
-            }
-
-            tr_free(s->pieces);
-        }
-
-        s->pieces = pieces;
-        s->pieceCount = pieceCount;
-
-        pieceListSort(s, PIECES_SORTED_BY_WEIGHT);
+    tr_torrent const* tor = s->tor;
+    tr_info const* inf = tr_torrentInfo(tor);
 
-        /* cleanup */
-        tr_free(pool);
+    if (s->pieceReplicationSize != inf->pieceCount)
+    {
+        replicationFree(s);
     }
-}
-
-static void pieceListRemovePiece(tr_swarm* s, tr_piece_index_t piece)
-{
-    struct weighted_piece const* p;
 
-    if ((p = pieceListLookup(s, piece)) != nullptr)
+    if (!replicationExists(s))
     {
-        int const pos = p - s->pieces;
-
-        tr_removeElementFromArray(s->pieces, pos, sizeof(struct weighted_piece), s->pieceCount);
-        --s->pieceCount;
-
-        if (s->pieceCount == 0)
-        {
-            tr_free(s->pieces);
-            s->pieces = nullptr;
-        }
+        replicationNew(s);
     }
-}
 
-static void pieceListResortPiece(tr_swarm* s, struct weighted_piece* p)
-{
-    int pos;
-    bool isSorted = true;
+    /* the pieces are about to be added with the current counts */
+    s->pieceReplicationChanged = false;
 
-    if (p == nullptr)
+    /* keep the request counts so that pieces which are still wanted stay in the same state */
+    if (s->pieces.pieceCount() != inf->pieceCount)
     {
-        return;
+        s->pieces = tr_piece_picker{ inf->pieceCount };
+        s->pieceRequests.assign(inf->pieceCount, 0);
     }
-
-    /* is the torrent already sorted? */
-    pos = p - s->pieces;
-    setComparePieceByWeightTorrent(s);
-
-    if (isSorted && pos > 0 && comparePieceByWeight(p - 1, p) > 0)
+    else
     {
-        isSorted = false;
+        s->pieces.clear();
     }
 
-    if (isSorted && pos < s->pieceCount - 1 && comparePieceByWeight(p, p + 1) > 0)
+    if (tr_torrentIsSeed(tor))
     {
-        isSorted = false;
+        return;
     }
 
-    if (s->pieceSortState != PIECES_SORTED_BY_WEIGHT)
+    for (tr_piece_index_t i = 0; i < inf->pieceCount; ++i)
     {
-        pieceListSort(s, PIECES_SORTED_BY_WEIGHT);
-        isSorted = true;
+        if (!inf->pieces[i].dnd && !tr_torrentPieceIsComplete(tor, i))
+        {
+            uint32_t remaining;
+            auto const state = getPieceState(s, i, &remaining);
+            s->pieces.add(i, inf->pieces[i].priority, s->pieceReplication[i], state, remaining);
+        }
     }
+}
 
-    /* if it's not sorted, move it around */
-    if (!isSorted)
+static void pieceListRemovePiece(tr_swarm* s, tr_piece_index_t piece)
+{
+    if (piece < s->pieces.pieceCount())
     {
-        bool exact;
-        struct weighted_piece const tmp = *p;
-
-        tr_removeElementFromArray(s->pieces, pos, sizeof(struct weighted_piece), s->pieceCount);
-        --s->pieceCount;
-
-        pos = tr_lowerBound(&tmp, s->pieces, s->pieceCount, sizeof(struct weighted_piece), comparePieceByWeight, &exact);
-
-        memmove(&s->pieces[pos + 1], &s->pieces[pos], sizeof(struct weighted_piece) * (s->pieceCount - pos));
-        ++s->pieceCount;
-
-        s->pieces[pos] = tmp;
+        s->pieces.remove(piece);
     }
+}
 
-    assertWeightedPiecesAreSorted(s);
+/* called when the number of blocks that the piece is missing or that we've requested changes */
+static void pieceListResortPiece(tr_swarm* s, tr_piece_index_t piece)
+{
+    if (piece < s->pieces.pieceCount() && s->pieces.isWanted(piece))
+    {
+        uint32_t remaining;
+        auto const state = getPieceState(s, piece, &remaining);
+        s->pieces.setState(piece, state, remaining);
+    }
 }
 
 static void pieceListRemoveRequest(tr_swarm* s, tr_block_index_t block)
 {
-    struct weighted_piece* p;
     tr_piece_index_t const index = tr_torBlockPiece(s->tor, block);
 
-    if ((p = pieceListLookup(s, index)) != nullptr && p->requestCount > 0)
+    if (index < std::size(s->pieceRequests) && s->pieceRequests[index] > 0)
     {
-        --p->requestCount;
-        pieceListResortPiece(s, p);
+        --s->pieceRequests[index];
+        pieceListResortPiece(s, index);
     }
 }
 
@@ -1175,9 +873,26 @@ static void pieceListRemoveRequest(tr_swarm* s, tr_block_index_t block)
 *****
 ****/
 
+static void pieceListUpdateReplication(tr_swarm* s, tr_piece_index_t piece)
+{
+    if (piece < s->pieces.pieceCount())
+    {
+        s->pieces.setReplication(piece, s->pieceReplication[piece]);
+    }
+}
+
+/* called before using the piece list, since whole bitfields only update pieceReplication */
+static void pieceListUpdateAllReplication(tr_swarm* s)
+{
+    if (s->pieceReplicationChanged)
+    {
+        s->pieces.setReplication(s->pieceReplication);
+        s->pieceReplicationChanged = false;
+    }
+}
+
 /**
- * Increase the replication count of this piece and sort it if the
- * piece list is already sorted
+ * Increase the replication count of this piece and move it in the piece list
  */
 static void tr_incrReplicationOfPiece(tr_swarm* s, size_t const index)
 {
@@ -1187,11 +902,7 @@ static void tr_incrReplicationOfPiece(tr_swarm* s, size_t const index)
     /* One more replication of this piece is present in the swarm */
     ++s->pieceReplication[index];
 
-    /* we only resort the piece if the list is already sorted */
-    if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
-    {
-        pieceListResortPiece(s, pieceListLookup(s, index));
-    }
+    pieceListUpdateReplication(s, index);
 }
 
 /**
@@ -1200,21 +911,10 @@ static void tr_incrReplicationOfPiece(tr_swarm* s, size_t const index)
 static void tr_incrReplicationFromBitfield(tr_swarm* s, tr_bitfield const* b)
 {
     TR_ASSERT(replicationExists(s));
+    TR_ASSERT(s->pieceReplicationSize == s->tor->info.pieceCount);
 
-    uint16_t* rep = s->pieceReplication;
-
-    for (size_t i = 0, n = s->tor->info.pieceCount; i < n; ++i)
-    {
-        if (tr_bitfieldHas(b, i))
-        {
-            ++rep[i];
-        }
-    }
-
-    if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
-    {
-        invalidatePieceSorting(s);
-    }
+    tr_bitfieldIncrCounts(b, s->pieceReplication, s->pieceReplicationSize);
+    s->pieceReplicationChanged = true;
 }
 
 /**
@@ -1229,6 +929,8 @@ static void tr_incrReplication(tr_swarm* s)
     {
         ++s->pieceReplication[i];
     }
+
+    s->pieceReplicationChanged = true;
 }
 
 /**
@@ -1239,28 +941,8 @@ static void tr_decrReplicationFromBitfield(tr_swarm* s, tr_bitfield const* b)
     TR_ASSERT(replicationExists(s));
     TR_ASSERT(s->pieceReplicationSize == s->tor->info.pieceCount);
 
-    if (tr_bitfieldHasAll(b))
-    {
-        for (size_t i = 0; i < s->pieceReplicationSize; ++i)
-        {
-            --s->pieceReplication[i];
-        }
-    }
-    else if (!tr_bitfieldHasNone(b))
-    {
-        for (size_t i = 0; i < s->pieceReplicationSize; ++i)
-        {
-            if (tr_bitfieldHas(b, i))
-            {
-                --s->pieceReplication[i];
-            }
-        }
-
-        if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
-        {
-            invalidatePieceSorting(s);
-        }
-    }
+    tr_bitfieldDecrCounts(b, s->pieceReplication, s->pieceReplicationSize);
+    s->pieceReplicationChanged = true;
 }
 
 /**
@@ -1286,250 +968,179 @@ void tr_peerMgrGetNextRequests(
     TR_ASSERT(tr_isTorrent(tor));
     TR_ASSERT(numwant > 0);
 
-    tr_swarm* s;
-    tr_bitfield const* const have = &peer->have;
+    /* hold off while the disk catches up with what we've already got */
+    if (tr_cacheIsFull(tor->session->cache))
+    {
+        *numgot = 0;
+        return;
+    }
 
-    /* walk through the pieces and find blocks that should be requested */
-    s = tor->swarm;
+    tr_swarm* const s = tor->swarm;
 
     /* prep the pieces list */
-    if (s->pieces == nullptr)
+    if (!pieceListExists(s))
     {
         pieceListRebuild(s);
     }
 
-    if (s->pieceSortState != PIECES_SORTED_BY_WEIGHT)
-    {
-        pieceListSort(s, PIECES_SORTED_BY_WEIGHT);
-    }
-
-    assertReplicationCountIsExact(s);
-    assertWeightedPiecesAreSorted(s);
-
-    updateEndgame(s);
+    pieceListUpdateAllReplication(s);
 
-    // TODO(ckerr) this safeguard is here to silence a false nullptr dereference
-    // warning. The better fix is to refactor the `pieces` array to be a std
-    // container but that's out-of-scope for a "fix all the warnings" PR
-    if (s->pieces == nullptr)
-    {
-        *numgot = 0;
-        return;
-    }
+    assertReplicationCountIsExact(s);
+
+    updateEndgame(s);
 
-    struct weighted_piece* pieces = s->pieces;
+    /* walk through the pieces that the peer has and find blocks that should be requested */
     int got = 0;
-    int checkedPieceCount = 0;
+    auto touched = std::vector<tr_piece_index_t>{};
 
-    for (int i = 0; i < s->pieceCount && got < numwant; ++i, ++checkedPieceCount)
+    auto const visit = [&](tr_piece_index_t piece)
     {
-        struct weighted_piece* p = pieces + i;
-
-        /* if the peer has this piece that we want... */
-        if (tr_bitfieldHas(have, p->index))
+        /* pieces whose blocks have all been requested come last,
+           and they're no use to us until the endgame */
+        if (s->endgame == 0 && s->pieces.state(piece) == tr_piece_picker::State::Requested)
         {
-            tr_block_index_t first;
-            tr_block_index_t last;
+            return false;
+        }
+
+        tr_block_index_t first;
+        tr_block_index_t last;
+        bool requested = false;
+
+        tr_torGetPieceBlockRange(tor, piece, &first, &last);
 
-            tr_torGetPieceBlockRange(tor, p->index, &first, &last);
+        /* skip past the blocks we've already got */
+        auto const* const blocks = &tor->completion.blockBitfield;
 
-            for (tr_block_index_t b = first; b <= last && (got < numwant || (get_intervals && setme[2 * got - 1] == b - 1));
-                 ++b)
+        for (tr_block_index_t b = tr_bitfieldFindNextUnset(blocks, first, last + 1);
+             b <= last && (got < numwant || (get_intervals && setme[2 * got - 1] == b - 1));
+             b = tr_bitfieldFindNextUnset(blocks, b + 1, last + 1))
+        {
+            /* always add peer if this block has no peers yet */
+            auto const peers = s->requests.peers(b);
+            auto const peerCount = std::size(peers);
+            if (peerCount != 0)
             {
-                /* don't request blocks we've already got */
-                if (tr_torrentBlockIsComplete(tor, b))
+                /* don't make a second block request until the endgame */
+                if (s->endgame == 0)
                 {
                     continue;
                 }
 
-                /* always add peer if this block has no peers yet */
-                auto const peers = getBlockRequestPeers(s, b);
-                auto const peerCount = std::size(peers);
-                if (peerCount != 0)
+                /* don't have more than two peers requesting this block */
+                if (peerCount > 1)
                 {
-                    /* don't make a second block request until the endgame */
-                    if (s->endgame == 0)
-                    {
-                        continue;
-                    }
-
-                    /* don't have more than two peers requesting this block */
-                    if (peerCount > 1)
-                    {
-                        continue;
-                    }
-
-                    /* don't send the same request to the same peer twice */
-                    if (peer == peers[0])
-                    {
-                        continue;
-                    }
-
-                    /* in the endgame allow an additional peer to download a
-                       block but only if the peer seems to be handling requests
-                       relatively fast */
-                    if (peer->pendingReqsToPeer + numwant - got < s->endgame)
-                    {
-                        continue;
-                    }
+                    continue;
                 }
 
-                /* update the caller's table */
-                if (!get_intervals)
-                {
-                    setme[got++] = b;
-                }
-                /* if intervals are requested two array entries are necessarry:
-                   one for the interval's starting block and one for its end block */
-                else if (got != 0 && setme[2 * got - 1] == b - 1 && b != first)
+                /* don't send the same request to the same peer twice */
+                if (peer == peers[0])
                 {
-                    /* expand the last interval */
-                    ++setme[2 * got - 1];
+                    continue;
                 }
-                else
+
+                /* in the endgame allow an additional peer to download a
+                   block but only if the peer seems to be handling requests
+                   relatively fast */
+                if (peer->pendingReqsToPeer + numwant - got < s->endgame)
                 {
-                    /* begin a new interval */
-                    setme[2 * got] = b;
-                    setme[2 * got + 1] = b;
-                    ++got;
+                    continue;
                 }
+            }
 
-                /* update our own tables */
-                requestListAdd(s, b, peer);
-                ++p->requestCount;
+            /* update the caller's table */
+            if (!get_intervals)
+            {
+                setme[got++] = b;
+            }
+            /* if intervals are requested two array entries are necessarry:
+               one for the interval's starting block and one for its end block */
+            else if (got != 0 && setme[2 * got - 1] == b - 1 && b != first)
+            {
+                /* expand the last interval */
+                ++setme[2 * got - 1];
+            }
+            else
+            {
+                /* begin a new interval */
+                setme[2 * got] = b;
+                setme[2 * got + 1] = b;
+                ++got;
             }
+
+            /* update our own tables */
+            requestListAdd(s, b, peer);
+            ++s->pieceRequests[piece];
+            requested = true;
         }
-    }
 
-    /* In most cases we've just changed the weights of a small number of pieces.
-     * So rather than qsort()ing the entire array, it's faster to apply an
-     * adaptive insertion sort algorithm. */
-    if (got > 0)
-    {
-        /* not enough requests || last piece modified */
-        if (checkedPieceCount == s->pieceCount)
+        if (requested)
         {
-            --checkedPieceCount;
+            touched.push_back(piece);
         }
 
-        setComparePieceByWeightTorrent(s);
+        return got < numwant;
+    };
 
-        for (int i = checkedPieceCount - 1; i >= 0; --i)
-        {
-            bool exact;
-
-            /* relative position! */
-            int const newpos = tr_lowerBound(
-                &s->pieces[i],
-                &s->pieces[i + 1],
-                s->pieceCount - (i + 1),
-                sizeof(struct weighted_piece),
-                comparePieceByWeight,
-                &exact);
-
-            if (newpos > 0)
-            {
-                struct weighted_piece const piece = s->pieces[i];
-                memmove(&s->pieces[i], &s->pieces[i + 1], sizeof(struct weighted_piece) * newpos);
-                s->pieces[i + newpos] = piece;
-            }
-        }
+    s->pieces.forEach(&peer->have, visit);
+
+    /* the picker can't be changed while we're walking it,
+       so move the pieces we've just requested from now */
+    for (auto const piece : touched)
+    {
+        pieceListResortPiece(s, piece);
     }
 
-    assertWeightedPiecesAreSorted(t);
     *numgot = got;
 }
 
 bool tr_peerMgrDidPeerRequest(tr_torrent const* tor, tr_peer const* peer, tr_block_index_t block)
 {
-    return requestListLookup(tor->swarm, block, peer) != nullptr;
+    return tor->swarm->requests.has(block, peer);
+}
+
+static void removeRequestFromTables(tr_swarm* s, tr_block_index_t block, tr_peer* peer)
+{
+    requestListRemove(s, block, peer);
+    pieceListRemoveRequest(s, block);
 }
 
 /* cancel requests that are too old */
 static void refillUpkeep([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
 {
-    time_t now;
-    time_t too_old;
-    int cancel_buflen = 0;
-    struct block_request* cancel = nullptr;
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     managerLock(mgr);
 
-    now = tr_time();
-    too_old = now - REQUEST_TTL_SECS;
-
-    /* alloc the temporary "cancel" buffer */
-    for (auto const* tor : mgr->session->torrents)
-    {
-        cancel_buflen = std::max(cancel_buflen, tor->swarm->requestCount);
-    }
-
-    if (cancel_buflen > 0)
-    {
-        cancel = tr_new(struct block_request, cancel_buflen);
-    }
+    time_t const now = tr_time();
+    time_t const too_old = now - REQUEST_TTL_SECS;
+    auto cancel = std::vector<std::pair<tr_block_index_t, tr_peerMsgs*>>{};
 
     /* prune requests that are too old */
     for (auto* tor : mgr->session->torrents)
     {
         tr_swarm* s = tor->swarm;
-        int const n = s->requestCount;
-
-        if (n > 0)
-        {
-            int keepCount = 0;
-            int cancelCount = 0;
 
-            for (int i = 0; i < n; ++i)
+        cancel.clear();
+        s->requests.forEachSentBy(
+            too_old,
+            [&cancel](auto const& request)
             {
-                struct block_request const* const request = &s->requests[i];
-                auto const* const msgs = dynamic_cast<tr_peerMsgs const*>(request->peer);
-
-                if (msgs != nullptr && request->sentAt <= too_old && !msgs->is_reading_block(request->block))
-                {
-                    TR_ASSERT(cancel != nullptr);
-                    TR_ASSERT(cancelCount < cancel_buflen);
-
-                    cancel[cancelCount++] = *request;
-                }
-                else
-                {
-                    if (i != keepCount)
-                    {
-                        s->requests[keepCount] = *request;
-                    }
-
-                    ++keepCount;
-                }
-            }
-
-            /* prune out the ones we aren't keeping */
-            s->requestCount = keepCount;
+                auto* const msgs = dynamic_cast<tr_peerMsgs*>(request.peer);
 
-            /* send cancel messages for all the "cancel" ones */
-            for (int i = 0; i < cancelCount; ++i)
-            {
-                struct block_request const* const request = &cancel[i];
-                auto* msgs = dynamic_cast<tr_peerMsgs*>(request->peer);
-                if (msgs != nullptr)
+                if (msgs != nullptr && !msgs->is_reading_block(request.block))
                 {
-                    request->peer->cancelsSentToPeer.add(now, 1);
-                    msgs->cancel_block_request(request->block);
-                    decrementPendingReqCount(request);
+                    cancel.emplace_back(request.block, msgs);
                 }
-            }
-
-            /* decrement the pending request counts for the timed-out blocks */
-            for (int i = 0; i < cancelCount; ++i)
-            {
-                struct block_request const* const request = &cancel[i];
+            });
 
-                pieceListRemoveRequest(s, request->block);
-            }
+        /* send cancel messages for all the "cancel" ones */
+        for (auto const& [block, msgs] : cancel)
+        {
+            msgs->cancelsSentToPeer.add(now, 1);
+            msgs->cancel_block_request(block);
+            removeRequestFromTables(s, block, msgs);
         }
     }
 
-    tr_free(cancel);
     tr_timerAddMsec(mgr->refillUpkeepTimer, REFILL_UPKEEP_PERIOD_MSEC);
     managerUnlock(mgr);
 }
@@ -1605,40 +1216,24 @@ static void peerSuggestedPiece(
 #endif
 }
 
-static void removeRequestFromTables(tr_swarm* s, tr_block_index_t block, tr_peer const* peer)
-{
-    requestListRemove(s, block, peer);
-    pieceListRemoveRequest(s, block);
-}
-
 /* peer choked us, or maybe it disconnected.
    either way we need to remove all its requests */
-static void peerDeclinedAllRequests(tr_swarm* s, tr_peer const* peer)
+static void peerDeclinedAllRequests(tr_swarm* s, tr_peer* peer)
 {
-    int n = 0;
-    tr_block_index_t* blocks = tr_new(tr_block_index_t, s->requestCount);
-
-    for (int i = 0; i < s->requestCount; ++i)
-    {
-        if (peer == s->requests[i].peer)
+    s->requests.remove(
+        peer,
+        [s](auto const& request)
         {
-            blocks[n++] = s->requests[i].block;
-        }
-    }
-
-    for (int i = 0; i < n; ++i)
-    {
-        removeRequestFromTables(s, blocks[i], peer);
-    }
-
-    tr_free(blocks);
+            decrementPendingReqCount(request.peer);
+            pieceListRemoveRequest(s, request.block);
+        });
 }
 
 static void cancelAllRequestsForBlock(tr_swarm* s, tr_block_index_t block, tr_peer* no_notify)
 {
     auto const now = tr_time();
 
-    for (auto* p : getBlockRequestPeers(s, block))
+    for (auto* p : s->requests.peers(block))
     {
         auto* msgs = dynamic_cast<tr_peerMsgs*>(p);
         if ((msgs != nullptr) && (msgs != no_notify))
@@ -1804,8 +1399,8 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
             tr_block_index_t const block = _tr_block(tor, p, e->offset);
             cancelAllRequestsForBlock(s, block, peer);
             peer->blocksSentToClient.add(tr_time(), 1);
-            pieceListResortPiece(s, pieceListLookup(s, p));
             tr_torrentGotBlock(tor, block);
+            pieceListResortPiece(s, p);
             break;
         }
 
@@ -1903,6 +1498,7 @@ static struct peer_atom* ensureAtomExists(
     }
 
     s->poolIsAllSeedsDirty = true;
+    swarmQueueCandidate(s, a);
 
     return a;
 }
@@ -1991,6 +1587,8 @@ static bool myHandshakeDoneCB(
                     tordbg(s, "marking peer %s as unreachable... numFails is %d", tr_atomAddrStr(atom), (int)atom->numFails);
                     atom->flags2 |= MYFLAG_UNREACHABLE;
                 }
+
+                swarmQueueCandidate(s, atom);
             }
         }
     }
@@ -2053,6 +1651,11 @@ static bool myHandshakeDoneCB(
                 success = true;
             }
         }
+
+        if (!success)
+        {
+            swarmQueueCandidate(s, atom);
+        }
     }
 
     if (s != nullptr)
@@ -2243,6 +1846,9 @@ void tr_peerMgrGotBadPiece(tr_torrent* tor, tr_piece_index_t pieceIndex)
         }
     }
 
+    /* its blocks are missing again */
+    pieceListResortPiece(s, pieceIndex);
+
     tr_announcerAddBytes(tor, TR_ANN_CORRUPT, byteCount);
 }
 
@@ -2406,6 +2012,7 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
 
 static void atomPulse(evutil_socket_t, short, void*);
 static void bandwidthPulse(evutil_socket_t, short, void*);
+static void allocatePulse(evutil_socket_t, short, void*);
 static void rechokePulse(evutil_socket_t, short, void*);
 static void reconnectPulse(evutil_socket_t, short, void*);
 
@@ -2428,6 +2035,11 @@ static void ensureMgrTimersExist(struct tr_peerMgr* m)
         m->bandwidthTimer = createTimer(m->session, BANDWIDTH_PERIOD_MSEC, bandwidthPulse, m);
     }
 
+    if (m->allocateTimer == nullptr)
+    {
+        m->allocateTimer = createTimer(m->session, ALLOCATE_PERIOD_MSEC, allocatePulse, m);
+    }
+
     if (m->rechokeTimer == nullptr)
     {
         m->rechokeTimer = createTimer(m->session, RECHOKE_PERIOD_MSEC, rechokePulse, m);
@@ -2450,7 +2062,6 @@ void tr_peerMgrStartTorrent(tr_torrent* tor)
 
     s->isRunning = true;
     s->maxPeers = tor->maxConnectedPeers;
-    s->pieceSortState = PIECES_UNSORTED;
 
     // rechoke soon
     tr_timerAddMsec(s->manager->rechokeTimer, 100);
@@ -2463,7 +2074,7 @@ static void stopSwarm(tr_swarm* swarm)
     swarm->isRunning = false;
 
     replicationFree(swarm);
-    invalidatePieceSorting(swarm);
+    swarm->pieces = {};
 
     removeAllPeers(swarm);
 
@@ -2874,7 +2485,7 @@ void tr_peerMgrClearInterest(tr_torrent* tor)
 }
 
 /* does this peer have any pieces that we want? */
-static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_interesting, tr_peer const* const peer)
+static bool isPeerInteresting(tr_torrent* const tor, tr_bitfield const* const boring_pieces, tr_peer const* const peer)
 {
     /* these cases should have already been handled by the calling code... */
     TR_ASSERT(!tr_torrentIsSeed(tor));
@@ -2885,15 +2496,7 @@ static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_
         return true;
     }
 
-    for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
-    {
-        if (piece_is_interesting[i] && tr_bitfieldHas(&peer->have, i))
-        {
-            return true;
-        }
-    }
-
-    return false;
+    return tr_bitfieldHasAnyNotIn(&peer->have, boring_pieces);
 }
 
 enum tr_rechoke_state
@@ -3026,24 +2629,28 @@ static void rechokeDownloads(tr_swarm* s)
 
     if (peerCount > 0)
     {
-        bool* piece_is_interesting;
         tr_torrent const* const tor = s->tor;
-        int const n = tor->info.pieceCount;
+        tr_piece_index_t const n = tor->info.pieceCount;
 
-        /* build a bitfield of interesting pieces... */
-        piece_is_interesting = tr_new(bool, n);
+        /* build a bitfield of the pieces we don't want from anyone... */
+        auto* const piece_is_boring = tr_new(bool, n);
+        auto boring_pieces = tr_bitfield{};
+        tr_bitfieldConstruct(&boring_pieces, n);
 
-        for (int i = 0; i < n; ++i)
+        for (tr_piece_index_t i = 0; i < n; ++i)
         {
-            piece_is_interesting[i] = !tor->info.pieces[i].dnd && !tr_torrentPieceIsComplete(tor, i);
+            piece_is_boring[i] = tor->info.pieces[i].dnd || tr_torrentPieceIsComplete(tor, i);
         }
 
+        tr_bitfieldSetFromFlags(&boring_pieces, piece_is_boring, n);
+        tr_free(piece_is_boring);
+
         /* decide WHICH peers to be interested in (based on their cancel-to-block ratio) */
         for (int i = 0; i < peerCount; ++i)
         {
             auto* const peer = static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, i));
 
-            if (!isPeerInteresting(s->tor, piece_is_interesting, peer))
+            if (!isPeerInteresting(s->tor, &boring_pieces, peer))
             {
                 peer->set_interested(false);
             }
@@ -3086,7 +2693,7 @@ static void rechokeDownloads(tr_swarm* s)
             }
         }
 
-        tr_free(piece_is_interesting);
+        tr_bitfieldDestruct(&boring_pieces);
     }
 
     if ((rechoke != nullptr) && (rechoke_count > 0))
@@ -3492,6 +3099,8 @@ static void removePeer(tr_swarm* s, tr_peer* peer)
     TR_ASSERT(s->stats.peerFromCount[atom->fromFirst] >= 0);
 
     delete peer;
+
+    swarmQueueCandidate(s, atom);
 }
 
 static void closePeer(tr_swarm* s, tr_peer* peer)
@@ -3780,6 +3389,21 @@ static void queuePulse(tr_session* session, tr_direction dir)
     }
 }
 
+static void allocatePulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
+{
+    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
+    managerLock(mgr);
+
+    /* allocate bandwidth to the peers */
+    auto* const bandwidth = mgr->session->bandwidth;
+    bandwidth->allocate(TR_UP);
+    bandwidth->allocate(TR_DOWN);
+
+    bool const is_limited = bandwidth->isLimitedInSubtree(TR_UP) || bandwidth->isLimitedInSubtree(TR_DOWN);
+    tr_timerAddMsec(mgr->allocateTimer, is_limited ? ALLOCATE_PERIOD_MSEC : BANDWIDTH_PERIOD_MSEC);
+    managerUnlock(mgr);
+}
+
 static void bandwidthPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
@@ -3788,10 +3412,6 @@ static void bandwidthPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]]
 
     pumpAllPeers(mgr);
 
-    /* allocate bandwidth to the peers */
-    session->bandwidth->allocate(TR_UP, BANDWIDTH_PERIOD_MSEC);
-    session->bandwidth->allocate(TR_DOWN, BANDWIDTH_PERIOD_MSEC);
-
     /* torrent upkeep */
     for (auto* tor : session->torrents)
     {
@@ -3956,6 +3576,10 @@ static void atomPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] shor
             tr_free(test);
             tr_free(keep);
         }
+
+        /* the queues may point to culled atoms, and have picked up stale
+           entries since the last pulse, so start them over */
+        swarmRebuildCandidates(s);
     }
 
     tr_timerAddMsec(mgr->atomTimer, ATOM_PERIOD_MSEC);
@@ -4023,8 +3647,13 @@ static constexpr uint64_t addValToKey(uint64_t value, int width, uint64_t addme)
     return value;
 }
 
-/* smaller value is better */
-static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom const* atom, uint8_t salt)
+/* where getPeerCandidateScore() puts the torrent's bits in an atom's score */
+static auto constexpr TorrentScoreShift = int{ 1 + 1 + 4 + 8 };
+
+/* smaller value is better.
+ * The bits that depend on the torrent are left zeroed here so that the score
+ * can be kept in the swarm's queue; getPeerCandidateScore() fills them in. */
+static uint64_t getAtomCandidateScore(struct peer_atom const* atom, uint8_t salt)
 {
     uint64_t i;
     uint64_t score = 0;
@@ -4038,6 +3667,33 @@ static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom co
     i = atom->lastConnectionAttemptAt;
     score = addValToKey(score, 32, i);
 
+    /* room for the torrent's priority, recently-started and seed bits */
+    score = addValToKey(score, 4 + 1 + 1, 0);
+
+    /* prefer peers that are known to be connectible */
+    i = (atom->flags & ADDED_F_CONNECTABLE) != 0 ? 0 : 1;
+    score = addValToKey(score, 1, i);
+
+    /* prefer peers that we might be able to upload to */
+    i = (atom->flags & ADDED_F_SEED_FLAG) == 0 ? 0 : 1;
+    score = addValToKey(score, 1, i);
+
+    /* Prefer peers that we got from more trusted sources.
+     * lower `fromBest' values indicate more trusted sources */
+    score = addValToKey(score, 4, atom->fromBest);
+
+    /* salt */
+    score = addValToKey(score, 8, salt);
+
+    return score;
+}
+
+/* smaller value is better */
+static uint64_t getPeerCandidateScore(tr_torrent const* tor, uint64_t atom_score)
+{
+    uint64_t i;
+    uint64_t score = 0;
+
     /* prefer peers belonging to a torrent of a higher priority */
     switch (tr_torrentGetPriority(tor))
     {
@@ -4064,53 +3720,159 @@ static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom co
     i = tr_torrentIsSeed(tor) ? 1 : 0;
     score = addValToKey(score, 1, i);
 
-    /* prefer peers that are known to be connectible */
-    i = (atom->flags & ADDED_F_CONNECTABLE) != 0 ? 0 : 1;
-    score = addValToKey(score, 1, i);
+    return atom_score | (score << TorrentScoreShift);
+}
 
-    /* prefer peers that we might be able to upload to */
-    i = (atom->flags & ADDED_F_SEED_FLAG) == 0 ? 0 : 1;
-    score = addValToKey(score, 1, i);
+/***
+****  Connection candidate queues
+****
+****  Rather than scoring every atom of every torrent on each reconnect
+****  pulse, each swarm keeps its atoms sorted in two heaps. An atom is
+****  (re)filed whenever something that decides its candidacy changes, and
+****  whatever entries it already had are left in place to be skipped once
+****  they surface. atomPulse() rebuilds the heaps from scratch every minute.
+***/
 
-    /* Prefer peers that we got from more trusted sources.
-     * lower `fromBest' values indicate more trusted sources */
-    score = addValToKey(score, 4, atom->fromBest);
+static bool compareCandidateEntries(peer_candidate_entry const& a, peer_candidate_entry const& b)
+{
+    /* the std heap functions keep the largest item first, so invert the
+       comparison to keep the smallest key first */
+    return a.key > b.key;
+}
 
-    /* salt */
-    score = addValToKey(score, 8, salt);
+static void candidateQueuePush(std::vector<peer_candidate_entry>& queue, peer_candidate_entry const& entry)
+{
+    queue.push_back(entry);
+    std::push_heap(std::begin(queue), std::end(queue), compareCandidateEntries);
+}
 
-    return score;
+static void candidateQueuePop(std::vector<peer_candidate_entry>& queue)
+{
+    std::pop_heap(std::begin(queue), std::end(queue), compareCandidateEntries);
+    queue.pop_back();
 }
 
-#ifdef TR_ENABLE_ASSERTS
+static constexpr bool candidateEntryIsCurrent(peer_candidate_entry const& entry)
+{
+    return entry.serial == entry.atom->candidate_serial;
+}
 
-static bool checkBestScoresComeFirst(struct peer_candidate const* candidates, int n, int k)
+/* file `atom' under the queue that matches isPeerCandidate() at `now',
+   or under neither one if it can't be a candidate until it's queued again */
+static void swarmPushCandidate(tr_swarm* s, struct peer_atom* atom, time_t const now)
 {
-    uint64_t worstFirstScore = 0;
-    int const x = std::min(n, k) - 1;
+    uint32_t const serial = ++atom->candidate_serial;
 
-    for (int i = 0; i < x; i++)
+    if (s->candidatesAreForSeed && atomIsSeed(atom))
     {
-        if (worstFirstScore < candidates[i].score)
-        {
-            worstFirstScore = candidates[i].score;
-        }
+        return;
     }
 
-    for (int i = 0; i < x; i++)
+    if (peerIsInUse(s, atom))
     {
-        TR_ASSERT(candidates[i].score <= worstFirstScore);
+        return;
     }
 
-    for (int i = x + 1; i < n; i++)
+    if (isAtomBlocklisted(s->manager->session, atom))
     {
-        TR_ASSERT(candidates[i].score >= worstFirstScore);
+        return;
     }
 
-    return true;
+    if ((atom->flags2 & MYFLAG_BANNED) != 0)
+    {
+        return;
+    }
+
+    time_t const eligible_at = atom->time + getReconnectIntervalSecs(atom, now);
+
+    if (now < eligible_at)
+    {
+        candidateQueuePush(s->reconnectQueue, { (uint64_t)eligible_at, serial, atom });
+    }
+    else
+    {
+        uint8_t const salt = tr_rand_int_weak(1024);
+        candidateQueuePush(s->candidates, { getAtomCandidateScore(atom, salt), serial, atom });
+    }
 }
 
-#endif /* TR_ENABLE_ASSERTS */
+static void swarmRebuildCandidates(tr_swarm* s)
+{
+    time_t const now = tr_time();
+    int nAtoms;
+    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&s->pool, &nAtoms);
+
+    s->candidates.clear();
+    s->reconnectQueue.clear();
+    s->candidatesAreForSeed = tr_torrentIsSeed(s->tor);
+
+    for (int i = 0; i < nAtoms; ++i)
+    {
+        swarmPushCandidate(s, atoms[i], now);
+    }
+}
+
+static void swarmQueueCandidate(tr_swarm* s, struct peer_atom* atom)
+{
+    swarmPushCandidate(s, atom, tr_time());
+
+    /* don't let the entries left behind by requeued atoms pile up */
+    size_t const maxEntries = 2 * tr_ptrArraySize(&s->pool) + 64;
+
+    if (s->candidates.size() + s->reconnectQueue.size() > maxEntries)
+    {
+        swarmRebuildCandidates(s);
+    }
+}
+
+/**
+ * @return the swarm's best candidate, or nullptr if it has none.
+ * The entry is at the front of s->candidates, and is only valid
+ * until that queue is next changed.
+ */
+static peer_candidate_entry const* swarmPeekCandidate(tr_swarm* s, time_t const now)
+{
+    if (s->candidatesAreForSeed != tr_torrentIsSeed(s->tor))
+    {
+        swarmRebuildCandidates(s);
+    }
+
+    /* promote the atoms that have waited out their reconnect interval */
+    auto& waiting = s->reconnectQueue;
+
+    while (!std::empty(waiting) && waiting.front().key <= (uint64_t)now)
+    {
+        auto const entry = waiting.front();
+        candidateQueuePop(waiting);
+
+        if (candidateEntryIsCurrent(entry))
+        {
+            swarmPushCandidate(s, entry.atom, now);
+        }
+    }
+
+    auto& candidates = s->candidates;
+
+    while (!std::empty(candidates))
+    {
+        auto const entry = candidates.front();
+
+        if (candidateEntryIsCurrent(entry) && isPeerCandidate(s->tor, entry.atom, now))
+        {
+            return &candidates.front();
+        }
+
+        candidateQueuePop(candidates);
+
+        /* its reconnect interval may have grown since it was filed */
+        if (candidateEntryIsCurrent(entry))
+        {
+            swarmPushCandidate(s, entry.atom, now);
+        }
+    }
+
+    return nullptr;
+}
 
 static bool calculateAllSeeds(tr_swarm* swarm)
 {
@@ -4139,41 +3901,38 @@ static bool swarmIsAllSeeds(tr_swarm* swarm)
     return swarm->poolIsAllSeeds;
 }
 
-/** @return an array of all the atoms we might want to connect to */
-static struct peer_candidate* getPeerCandidates(tr_session* session, int* candidateCount, int max)
+/**
+ * @return up to `max' of the atoms we might want to connect to, best first.
+ * They're taken out of their swarms' queues, so connect to all of them.
+ */
+static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t max)
 {
-    struct peer_candidate* candidates;
-    struct peer_candidate* walk;
+    auto candidates = std::vector<peer_candidate>{};
     time_t const now = tr_time();
     uint64_t const now_msec = tr_time_msec();
     /* leave 5% of connection slots for incoming connections -- ticket #2609 */
     int const maxCandidates = tr_sessionGetPeerLimit(session) * 0.95;
 
-    /* count how many peers and atoms we've got */
-    int atomCount = 0;
+    /* count how many peers we've got */
     int peerCount = 0;
     for (auto const* tor : session->torrents)
     {
-        atomCount += tr_ptrArraySize(&tor->swarm->pool);
         peerCount += tr_ptrArraySize(&tor->swarm->peers);
     }
 
     /* don't start any new handshakes if we're full up */
     if (maxCandidates <= peerCount)
     {
-        *candidateCount = 0;
-        return nullptr;
+        return candidates;
     }
 
-    /* allocate an array of candidates */
-    walk = candidates = tr_new(struct peer_candidate, atomCount);
+    /* a heap of each torrent's best candidate. Since every swarm's queue is
+       already sorted, merging them costs O(log n) per candidate taken */
+    auto best = std::vector<peer_candidate>{};
+    auto const compare = [](auto const& a, auto const& b) { return a.score > b.score; };
 
-    /* populate the candidate array */
     for (auto* tor : session->torrents)
     {
-        int nAtoms;
-        struct peer_atom** atoms;
-
         if (!tor->swarm->isRunning)
         {
             continue;
@@ -4199,35 +3958,40 @@ static struct peer_candidate* getPeerCandidates(tr_session* session, int* candid
             continue;
         }
 
-        atoms = (struct peer_atom**)tr_ptrArrayPeek(&tor->swarm->pool, &nAtoms);
+        peer_candidate_entry const* const entry = swarmPeekCandidate(tor->swarm, now);
 
-        for (int i = 0; i < nAtoms; ++i)
+        if (entry != nullptr)
         {
-            struct peer_atom* atom = atoms[i];
-
-            if (isPeerCandidate(tor, atom, now))
-            {
-                uint8_t const salt = tr_rand_int_weak(1024);
-                walk->tor = tor;
-                walk->atom = atom;
-                walk->score = getPeerCandidateScore(tor, atom, salt);
-                ++walk;
-            }
+            best.push_back({ getPeerCandidateScore(tor, entry->key), tor, entry->atom });
         }
     }
 
-    auto const n_candidates = walk - candidates;
-    *candidateCount = n_candidates;
-    if (n_candidates > max)
+    std::make_heap(std::begin(best), std::end(best), compare);
+
+    while (std::size(candidates) < max && !std::empty(best))
     {
-        std::partial_sort(
-            candidates,
-            candidates + max,
-            candidates + n_candidates,
-            [](auto const& a, auto const& b) { return a.score < b.score; });
+        std::pop_heap(std::begin(best), std::end(best), compare);
+        auto const candidate = best.back();
+        best.pop_back();
+
+        tr_swarm* const s = candidate.tor->swarm;
+        TR_ASSERT(s->candidates.front().atom == candidate.atom);
+        candidateQueuePop(s->candidates);
+        candidates.push_back(candidate);
+
+        peer_candidate_entry const* const entry = swarmPeekCandidate(s, now);
+
+        if (entry != nullptr)
+        {
+            best.push_back({ getPeerCandidateScore(candidate.tor, entry->key), candidate.tor, entry->atom });
+            std::push_heap(std::begin(best), std::end(best), compare);
+        }
     }
 
-    TR_ASSERT(checkBestScoresComeFirst(candidates, *candidateCount, max));
+    TR_ASSERT(std::is_sorted(
+        std::begin(candidates),
+        std::end(candidates),
+        [](auto const& a, auto const& b) { return a.score < b.score; }));
     return candidates;
 }
 
@@ -4275,6 +4039,11 @@ static void initiateConnection(tr_peerMgr* mgr, tr_swarm* s, struct peer_atom* a
 
     atom->lastConnectionAttemptAt = now;
     atom->time = now;
+
+    if (io == nullptr)
+    {
+        swarmQueueCandidate(s, atom);
+    }
 }
 
 static void initiateCandidateConnection(tr_peerMgr* mgr, struct peer_candidate* c)
@@ -4292,13 +4061,8 @@ static void initiateCandidateConnection(tr_peerMgr* mgr, struct peer_candidate*
 
 static void makeNewPeerConnections(struct tr_peerMgr* mgr, int const max)
 {
-    int n;
-    struct peer_candidate* candidates = getPeerCandidates(mgr->session, &n, max);
-
-    for (int i = 0; i < n && i < max; ++i)
+    for (auto& candidate : getPeerCandidates(mgr->session, max))
     {
-        initiateCandidateConnection(mgr, &candidates[i]);
+        initiateCandidateConnection(mgr, &candidate);
     }
-
-    tr_free(candidates);
 }
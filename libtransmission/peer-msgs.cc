@@ -202,6 +202,7 @@ public:
         , state{ AWAITING_BT_LENGTH }
         , torrent{ torrent_in }
         , outMessages{ evbuffer_new() }
+        , outBlock{ evbuffer_new() }
         , outMessagesBatchedAt{ 0 }
         , io{ io_in }
         , callback_{ callback }
@@ -259,6 +260,7 @@ public:
         }
 
         evbuffer_free(this->outMessages);
+        evbuffer_free(this->outBlock);
         tr_free(this->pex6);
         tr_free(this->pex);
     }
@@ -561,6 +563,12 @@ public:
 
     int prefetchCount = 0;
 
+    /* the next block the peer asked for is being read from disk */
+    bool isWaitingForDisk = false;
+
+    /* that read failed, so the block gets read the slow way to report the error */
+    bool diskReadFailed = false;
+
     /* how long the outMessages batch should be allowed to grow before
      * it's flushed -- some messages (like requests >:) should be sent
      * very quickly; others aren't as urgent. */
@@ -586,6 +594,8 @@ public:
 
     evbuffer* const outMessages; /* all the non-piece messages */
 
+    evbuffer* const outBlock; /* the piece message being sent, reused for each block */
+
     struct peer_request peerAskedFor[REQQ] = {};
 
     int peerAskedForMetadata[METADATA_REQQ] = {};
@@ -984,6 +994,7 @@ static bool requestIsValid(tr_peerMsgsImpl const* msgs, struct peer_request cons
 
 static void sendLtepHandshake(tr_peerMsgsImpl* msgs)
 {
+    auto arena = tr_variant_arena{};
     tr_variant val;
     bool allow_pex;
     struct evbuffer* payload;
@@ -1021,6 +1032,7 @@ static void sendLtepHandshake(tr_peerMsgsImpl* msgs)
         allow_pex = true;
     }
 
+    tr_variantInitArena(&val, &arena);
     tr_variantInitDict(&val, 8);
     tr_variantDictAddBool(&val, TR_KEY_e, msgs->session->encryptionMode != TR_CLEAR_PREFERRED);
 
@@ -1071,6 +1083,7 @@ static void sendLtepHandshake(tr_peerMsgsImpl* msgs)
 static void parseLtepHandshake(tr_peerMsgsImpl* msgs, uint32_t len, struct evbuffer* inbuf)
 {
     int64_t i;
+    auto arena = tr_variant_arena{};
     tr_variant val;
     tr_variant* sub;
     uint8_t* tmp = tr_new(uint8_t, len);
@@ -1083,6 +1096,8 @@ static void parseLtepHandshake(tr_peerMsgsImpl* msgs, uint32_t len, struct evbuf
     tr_peerIoReadBytes(msgs->io, inbuf, tmp, len);
     msgs->peerSentLtepHandshake = true;
 
+    tr_variantInitArena(&val, &arena);
+
     if (tr_variantFromBenc(&val, tmp, len) != 0 || !tr_variantIsDict(&val))
     {
         dbgmsg(msgs, "GET  extended-handshake, couldn't get dictionary");
@@ -1193,7 +1208,9 @@ static void parseUtMetadata(tr_peerMsgsImpl* msgs, uint32_t msglen, struct evbuf
     tr_peerIoReadBytes(msgs->io, inbuf, tmp, msglen);
     char const* const msg_end = (char const*)tmp + msglen;
 
+    auto arena = tr_variant_arena{};
     tr_variant dict;
+    tr_variantInitArena(&dict, &arena);
     char const* benc_end;
     if (tr_variantFromBencFull(&dict, tmp, msglen, nullptr, &benc_end) == 0)
     {
@@ -1264,7 +1281,9 @@ static void parseUtPex(tr_peerMsgsImpl* msgs, uint32_t msglen, struct evbuffer*
     uint8_t* tmp = tr_new(uint8_t, msglen);
     tr_peerIoReadBytes(msgs->io, inbuf, tmp, msglen);
 
+    auto arena = tr_variant_arena{};
     tr_variant val;
+    tr_variantInitArena(&val, &arena);
     bool const loaded = tr_variantFromBenc(&val, tmp, msglen) == 0;
 
     tr_free(tmp);
@@ -1446,7 +1465,7 @@ static void peerMadeRequest(tr_peerMsgsImpl* msgs, struct peer_request const* re
 {
     bool const fext = tr_peerIoSupportsFEXT(msgs->io);
     bool const reqIsValid = requestIsValid(msgs, req);
-    bool const clientHasPiece = reqIsValid && tr_torrentPieceIsComplete(msgs->torrent, req->index);
+    bool const clientHasPiece = reqIsValid && tr_torrentHasVerifiedPiece(msgs->torrent, req->index);
     bool const peerIsChoked = msgs->peer_is_choked_;
 
     bool allow = false;
@@ -2074,6 +2093,68 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 }
 
+static void onBlockRead(tr_torrent* tor, int err, void* vio)
+{
+    auto* const io = static_cast<tr_peerIo*>(vio);
+    auto* const msgs = static_cast<tr_peerMsgsImpl*>(io->userData);
+
+    /* the peer might've been closed while we were reading */
+    if (msgs != nullptr)
+    {
+        msgs->isWaitingForDisk = false;
+        msgs->diskReadFailed = err != 0;
+
+        if (tor != nullptr)
+        {
+            peerPulse(msgs);
+        }
+    }
+
+    tr_peerIoUnref(io); /* balanced by the ref in waitForNextBlock() */
+}
+
+/* If the next block the peer wants isn't in memory, read it on one of the
+ * cache's reader threads instead of blocking the libevent thread on it.
+ * Returns true if the block isn't ready to be sent yet. */
+static bool waitForNextBlock(tr_peerMsgsImpl* msgs)
+{
+    if (msgs->isWaitingForDisk)
+    {
+        return true;
+    }
+
+    if (msgs->diskReadFailed)
+    {
+        msgs->diskReadFailed = false;
+        return false;
+    }
+
+    if (msgs->pendingReqsToClient == 0)
+    {
+        return false;
+    }
+
+    struct peer_request const* req = &msgs->peerAskedFor[0];
+    auto* const cache = msgs->session->cache;
+
+    if (!requestIsValid(msgs, req) || !tr_torrentHasVerifiedPiece(msgs->torrent, req->index) ||
+        !tr_cacheBlockNeedsRead(cache, msgs->torrent, req->index, req->offset, req->length))
+    {
+        return false;
+    }
+
+    tr_peerIoRef(msgs->io);
+
+    if (tr_cacheReadBlockAsync(cache, msgs->torrent, req->index, req->offset, req->length, onBlockRead, msgs->io) != 0)
+    {
+        tr_peerIoUnref(msgs->io);
+        return false;
+    }
+
+    msgs->isWaitingForDisk = true;
+    return true;
+}
+
 static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     int piece;
@@ -2172,35 +2253,32 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     ***  Data Blocks
     **/
 
-    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize && popNextRequest(msgs, &req))
+    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize && !waitForNextBlock(msgs) &&
+        popNextRequest(msgs, &req))
     {
         --msgs->prefetchCount;
 
-        if (requestIsValid(msgs, &req) && tr_torrentPieceIsComplete(msgs->torrent, req.index))
+        if (requestIsValid(msgs, &req) && tr_torrentHasVerifiedPiece(msgs->torrent, req.index))
         {
             bool err;
             uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
-            struct evbuffer* out;
-            struct evbuffer_iovec iovec[1];
-
-            out = evbuffer_new();
-            evbuffer_expand(out, msglen);
+            struct evbuffer* const out = msgs->outBlock;
 
             evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
             evbuffer_add_uint8(out, BT_PIECE);
             evbuffer_add_uint32(out, req.index);
             evbuffer_add_uint32(out, req.offset);
 
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            err = tr_cacheReadBlock(
+            /* tr_peerIoWriteBuf() encrypts into its own output buffer rather
+             * than in place, so every peer can share the cache's copy of the block. */
+            err = tr_cacheReadBlockToBuffer(
                       msgs->session->cache,
                       msgs->torrent,
                       req.index,
                       req.offset,
                       req.length,
-                      static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
+                      out,
+                      true) != 0;
 
             /* check the piece if it needs checking... */
             if (!err && tr_torrentPieceNeedsCheck(msgs->torrent, req.index))
@@ -2234,7 +2312,7 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
                 msgs->blocksSentToPeer.add(tr_time(), 1);
             }
 
-            evbuffer_free(out);
+            evbuffer_drain(out, evbuffer_get_length(out));
 
             if (err)
             {
@@ -2327,7 +2405,7 @@ static void tellPeerWhatWeHave(tr_peerMsgsImpl* msgs)
 {
     bool const fext = tr_peerIoSupportsFEXT(msgs->io);
 
-    if (fext && tr_torrentHasAll(msgs->torrent))
+    if (fext && tr_torrentHasAll(msgs->torrent) && std::empty(msgs->torrent->pendingPieceChecks))
     {
         protocolSendHaveAll(msgs);
     }
@@ -2525,6 +2603,7 @@ static void sendPex(tr_peerMsgsImpl* msgs)
         }
         else
         {
+            auto arena = tr_variant_arena{};
             tr_variant val;
             uint8_t* tmp;
             uint8_t* walk;
@@ -2540,6 +2619,7 @@ static void sendPex(tr_peerMsgsImpl* msgs)
             msgs->pexCount6 = diffs6.elementCount;
 
             /* build the pex payload */
+            tr_variantInitArena(&val, &arena);
             tr_variantInitDict(&val, 3); /* ipv6 support: left as 3: speed vs. likelihood? */
 
             if (diffs.addedCount > 0)
@@ -0,0 +1,322 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring> /* memcmp(), memcpy() */
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+#include "cache.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "inout.h"
+#include "piece-check.h"
+#include "session.h"
+#include "torrent.h"
+#include "tr-assert.h"
+#include "trevent.h"
+
+enum
+{
+    /* the disk is usually the bottleneck, so a couple of threads is plenty */
+    MAX_CHECKER_THREADS = 2
+};
+
+/* part of the piece that wasn't in the cache and has to be read from disk */
+struct check_read
+{
+    uint32_t piece_offset;
+    tr_io_span span;
+};
+
+struct check_job
+{
+    tr_session* session;
+    int torrent_id;
+    tr_piece_index_t piece;
+    tr_piece_check_done_func callback;
+    uint8_t expected_hash[SHA_DIGEST_LENGTH];
+
+    std::vector<uint8_t> buf;
+    std::vector<check_read> reads;
+
+    /* false if some of the piece couldn't be found */
+    bool ok = true;
+    bool pass = false;
+
+    /* set by tr_pieceCheckerRemove() if nobody wants the result anymore */
+    bool is_cancelled = false;
+};
+
+struct tr_piece_checker
+{
+    tr_session* session;
+    std::vector<std::thread> threads;
+
+    /* everything below is guarded by `lock` */
+    std::mutex lock;
+    std::condition_variable work_cv;
+    std::deque<check_job*> work;
+
+    /* jobs that have been taken off `work` but whose results
+     * haven't been delivered to the libevent thread yet */
+    std::vector<check_job*> in_flight;
+
+    bool is_closing = false;
+};
+
+/****
+*****  Worker threads
+****/
+
+static void freeJob(check_job* job)
+{
+    for (auto const& read : job->reads)
+    {
+        tr_sys_file_close(read.span.fd, nullptr);
+    }
+
+    delete job;
+}
+
+static bool readSpan(tr_io_span const& span, uint8_t* buf)
+{
+    uint64_t offset = span.file_offset;
+    uint64_t left = span.length;
+
+    while (left > 0)
+    {
+        uint64_t n_read = 0;
+
+        if (!tr_sys_file_read_at(span.fd, buf, left, offset, &n_read, nullptr) || n_read == 0)
+        {
+            return false;
+        }
+
+        buf += n_read;
+        offset += n_read;
+        left -= n_read;
+    }
+
+    return true;
+}
+
+static void onJobDone(void* vjob)
+{
+    auto* const job = static_cast<check_job*>(vjob);
+    tr_piece_checker* const checker = job->session->pieceChecker;
+
+    if (checker != nullptr)
+    {
+        auto const lock = std::lock_guard(checker->lock);
+        auto& in_flight = checker->in_flight;
+        in_flight.erase(std::find(std::begin(in_flight), std::end(in_flight), job));
+    }
+
+    tr_torrent* const tor = job->is_cancelled ? nullptr : tr_torrentFindFromId(job->session, job->torrent_id);
+
+    if (tor != nullptr)
+    {
+        (*job->callback)(tor, job->piece, job->pass);
+    }
+
+    freeJob(job);
+}
+
+static void checkJob(check_job* job)
+{
+    for (auto const& read : job->reads)
+    {
+        if (job->ok && !readSpan(read.span, &job->buf[read.piece_offset]))
+        {
+            job->ok = false;
+        }
+    }
+
+    if (job->ok)
+    {
+        uint8_t hash[SHA_DIGEST_LENGTH];
+        tr_sha1_ctx_t sha = tr_sha1_init();
+        tr_sha1_update(sha, std::data(job->buf), std::size(job->buf));
+        tr_sha1_final(sha, hash);
+        job->pass = memcmp(hash, job->expected_hash, SHA_DIGEST_LENGTH) == 0;
+    }
+}
+
+static void workerThreadFunc(tr_piece_checker* checker)
+{
+    auto lock = std::unique_lock(checker->lock);
+
+    for (;;)
+    {
+        checker->work_cv.wait(lock, [checker]() { return checker->is_closing || !std::empty(checker->work); });
+
+        if (checker->is_closing)
+        {
+            break;
+        }
+
+        auto* const job = checker->work.front();
+        checker->work.pop_front();
+        checker->in_flight.push_back(job);
+
+        lock.unlock();
+        checkJob(job);
+        tr_runInEventThread(job->session, onJobDone, job);
+        lock.lock();
+    }
+}
+
+/***
+****
+***/
+
+tr_piece_checker* tr_pieceCheckerNew(tr_session* session)
+{
+    auto* const checker = new tr_piece_checker{};
+    checker->session = session;
+
+    auto const n_threads = std::clamp(int(std::thread::hardware_concurrency()), 1, int{ MAX_CHECKER_THREADS });
+
+    for (int i = 0; i < n_threads; ++i)
+    {
+        checker->threads.emplace_back(workerThreadFunc, checker);
+    }
+
+    return checker;
+}
+
+void tr_pieceCheckerFree(tr_piece_checker* checker)
+{
+    {
+        auto const lock = std::lock_guard(checker->lock);
+        checker->is_closing = true;
+    }
+
+    checker->work_cv.notify_all();
+
+    for (auto& thread : checker->threads)
+    {
+        thread.join();
+    }
+
+    /* the torrents are gone by now, so nobody's waiting on these.
+     * Jobs in `in_flight` are freed by their pending onJobDone() */
+    for (auto* job : checker->work)
+    {
+        freeJob(job);
+    }
+
+    delete checker;
+}
+
+void tr_pieceCheckerRemove(tr_piece_checker* checker, tr_torrent const* tor)
+{
+    TR_ASSERT(tr_amInEventThread(tor->session));
+
+    auto const lock = std::lock_guard(checker->lock);
+    auto& work = checker->work;
+
+    for (auto* job : checker->in_flight)
+    {
+        if (job->torrent_id == tor->uniqueId)
+        {
+            job->is_cancelled = true;
+        }
+    }
+
+    for (auto it = std::begin(work); it != std::end(work);)
+    {
+        if ((*it)->torrent_id == tor->uniqueId)
+        {
+            freeJob(*it);
+            it = work.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/* queue up disk reads for the part of the piece in [begin...end) */
+static void addReads(check_job* job, tr_torrent* tor, uint32_t begin, uint32_t end)
+{
+    auto spans = std::vector<tr_io_span>{};
+
+    if (!job->ok || tr_ioPrepareRead(tor, job->piece, begin, end - begin, spans) != 0)
+    {
+        job->ok = false;
+        return;
+    }
+
+    for (auto const& span : spans)
+    {
+        job->reads.push_back({ begin, span });
+        begin += span.length;
+    }
+}
+
+void tr_pieceCheckerAdd(
+    tr_piece_checker* checker,
+    tr_torrent* tor,
+    tr_piece_index_t piece,
+    tr_piece_check_done_func callback)
+{
+    TR_ASSERT(tr_amInEventThread(tor->session));
+    TR_ASSERT(piece < tor->info.pieceCount);
+
+    auto* const job = new check_job{};
+    job->session = tor->session;
+    job->torrent_id = tor->uniqueId;
+    job->piece = piece;
+    job->callback = callback;
+    memcpy(job->expected_hash, tor->info.pieces[piece].hash, SHA_DIGEST_LENGTH);
+
+    uint32_t const piece_size = tr_torPieceCountBytes(tor, piece);
+    job->buf.resize(piece_size);
+
+    /* take what we can from the cache and leave the gaps for the worker to read */
+    uint32_t gap_begin = 0;
+    bool in_gap = false;
+
+    for (uint32_t offset = 0; offset < piece_size; offset += tor->blockSize)
+    {
+        uint32_t const len = std::min(tor->blockSize, piece_size - offset);
+
+        if (tr_cacheCopyBlock(tor->session->cache, tor, piece, offset, len, &job->buf[offset]))
+        {
+            if (in_gap)
+            {
+                addReads(job, tor, gap_begin, offset);
+                in_gap = false;
+            }
+        }
+        else if (!in_gap)
+        {
+            gap_begin = offset;
+            in_gap = true;
+        }
+    }
+
+    if (in_gap)
+    {
+        addReads(job, tor, gap_begin, piece_size);
+    }
+
+    {
+        auto const lock = std::lock_guard(checker->lock);
+        checker->work.push_back(job);
+    }
+
+    checker->work_cv.notify_one();
+}
@@ -0,0 +1,52 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include "transmission.h"
+
+struct tr_piece_checker;
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/* invoked in the libevent thread with the result of a piece check.
+ * It isn't invoked if the torrent was removed while its piece was being checked. */
+using tr_piece_check_done_func = void (*)(tr_torrent* tor, tr_piece_index_t piece, bool pass);
+
+tr_piece_checker* tr_pieceCheckerNew(tr_session* session);
+
+void tr_pieceCheckerFree(tr_piece_checker* checker);
+
+/**
+ * Checks a piece's SHA-1 on one of the checker's worker threads.
+ *
+ * Whatever parts of the piece are still in the block cache are copied out of
+ * it right away; the rest are read from disk by the worker. Must be called
+ * from the libevent thread.
+ */
+void tr_pieceCheckerAdd(
+    tr_piece_checker* checker,
+    tr_torrent* tor,
+    tr_piece_index_t piece,
+    tr_piece_check_done_func callback);
+
+/**
+ * Cancels all of a torrent's piece checks. Queued checks are dropped, and
+ * the callbacks of the ones that are already running won't be invoked.
+ * Must be called from the libevent thread.
+ */
+void tr_pieceCheckerRemove(tr_piece_checker* checker, tr_torrent const* tor);
+
+/* @} */
@@ -0,0 +1,260 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <functional> // std::greater
+#include <utility>
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "crypto-utils.h" /* tr_rand_int_weak() */
+#include "piece-picker.h"
+#include "tr-assert.h"
+
+enum
+{
+    /* a peer is "sparse" if it has fewer than 1/SPARSE_RATIO of the pieces we want */
+    SPARSE_RATIO = 128
+};
+
+tr_piece_picker::tr_piece_picker(tr_piece_index_t piece_count)
+    : pieces_(piece_count)
+{
+}
+
+void tr_piece_picker::link(tr_piece_index_t piece)
+{
+    auto& node = pieces_[piece];
+    auto const group = groupOf(node);
+    auto& buckets = buckets_[group];
+
+    if (std::size(buckets) <= node.replication)
+    {
+        buckets.resize(node.replication + 1);
+    }
+
+    auto& b = buckets[node.replication];
+
+    if (node.state == State::Partial && b.head != NoPiece)
+    {
+        linkByRemaining(b, piece);
+    }
+    /* add it to either end so that equal pieces come out in a random-ish order */
+    else if (b.head == NoPiece)
+    {
+        node.prev = node.next = NoPiece;
+        b.head = b.tail = piece;
+    }
+    else if ((node.salt & 1) != 0)
+    {
+        node.prev = NoPiece;
+        node.next = b.head;
+        pieces_[b.head].prev = piece;
+        b.head = piece;
+    }
+    else
+    {
+        node.prev = b.tail;
+        node.next = NoPiece;
+        pieces_[b.tail].next = piece;
+        b.tail = piece;
+    }
+
+    ++group_sizes_[group];
+}
+
+/* started pieces are kept sorted so that the ones closest to being finished come first.
+   There are only as many of them as we have requests out, so the walk is short. */
+void tr_piece_picker::linkByRemaining(bucket_list& b, tr_piece_index_t piece)
+{
+    auto& node = pieces_[piece];
+    auto const goes_before = [this, &node](tr_piece_index_t other)
+    {
+        auto const remaining = pieces_[other].remaining;
+        return node.remaining < remaining || (node.remaining == remaining && (node.salt & 1) != 0);
+    };
+
+    auto next = b.head;
+    while (next != NoPiece && !goes_before(next))
+    {
+        next = pieces_[next].next;
+    }
+
+    node.next = next;
+    node.prev = next != NoPiece ? pieces_[next].prev : b.tail;
+    (node.prev != NoPiece ? pieces_[node.prev].next : b.head) = piece;
+    (next != NoPiece ? pieces_[next].prev : b.tail) = piece;
+}
+
+void tr_piece_picker::unlink(tr_piece_index_t piece)
+{
+    auto& node = pieces_[piece];
+    auto const group = groupOf(node);
+    auto& b = buckets_[group][node.replication];
+
+    (node.prev != NoPiece ? pieces_[node.prev].next : b.head) = node.next;
+    (node.next != NoPiece ? pieces_[node.next].prev : b.tail) = node.prev;
+    node.prev = node.next = NoPiece;
+
+    --group_sizes_[group];
+}
+
+void tr_piece_picker::add(
+    tr_piece_index_t piece,
+    tr_priority_t priority,
+    uint16_t replication,
+    State state,
+    uint32_t remaining)
+{
+    TR_ASSERT(piece < pieceCount());
+    TR_ASSERT(priority >= TR_PRI_LOW && priority <= TR_PRI_HIGH);
+
+    auto& node = pieces_[piece];
+
+    if (node.is_wanted)
+    {
+        unlink(piece);
+    }
+    else
+    {
+        node.is_wanted = true;
+        node.salt = uint16_t(tr_rand_int_weak(UINT16_MAX + 1));
+        ++size_;
+    }
+
+    node.priority = priority;
+    node.replication = replication;
+    node.state = state;
+    node.remaining = state == State::Partial ? remaining : 0;
+    link(piece);
+}
+
+void tr_piece_picker::remove(tr_piece_index_t piece)
+{
+    TR_ASSERT(piece < pieceCount());
+
+    auto& node = pieces_[piece];
+
+    if (node.is_wanted)
+    {
+        unlink(piece);
+        node.is_wanted = false;
+        --size_;
+    }
+}
+
+void tr_piece_picker::clear()
+{
+    for (auto& node : pieces_)
+    {
+        node = piece_node{};
+    }
+
+    for (auto& buckets : buckets_)
+    {
+        buckets.clear();
+    }
+
+    group_sizes_ = {};
+    size_ = 0;
+}
+
+void tr_piece_picker::setPriority(tr_piece_index_t piece, tr_priority_t priority)
+{
+    auto& node = pieces_[piece];
+
+    if (node.is_wanted && node.priority != priority)
+    {
+        unlink(piece);
+        node.priority = priority;
+        link(piece);
+    }
+}
+
+void tr_piece_picker::setReplication(tr_piece_index_t piece, uint16_t replication)
+{
+    auto& node = pieces_[piece];
+
+    if (node.is_wanted && node.replication != replication)
+    {
+        unlink(piece);
+        node.replication = replication;
+        link(piece);
+    }
+}
+
+void tr_piece_picker::setReplication(uint16_t const* replication)
+{
+    for (tr_piece_index_t piece = 0, n = pieceCount(); piece < n; ++piece)
+    {
+        setReplication(piece, replication[piece]);
+    }
+}
+
+void tr_piece_picker::setState(tr_piece_index_t piece, State state, uint32_t remaining)
+{
+    auto& node = pieces_[piece];
+
+    if (state != State::Partial)
+    {
+        remaining = 0;
+    }
+
+    if (node.is_wanted && (node.state != state || node.remaining != remaining))
+    {
+        unlink(piece);
+        node.state = state;
+        node.remaining = remaining;
+        link(piece);
+    }
+}
+
+bool tr_piece_picker::isSparse(tr_bitfield const* have) const
+{
+    if (tr_bitfieldHasAll(have))
+    {
+        return false;
+    }
+
+    return have->true_count * SPARSE_RATIO < size_;
+}
+
+std::vector<std::pair<uint64_t, tr_piece_index_t>> tr_piece_picker::sparseCandidates(tr_bitfield const* have) const
+{
+    auto candidates = std::vector<std::pair<uint64_t, tr_piece_index_t>>{};
+    candidates.reserve(have->true_count);
+
+    /* skip over the peer's empty bytes instead of testing every piece */
+    auto const n_pieces = std::size(pieces_);
+    auto const n_bytes = std::min(have->alloc_count, (n_pieces + 7) / 8);
+
+    for (size_t i = 0; i < n_bytes; ++i)
+    {
+        if (have->bits[i] == 0)
+        {
+            continue;
+        }
+
+        for (size_t bit = 0; bit < 8 && i * 8 + bit < n_pieces; ++bit)
+        {
+            auto const piece = tr_piece_index_t(i * 8 + bit);
+            auto const& node = pieces_[piece];
+
+            if ((have->bits[i] << bit & 0x80) != 0 && node.is_wanted)
+            {
+                auto const remaining = std::min(node.remaining, uint32_t{ UINT16_MAX });
+                auto const key = uint64_t{ groupOf(node) } << 48 | uint64_t{ node.replication } << 32 |
+                    uint64_t{ remaining } << 16 | node.salt;
+                candidates.emplace_back(key, piece);
+            }
+        }
+    }
+
+    std::make_heap(std::begin(candidates), std::end(candidates), std::greater<>{});
+    return candidates;
+}
@@ -0,0 +1,201 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint>
+#include <functional> // std::greater
+#include <utility> // std::pair
+#include <vector>
+
+#include "transmission.h"
+#include "bitfield.h"
+
+/**
+ * The pieces we still want, kept in the order we'd like to request them:
+ *
+ * 1. pieces we've started but haven't requested all of yet, so that they
+ *    get finished and can be shared; then untouched pieces; then pieces
+ *    whose blocks have all been requested (which only matter in endgame)
+ * 2. higher priorities before lower ones
+ * 3. rarest first
+ * 4. for started pieces, the fewest blocks left to request first
+ * 5. random
+ *
+ * Each (state, priority, replication) combination is a bucket with its own
+ * intrusive list of pieces, so adding and removing pieces or changing one
+ * of those properties is O(1) and walking the pieces in order never sorts.
+ * The exception is started pieces, which are inserted in order of how many
+ * blocks they have left; there are only as many of those as we have
+ * requests out, so that's a short walk.
+ */
+class tr_piece_picker
+{
+public:
+    enum class State : uint8_t
+    {
+        Partial,
+        Untouched,
+        Requested
+    };
+
+    tr_piece_picker() = default;
+    explicit tr_piece_picker(tr_piece_index_t piece_count);
+
+    [[nodiscard]] tr_piece_index_t pieceCount() const
+    {
+        return tr_piece_index_t(std::size(pieces_));
+    }
+
+    /* number of pieces that are wanted */
+    [[nodiscard]] size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] bool isWanted(tr_piece_index_t piece) const
+    {
+        return pieces_[piece].is_wanted;
+    }
+
+    [[nodiscard]] State state(tr_piece_index_t piece) const
+    {
+        return pieces_[piece].state;
+    }
+
+    /* `remaining` is the number of blocks left to request, which only matters for Partial pieces */
+    void add(tr_piece_index_t piece, tr_priority_t priority, uint16_t replication, State state, uint32_t remaining = 0);
+
+    void remove(tr_piece_index_t piece);
+
+    void clear();
+
+    /* these are no-ops for pieces that aren't wanted */
+    void setPriority(tr_piece_index_t piece, tr_priority_t priority);
+    void setReplication(tr_piece_index_t piece, uint16_t replication);
+    void setState(tr_piece_index_t piece, State state, uint32_t remaining = 0);
+
+    /**
+     * Catches up with a whole array of replication counts, e.g. after a peer's
+     * bitfield was added to or removed from them. This is a single pass over
+     * the pieces that only moves the ones whose count changed.
+     */
+    void setReplication(uint16_t const* replication);
+
+    /**
+     * Passes the wanted pieces to `func` in the order they should be requested
+     * until it returns false. `func` mustn't change the picker.
+     */
+    template<typename Func>
+    void forEach(Func func) const
+    {
+        for (size_t group = 0; group < NumGroups; ++group)
+        {
+            if (group_sizes_[group] == 0)
+            {
+                continue;
+            }
+
+            for (auto const& bucket : buckets_[group])
+            {
+                for (auto piece = bucket.head; piece != NoPiece; piece = pieces_[piece].next)
+                {
+                    if (!func(piece))
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Like forEach(), but only visits pieces that are in `have`.
+     *
+     * If `have` is sparse compared to the wanted pieces, its pieces are picked
+     * out and heapified instead of walking past the pieces the peer doesn't
+     * have, so only as many of them get sorted as `func` looks at.
+     */
+    template<typename Func>
+    void forEach(tr_bitfield const* have, Func func) const
+    {
+        if (!isSparse(have))
+        {
+            forEach([&func, have](tr_piece_index_t piece) { return !tr_bitfieldHas(have, piece) || func(piece); });
+            return;
+        }
+
+        auto candidates = sparseCandidates(have);
+
+        while (!std::empty(candidates))
+        {
+            std::pop_heap(std::begin(candidates), std::end(candidates), std::greater<>{});
+            auto const piece = candidates.back().second;
+            candidates.pop_back();
+
+            if (!func(piece))
+            {
+                return;
+            }
+        }
+    }
+
+private:
+    static constexpr auto NoPiece = ~tr_piece_index_t{ 0 };
+    static constexpr size_t NumPriorities = 3;
+    static constexpr size_t NumGroups = 3 * NumPriorities;
+
+    struct piece_node
+    {
+        tr_piece_index_t prev = NoPiece;
+        tr_piece_index_t next = NoPiece;
+        uint32_t remaining = 0;
+        uint16_t replication = 0;
+        uint16_t salt = 0;
+        tr_priority_t priority = TR_PRI_NORMAL;
+        State state = State::Untouched;
+        bool is_wanted = false;
+    };
+
+    struct bucket_list
+    {
+        tr_piece_index_t head = NoPiece;
+        tr_piece_index_t tail = NoPiece;
+    };
+
+    [[nodiscard]] static size_t groupOf(piece_node const& node)
+    {
+        return size_t(node.state) * NumPriorities + size_t(TR_PRI_HIGH - node.priority);
+    }
+
+    [[nodiscard]] bool isSparse(tr_bitfield const* have) const;
+
+    /* a min-heap of the wanted pieces in `have`, keyed by their order in the picker */
+    [[nodiscard]] std::vector<std::pair<uint64_t, tr_piece_index_t>> sparseCandidates(tr_bitfield const* have) const;
+
+    void link(tr_piece_index_t piece);
+    void linkByRemaining(bucket_list& b, tr_piece_index_t piece);
+    void unlink(tr_piece_index_t piece);
+
+    std::vector<piece_node> pieces_;
+    std::array<std::vector<bucket_list>, NumGroups> buckets_;
+    std::array<size_t, NumGroups> group_sizes_ = {};
+    size_t size_ = 0;
+};
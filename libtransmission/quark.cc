@@ -21,7 +21,7 @@
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 388>{ "",
+auto constexpr my_static = std::array<std::string_view, 395>{ "",
                                                               "activeTorrentCount",
                                                               "activity-date",
                                                               "activityDate",
@@ -231,6 +231,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "peer-port-random-low",
                                                               "peer-port-random-on-start",
                                                               "peer-socket-tos",
+                                                              "peer-socket-zerocopy",
                                                               "peerIsChoked",
                                                               "peerIsInterested",
                                                               "peers",
@@ -271,9 +272,11 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "queue-stalled-minutes",
                                                               "queuePosition",
                                                               "rateDownload",
+                                                              "rateDownloadLimit",
                                                               "rateToClient",
                                                               "rateToPeer",
                                                               "rateUpload",
+                                                              "rateUploadLimit",
                                                               "ratio-limit",
                                                               "ratio-limit-enabled",
                                                               "ratio-mode",
@@ -292,6 +295,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "rename-partial-files",
                                                               "reqq",
                                                               "result",
+                                                              "revision",
                                                               "rpc-authentication-required",
                                                               "rpc-bind-address",
                                                               "rpc-enabled",
@@ -334,6 +338,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "show-statusbar",
                                                               "show-toolbar",
                                                               "show-tracker-scrapes",
+                                                              "since",
                                                               "size-bytes",
                                                               "size-units",
                                                               "sizeWhenDone",
@@ -402,6 +407,8 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "ut_recommend",
                                                               "utp-enabled",
                                                               "v",
+                                                              "verify-io-limit-mb",
+                                                              "verify-threads",
                                                               "version",
                                                               "wanted",
                                                               "warning message",
@@ -232,6 +232,7 @@ enum
     TR_KEY_peer_port_random_low,
     TR_KEY_peer_port_random_on_start,
     TR_KEY_peer_socket_tos,
+    TR_KEY_peer_socket_zerocopy,
     TR_KEY_peerIsChoked,
     TR_KEY_peerIsInterested,
     TR_KEY_peers,
@@ -272,9 +273,11 @@ enum
     TR_KEY_queue_stalled_minutes,
     TR_KEY_queuePosition,
     TR_KEY_rateDownload,
+    TR_KEY_rateDownloadLimit,
     TR_KEY_rateToClient,
     TR_KEY_rateToPeer,
     TR_KEY_rateUpload,
+    TR_KEY_rateUploadLimit,
     TR_KEY_ratio_limit,
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
@@ -293,6 +296,7 @@ enum
     TR_KEY_rename_partial_files,
     TR_KEY_reqq,
     TR_KEY_result,
+    TR_KEY_revision,
     TR_KEY_rpc_authentication_required,
     TR_KEY_rpc_bind_address,
     TR_KEY_rpc_enabled,
@@ -335,6 +339,7 @@ enum
     TR_KEY_show_statusbar,
     TR_KEY_show_toolbar,
     TR_KEY_show_tracker_scrapes,
+    TR_KEY_since,
     TR_KEY_size_bytes,
     TR_KEY_size_units,
     TR_KEY_sizeWhenDone,
@@ -403,6 +408,8 @@ enum
     TR_KEY_ut_recommend,
     TR_KEY_utp_enabled,
     TR_KEY_v,
+    TR_KEY_verify_io_limit_mb,
+    TR_KEY_verify_threads,
     TR_KEY_version,
     TR_KEY_wanted,
     TR_KEY_warning_message,
@@ -0,0 +1,307 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <cstddef> // size_t
+#include <ctime> // time_t
+#include <unordered_map>
+
+#include "transmission.h" // tr_block_index_t
+#include "tr-assert.h"
+
+/**
+ * The blocks a swarm has requested and is still waiting on, indexed both by
+ * block and by peer.
+ *
+ * Each block keeps its requests in a couple of inline slots -- we never ask
+ * more than two peers for the same block, even in endgame -- and each peer's
+ * requests are threaded together in the order they were sent. That makes
+ * adding, finding, and removing a request O(1), dropping all of a peer's
+ * requests O(that peer's requests), and finding timed-out requests
+ * O(timed-out requests + peers) since each peer's oldest requests are first.
+ */
+template<typename Peer>
+class tr_request_table
+{
+public:
+    static constexpr size_t MaxPeersPerBlock = 2;
+
+    struct request
+    {
+        tr_block_index_t block = {};
+        Peer* peer = nullptr;
+        time_t sent_at = {};
+
+    private:
+        friend class tr_request_table;
+
+        request* prev = nullptr;
+        request* next = nullptr;
+    };
+
+    /* the peers that a block has been requested from */
+    class peer_set
+    {
+    public:
+        [[nodiscard]] size_t size() const
+        {
+            return n_;
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            return n_ == 0;
+        }
+
+        [[nodiscard]] Peer* operator[](size_t i) const
+        {
+            return peers_[i];
+        }
+
+        [[nodiscard]] Peer* const* begin() const
+        {
+            return std::data(peers_);
+        }
+
+        [[nodiscard]] Peer* const* end() const
+        {
+            return std::data(peers_) + n_;
+        }
+
+    private:
+        friend class tr_request_table;
+
+        std::array<Peer*, MaxPeersPerBlock> peers_ = {};
+        size_t n_ = 0;
+    };
+
+    tr_request_table() = default;
+    tr_request_table(tr_request_table const&) = delete;
+    tr_request_table& operator=(tr_request_table const&) = delete;
+
+    /* total number of outstanding requests */
+    [[nodiscard]] size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] size_t count(Peer const* peer) const
+    {
+        auto const it = by_peer_.find(peer);
+        return it == std::end(by_peer_) ? 0 : it->second.size;
+    }
+
+    [[nodiscard]] bool has(tr_block_index_t block, Peer const* peer) const
+    {
+        auto const it = by_block_.find(block);
+        return it != std::end(by_block_) && findSlot(it->second, peer) != nullptr;
+    }
+
+    [[nodiscard]] peer_set peers(tr_block_index_t block) const
+    {
+        auto set = peer_set{};
+
+        if (auto const it = by_block_.find(block); it != std::end(by_block_))
+        {
+            for (auto const& slot : it->second.slots)
+            {
+                if (slot.peer != nullptr)
+                {
+                    set.peers_[set.n_++] = slot.peer;
+                }
+            }
+        }
+
+        return set;
+    }
+
+    /* returns false if `block` has already been requested from `peer` or from too many peers */
+    bool add(tr_block_index_t block, Peer* peer, time_t sent_at)
+    {
+        TR_ASSERT(peer != nullptr);
+
+        auto& slots = by_block_[block].slots;
+        request* empty_slot = nullptr;
+
+        for (auto& slot : slots)
+        {
+            if (slot.peer == peer)
+            {
+                return false;
+            }
+
+            if (slot.peer == nullptr && empty_slot == nullptr)
+            {
+                empty_slot = &slot;
+            }
+        }
+
+        if (empty_slot == nullptr)
+        {
+            return false;
+        }
+
+        empty_slot->block = block;
+        empty_slot->peer = peer;
+        empty_slot->sent_at = sent_at;
+
+        auto& list = by_peer_[peer];
+        empty_slot->prev = list.tail;
+        empty_slot->next = nullptr;
+        (list.tail != nullptr ? list.tail->next : list.head) = empty_slot;
+        list.tail = empty_slot;
+        ++list.size;
+
+        ++size_;
+        return true;
+    }
+
+    /* returns false if there wasn't any such request */
+    bool remove(tr_block_index_t block, Peer const* peer)
+    {
+        auto const it = by_block_.find(block);
+
+        if (it == std::end(by_block_))
+        {
+            return false;
+        }
+
+        auto* const slot = findSlot(it->second, peer);
+
+        if (slot == nullptr)
+        {
+            return false;
+        }
+
+        unlink(slot);
+
+        if (isEmpty(it->second))
+        {
+            by_block_.erase(it);
+        }
+
+        return true;
+    }
+
+    /* removes all of `peer`'s requests, oldest first, passing each one to `func` before it's removed */
+    template<typename Func>
+    void remove(Peer const* peer, Func func)
+    {
+        auto const it = by_peer_.find(peer);
+
+        if (it == std::end(by_peer_))
+        {
+            return;
+        }
+
+        // unlink() erases the list once it's empty, so don't touch `it` after the last one
+        for (auto n = it->second.size; n > 0; --n)
+        {
+            auto* const req = it->second.head;
+            auto const block = req->block;
+            func(static_cast<request const&>(*req));
+            unlink(req);
+
+            if (auto const bit = by_block_.find(block); isEmpty(bit->second))
+            {
+                by_block_.erase(bit);
+            }
+        }
+    }
+
+    /* passes each request that was sent at or before `cutoff` to `func` */
+    template<typename Func>
+    void forEachSentBy(time_t cutoff, Func func) const
+    {
+        for (auto const& [peer, list] : by_peer_)
+        {
+            for (request const* req = list.head; req != nullptr && req->sent_at <= cutoff; req = req->next)
+            {
+                func(*req);
+            }
+        }
+    }
+
+private:
+    struct block_requests
+    {
+        std::array<request, MaxPeersPerBlock> slots;
+    };
+
+    struct peer_requests
+    {
+        request* head = nullptr;
+        request* tail = nullptr;
+        size_t size = 0;
+    };
+
+    [[nodiscard]] static request* findSlot(block_requests const& reqs, Peer const* peer)
+    {
+        if (peer == nullptr)
+        {
+            return nullptr;
+        }
+
+        for (auto const& slot : reqs.slots)
+        {
+            if (slot.peer == peer)
+            {
+                return const_cast<request*>(&slot);
+            }
+        }
+
+        return nullptr;
+    }
+
+    [[nodiscard]] static bool isEmpty(block_requests const& reqs)
+    {
+        for (auto const& slot : reqs.slots)
+        {
+            if (slot.peer != nullptr)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void unlink(request* req)
+    {
+        auto const it = by_peer_.find(req->peer);
+        TR_ASSERT(it != std::end(by_peer_));
+        auto& list = it->second;
+
+        (req->prev != nullptr ? req->prev->next : list.head) = req->next;
+        (req->next != nullptr ? req->next->prev : list.tail) = req->prev;
+
+        if (--list.size == 0)
+        {
+            by_peer_.erase(it);
+        }
+
+        *req = request{};
+        --size_;
+    }
+
+    // std::unordered_map never moves its elements, so the per-peer lists can point into it
+    std::unordered_map<tr_block_index_t, block_requests> by_block_;
+    std::unordered_map<Peer const*, peer_requests> by_peer_;
+    size_t size_ = 0;
+};
@@ -568,8 +568,28 @@ static void saveProgress(tr_variant* dict, tr_torrent* tor)
         tr_variantDictAddStr(prog, TR_KEY_have, "all");
     }
 
-    /* add the blocks bitfield */
-    bitfieldToBenc(&tor->completion.blockBitfield, tr_variantDictAdd(prog, TR_KEY_blocks));
+    /* add the blocks bitfield, leaving out any pieces that haven't passed their checks yet */
+    if (std::empty(tor->pendingPieceChecks))
+    {
+        bitfieldToBenc(&tor->completion.blockBitfield, tr_variantDictAdd(prog, TR_KEY_blocks));
+    }
+    else
+    {
+        struct tr_bitfield blocks = {};
+        tr_bitfieldConstruct(&blocks, tor->blockCount);
+        tr_bitfieldSetFromBitfield(&blocks, &tor->completion.blockBitfield);
+
+        for (auto const piece : tor->pendingPieceChecks)
+        {
+            tr_block_index_t first;
+            tr_block_index_t last;
+            tr_torGetPieceBlockRange(tor, piece, &first, &last);
+            tr_bitfieldRemRange(&blocks, first, last + 1);
+        }
+
+        bitfieldToBenc(&blocks, tr_variantDictAdd(prog, TR_KEY_blocks));
+        tr_bitfieldDestruct(&blocks);
+    }
 }
 
 static uint64_t loadProgress(tr_variant* dict, tr_torrent* tor)
@@ -729,6 +749,7 @@ static uint64_t loadProgress(tr_variant* dict, tr_torrent* tor)
 void tr_torrentSaveResume(tr_torrent* tor)
 {
     int err;
+    auto arena = tr_variant_arena{};
     tr_variant top;
     char* filename;
 
@@ -737,6 +758,7 @@ void tr_torrentSaveResume(tr_torrent* tor)
         return;
     }
 
+    tr_variantInitArena(&top, &arena);
     tr_variantInitDict(&top, 50); /* arbitrary "big enough" number */
     tr_variantDictAddInt(&top, TR_KEY_seeding_time_seconds, tor->secondsSeeding);
     tr_variantDictAddInt(&top, TR_KEY_downloading_time_seconds, tor->secondsDownloading);
@@ -792,6 +814,7 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
     int64_t i;
     char const* str;
     char* filename;
+    auto arena = tr_variant_arena{};
     tr_variant top;
     bool boolVal;
     uint64_t fieldsLoaded = 0;
@@ -804,6 +827,7 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
     }
 
     filename = getResumeFilename(tor, TR_METAINFO_BASENAME_HASH);
+    tr_variantInitArena(&top, &arena);
 
     if (!tr_variantFromFile(&top, TR_VARIANT_FMT_BENC, filename, &error))
     {
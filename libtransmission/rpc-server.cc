@@ -11,6 +11,7 @@
 #include <cstring> /* memcpy */
 #include <list>
 #include <string>
+#include <vector>
 
 #include <zlib.h>
 
@@ -281,17 +282,92 @@ static char const* mimetype_guess(char const* path)
     return "application/octet-stream";
 }
 
+static bool accepts_gzip(struct evhttp_request* req)
+{
+    char const* key = "Accept-Encoding";
+    char const* encoding = evhttp_find_header(req->input_headers, key);
+    return encoding != nullptr && strstr(encoding, "gzip") != nullptr;
+}
+
+static z_stream* get_deflate_stream(struct tr_rpc_server* server)
+{
+    if (!server->isStreamInitialized)
+    {
+        int compressionLevel;
+
+        server->isStreamInitialized = true;
+        server->stream.zalloc = (alloc_func)Z_NULL;
+        server->stream.zfree = (free_func)Z_NULL;
+        server->stream.opaque = (voidpf)Z_NULL;
+
+        /* zlib's manual says: "Add 16 to windowBits to write a simple gzip header
+         * and trailer around the compressed data instead of a zlib wrapper." */
+#ifdef TR_LIGHTWEIGHT
+        compressionLevel = Z_DEFAULT_COMPRESSION;
+#else
+        compressionLevel = Z_BEST_COMPRESSION;
+#endif
+        deflateInit2(&server->stream, compressionLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+
+    return &server->stream;
+}
+
+/* deflate all of `in' into `out' and drain it from `in'.
+ * `flush' is passed on to deflate() once the input is used up */
+static void add_deflated(z_stream* stream, struct evbuffer* out, struct evbuffer* in, int flush)
+{
+    int const n_in = evbuffer_peek(in, -1, nullptr, nullptr, 0);
+    auto iovec_in = std::vector<struct evbuffer_iovec>(n_in);
+    evbuffer_peek(in, -1, nullptr, std::data(iovec_in), n_in);
+
+    for (int i = 0; i <= n_in; ++i)
+    {
+        bool const is_last = i == n_in;
+
+        if (is_last && flush == Z_NO_FLUSH)
+        {
+            break;
+        }
+
+        int const mode = is_last ? flush : Z_NO_FLUSH;
+        stream->next_in = is_last ? nullptr : static_cast<Bytef*>(iovec_in[i].iov_base);
+        stream->avail_in = is_last ? 0 : iovec_in[i].iov_len;
+
+        for (;;)
+        {
+            struct evbuffer_iovec iovec_out[1];
+            evbuffer_reserve_space(out, 16 * 1024, iovec_out, 1);
+            stream->next_out = static_cast<Bytef*>(iovec_out[0].iov_base);
+            stream->avail_out = iovec_out[0].iov_len;
+            int const state = deflate(stream, mode);
+            iovec_out[0].iov_len -= stream->avail_out;
+            evbuffer_commit_space(out, iovec_out, 1);
+
+            /* Z_STREAM_END, or an error */
+            if (state != Z_OK && state != Z_BUF_ERROR)
+            {
+                break;
+            }
+
+            /* all of the input's been used and there's no more output pending */
+            if (stream->avail_out != 0 && mode != Z_FINISH)
+            {
+                break;
+            }
+        }
+    }
+
+    evbuffer_drain(in, evbuffer_get_length(in));
+}
+
 static void add_response(
     struct evhttp_request* req,
     struct tr_rpc_server* server,
     struct evbuffer* out,
     struct evbuffer* content)
 {
-    char const* key = "Accept-Encoding";
-    char const* encoding = evhttp_find_header(req->input_headers, key);
-    bool const do_compress = encoding != nullptr && strstr(encoding, "gzip") != nullptr;
-
-    if (!do_compress)
+    if (!accepts_gzip(req))
     {
         evbuffer_add_buffer(out, content);
     }
@@ -302,24 +378,7 @@ static void add_response(
         void* content_ptr = evbuffer_pullup(content, -1);
         size_t const content_len = evbuffer_get_length(content);
 
-        if (!server->isStreamInitialized)
-        {
-            int compressionLevel;
-
-            server->isStreamInitialized = true;
-            server->stream.zalloc = (alloc_func)Z_NULL;
-            server->stream.zfree = (free_func)Z_NULL;
-            server->stream.opaque = (voidpf)Z_NULL;
-
-            /* zlib's manual says: "Add 16 to windowBits to write a simple gzip header
-             * and trailer around the compressed data instead of a zlib wrapper." */
-#ifdef TR_LIGHTWEIGHT
-            compressionLevel = Z_DEFAULT_COMPRESSION;
-#else
-            compressionLevel = Z_BEST_COMPRESSION;
-#endif
-            deflateInit2(&server->stream, compressionLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
-        }
+        get_deflate_stream(server);
 
         server->stream.next_in = static_cast<Bytef*>(content_ptr);
         server->stream.avail_in = content_len;
@@ -472,24 +531,91 @@ struct rpc_response_data
     struct tr_rpc_server* server;
 };
 
+/* Responses bigger than this are queued as chunks while they're being
+ * serialized. For clients that accept gzip, each chunk is compressed as it
+ * comes, so the uncompressed JSON is never held in full. There's no flow
+ * control: serializing finishes before anything is sent, so the whole
+ * response still sits in the connection's output buffer until the client
+ * reads it. */
+static auto constexpr RpcResponseChunkSize = size_t{ 64 * 1024 };
+
+struct rpc_response_stream
+{
+    struct evhttp_request* req;
+    struct tr_rpc_server* server;
+    struct evbuffer* out;
+    bool doCompress;
+    bool isStarted;
+};
+
+static void rpc_response_flush(struct evbuffer* json, void* vstream)
+{
+    auto* stream = static_cast<struct rpc_response_stream*>(vstream);
+
+    if (!stream->isStarted)
+    {
+        stream->isStarted = true;
+
+        if (stream->doCompress)
+        {
+            evhttp_add_header(stream->req->output_headers, "Content-Encoding", "gzip");
+        }
+
+        evhttp_send_reply_start(stream->req, HTTP_OK, "OK");
+    }
+
+    if (stream->doCompress)
+    {
+        add_deflated(get_deflate_stream(stream->server), stream->out, json, Z_NO_FLUSH);
+    }
+    else
+    {
+        evbuffer_add_buffer(stream->out, json);
+    }
+
+    evhttp_send_reply_chunk(stream->req, stream->out);
+}
+
 static void rpc_response_func([[maybe_unused]] tr_session* session, tr_variant* response, void* user_data)
 {
     auto* data = static_cast<struct rpc_response_data*>(user_data);
-    struct evbuffer* response_buf = tr_variantToBuf(response, TR_VARIANT_FMT_JSON_LEAN);
-    struct evbuffer* buf = evbuffer_new();
+    struct evbuffer* json = evbuffer_new();
+    struct rpc_response_stream stream = { data->req, data->server, evbuffer_new(), accepts_gzip(data->req), false };
 
-    add_response(data->req, data->server, buf, response_buf);
     evhttp_add_header(data->req->output_headers, "Content-Type", "application/json; charset=UTF-8");
-    evhttp_send_reply(data->req, HTTP_OK, "OK", buf);
+    tr_variantToBufFunc(response, TR_VARIANT_FMT_JSON_LEAN, json, RpcResponseChunkSize, rpc_response_flush, &stream);
+
+    if (!stream.isStarted) /* it all fit in one chunk */
+    {
+        add_response(data->req, data->server, stream.out, json);
+        evhttp_send_reply(data->req, HTTP_OK, "OK", stream.out);
+    }
+    else
+    {
+        if (stream.doCompress)
+        {
+            add_deflated(get_deflate_stream(data->server), stream.out, json, Z_FINISH);
+            deflateReset(get_deflate_stream(data->server));
+        }
+        else
+        {
+            evbuffer_add_buffer(stream.out, json);
+        }
+
+        evhttp_send_reply_chunk(data->req, stream.out);
+        evhttp_send_reply_end(data->req);
+    }
 
-    evbuffer_free(buf);
-    evbuffer_free(response_buf);
+    evbuffer_free(stream.out);
+    evbuffer_free(json);
     tr_free(data);
 }
 
 static void handle_rpc_from_json(struct evhttp_request* req, struct tr_rpc_server* server, char const* json, size_t json_len)
 {
+    auto arena = tr_variant_arena{};
     tr_variant top;
+    tr_variantInitArena(&top, &arena);
     bool have_content = tr_variantFromJson(&top, json, json_len) == 0;
     struct rpc_response_data* data;
 
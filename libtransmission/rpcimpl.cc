@@ -804,10 +804,18 @@ static void initField(
         tr_variantInitInt(initme, toSpeedBytes(st->pieceDownloadSpeed_KBps));
         break;
 
+    case TR_KEY_rateDownloadLimit:
+        tr_variantInitInt(initme, st->pieceDownloadSpeedLimit_KBps < 0 ? -1 : toSpeedBytes(st->pieceDownloadSpeedLimit_KBps));
+        break;
+
     case TR_KEY_rateUpload:
         tr_variantInitInt(initme, toSpeedBytes(st->pieceUploadSpeed_KBps));
         break;
 
+    case TR_KEY_rateUploadLimit:
+        tr_variantInitInt(initme, st->pieceUploadSpeedLimit_KBps < 0 ? -1 : toSpeedBytes(st->pieceUploadSpeedLimit_KBps));
+        break;
+
     case TR_KEY_recheckProgress:
         tr_variantInitReal(initme, st->recheckProgress);
         break;
@@ -936,6 +944,169 @@ static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_variant* entry,
     }
 }
 
+/***
+****  torrent-get with "since": only what changed since a previous call
+***/
+
+static auto constexpr FnvOffsetBasis = uint64_t{ 14695981039346656037ULL };
+static auto constexpr FnvPrime = uint64_t{ 1099511628211ULL };
+
+static uint64_t hashBytes(uint64_t hash, void const* vbytes, size_t n)
+{
+    auto const* bytes = static_cast<uint8_t const*>(vbytes);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FnvPrime;
+    }
+
+    return hash;
+}
+
+static uint64_t hashVariant(uint64_t hash, tr_variant* v)
+{
+    bool b;
+    double d;
+    int64_t i;
+    size_t len;
+    char const* str;
+
+    if (tr_variantIsBool(v) && tr_variantGetBool(v, &b))
+    {
+        hash = hashBytes(hash, "b", 1);
+        hash = hashBytes(hash, &b, sizeof(b));
+    }
+    else if (tr_variantIsInt(v) && tr_variantGetInt(v, &i))
+    {
+        hash = hashBytes(hash, "i", 1);
+        hash = hashBytes(hash, &i, sizeof(i));
+    }
+    else if (tr_variantIsReal(v) && tr_variantGetReal(v, &d))
+    {
+        hash = hashBytes(hash, "f", 1);
+        hash = hashBytes(hash, &d, sizeof(d));
+    }
+    else if (tr_variantIsString(v) && tr_variantGetStr(v, &str, &len))
+    {
+        hash = hashBytes(hash, "s", 1);
+        hash = hashBytes(hash, &len, sizeof(len));
+        hash = hashBytes(hash, str, len);
+    }
+    else if (tr_variantIsList(v))
+    {
+        size_t const n = tr_variantListSize(v);
+        hash = hashBytes(hash, "l", 1);
+        hash = hashBytes(hash, &n, sizeof(n));
+
+        for (size_t pos = 0; pos < n; ++pos)
+        {
+            hash = hashVariant(hash, tr_variantListChild(v, pos));
+        }
+    }
+    else if (tr_variantIsDict(v))
+    {
+        tr_quark key;
+        tr_variant* child;
+        hash = hashBytes(hash, "d", 1);
+
+        for (size_t pos = 0; tr_variantDictChild(v, pos, &key, &child); ++pos)
+        {
+            hash = hashBytes(hash, &key, sizeof(key));
+            hash = hashVariant(hash, child);
+        }
+    }
+
+    return hash;
+}
+
+static tr_torrent_field_state* getFieldState(tr_torrent* tor, tr_quark key, bool* isNew)
+{
+    auto& states = tor->rpcFieldStates;
+    auto const it = std::lower_bound(
+        std::begin(states),
+        std::end(states),
+        key,
+        [](auto const& state, tr_quark k) { return state.key < k; });
+
+    *isNew = it == std::end(states) || it->key != key;
+
+    return *isNew ? &*states.insert(it, { key, 0, 0, 0 }) : &*it;
+}
+
+/* add an object holding the torrent's fields that changed after `since' to `list',
+   unless there aren't any. Fields that change now are stamped with `revision' */
+static void addTorrentChanges(
+    tr_torrent* tor,
+    tr_variant* list,
+    tr_quark const* fields,
+    size_t fieldCount,
+    int64_t since,
+    uint64_t revision)
+{
+    /* torrents that aren't stopped change all the time, and so do
+       trackerStats; everything else is marked by tr_torrentMarkChanged() */
+    bool const active = tr_torrentGetActivity(tor) != TR_STATUS_STOPPED || tor->isStopping;
+    tr_info const* const inf = tr_torrentInfo(tor);
+    tr_stat const* st = nullptr;
+    tr_variant* entry = tr_variantListAdd(list);
+    size_t changedCount = 0;
+
+    tr_variantInitDict(entry, fieldCount + 1);
+
+    for (size_t i = 0; i < fieldCount; ++i)
+    {
+        bool isNew;
+        tr_quark const key = fields[i];
+        tr_torrent_field_state* const state = getFieldState(tor, key, &isNew);
+        bool const check = isNew || active || key == TR_KEY_trackerStats || state->changeCount != tor->changeCount;
+
+        if (!check && (int64_t)state->revision <= since)
+        {
+            continue;
+        }
+
+        if (st == nullptr)
+        {
+            st = tr_torrentStat(tor);
+        }
+
+        tr_variant* child = tr_variantDictAdd(entry, key);
+        initField(tor, inf, st, child, key);
+
+        if (check)
+        {
+            uint64_t const hash = hashVariant(FnvOffsetBasis, child);
+
+            if (isNew || state->hash != hash)
+            {
+                state->hash = hash;
+                state->revision = revision;
+            }
+
+            state->changeCount = tor->changeCount;
+
+            if ((int64_t)state->revision <= since)
+            {
+                tr_variantDictRemove(entry, key);
+                continue;
+            }
+        }
+
+        ++changedCount;
+    }
+
+    if (changedCount == 0)
+    {
+        tr_variantListRemove(list, tr_variantListSize(list) - 1);
+    }
+    else if (tr_variantDictFind(entry, TR_KEY_id) == nullptr)
+    {
+        /* so the client knows which torrent this is */
+        tr_variantDictAddInt(entry, TR_KEY_id, tr_torrentId(tor));
+    }
+}
+
 static char const* torrentGet(
     tr_session* session,
     tr_variant* args_in,
@@ -949,6 +1120,8 @@ static char const* torrentGet(
     char const* strVal;
     char const* errmsg = nullptr;
     tr_format format;
+    int64_t since = 0;
+    bool const changesOnly = tr_variantDictFindInt(args_in, TR_KEY_since, &since);
 
     if (tr_variantDictFindStr(args_in, TR_KEY_format, &strVal, nullptr) && strcmp(strVal, "table") == 0)
     {
@@ -959,7 +1132,27 @@ static char const* torrentGet(
         format = TR_FORMAT_OBJECT;
     }
 
-    if (tr_variantDictFindStr(args_in, TR_KEY_ids, &strVal, nullptr) && strcmp(strVal, "recently-active") == 0)
+    if (changesOnly)
+    {
+        int n = 0;
+        tr_variant* d;
+        tr_variant* removed_out = tr_variantDictAddList(args_out, TR_KEY_removed, 0);
+
+        while ((d = tr_variantListChild(&session->removedTorrents, n)) != nullptr)
+        {
+            int64_t removedAt;
+            int64_t id;
+
+            if (tr_variantDictFindInt(d, TR_KEY_revision, &removedAt) && removedAt > since &&
+                tr_variantDictFindInt(d, TR_KEY_id, &id))
+            {
+                tr_variantListAddInt(removed_out, id);
+            }
+
+            ++n;
+        }
+    }
+    else if (tr_variantDictFindStr(args_in, TR_KEY_ids, &strVal, nullptr) && strcmp(strVal, "recently-active") == 0)
     {
         int n = 0;
         tr_variant* d;
@@ -986,6 +1179,10 @@ static char const* torrentGet(
     {
         errmsg = "no fields specified";
     }
+    else if (changesOnly && format == TR_FORMAT_TABLE)
+    {
+        errmsg = "\"since\" can't be used with the \"table\" format";
+    }
     else
     {
         /* make an array of property name quarks */
@@ -1011,9 +1208,23 @@ static char const* torrentGet(
             }
         }
 
-        for (int i = 0; i < torrentCount; ++i)
+        if (changesOnly)
         {
-            addTorrentInfo(torrents[i], format, tr_variantListAdd(list), keys, keyCount);
+            uint64_t const revision = ++session->rpcRevision;
+
+            for (int i = 0; i < torrentCount; ++i)
+            {
+                addTorrentChanges(torrents[i], list, keys, keyCount, since, revision);
+            }
+
+            tr_variantDictAddInt(args_out, TR_KEY_revision, revision);
+        }
+        else
+        {
+            for (int i = 0; i < torrentCount; ++i)
+            {
+                addTorrentInfo(torrents[i], format, tr_variantListAdd(list), keys, keyCount);
+            }
         }
 
         tr_free(keys);
@@ -2845,10 +3056,12 @@ void tr_rpc_request_exec_uri(
     void* callback_user_data)
 {
     char const* pch;
+    auto arena = tr_variant_arena{};
     tr_variant top;
     tr_variant* args;
     char* request = tr_strndup(request_uri, request_uri_len);
 
+    tr_variantInitArena(&top, &arena);
     tr_variantInitDict(&top, 3);
     args = tr_variantDictAddDict(&top, TR_KEY_arguments, 0);
 
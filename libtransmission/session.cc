@@ -16,6 +16,7 @@
 #include <iterator> // std::back_inserter
 #include <list>
 #include <numeric> // std::acumulate()
+#include <thread> // std::thread::hardware_concurrency()
 #include <vector>
 
 #ifndef _WIN32
@@ -43,6 +44,7 @@
 #include "net.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
+#include "piece-check.h"
 #include "platform.h" /* tr_lock, tr_getTorrentDir() */
 #include "platform-quota.h" /* tr_device_info_free() */
 #include "port-forwarding.h"
@@ -68,9 +70,11 @@ enum
 #ifdef TR_LIGHTWEIGHT
     DEFAULT_CACHE_SIZE_MB = 2,
     DEFAULT_PREFETCH_ENABLED = false,
+    MAX_DEFAULT_VERIFY_THREADS = 1,
 #else
     DEFAULT_CACHE_SIZE_MB = 4,
     DEFAULT_PREFETCH_ENABLED = true,
+    MAX_DEFAULT_VERIFY_THREADS = 4,
 #endif
     SAVE_INTERVAL_SECS = 360
 };
@@ -344,7 +348,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 63);
+    tr_variantDictReserve(d, 65);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist");
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DEFAULT_CACHE_SIZE_MB);
@@ -369,6 +373,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddInt(d, TR_KEY_peer_port_random_low, 49152);
     tr_variantDictAddInt(d, TR_KEY_peer_port_random_high, 65535);
     tr_variantDictAddStr(d, TR_KEY_peer_socket_tos, TR_DEFAULT_PEER_SOCKET_TOS_STR);
+    tr_variantDictAddBool(d, TR_KEY_peer_socket_zerocopy, false);
     tr_variantDictAddBool(d, TR_KEY_pex_enabled, true);
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
@@ -406,6 +411,11 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_umask, 022);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, 14);
+    tr_variantDictAddInt(
+        d,
+        TR_KEY_verify_threads,
+        std::clamp(int(std::thread::hardware_concurrency()), 1, int{ MAX_DEFAULT_VERIFY_THREADS }));
+    tr_variantDictAddInt(d, TR_KEY_verify_io_limit_mb, 0);
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv4, TR_DEFAULT_BIND_ADDRESS_IPV4);
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv6, TR_DEFAULT_BIND_ADDRESS_IPV6);
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, true);
@@ -418,7 +428,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 63);
+    tr_variantDictReserve(d, 65);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, tr_blocklistIsEnabled(s));
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, tr_blocklistGetURL(s));
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
@@ -444,6 +454,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddInt(d, TR_KEY_peer_port_random_high, s->randomPortHigh);
     tr_variantDictAddStr(d, TR_KEY_peer_socket_tos, format_tos(s->peerSocketTOS));
     tr_variantDictAddStr(d, TR_KEY_peer_congestion_algorithm, s->peer_congestion_algorithm);
+    tr_variantDictAddBool(d, TR_KEY_peer_socket_zerocopy, s->peerSocketZeroCopy);
     tr_variantDictAddBool(d, TR_KEY_pex_enabled, s->isPexEnabled);
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, tr_sessionIsPortForwardingEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
@@ -479,6 +490,8 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, tr_sessionIsSpeedLimited(s, TR_UP));
     tr_variantDictAddInt(d, TR_KEY_umask, s->umask);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, s->uploadSlotsPerTorrent);
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, s->verifyThreads);
+    tr_variantDictAddInt(d, TR_KEY_verify_io_limit_mb, s->verifyIoLimit_MB);
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv4, tr_address_to_string(&s->bind_ipv4->addr));
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv6, tr_address_to_string(&s->bind_ipv6->addr));
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, !tr_sessionGetPaused(s));
@@ -629,10 +642,13 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
     session->udp6_socket = TR_BAD_SOCKET;
     session->lock = tr_lockNew();
     session->cache = tr_cacheNew(1024 * 1024 * 2);
+    session->pieceChecker = tr_pieceCheckerNew(session);
     session->magicNumber = SESSION_MAGIC_NUMBER;
     session->session_id = tr_session_id_new();
     session->bandwidth = new Bandwidth(nullptr);
     tr_variantInitList(&session->removedTorrents, 0);
+    /* start from the clock, so that revisions clients got from an earlier run are older */
+    session->rpcRevision = (uint64_t)tr_time() << 20;
 
     /* nice to start logging at the very beginning */
     if (tr_variantDictFindInt(clientSettings, TR_KEY_message_level, &i))
@@ -887,6 +903,11 @@ static void sessionSetImpl(void* vdata)
         session->peer_congestion_algorithm = tr_strdup("");
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_peer_socket_zerocopy, &boolVal))
+    {
+        session->peerSocketZeroCopy = boolVal;
+    }
+
     if (tr_variantDictFindBool(settings, TR_KEY_blocklist_enabled, &boolVal))
     {
         tr_blocklistSetEnabled(session, boolVal);
@@ -912,6 +933,16 @@ static void sessionSetImpl(void* vdata)
         session->peer_id_ttl_hours = i;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_threads, &i))
+    {
+        session->verifyThreads = std::max(int(i), 1);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_io_limit_mb, &i))
+    {
+        session->verifyIoLimit_MB = std::max(int(i), 0);
+    }
+
     /* torrent queues */
     if (tr_variantDictFindInt(settings, TR_KEY_queue_stalled_minutes, &i))
     {
@@ -1973,6 +2004,9 @@ static void sessionCloseImplStart(tr_session* session)
     tr_cacheFree(session->cache);
     session->cache = nullptr;
 
+    tr_pieceCheckerFree(session->pieceChecker);
+    session->pieceChecker = nullptr;
+
     /* saveTimer is not used at this point, reusing for UDP shutdown wait */
     TR_ASSERT(session->saveTimer == nullptr);
     session->saveTimer = evtimer_new(session->event_base, sessionCloseImplWaitForIdleUdp, session);
@@ -2012,6 +2046,7 @@ static void sessionCloseImplFinish(tr_session* session)
 
     tr_statsClose(session);
     tr_peerMgrFree(session->peerMgr);
+    tr_peerIoCloseLingering(session);
 
     closeBlocklists(session);
 
@@ -61,6 +61,9 @@ struct tr_blocklistFile;
 struct tr_cache;
 struct tr_fdInfo;
 struct tr_device_info;
+struct tr_peer_zerocopy;
+struct tr_piece_checker;
+struct tr_udp_queue;
 
 struct tr_turtle_info
 {
@@ -142,6 +145,9 @@ struct tr_session
 
     tr_variant removedTorrents;
 
+    /* bumped by each `torrent-get' that only wants what changed */
+    uint64_t rpcRevision;
+
     bool stalledEnabled;
     bool queueEnabled[2];
     int queueSize[2];
@@ -171,6 +177,11 @@ struct tr_session
 
     int uploadSlotsPerTorrent;
 
+    /* how many threads hash pieces during verification, and how many
+     * MB/s each disk being verified may be read at (0 means no limit) */
+    int verifyThreads;
+    int verifyIoLimit_MB;
+
     /* The UDP sockets used for the DHT and uTP. */
     tr_port udp_port;
     tr_socket_t udp_socket;
@@ -179,6 +190,9 @@ struct tr_session
     struct event* udp_event;
     struct event* udp6_event;
 
+    /* receive buffers and not-yet-sent datagrams for the UDP sockets */
+    struct tr_udp_queue* udp_queue;
+
     struct event* utp_timer;
 
     /* The open port on the local machine for incoming peer requests */
@@ -197,6 +211,10 @@ struct tr_session
 
     int peerSocketTOS;
     char* peer_congestion_algorithm;
+    bool peerSocketZeroCopy;
+
+    /* zero-copy peer sockets that have been closed, but whose sent data the kernel is still using */
+    std::unordered_set<struct tr_peer_zerocopy*> zeroCopyLingering;
 
     std::unordered_set<tr_torrent*> torrents;
     std::map<int, tr_torrent*> torrentsById;
@@ -220,6 +238,8 @@ struct tr_session
 
     struct tr_cache* cache;
 
+    struct tr_piece_checker* pieceChecker;
+
     struct tr_lock* lock;
 
     struct tr_web* web;
@@ -42,6 +42,7 @@
 #include "metainfo.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
 #include "peer-mgr.h"
+#include "piece-check.h"
 #include "platform.h" /* TR_PATH_DELIMITER_STR */
 #include "resume.h"
 #include "session.h"
@@ -516,6 +517,7 @@ void tr_torrentSetLocalError(tr_torrent* tor, char const* fmt, ...)
     tor->errorTracker[0] = '\0';
     evutil_vsnprintf(tor->errorString, sizeof(tor->errorString), fmt, ap);
     va_end(ap);
+    tr_torrentMarkChanged(tor);
 
     tr_logAddTorErr(tor, "%s", tor->errorString);
 
@@ -530,6 +532,7 @@ static constexpr void tr_torrentClearError(tr_torrent* tor)
     tor->error = TR_STAT_OK;
     tor->errorString[0] = '\0';
     tor->errorTracker[0] = '\0';
+    tr_torrentMarkChanged(tor);
 }
 
 static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, [[maybe_unused]] void* user_data)
@@ -554,6 +557,7 @@ static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, [[
         tor->error = TR_STAT_TRACKER_WARNING;
         tr_strlcpy(tor->errorTracker, event->tracker, sizeof(tor->errorTracker));
         tr_strlcpy(tor->errorString, event->text, sizeof(tor->errorString));
+        tr_torrentMarkChanged(tor);
         break;
 
     case TR_TRACKER_ERROR:
@@ -561,6 +565,7 @@ static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, [[
         tor->error = TR_STAT_TRACKER_ERROR;
         tr_strlcpy(tor->errorTracker, event->tracker, sizeof(tor->errorTracker));
         tr_strlcpy(tor->errorString, event->text, sizeof(tor->errorString));
+        tr_torrentMarkChanged(tor);
         break;
 
     case TR_TRACKER_ERROR_CLEAR:
@@ -1183,6 +1188,7 @@ void tr_torrentSetVerifyState(tr_torrent* tor, tr_verify_state state)
 
     tor->verifyState = state;
     tor->anyDate = tr_time();
+    tr_torrentMarkChanged(tor);
 }
 
 tr_torrent_activity tr_torrentGetActivity(tr_torrent const* tor)
@@ -1252,6 +1258,12 @@ static double getVerifyProgress(tr_torrent const* tor)
     return d;
 }
 
+static float getEffectiveSpeedLimit_KBps(tr_torrent const* tor, tr_direction dir)
+{
+    auto const limit_Bps = tor->bandwidth->getLimit_Bps(dir);
+    return limit_Bps != 0 ? toSpeedKBps(limit_Bps) : -1;
+}
+
 tr_stat const* tr_torrentStat(tr_torrent* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1300,6 +1312,8 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     pieceDownloadSpeed_Bps = tor->bandwidth->getPieceSpeed_Bps(now, TR_DOWN);
     s->pieceUploadSpeed_KBps = toSpeedKBps(pieceUploadSpeed_Bps);
     s->pieceDownloadSpeed_KBps = toSpeedKBps(pieceDownloadSpeed_Bps);
+    s->pieceUploadSpeedLimit_KBps = getEffectiveSpeedLimit_KBps(tor, TR_UP);
+    s->pieceDownloadSpeedLimit_KBps = getEffectiveSpeedLimit_KBps(tor, TR_DOWN);
 
     s->percentComplete = tr_cpPercentComplete(&tor->completion);
     s->metadataPercentComplete = tr_torrentGetMetadataPercent(tor);
@@ -1586,6 +1600,45 @@ void tr_torrentSetHasPiece(tr_torrent* tor, tr_piece_index_t pieceIndex, bool ha
     }
 }
 
+bool tr_torrentHasVerifiedPiece(tr_torrent const* tor, tr_piece_index_t i)
+{
+    auto const& pending = tor->pendingPieceChecks;
+
+    return tr_torrentPieceIsComplete(tor, i) && std::find(std::begin(pending), std::end(pending), i) == std::end(pending);
+}
+
+void* tr_torrentCreatePieceBitfield(tr_torrent const* tor, size_t* byte_count)
+{
+    auto* const bytes = static_cast<uint8_t*>(tr_cpCreatePieceBitfield(&tor->completion, byte_count));
+
+    for (auto const piece : tor->pendingPieceChecks)
+    {
+        bytes[piece >> 3U] &= ~(0x80 >> (piece & 7U));
+    }
+
+    return bytes;
+}
+
+/* Forget the torrent's piece checks that haven't come back yet. Their
+ * pieces haven't passed, so they have to be downloaded again */
+static void cancelPieceChecks(tr_torrent* tor)
+{
+    if (std::empty(tor->pendingPieceChecks))
+    {
+        return;
+    }
+
+    tr_pieceCheckerRemove(tor->session->pieceChecker, tor);
+
+    for (auto const piece : tor->pendingPieceChecks)
+    {
+        tr_cpPieceRem(&tor->completion, piece);
+    }
+
+    tor->pendingPieceChecks.clear();
+    tr_torrentSetDirty(tor);
+}
+
 /***
 ****
 ***/
@@ -1622,6 +1675,7 @@ static void freeTorrent(tr_torrent* tor)
         {
             t->queuePosition--;
             t->anyDate = now;
+            tr_torrentMarkChanged(t);
         }
     }
 
@@ -1898,9 +1952,12 @@ static void stopTorrent(void* vtor)
 
     tr_torrentLock(tor);
 
+    tr_torrentMarkChanged(tor);
+
     tr_verifyRemove(tor);
     tr_peerMgrStopTorrent(tor);
     tr_announcerTorrentStopped(tor);
+    cancelPieceChecks(tor);
     tr_cacheFlushTorrent(tor->session->cache, tor);
 
     tr_fdTorrentClose(tor->session, tor->uniqueId);
@@ -1947,9 +2004,11 @@ static void closeTorrent(void* vtor)
 
     TR_ASSERT(tr_isTorrent(tor));
 
-    tr_variant* d = tr_variantListAddDict(&tor->session->removedTorrents, 2);
+    tr_variant* d = tr_variantListAddDict(&tor->session->removedTorrents, 3);
     tr_variantDictAddInt(d, TR_KEY_id, tor->uniqueId);
     tr_variantDictAddInt(d, TR_KEY_date, tr_time());
+    /* clients that made their last `torrent-get' before now haven't seen this */
+    tr_variantDictAddInt(d, TR_KEY_revision, tor->session->rpcRevision + 1);
 
     tr_logAddTorInfo(tor, "%s", _("Removing torrent"));
 
@@ -2163,6 +2222,12 @@ void tr_torrentRecheckCompleteness(tr_torrent* tor)
 {
     tr_completeness completeness;
 
+    /* don't call it done until the last pieces have passed their checks */
+    if (!std::empty(tor->pendingPieceChecks))
+    {
+        return;
+    }
+
     tr_torrentLock(tor);
 
     completeness = tr_cpGetStatus(&tor->completion);
@@ -3162,6 +3227,9 @@ static void setLocation(void* vdata)
         /* bad idea to move files while they're being verified... */
         tr_verifyRemove(tor);
 
+        /* ...or while the cache still has writes in flight to the old ones */
+        tr_cacheFlushTorrent(tor->session->cache, tor);
+
         /* try to move the files.
          * FIXME: there are still all kinds of nasty cases, like what
          * if the target directory runs out of space halfway through... */
@@ -3380,6 +3448,50 @@ static void tr_torrentPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceInde
     }
 }
 
+static void gotPieceCheck(tr_torrent* tor, tr_piece_index_t p, bool pass)
+{
+    tr_deeplog_tor(tor, "[LAZY] checked just-completed piece %zu, pass==%d", (size_t)p, (int)pass);
+    tr_torrentSetHasPiece(tor, p, pass);
+    tr_torrentSetPieceChecked(tor, p);
+    tor->anyDate = tr_time();
+    tr_torrentSetDirty(tor);
+
+    if (pass)
+    {
+        tr_torrentPieceCompleted(tor, p);
+    }
+    else
+    {
+        uint32_t const n = tr_torPieceCountBytes(tor, p);
+        tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
+        tor->corruptCur += n;
+        tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
+        tr_cacheDropPieceHash(tor->session->cache, tor, p);
+        tr_peerMgrGotBadPiece(tor, p);
+    }
+}
+
+static void onPieceChecked(tr_torrent* tor, tr_piece_index_t p, bool pass)
+{
+    auto& pending = tor->pendingPieceChecks;
+    auto const it = std::find(std::begin(pending), std::end(pending), p);
+    TR_ASSERT(it != std::end(pending));
+
+    pending.erase(it);
+
+    /* skip it if the piece was re-verified or dropped while it was being hashed */
+    if (tor->verifyState == TR_VERIFY_NONE && tr_torrentPieceIsComplete(tor, p))
+    {
+        gotPieceCheck(tor, p, pass);
+    }
+
+    /* completeness checks were put off while this piece was in flight */
+    if (std::empty(pending))
+    {
+        tr_torrentRecheckCompleteness(tor);
+    }
+}
+
 void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -3398,19 +3510,20 @@ void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
 
         if (tr_torrentPieceIsComplete(tor, p))
         {
+            uint8_t hash[SHA_DIGEST_LENGTH];
+
             tr_logAddTorDbg(tor, "[LAZY] checking just-completed piece %zu", (size_t)p);
 
-            if (tr_torrentCheckPiece(tor, p))
+            if (tr_cacheTakePieceHash(tor->session->cache, tor, p, hash))
             {
-                tr_torrentPieceCompleted(tor, p);
+                /* its blocks came in order and were hashed on the way into the cache */
+                gotPieceCheck(tor, p, memcmp(hash, tor->info.pieces[p].hash, SHA_DIGEST_LENGTH) == 0);
             }
             else
             {
-                uint32_t const n = tr_torPieceCountBytes(tor, p);
-                tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
-                tor->corruptCur += n;
-                tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
-                tr_peerMgrGotBadPiece(tor, p);
+                /* hash it off the libevent thread; onPieceChecked() takes it from there */
+                tor->pendingPieceChecks.push_back(p);
+                tr_pieceCheckerAdd(tor->session->pieceChecker, tor, p, onPieceChecked);
             }
         }
     }
@@ -3623,12 +3736,14 @@ void tr_torrentSetQueuePosition(tr_torrent* tor, int pos)
         {
             walk->queuePosition--;
             walk->anyDate = now;
+            tr_torrentMarkChanged(walk);
         }
 
         if ((old_pos > pos) && (pos <= walk->queuePosition) && (walk->queuePosition < old_pos))
         {
             walk->queuePosition++;
             walk->anyDate = now;
+            tr_torrentMarkChanged(walk);
         }
 
         if (back < walk->queuePosition)
@@ -3639,6 +3754,7 @@ void tr_torrentSetQueuePosition(tr_torrent* tor, int pos)
 
     tor->queuePosition = std::min(pos, back + 1);
     tor->anyDate = now;
+    tr_torrentMarkChanged(tor);
 
     TR_ASSERT(queueIsSequenced(tor->session));
 }
@@ -3938,6 +4054,7 @@ static void torrentRenamePath(void* vdata)
     ***/
 
     tor->anyDate = tr_time();
+    tr_torrentMarkChanged(tor);
 
     /* callback */
     if (data->callback != nullptr)
@@ -14,6 +14,7 @@
 
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 #include "bandwidth.h" /* tr_bandwidth */
 #include "completion.h" /* tr_completion */
@@ -126,6 +127,16 @@ tr_torrent_activity tr_torrentGetActivity(tr_torrent const* tor);
 
 struct tr_incomplete_metadata;
 
+/* what the RPC server last saw of one of a torrent's `torrent-get' fields,
+ * so that it can tell clients which fields changed since their last call */
+struct tr_torrent_field_state
+{
+    tr_quark key;
+    uint32_t changeCount; /* tr_torrent.changeCount when the field was checked */
+    uint64_t hash; /* the field's value when it was checked */
+    uint64_t revision; /* tr_session.rpcRevision when the value last changed */
+};
+
 /** @brief Torrent object */
 struct tr_torrent
 {
@@ -244,6 +255,9 @@ struct tr_torrent
     bool isDirty;
     bool isQueued;
 
+    /* bumped by tr_torrentMarkChanged() */
+    uint32_t changeCount;
+
     bool prefetchMagnetMetadata;
     bool magnetVerify;
 
@@ -253,6 +267,11 @@ struct tr_torrent
 
     tr_verify_state verifyState;
 
+    /* just-completed pieces that are still being hashed by the piece checker.
+     * They're complete in `completion`, but they mustn't be uploaded,
+     * advertised, or saved as complete until they pass */
+    std::vector<tr_piece_index_t> pendingPieceChecks;
+
     time_t lastStatTime;
     tr_stat stats;
 
@@ -272,6 +291,8 @@ struct tr_torrent
     bool finishedSeedingByIdle;
 
     tr_labels_t labels;
+
+    std::vector<tr_torrent_field_state> rpcFieldStates;
 };
 
 /* what piece index is this block in? */
@@ -356,6 +377,14 @@ constexpr bool tr_isTorrent(tr_torrent const* tor)
     return tor != nullptr && tor->magicNumber == TORRENT_MAGIC_NUMBER && tr_isSession(tor->session);
 }
 
+/* note that something RPC clients can see just changed while the torrent
+ * may be stopped. Torrents that aren't stopped are assumed to be changing
+ * all the time, so they needn't bother */
+constexpr void tr_torrentMarkChanged(tr_torrent* tor)
+{
+    ++tor->changeCount;
+}
+
 /* set a flag indicating that the torrent's .resume file
  * needs to be saved when the torrent is closed */
 constexpr void tr_torrentSetDirty(tr_torrent* tor)
@@ -363,6 +392,7 @@ constexpr void tr_torrentSetDirty(tr_torrent* tor)
     TR_ASSERT(tr_isTorrent(tor));
 
     tor->isDirty = true;
+    tr_torrentMarkChanged(tor);
 }
 
 /* note that the torrent's tr_info just changed */
@@ -371,6 +401,7 @@ static inline void tr_torrentMarkEdited(tr_torrent* tor)
     TR_ASSERT(tr_isTorrent(tor));
 
     tor->editDate = tr_time();
+    tr_torrentMarkChanged(tor);
 }
 
 uint32_t tr_getBlockSize(uint32_t pieceSize);
@@ -445,6 +476,9 @@ static inline bool tr_torrentPieceIsComplete(tr_torrent const* tor, tr_piece_ind
     return tr_cpPieceIsComplete(&tor->completion, i);
 }
 
+/* true if the piece is complete and isn't still waiting on its hash check */
+bool tr_torrentHasVerifiedPiece(tr_torrent const* tor, tr_piece_index_t i);
+
 static inline bool tr_torrentBlockIsComplete(tr_torrent const* tor, tr_block_index_t i)
 {
     return tr_cpBlockIsComplete(&tor->completion, i);
@@ -460,10 +494,8 @@ static inline size_t tr_torrentMissingBytesInPiece(tr_torrent const* tor, tr_pie
     return tr_cpMissingBytesInPiece(&tor->completion, i);
 }
 
-static inline void* tr_torrentCreatePieceBitfield(tr_torrent const* tor, size_t* byte_count)
-{
-    return tr_cpCreatePieceBitfield(&tor->completion, byte_count);
-}
+/* like tr_cpCreatePieceBitfield(), but without the pieces that are still being checked */
+void* tr_torrentCreatePieceBitfield(tr_torrent const* tor, size_t* byte_count);
 
 constexpr uint64_t tr_torrentHaveTotal(tr_torrent const* tor)
 {
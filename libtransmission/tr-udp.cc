@@ -24,12 +24,19 @@ THE SOFTWARE.
 #include <string.h> /* memcmp(), memcpy(), memset() */
 #include <stdlib.h> /* malloc(), free() */
 
+#include <array>
+#include <vector>
+
 #ifdef _WIN32
 #include <io.h> /* dup2() */
 #else
 #include <unistd.h> /* dup2() */
 #endif
 
+#ifdef __linux__
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#endif
+
 #include <event2/event.h>
 
 #include <stdint.h>
@@ -239,20 +246,246 @@ FAIL:
     }
 }
 
-static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+/***
+****  Batched I/O
+***/
+
+enum
 {
-    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
-    TR_ASSERT(type == EV_READ);
+    /* the largest datagram we'll read. Anything longer gets truncated */
+    UDP_MAX_DATAGRAM = 4096,
 
-    int rc;
-    socklen_t fromlen;
-    unsigned char buf[4096];
-    struct sockaddr_storage from;
-    auto* session = static_cast<tr_session*>(vsession);
+    /* how many datagrams are read or written per recvmmsg() or sendmmsg() */
+    UDP_BATCH_SIZE = 32,
+
+    /* so that a flood of packets can't starve everything else */
+    UDP_MAX_BATCHES_PER_WAKEUP = 8,
+
+    /* stop waiting for the loop iteration to end once this many are queued up */
+    UDP_MAX_QUEUED = 256,
+
+    /* the most segments, and bytes, Linux takes in one UDP_SEGMENT send */
+    UDP_MAX_SEGMENTS = 64,
+    UDP_MAX_SEGMENTED_BYTES = 60000
+};
+
+struct tr_udp_datagram
+{
+    tr_socket_t sock;
+    size_t offset; /* into tr_udp_queue.bytes */
+    size_t len;
+    struct sockaddr_storage to;
+    socklen_t tolen;
+};
+
+struct tr_udp_queue
+{
+    /* activated when the first datagram is queued, so that everything
+     * queued during this loop iteration gets sent together at its end */
+    struct event* flush_event;
+
+    std::vector<tr_udp_datagram> datagrams;
+    std::vector<unsigned char> bytes;
 
-    fromlen = sizeof(from);
-    rc = recvfrom(s, reinterpret_cast<char*>(buf), 4096 - 1, 0, (struct sockaddr*)&from, &fromlen);
+    /* cleared if the kernel turns down a segmented send */
+    bool gso_works = true;
 
+    /* one per datagram in a batch, with room for the DHT's trailing '\0' */
+    std::vector<std::array<unsigned char, UDP_MAX_DATAGRAM>> recv_bufs;
+};
+
+#ifdef HAVE_SENDMMSG
+
+static bool is_same_flow(tr_udp_datagram const& a, tr_udp_datagram const& b)
+{
+    return a.sock == b.sock && a.tolen == b.tolen && memcmp(&a.to, &b.to, a.tolen) == 0;
+}
+
+/* Sends the queue with as few sendmmsg() calls as possible. Where the
+ * kernel supports it, runs of same-sized datagrams to the same address
+ * go out as one UDP_SEGMENT message for the kernel to split up. */
+static void flush_batched(tr_udp_queue* q)
+{
+    auto const& all = q->datagrams;
+    auto iov = std::vector<struct iovec>(std::size(all));
+
+    for (size_t i = 0; i < std::size(all); ++i)
+    {
+        iov[i].iov_base = std::data(q->bytes) + all[i].offset;
+        iov[i].iov_len = all[i].len;
+    }
+
+    size_t i = 0;
+
+    while (i < std::size(all))
+    {
+        union gso_control
+        {
+            char buf[CMSG_SPACE(sizeof(uint16_t))];
+            struct cmsghdr align;
+        };
+
+        auto msgs = std::array<struct mmsghdr, UDP_BATCH_SIZE>{};
+        auto controls = std::array<gso_control, UDP_BATCH_SIZE>{};
+        auto firsts = std::array<size_t, UDP_BATCH_SIZE + 1>{};
+        tr_socket_t const sock = all[i].sock;
+        bool used_gso = false;
+        size_t n_msgs = 0;
+        size_t j = i;
+
+        while (n_msgs < UDP_BATCH_SIZE && j < std::size(all) && all[j].sock == sock)
+        {
+            auto const& first = all[j];
+            size_t end = j + 1;
+
+#ifdef UDP_SEGMENT
+
+            if (q->gso_works)
+            {
+                while (end < std::size(all) && end - j < UDP_MAX_SEGMENTS && all[end].len == first.len &&
+                       (end + 1 - j) * first.len <= UDP_MAX_SEGMENTED_BYTES && is_same_flow(all[end], first))
+                {
+                    ++end;
+                }
+            }
+
+#endif
+
+            auto& hdr = msgs[n_msgs].msg_hdr;
+            hdr.msg_name = const_cast<sockaddr_storage*>(&first.to);
+            hdr.msg_namelen = first.tolen;
+            hdr.msg_iov = &iov[j];
+            hdr.msg_iovlen = end - j;
+
+#ifdef UDP_SEGMENT
+
+            if (end - j > 1)
+            {
+                hdr.msg_control = controls[n_msgs].buf;
+                hdr.msg_controllen = sizeof(controls[n_msgs].buf);
+
+                struct cmsghdr* const cm = CMSG_FIRSTHDR(&hdr);
+                cm->cmsg_level = IPPROTO_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                auto const segment_size = uint16_t(first.len);
+                memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+                used_gso = true;
+            }
+
+#endif
+
+            firsts[n_msgs++] = j;
+            j = end;
+        }
+
+        firsts[n_msgs] = j;
+
+        int const n_sent = sendmmsg(sock, std::data(msgs), n_msgs, 0);
+
+        if (n_sent > 0)
+        {
+            i = firsts[n_sent];
+        }
+        else if (used_gso && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT))
+        {
+            tr_logAddNamedDbg("UDP", "Segmented sends don't work here; sending datagrams one by one");
+            q->gso_works = false;
+        }
+        else
+        {
+            /* drop the message that failed, like a failed sendto() would */
+            i = firsts[1];
+        }
+    }
+}
+
+#endif
+
+static void udp_flush(tr_udp_queue* q)
+{
+#ifdef HAVE_SENDMMSG
+
+    flush_batched(q);
+
+#else
+
+    for (auto const& d : q->datagrams)
+    {
+        auto const* const buf = reinterpret_cast<char const*>(std::data(q->bytes) + d.offset);
+        sendto(d.sock, buf, d.len, 0, (struct sockaddr const*)&d.to, d.tolen);
+    }
+
+#endif
+
+    q->datagrams.clear();
+    q->bytes.clear();
+}
+
+static void flush_callback([[maybe_unused]] evutil_socket_t s, [[maybe_unused]] short type, void* vqueue)
+{
+    udp_flush(static_cast<tr_udp_queue*>(vqueue));
+}
+
+void tr_udpSendTo(tr_session* session, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
+{
+    auto d = tr_udp_datagram{};
+
+    if (to->sa_family == AF_INET)
+    {
+        d.sock = session->udp_socket;
+    }
+    else if (to->sa_family == AF_INET6)
+    {
+        d.sock = session->udp6_socket;
+    }
+    else
+    {
+        d.sock = TR_BAD_SOCKET;
+    }
+
+    if (d.sock == TR_BAD_SOCKET || tolen > sizeof(d.to))
+    {
+        return;
+    }
+
+    auto* const q = session->udp_queue;
+
+    if (q == nullptr)
+    {
+        sendto(d.sock, static_cast<char const*>(buf), buflen, 0, to, tolen);
+        return;
+    }
+
+    auto const* const bytes = static_cast<unsigned char const*>(buf);
+    d.offset = std::size(q->bytes);
+    d.len = buflen;
+    memcpy(&d.to, to, tolen);
+    d.tolen = tolen;
+    q->bytes.insert(std::end(q->bytes), bytes, bytes + buflen);
+    q->datagrams.push_back(d);
+
+    if (std::size(q->datagrams) == 1)
+    {
+        event_active(q->flush_event, 0, 0);
+    }
+    else if (std::size(q->datagrams) >= UDP_MAX_QUEUED)
+    {
+        udp_flush(q);
+    }
+}
+
+/***
+****
+***/
+
+static void handle_datagram(
+    tr_session* session,
+    unsigned char* buf,
+    int rc,
+    struct sockaddr_storage* from,
+    socklen_t fromlen)
+{
     /* Since most packets we receive here are ÂµTP, make quick inline
        checks for the other protocols.  The logic is as follows:
        - all DHT packets start with 'd'
@@ -267,7 +500,7 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
             if (tr_sessionAllowsDHT(session))
             {
                 buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback(buf, rc, (struct sockaddr*)&from, fromlen, vsession);
+                tr_dhtCallback(buf, rc, (struct sockaddr*)from, fromlen, session);
             }
         }
         else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
@@ -283,7 +516,7 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
         {
             if (tr_sessionIsUTPEnabled(session))
             {
-                rc = tr_utpPacket(buf, rc, (struct sockaddr*)&from, fromlen, session);
+                rc = tr_utpPacket(buf, rc, (struct sockaddr*)from, fromlen, session);
 
                 if (rc == 0)
                 {
@@ -294,6 +527,59 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
     }
 }
 
+static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+{
+    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
+    TR_ASSERT(type == EV_READ);
+
+    auto* session = static_cast<tr_session*>(vsession);
+
+#ifdef HAVE_RECVMMSG
+
+    /* drain the socket a batch at a time */
+    auto& bufs = session->udp_queue->recv_bufs;
+
+    for (int batch = 0; batch < UDP_MAX_BATCHES_PER_WAKEUP; ++batch)
+    {
+        auto msgs = std::array<struct mmsghdr, UDP_BATCH_SIZE>{};
+        auto iov = std::array<struct iovec, UDP_BATCH_SIZE>{};
+        auto from = std::array<struct sockaddr_storage, UDP_BATCH_SIZE>{};
+
+        for (size_t i = 0; i < UDP_BATCH_SIZE; ++i)
+        {
+            iov[i].iov_base = std::data(bufs[i]);
+            iov[i].iov_len = UDP_MAX_DATAGRAM - 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int const n = recvmmsg(s, std::data(msgs), UDP_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+
+        for (int i = 0; i < n; ++i)
+        {
+            handle_datagram(session, std::data(bufs[i]), msgs[i].msg_len, &from[i], msgs[i].msg_hdr.msg_namelen);
+        }
+
+        if (n < UDP_BATCH_SIZE)
+        {
+            break;
+        }
+    }
+
+#else
+
+    unsigned char buf[UDP_MAX_DATAGRAM];
+    struct sockaddr_storage from;
+    socklen_t fromlen = sizeof(from);
+    int const rc = recvfrom(s, reinterpret_cast<char*>(buf), UDP_MAX_DATAGRAM - 1, 0, (struct sockaddr*)&from, &fromlen);
+
+    handle_datagram(session, buf, rc, &from, fromlen);
+
+#endif
+}
+
 void tr_udpInit(tr_session* ss)
 {
     TR_ASSERT(ss->udp_socket == TR_BAD_SOCKET);
@@ -311,6 +597,10 @@ void tr_udpInit(tr_session* ss)
         return;
     }
 
+    ss->udp_queue = new tr_udp_queue{};
+    ss->udp_queue->flush_event = event_new(ss->event_base, -1, 0, flush_callback, ss->udp_queue);
+    ss->udp_queue->recv_bufs.resize(UDP_BATCH_SIZE);
+
     ss->udp_socket = socket(PF_INET, SOCK_DGRAM, 0);
 
     if (ss->udp_socket == TR_BAD_SOCKET)
@@ -384,6 +674,14 @@ void tr_udpUninit(tr_session* ss)
 {
     tr_dhtUninit(ss);
 
+    if (ss->udp_queue != nullptr)
+    {
+        udp_flush(ss->udp_queue);
+        event_free(ss->udp_queue->flush_event);
+        delete ss->udp_queue;
+        ss->udp_queue = nullptr;
+    }
+
     if (ss->udp_socket != TR_BAD_SOCKET)
     {
         tr_netCloseSocket(ss->udp_socket);
@@ -31,4 +31,9 @@ void tr_udpInit(tr_session*);
 void tr_udpUninit(tr_session*);
 void tr_udpSetSocketBuffers(tr_session*);
 
+/* Queues a datagram to go out on the UDP socket for `to`'s address family.
+ * Everything queued while the libevent thread is busy with its current
+ * callbacks is sent together afterwards, with sendmmsg() where available. */
+void tr_udpSendTo(tr_session* session, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
 bool tau_handle_message(tr_session* session, uint8_t const* msg, size_t msglen);
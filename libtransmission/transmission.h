@@ -1749,6 +1749,14 @@ struct tr_stat
         This ONLY counts piece data. */
     float pieceDownloadSpeed_KBps;
 
+    /** The speed that this torrent's limit and the session's limit, if it
+        honors it, hold pieceUploadSpeed_KBps to, or -1 if it's unlimited. */
+    float pieceUploadSpeedLimit_KBps;
+
+    /** The speed that this torrent's limit and the session's limit, if it
+        honors it, hold pieceDownloadSpeed_KBps to, or -1 if it's unlimited. */
+    float pieceDownloadSpeedLimit_KBps;
+
 #define TR_ETA_NOT_AVAIL -1
 #define TR_ETA_UNKNOWN -2
     /** If downloading, estimated number of seconds left until the torrent is done.
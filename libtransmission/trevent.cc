@@ -6,6 +6,7 @@
  *
  */
 
+#include <atomic>
 #include <errno.h>
 #include <string.h>
 
@@ -26,7 +27,7 @@
 #include "session.h"
 
 #include "transmission.h"
-#include "platform.h" /* tr_lockLock() */
+#include "platform.h" /* tr_threadNew() */
 #include "tr-assert.h"
 #include "trevent.h"
 #include "utils.h"
@@ -148,23 +149,28 @@ using tr_pipe_end_t = int;
 ****
 ***/
 
+struct tr_run_data
+{
+    void (*func)(void*);
+    void* user_data;
+    tr_run_data* next;
+};
+
+/* Calls from other threads are pushed onto a lock-free stack, and the
+ * libevent thread takes them all at once whenever it's woken up. Only
+ * the push that finds the stack empty writes to the pipe, so a burst
+ * of calls costs one wakeup instead of a pair of writes apiece. */
 struct tr_event_handle
 {
     bool die;
     tr_pipe_end_t fds[2];
-    tr_lock* lock;
+    std::atomic<tr_run_data*> pending = nullptr;
     tr_session* session;
     tr_thread* thread;
     struct event_base* base;
     struct event* pipeEvent;
 };
 
-struct tr_run_data
-{
-    void (*func)(void*);
-    void* user_data;
-};
-
 #define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
 
 static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
@@ -188,14 +194,29 @@ static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
     {
     case 'r': /* run in libevent thread */
         {
-            struct tr_run_data data;
-            size_t const nwant = sizeof(data);
-            ev_ssize_t const ngot = piperead(fd, &data, nwant);
+            /* the stack is newest-first, so flip it to run the calls in the order they were made */
+            tr_run_data* todo = nullptr;
+
+            for (auto* data = eh->pending.exchange(nullptr, std::memory_order_acquire); data != nullptr;)
+            {
+                auto* const next = data->next;
+                data->next = todo;
+                todo = data;
+                data = next;
+            }
 
-            if (!eh->die && ngot == (ev_ssize_t)nwant)
+            while (todo != nullptr)
             {
-                dbgmsg("invoking function in libevent thread");
-                (*data.func)(data.user_data);
+                auto* const data = todo;
+                todo = todo->next;
+
+                if (!eh->die)
+                {
+                    dbgmsg("invoking function in libevent thread");
+                    (*data->func)(data->user_data);
+                }
+
+                delete data;
             }
 
             break;
@@ -260,10 +281,16 @@ static void libeventThreadFunc(void* veh)
     }
 
     /* shut down the thread */
-    tr_lockFree(eh->lock);
+    for (auto* data = eh->pending.load(); data != nullptr;)
+    {
+        auto* const next = data->next;
+        delete data;
+        data = next;
+    }
+
     event_base_free(base);
     eh->session->events = nullptr;
-    tr_free(eh);
+    delete eh;
     tr_logAddDebug("Closing libevent thread");
 }
 
@@ -273,8 +300,7 @@ void tr_eventInit(tr_session* session)
 
     session->events = nullptr;
 
-    eh = tr_new0(tr_event_handle, 1);
-    eh->lock = tr_lockNew();
+    eh = new tr_event_handle{};
 
     if (pipe(eh->fds) == -1)
     {
@@ -336,28 +362,22 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
     }
     else
     {
-        tr_pipe_end_t fd;
-        char ch;
-        ev_ssize_t res_1;
-        ev_ssize_t res_2;
         tr_event_handle* e = session->events;
-        struct tr_run_data data;
-
-        tr_lockLock(e->lock);
+        auto* const data = new tr_run_data{ func, user_data, e->pending.load(std::memory_order_relaxed) };
 
-        fd = e->fds[1];
-        ch = 'r';
-        res_1 = pipewrite(fd, &ch, 1);
-
-        data.func = func;
-        data.user_data = user_data;
-        res_2 = pipewrite(fd, &data, sizeof(data));
-
-        tr_lockUnlock(e->lock);
+        while (!e->pending.compare_exchange_weak(data->next, data, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
 
-        if (res_1 == -1 || res_2 == -1)
+        /* if the stack wasn't empty, the libevent thread's already been woken up for it */
+        if (data->next == nullptr)
         {
-            tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+            char const ch = 'r';
+
+            if (pipewrite(e->fds[1], &ch, 1) == -1)
+            {
+                tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+            }
         }
     }
 }
@@ -23,6 +23,9 @@
 
 #define MAX_BENC_STR_LENGTH (128 * 1024 * 1024) /* arbitrary */
 
+/* how deep to remember container sizes as a preallocation heuristic */
+#define MAX_PREALLOC_DEPTH 64
+
 /***
 ****  tr_variantParse()
 ****  tr_variantLoad()
@@ -169,6 +172,13 @@ int tr_variantParseBenc(void const* buf_in, void const* bufend_in, tr_variant* t
     auto const* const bufend = static_cast<uint8_t const*>(bufend_in);
     auto stack = std::deque<tr_variant*>{};
     tr_quark key = 0;
+    auto key_cache = tr_variant_key_cache{};
+
+    /* Sibling containers tend to be the same size, e.g. every file in a
+     * multi-file torrent is a two-entry dict. So when a container ends,
+     * remember its size as a preallocation guess for the next container
+     * at that depth. */
+    size_t prealloc_guess[MAX_PREALLOC_DEPTH] = {};
 
     if ((buf_in == nullptr) || (bufend_in == nullptr) || (top == nullptr))
     {
@@ -215,7 +225,8 @@ int tr_variantParseBenc(void const* buf_in, void const* bufend_in, tr_variant* t
 
             if ((v = get_node(stack, &key, top, &err)) != nullptr)
             {
-                tr_variantInitList(v, 0);
+                size_t const depth = std::size(stack);
+                tr_variantInitList(v, depth < MAX_PREALLOC_DEPTH ? prealloc_guess[depth] : 0);
                 stack.push_back(v);
             }
         }
@@ -227,7 +238,8 @@ int tr_variantParseBenc(void const* buf_in, void const* bufend_in, tr_variant* t
 
             if ((v = get_node(stack, &key, top, &err)) != nullptr)
             {
-                tr_variantInitDict(v, 0);
+                size_t const depth = std::size(stack);
+                tr_variantInitDict(v, depth < MAX_PREALLOC_DEPTH ? prealloc_guess[depth] : 0);
                 stack.push_back(v);
             }
         }
@@ -242,6 +254,12 @@ int tr_variantParseBenc(void const* buf_in, void const* bufend_in, tr_variant* t
             }
             else
             {
+                size_t const depth = std::size(stack) - 1;
+                if (depth < MAX_PREALLOC_DEPTH)
+                {
+                    prealloc_guess[depth] = stack.back()->val.l.count;
+                }
+
                 stack.pop_back();
 
                 if (std::empty(stack))
@@ -266,7 +284,7 @@ int tr_variantParseBenc(void const* buf_in, void const* bufend_in, tr_variant* t
 
             if (key == 0 && !std::empty(stack) && tr_variantIsDict(stack.back()))
             {
-                key = tr_quark_new(str, str_len);
+                key = tr_variantKeyCacheGet(&key_cache, str, str_len);
             }
             else if ((v = get_node(stack, &key, top, &err)) != nullptr)
             {
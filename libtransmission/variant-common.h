@@ -13,6 +13,7 @@
 #endif
 
 #include "tr-macros.h"
+#include "variant.h" /* tr_variant_flush_func */
 
 using VariantWalkFunc = void (*)(tr_variant const* val, void* user_data);
 
@@ -29,12 +30,29 @@ struct VariantWalkFuncs
 
 void tr_variantWalk(tr_variant const* top, struct VariantWalkFuncs const* walkFuncs, void* user_data, bool sort_dicts);
 
-void tr_variantToBufJson(tr_variant const* top, struct evbuffer* buf, bool lean);
+void tr_variantToBufJson(
+    tr_variant const* top,
+    struct evbuffer* buf,
+    bool lean,
+    size_t flush_size,
+    tr_variant_flush_func flush_func,
+    void* flush_user_data);
 
 void tr_variantToBufBenc(tr_variant const* top, struct evbuffer* buf);
 
 void tr_variantInit(tr_variant* v, char type);
 
+/* Parsed documents tend to use the same few dict keys over and over,
+ * e.g. every file in a .torrent has a "length" and a "path". This
+ * remembers recent keys so the parsers don't need tr_quark_new() to
+ * search for the same string each time. */
+struct tr_variant_key_cache
+{
+    tr_quark keys[64] = {};
+};
+
+tr_quark tr_variantKeyCacheGet(tr_variant_key_cache* cache, void const* str, size_t len);
+
 /* source - such as a filename. Only when logging an error */
 int tr_jsonParse(char const* source, void const* vbuf, size_t len, tr_variant* setme_benc, char const** setme_end);
 
@@ -41,6 +41,7 @@ struct json_wrapper_data
     struct evbuffer* strbuf;
     char const* source;
     std::deque<tr_variant*> stack;
+    tr_variant_key_cache keyCache;
 
     /* A very common pattern is for a container's children to be similar,
      * e.g. they may all be objects with the same set of keys. So when
@@ -66,7 +67,7 @@ static tr_variant* get_node(struct jsonsl_st* jsn)
     }
     else if (tr_variantIsDict(parent) && data->key != nullptr)
     {
-        node = tr_variantDictAdd(parent, tr_quark_new(data->key, data->keylen));
+        node = tr_variantDictAdd(parent, tr_variantKeyCacheGet(&data->keyCache, data->key, data->keylen));
 
         data->key = nullptr;
         data->keylen = 0;
@@ -179,6 +180,17 @@ static char* extract_escaped_string(char const* in, size_t in_len, size_t* len,
 
     while (in < in_end)
     {
+        /* copy everything up to the next escape as-is */
+        auto const* const escape = static_cast<char const*>(memchr(in, '\\', in_end - in));
+        auto const* const run_end = escape != nullptr ? escape : in_end;
+        evbuffer_add(buf, in, run_end - in);
+        in = run_end;
+
+        if (in == in_end)
+        {
+            break;
+        }
+
         bool unescaped = false;
 
         if (*in == '\\' && in_end - in >= 2)
@@ -428,6 +440,10 @@ struct jsonWalk
     bool doIndent;
     std::deque<ParentState> parents;
     struct evbuffer* out;
+
+    size_t flushSize;
+    tr_variant_flush_func flushFunc;
+    void* flushUserData;
 };
 
 static void jsonIndent(struct jsonWalk* data)
@@ -448,6 +464,11 @@ static void jsonIndent(struct jsonWalk* data)
 
 static void jsonChildFunc(struct jsonWalk* data)
 {
+    if (data->flushFunc != nullptr && evbuffer_get_length(data->out) >= data->flushSize)
+    {
+        data->flushFunc(data->out, data->flushUserData);
+    }
+
     if (!std::empty(data->parents))
     {
         auto& pstate = data->parents.back();
@@ -693,12 +714,21 @@ static struct VariantWalkFuncs const walk_funcs = {
     jsonContainerEndFunc, //
 };
 
-void tr_variantToBufJson(tr_variant const* top, struct evbuffer* buf, bool lean)
+void tr_variantToBufJson(
+    tr_variant const* top,
+    struct evbuffer* buf,
+    bool lean,
+    size_t flush_size,
+    tr_variant_flush_func flush_func,
+    void* flush_user_data)
 {
     struct jsonWalk data;
 
     data.doIndent = !lean;
     data.out = buf;
+    data.flushSize = flush_size;
+    data.flushFunc = flush_func;
+    data.flushUserData = flush_user_data;
 
     tr_variantWalk(top, &walk_funcs, &data, true);
 
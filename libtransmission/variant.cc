@@ -128,6 +128,117 @@ void tr_variantInit(tr_variant* v, char type)
     memset(&v->val, 0, sizeof(v->val));
 }
 
+tr_quark tr_variantKeyCacheGet(tr_variant_key_cache* cache, void const* str, size_t len)
+{
+    auto const* const bytes = static_cast<uint8_t const*>(str);
+
+    /* FNV-1a */
+    auto hash = uint32_t{ 2166136261U };
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+
+    /* an empty slot holds TR_KEY_NONE, whose string is "" */
+    auto& slot = cache->keys[hash % std::size(cache->keys)];
+    size_t slot_len;
+    char const* const slot_str = tr_quark_get_string(slot, &slot_len);
+
+    if (slot_len != len || (len != 0 && memcmp(slot_str, str, len) != 0))
+    {
+        slot = tr_quark_new(str, len);
+    }
+
+    return slot;
+}
+
+/***
+****  tr_variant_arena
+***/
+
+struct tr_variant_arena::block
+{
+    block* next;
+};
+
+/* everything the arena hands out is aligned well enough for a tr_variant */
+static constexpr size_t arenaRoundUp(size_t n)
+{
+    return (n + alignof(tr_variant) - 1) & ~(alignof(tr_variant) - 1);
+}
+
+tr_variant_arena::~tr_variant_arena()
+{
+    while (blocks_ != nullptr)
+    {
+        block* const next = blocks_->next;
+        tr_free(blocks_);
+        blocks_ = next;
+    }
+}
+
+void* tr_variant_arena::alloc(size_t size)
+{
+    size = arenaRoundUp(size);
+
+    if (size > size_t(end_ - pos_))
+    {
+        auto constexpr MaxBlockSize = size_t{ 1024 * 1024 };
+        auto constexpr HeaderSize = arenaRoundUp(sizeof(block));
+
+        /* big requests get a block of their own so that the rest of the current one isn't wasted */
+        bool const is_dedicated = size > next_block_size_ / 2;
+        size_t const data_size = is_dedicated ? size : next_block_size_;
+
+        auto* const b = static_cast<block*>(tr_malloc(HeaderSize + data_size));
+        b->next = blocks_;
+        blocks_ = b;
+
+        char* const data = reinterpret_cast<char*>(b) + HeaderSize;
+
+        if (is_dedicated)
+        {
+            return data;
+        }
+
+        pos_ = data;
+        end_ = data + data_size;
+        next_block_size_ = std::min(next_block_size_ * 2, MaxBlockSize);
+    }
+
+    void* const ret = pos_;
+    pos_ += size;
+    return ret;
+}
+
+void* tr_variant_arena::grow(void* ptr, size_t old_size, size_t new_size)
+{
+    old_size = arenaRoundUp(old_size);
+    new_size = arenaRoundUp(new_size);
+
+    /* if it's the most recent allocation and there's room, just extend it */
+    if (ptr != nullptr && static_cast<char*>(ptr) + old_size == pos_ && new_size - old_size <= size_t(end_ - pos_))
+    {
+        pos_ = static_cast<char*>(ptr) + new_size;
+        return ptr;
+    }
+
+    void* const ret = alloc(new_size);
+
+    if (old_size != 0)
+    {
+        memcpy(ret, ptr, old_size);
+    }
+
+    return ret;
+}
+
+void tr_variantInitArena(tr_variant* v, tr_variant_arena* arena)
+{
+    v->arena = arena;
+    tr_variantInit(v, 0);
+}
+
 /***
 ****
 ***/
@@ -158,6 +269,7 @@ static constexpr char const* tr_variant_string_get_string(struct tr_variant_stri
 
     case TR_STRING_TYPE_HEAP:
     case TR_STRING_TYPE_QUARK:
+    case TR_STRING_TYPE_ARENA:
         return str->str.str;
 
     default:
@@ -173,7 +285,11 @@ static void tr_variant_string_set_quark(struct tr_variant_string* str, tr_quark
     str->str.str = tr_quark_get_string(quark, &str->len);
 }
 
-static void tr_variant_string_set_string(struct tr_variant_string* str, char const* bytes, size_t len)
+static void tr_variant_string_set_string(
+    struct tr_variant_string* str,
+    char const* bytes,
+    size_t len,
+    tr_variant_arena* arena)
 {
     tr_variant_string_clear(str);
 
@@ -199,10 +315,10 @@ static void tr_variant_string_set_string(struct tr_variant_string* str, char con
     }
     else
     {
-        auto* tmp = tr_new(char, len + 1);
+        auto* tmp = arena != nullptr ? static_cast<char*>(arena->alloc(len + 1)) : tr_new(char, len + 1);
         memcpy(tmp, bytes, len);
         tmp[len] = '\0';
-        str->type = TR_STRING_TYPE_HEAP;
+        str->type = arena != nullptr ? TR_STRING_TYPE_ARENA : TR_STRING_TYPE_HEAP;
         str->str.str = tmp;
         str->len = len;
     }
@@ -219,10 +335,101 @@ static constexpr char const* getStr(tr_variant const* v)
     return tr_variant_string_get_string(&v->val.s);
 }
 
+/* Dicts with at least this many children get an open-addressed hash
+ * index of their keys the first time they're searched, so that reading
+ * a big dict key by key (settings, .resume files) isn't quadratic.
+ * Each slot holds a child's position + 1, or 0 if the slot is empty.
+ * There are twice as many slots as `alloc' so the table is at most
+ * half full; it's dropped whenever `alloc' changes or a child is
+ * removed, and rebuilt by the next search. */
+static auto constexpr DictIndexMinCount = size_t{ 16 };
+
+static size_t dictIndexMask(tr_variant const* dict)
+{
+    size_t const n_slots = dict->val.l.alloc * 2;
+
+    TR_ASSERT((n_slots & (n_slots - 1)) == 0);
+
+    return n_slots - 1;
+}
+
+static constexpr size_t dictIndexSlot(tr_quark const key, size_t mask)
+{
+    /* quarks are small sequential numbers, so spread them out first */
+    return size_t((uint64_t(key) * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+}
+
+/* indexes the child at `pos` unless an earlier child has the same key */
+static void dictIndexAdd(tr_variant* dict, size_t pos)
+{
+    uint32_t* const index = dict->val.l.index;
+    size_t const mask = dictIndexMask(dict);
+    tr_quark const key = dict->val.l.vals[pos].key;
+
+    for (size_t slot = dictIndexSlot(key, mask);; slot = (slot + 1) & mask)
+    {
+        if (index[slot] == 0)
+        {
+            index[slot] = uint32_t(pos + 1);
+            break;
+        }
+
+        if (dict->val.l.vals[index[slot] - 1].key == key)
+        {
+            break;
+        }
+    }
+}
+
+static void dictIndexBuild(tr_variant* dict)
+{
+    size_t const n_bytes = sizeof(uint32_t) * (dictIndexMask(dict) + 1);
+    void* const index = dict->arena != nullptr ? dict->arena->alloc(n_bytes) : tr_malloc(n_bytes);
+    memset(index, 0, n_bytes);
+    dict->val.l.index = static_cast<uint32_t*>(index);
+
+    for (size_t i = 0, n = dict->val.l.count; i < n; ++i)
+    {
+        dictIndexAdd(dict, i);
+    }
+}
+
+static void dictIndexFree(tr_variant* dict)
+{
+    if (dict->arena == nullptr)
+    {
+        tr_free(dict->val.l.index);
+    }
+
+    dict->val.l.index = nullptr;
+}
+
 static int dictIndexOf(tr_variant const* dict, tr_quark const key)
 {
     if (tr_variantIsDict(dict))
     {
+        if (dict->val.l.index == nullptr && dict->val.l.count >= DictIndexMinCount)
+        {
+            /* the index is a cache, so building it doesn't change the dict */
+            dictIndexBuild(const_cast<tr_variant*>(dict));
+        }
+
+        if (dict->val.l.index != nullptr)
+        {
+            uint32_t const* const index = dict->val.l.index;
+            size_t const mask = dictIndexMask(dict);
+
+            for (size_t slot = dictIndexSlot(key, mask); index[slot] != 0; slot = (slot + 1) & mask)
+            {
+                if (dict->val.l.vals[index[slot] - 1].key == key)
+                {
+                    return int(index[slot] - 1);
+                }
+            }
+
+            return -1;
+        }
+
         for (size_t i = 0; i < dict->val.l.count; ++i)
         {
             if (dict->val.l.vals[i].key == key)
@@ -447,7 +654,7 @@ bool tr_variantDictFindRaw(tr_variant* dict, tr_quark const key, uint8_t const**
 void tr_variantInitRaw(tr_variant* v, void const* src, size_t byteCount)
 {
     tr_variantInit(v, TR_VARIANT_TYPE_STR);
-    tr_variant_string_set_string(&v->val.s, static_cast<char const*>(src), byteCount);
+    tr_variant_string_set_string(&v->val.s, static_cast<char const*>(src), byteCount, v->arena);
 }
 
 void tr_variantInitQuark(tr_variant* v, tr_quark const q)
@@ -459,7 +666,7 @@ void tr_variantInitQuark(tr_variant* v, tr_quark const q)
 void tr_variantInitStr(tr_variant* v, void const* str, size_t len)
 {
     tr_variantInit(v, TR_VARIANT_TYPE_STR);
-    tr_variant_string_set_string(&v->val.s, static_cast<char const*>(str), len);
+    tr_variant_string_set_string(&v->val.s, static_cast<char const*>(str), len, v->arena);
 }
 
 void tr_variantInitBool(tr_variant* v, bool value)
@@ -502,7 +709,21 @@ static void containerReserve(tr_variant* v, size_t count)
             n *= 2U;
         }
 
-        v->val.l.vals = tr_renew(tr_variant, v->val.l.vals, n);
+        if (v->val.l.index != nullptr)
+        {
+            dictIndexFree(v);
+        }
+
+        if (v->arena != nullptr)
+        {
+            void* const vals = v->arena->grow(v->val.l.vals, sizeof(tr_variant) * v->val.l.alloc, sizeof(tr_variant) * n);
+            v->val.l.vals = static_cast<tr_variant*>(vals);
+        }
+        else
+        {
+            v->val.l.vals = tr_renew(tr_variant, v->val.l.vals, n);
+        }
+
         v->val.l.alloc = n;
     }
 }
@@ -535,6 +756,7 @@ tr_variant* tr_variantListAdd(tr_variant* list)
 
     tr_variant* child = &list->val.l.vals[list->val.l.count++];
     child->key = 0;
+    child->arena = list->arena;
     tr_variantInit(child, TR_VARIANT_TYPE_INT);
 
     return child;
@@ -603,9 +825,15 @@ tr_variant* tr_variantDictAdd(tr_variant* dict, tr_quark const key)
     containerReserve(dict, 1);
 
     tr_variant* val = dict->val.l.vals + dict->val.l.count++;
+    val->arena = dict->arena;
     tr_variantInit(val, TR_VARIANT_TYPE_INT);
     val->key = key;
 
+    if (dict->val.l.index != nullptr)
+    {
+        dictIndexAdd(dict, dict->val.l.count - 1);
+    }
+
     return val;
 }
 
@@ -692,11 +920,24 @@ tr_variant* tr_variantDictAddDict(tr_variant* dict, tr_quark const key, size_t r
     return child;
 }
 
+static void tr_variantCopy(tr_variant* target, tr_variant const* src);
+
 tr_variant* tr_variantDictSteal(tr_variant* dict, tr_quark const key, tr_variant* value)
 {
     tr_variant* child = tr_variantDictAdd(dict, key);
-    *child = *value;
-    child->key = key;
+
+    if (value->arena != dict->arena)
+    {
+        /* the memory isn't ours to take over, so copy it instead */
+        tr_variantCopy(child, value);
+        tr_variantFree(value);
+    }
+    else
+    {
+        *child = *value;
+        child->key = key;
+    }
+
     tr_variantInit(value, value->type);
     return child;
 }
@@ -712,6 +953,11 @@ bool tr_variantDictRemove(tr_variant* dict, tr_quark const key)
 
         tr_variantFree(&dict->val.l.vals[i]);
 
+        if (dict->val.l.index != nullptr)
+        {
+            dictIndexFree(dict);
+        }
+
         if (i != last)
         {
             dict->val.l.vals[i] = dict->val.l.vals[last];
@@ -906,6 +1152,7 @@ static void freeStringFunc(tr_variant const* v, [[maybe_unused]] void* user_data
 static void freeContainerEndFunc(tr_variant const* v, [[maybe_unused]] void* user_data)
 {
     tr_free(v->val.l.vals);
+    tr_free(v->val.l.index);
 }
 
 static struct VariantWalkFuncs const freeWalkFuncs = {
@@ -920,7 +1167,8 @@ static struct VariantWalkFuncs const freeWalkFuncs = {
 
 void tr_variantFree(tr_variant* v)
 {
-    if (tr_variantIsSomething(v))
+    /* arena trees are freed all at once by their arena */
+    if (v->arena == nullptr && tr_variantIsSomething(v))
     {
         tr_variantWalk(v, &freeWalkFuncs, nullptr, false);
     }
@@ -979,6 +1227,44 @@ static void tr_variantListCopy(tr_variant* target, tr_variant const* src)
     }
 }
 
+/* initializes `target` as a deep copy of `src` */
+static void tr_variantCopy(tr_variant* target, tr_variant const* src)
+{
+    if (tr_variantIsBool(src))
+    {
+        tr_variantInitBool(target, src->val.b);
+    }
+    else if (tr_variantIsReal(src))
+    {
+        tr_variantInitReal(target, src->val.d);
+    }
+    else if (tr_variantIsInt(src))
+    {
+        tr_variantInitInt(target, src->val.i);
+    }
+    else if (tr_variantIsString(src))
+    {
+        size_t len = 0;
+        char const* str = nullptr;
+        (void)tr_variantGetStr(src, &str, &len);
+        tr_variantInitRaw(target, str, len);
+    }
+    else if (tr_variantIsDict(src))
+    {
+        tr_variantInitDict(target, src->val.l.count);
+        tr_variantMergeDicts(target, src);
+    }
+    else if (tr_variantIsList(src))
+    {
+        tr_variantInitList(target, src->val.l.count);
+        tr_variantListCopy(target, src);
+    }
+    else
+    {
+        tr_variantInit(target, src->type);
+    }
+}
+
 static size_t tr_variantDictSize(tr_variant const* dict)
 {
     return tr_variantIsDict(dict) ? dict->val.l.count : 0;
@@ -1086,16 +1372,19 @@ void tr_variantMergeDicts(tr_variant* target, tr_variant const* source)
 ****
 ***/
 
-struct evbuffer* tr_variantToBuf(tr_variant const* v, tr_variant_fmt fmt)
+void tr_variantToBufFunc(
+    tr_variant const* v,
+    tr_variant_fmt fmt,
+    struct evbuffer* buf,
+    size_t flush_size,
+    tr_variant_flush_func flush_func,
+    void* user_data)
 {
     struct locale_context locale_ctx;
-    struct evbuffer* buf = evbuffer_new();
 
     /* parse with LC_NUMERIC="C" to ensure a "." decimal separator */
     use_numeric_locale(&locale_ctx, "C");
 
-    evbuffer_expand(buf, 4096); /* alloc a little memory to start off with */
-
     switch (fmt)
     {
     case TR_VARIANT_FMT_BENC:
@@ -1103,16 +1392,25 @@ struct evbuffer* tr_variantToBuf(tr_variant const* v, tr_variant_fmt fmt)
         break;
 
     case TR_VARIANT_FMT_JSON:
-        tr_variantToBufJson(v, buf, false);
+        tr_variantToBufJson(v, buf, false, flush_size, flush_func, user_data);
         break;
 
     case TR_VARIANT_FMT_JSON_LEAN:
-        tr_variantToBufJson(v, buf, true);
+        tr_variantToBufJson(v, buf, true, flush_size, flush_func, user_data);
         break;
     }
 
     /* restore the previous locale */
     restore_locale(&locale_ctx);
+}
+
+struct evbuffer* tr_variantToBuf(tr_variant const* v, tr_variant_fmt fmt)
+{
+    struct evbuffer* buf = evbuffer_new();
+
+    evbuffer_expand(buf, 4096); /* alloc a little memory to start off with */
+
+    tr_variantToBufFunc(v, fmt, buf, 0, nullptr, nullptr);
     return buf;
 }
 
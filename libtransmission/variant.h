@@ -34,7 +34,8 @@ enum tr_string_type
 {
     TR_STRING_TYPE_QUARK,
     TR_STRING_TYPE_HEAP,
-    TR_STRING_TYPE_BUF
+    TR_STRING_TYPE_BUF,
+    TR_STRING_TYPE_ARENA
 };
 
 /* these are PRIVATE IMPLEMENTATION details that should not be touched.
@@ -64,6 +65,8 @@ enum
     TR_VARIANT_TYPE_REAL = 32
 };
 
+class tr_variant_arena;
+
 /* These are PRIVATE IMPLEMENTATION details that should not be touched.
  * I'll probably change them just to break your code! HA HA HA!
  * it's included in the header for inlining and composition */
@@ -73,6 +76,9 @@ struct tr_variant
 
     tr_quark key = TR_KEY_NONE;
 
+    /* if set, this node's strings and children are allocated from here */
+    tr_variant_arena* arena = nullptr;
+
     union
     {
         bool b;
@@ -88,12 +94,50 @@ struct tr_variant
             size_t alloc;
             size_t count;
             struct tr_variant* vals;
+            uint32_t* index; /* dicts only: hash of the keys in `vals', built on demand */
         } l;
     } val = {};
 };
 
 void tr_variantFree(tr_variant*);
 
+/**
+ * A bump allocator for variant trees that are built or parsed, used once,
+ * and thrown away, such as RPC requests and peer messages.
+ *
+ * A tree whose root was given to tr_variantInitArena() takes its nodes,
+ * strings, and container growth from here rather than from the heap, and
+ * tr_variantFree() on any part of it does nothing. All of it is released
+ * at once when the arena is destroyed, so the arena must outlive the tree
+ * and nothing may be moved out of the tree into one that isn't in it.
+ */
+class tr_variant_arena
+{
+public:
+    tr_variant_arena() = default;
+    ~tr_variant_arena();
+
+    tr_variant_arena(tr_variant_arena const&) = delete;
+    tr_variant_arena& operator=(tr_variant_arena const&) = delete;
+
+    void* alloc(size_t size);
+
+    /* grows the block at `ptr`, in place if it was the last one allocated */
+    void* grow(void* ptr, size_t old_size, size_t new_size);
+
+private:
+    struct block;
+
+    block* blocks_ = nullptr;
+    char* pos_ = nullptr;
+    char* end_ = nullptr;
+    size_t next_block_size_ = 4096;
+};
+
+/* Resets `v` to an empty variant whose tree is allocated from `arena`.
+ * Initialize it as a list or dict, or parse into it, as usual. */
+void tr_variantInitArena(tr_variant* v, tr_variant_arena* arena);
+
 /***
 ****  Serialization / Deserialization
 ***/
@@ -111,6 +155,23 @@ char* tr_variantToStr(tr_variant const* variant, tr_variant_fmt fmt, size_t* len
 
 struct evbuffer* tr_variantToBuf(tr_variant const* variant, tr_variant_fmt fmt);
 
+/* called by tr_variantToBufFunc() whenever `buf' holds enough output.
+ * It should drain what it handles from `buf'. */
+using tr_variant_flush_func = void (*)(struct evbuffer* buf, void* user_data);
+
+/* Like tr_variantToBuf(), but appends to `buf' and hands the output to `flush_func'
+ * each time `flush_size' bytes or more have piled up, so that it can be processed
+ * (e.g. compressed) as it's written. This all happens in one call, so how much of
+ * the output is held at once is up to `flush_func'. Whatever's left at the end is
+ * left in `buf'. Only the JSON formats are flushed this way. */
+void tr_variantToBufFunc(
+    tr_variant const* variant,
+    tr_variant_fmt fmt,
+    struct evbuffer* buf,
+    size_t flush_size,
+    tr_variant_flush_func flush_func,
+    void* user_data);
+
 /* TR_VARIANT_FMT_JSON_LEAN and TR_VARIANT_FMT_JSON are equivalent here. */
 bool tr_variantFromFile(tr_variant* setme, tr_variant_fmt fmt, char const* filename, struct tr_error** error);
 
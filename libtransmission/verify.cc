@@ -7,9 +7,15 @@
  */
 
 #include <algorithm>
-#include <cstdlib> /* free() */
-#include <cstring> /* memcmp() */
+#include <condition_variable>
+#include <cstring> /* memcmp(), memcpy() */
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "transmission.h"
 #include "completion.h"
@@ -17,9 +23,10 @@
 #include "file.h"
 #include "log.h"
 #include "platform.h" /* tr_lock() */
+#include "session.h" /* toMemBytes() */
 #include "torrent.h"
 #include "tr-assert.h"
-#include "utils.h" /* tr_malloc(), tr_free() */
+#include "utils.h" /* tr_time_msec(), tr_wait_msec() */
 #include "verify.h"
 
 /***
@@ -28,132 +35,383 @@
 
 enum
 {
-    MSEC_TO_SLEEP_PER_SECOND_DURING_VERIFY = 100
+    /* upper bound on the piece data a torrent's reader keeps in memory
+     * while it waits for the hashing threads to catch up */
+    MAX_BYTES_IN_FLIGHT = 64 * 1024 * 1024,
+
+    /* how far ahead of the reader to ask the OS to prefetch */
+    READAHEAD_BYTES = 8 * 1024 * 1024,
+
+    /* how long the reader naps at a time when it's over its I/O budget */
+    MAX_THROTTLE_NAP_MSEC = 100
 };
 
-static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
+/***
+****  Hashing threads
+***/
+
+namespace
 {
-    tr_sys_file_t fd = TR_BAD_SYS_FILE;
-    uint64_t filePos = 0;
-    bool changed = false;
-    bool hadPiece = false;
-    time_t lastSleptAt = 0;
-    uint32_t piecePos = 0;
-    tr_file_index_t fileIndex = 0;
-    tr_file_index_t prevFileIndex = !fileIndex;
-    tr_piece_index_t pieceIndex = 0;
-    time_t const begin = tr_time();
-    size_t const buflen = 1024 * 128; // 128 KiB buffer
-    auto* const buffer = static_cast<uint8_t*>(tr_malloc(buflen));
 
-    tr_sha1_ctx_t sha = tr_sha1_init();
+struct verify_batch;
 
-    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
-    tr_torrentSetChecked(tor, 0);
+/* a piece that has been read from disk and is waiting to be hashed */
+struct verify_piece
+{
+    tr_piece_index_t index = 0;
+    bool had_piece = false;
+    bool read_ok = false;
+    bool has_piece = false;
+    uint8_t expected_hash[SHA_DIGEST_LENGTH] = {};
+    std::vector<uint8_t> buf;
+    verify_batch* batch = nullptr;
+};
 
-    while (!*stopFlag && pieceIndex < tor->info.pieceCount)
+/* the hashed pieces that are ready to be handed back to a torrent's reader */
+struct verify_batch
+{
+    std::mutex lock;
+    std::condition_variable done_cv;
+    std::vector<verify_piece*> done;
+};
+
+/* a pool of threads that SHA-1 whole pieces for all the readers */
+class verify_hash_pool
+{
+public:
+    explicit verify_hash_pool(size_t n_threads)
     {
-        uint64_t leftInPiece;
-        uint64_t bytesThisPass;
-        uint64_t leftInFile;
-        tr_file const* file = &tor->info.files[fileIndex];
+        for (size_t i = 0; i < n_threads; ++i)
+        {
+            threads_.emplace_back([this]() { run(); });
+        }
+    }
 
-        /* if we're starting a new piece... */
-        if (piecePos == 0)
+    ~verify_hash_pool()
+    {
         {
-            hadPiece = tr_torrentPieceIsComplete(tor, pieceIndex);
+            auto const lock = std::lock_guard(lock_);
+            is_closing_ = true;
         }
 
-        /* if we're starting a new file... */
-        if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
+        todo_cv_.notify_all();
+
+        for (auto& thread : threads_)
         {
-            char* filename = tr_torrentFindFile(tor, fileIndex);
-            fd = filename == nullptr ? TR_BAD_SYS_FILE :
-                                       tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
-            tr_free(filename);
-            prevFileIndex = fileIndex;
+            thread.join();
+        }
+    }
+
+    verify_hash_pool(verify_hash_pool const&) = delete;
+    verify_hash_pool& operator=(verify_hash_pool const&) = delete;
+
+    size_t size() const
+    {
+        return std::size(threads_);
+    }
+
+    void submit(verify_piece* piece)
+    {
+        {
+            auto const lock = std::lock_guard(lock_);
+            todo_.push_back(piece);
         }
 
-        /* figure out how much we can read this pass */
-        leftInPiece = tr_torPieceCountBytes(tor, pieceIndex) - piecePos;
-        leftInFile = file->length - filePos;
-        bytesThisPass = std::min(leftInFile, leftInPiece);
-        bytesThisPass = std::min(bytesThisPass, uint64_t{ buflen });
+        todo_cv_.notify_one();
+    }
 
-        /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+private:
+    void run()
+    {
+        for (;;)
         {
-            uint64_t numRead;
+            auto lock = std::unique_lock(lock_);
+            todo_cv_.wait(lock, [this]() { return is_closing_ || !std::empty(todo_); });
 
-            if (tr_sys_file_read_at(fd, buffer, bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
+            if (std::empty(todo_))
             {
-                bytesThisPass = numRead;
-                tr_sha1_update(sha, buffer, bytesThisPass);
-                tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+                break;
             }
+
+            auto* const piece = todo_.front();
+            todo_.pop_front();
+            lock.unlock();
+
+            piece->has_piece = false;
+
+            if (piece->read_ok)
+            {
+                uint8_t hash[SHA_DIGEST_LENGTH];
+                tr_sha1_ctx_t sha = tr_sha1_init();
+                tr_sha1_update(sha, std::data(piece->buf), std::size(piece->buf));
+                tr_sha1_final(sha, hash);
+                piece->has_piece = memcmp(hash, piece->expected_hash, SHA_DIGEST_LENGTH) == 0;
+            }
+
+            auto* const batch = piece->batch;
+
+            {
+                auto const batch_lock = std::lock_guard(batch->lock);
+                batch->done.push_back(piece);
+            }
+
+            batch->done_cv.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex lock_;
+    std::condition_variable todo_cv_;
+    std::deque<verify_piece*> todo_;
+    bool is_closing_ = false;
+};
+
+} // namespace
+
+/***
+****  Reading
+***/
+
+namespace
+{
+
+/* where a torrent's reader is in the torrent's files */
+struct verify_cursor
+{
+    tr_file_index_t file_index = 0;
+    uint64_t file_pos = 0;
+    tr_sys_file_t fd = TR_BAD_SYS_FILE;
+    bool is_open = false;
+    uint64_t readahead_end = 0;
+};
+
+/* how much the reader has read since it started being throttled */
+struct verify_throttle
+{
+    uint64_t limit = 0;
+    uint64_t start_msec = 0;
+    uint64_t bytes = 0;
+};
+
+} // namespace
+
+static void closeCursorFile(verify_cursor& cursor)
+{
+    if (cursor.fd != TR_BAD_SYS_FILE)
+    {
+        tr_sys_file_close(cursor.fd, nullptr);
+        cursor.fd = TR_BAD_SYS_FILE;
+    }
+
+    cursor.is_open = false;
+}
+
+static bool readFully(tr_sys_file_t fd, uint8_t* buf, uint64_t len, uint64_t offset)
+{
+    while (len > 0)
+    {
+        uint64_t n_read = 0;
+
+        if (!tr_sys_file_read_at(fd, buf, len, offset, &n_read, nullptr) || n_read == 0)
+        {
+            return false;
         }
 
-        /* move our offsets */
-        leftInPiece -= bytesThisPass;
-        leftInFile -= bytesThisPass;
-        piecePos += bytesThisPass;
-        filePos += bytesThisPass;
+        buf += n_read;
+        len -= n_read;
+        offset += n_read;
+    }
+
+    return true;
+}
+
+/* Read the next `len` bytes of the torrent into `buf` with one large
+ * sequential read per file. Returns false if any part of it couldn't be
+ * read, e.g. because the file is missing or too short. */
+static bool readNext(tr_torrent* tor, verify_cursor& cursor, uint8_t* buf, uint64_t len)
+{
+    bool ok = true;
+
+    while (len > 0)
+    {
+        TR_ASSERT(cursor.file_index < tor->info.fileCount);
+
+        tr_file const& file = tor->info.files[cursor.file_index];
 
-        /* if we're finishing a piece... */
-        if (leftInPiece == 0)
+        if (!cursor.is_open && file.length > 0)
         {
-            time_t now;
-            bool hasPiece;
-            uint8_t hash[SHA_DIGEST_LENGTH];
+            char* filename = tr_torrentFindFile(tor, cursor.file_index);
+            cursor.fd = filename == nullptr ?
+                TR_BAD_SYS_FILE :
+                tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
+            cursor.is_open = true;
+            cursor.readahead_end = 0;
+            tr_free(filename);
+        }
 
-            tr_sha1_final(sha, hash);
-            hasPiece = memcmp(hash, tor->info.pieces[pieceIndex].hash, SHA_DIGEST_LENGTH) == 0;
+        uint64_t const n = std::min(file.length - cursor.file_pos, len);
 
-            if (hasPiece || hadPiece)
+        if (n > 0)
+        {
+            if (cursor.fd == TR_BAD_SYS_FILE || !readFully(cursor.fd, buf, n, cursor.file_pos))
             {
-                tr_torrentSetHasPiece(tor, pieceIndex, hasPiece);
-                changed |= hasPiece != hadPiece;
+                ok = false;
             }
+            else
+            {
+                tr_sys_file_advise(cursor.fd, cursor.file_pos, n, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
 
-            tr_torrentSetPieceChecked(tor, pieceIndex);
-            now = tr_time();
-            tor->anyDate = now;
+                /* keep the disk busy while the hashing threads are working */
+                uint64_t const end = cursor.file_pos + n;
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (lastSleptAt != now)
-            {
-                lastSleptAt = now;
-                tr_wait_msec(MSEC_TO_SLEEP_PER_SECOND_DURING_VERIFY);
+                if (end >= cursor.readahead_end && end < file.length)
+                {
+                    uint64_t const readahead = std::min(uint64_t{ READAHEAD_BYTES }, file.length - end);
+                    tr_sys_file_advise(cursor.fd, end, readahead, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+                    cursor.readahead_end = end + readahead / 2;
+                }
             }
+        }
+
+        buf += n;
+        len -= n;
+        cursor.file_pos += n;
+
+        if (cursor.file_pos == file.length)
+        {
+            closeCursorFile(cursor);
+            ++cursor.file_index;
+            cursor.file_pos = 0;
+        }
+    }
+
+    return ok;
+}
+
+/* keep a reader within the session's verify I/O budget */
+static void throttleRead(tr_session const* session, verify_throttle& throttle, uint64_t n_read, bool const* stopFlag)
+{
+    uint64_t const limit = toMemBytes(session->verifyIoLimit_MB);
+
+    if (limit != throttle.limit)
+    {
+        throttle = verify_throttle{};
+        throttle.limit = limit;
+        throttle.start_msec = tr_time_msec();
+    }
+
+    if (limit == 0)
+    {
+        return;
+    }
+
+    throttle.bytes += n_read;
+    uint64_t const due_msec = throttle.start_msec + throttle.bytes * 1000 / limit;
+
+    for (uint64_t now = tr_time_msec(); !*stopFlag && now < due_msec; now = tr_time_msec())
+    {
+        tr_wait_msec(std::min(long(due_msec - now), long{ MAX_THROTTLE_NAP_MSEC }));
+    }
+}
+
+/***
+****
+***/
+
+static verify_hash_pool* hashPool = nullptr;
+
+/* returns true if the piece's completeness changed */
+static bool applyPiece(tr_torrent* tor, verify_piece const* piece)
+{
+    bool changed = false;
+
+    if (piece->has_piece || piece->had_piece)
+    {
+        tr_torrentSetHasPiece(tor, piece->index, piece->has_piece);
+        changed = piece->has_piece != piece->had_piece;
+    }
+
+    tr_torrentSetPieceChecked(tor, piece->index);
+    tor->anyDate = tr_time();
+
+    return changed;
+}
+
+static bool verifyTorrent(tr_torrent* tor, bool const* stopFlag)
+{
+    time_t const begin = tr_time();
+    auto* const pool = hashPool;
+    auto const max_in_flight = std::max(
+        size_t{ 2 },
+        std::min(2 * pool->size(), size_t{ MAX_BYTES_IN_FLIGHT } / std::max(size_t{ 1 }, size_t{ tor->info.pieceSize })));
+
+    auto batch = verify_batch{};
+    auto pieces = std::vector<std::unique_ptr<verify_piece>>{};
+    auto idle = std::vector<verify_piece*>{};
+    auto cursor = verify_cursor{};
+    auto throttle = verify_throttle{};
+    size_t in_flight = 0;
+    bool changed = false;
+
+    /* wait for at least one piece to come back from the hashing threads */
+    auto const reap = [&]()
+    {
+        auto done = std::vector<verify_piece*>{};
 
-            sha = tr_sha1_init();
-            pieceIndex++;
-            piecePos = 0;
+        {
+            auto lock = std::unique_lock(batch.lock);
+            batch.done_cv.wait(lock, [&batch]() { return !std::empty(batch.done); });
+            std::swap(done, batch.done);
         }
 
-        /* if we're finishing a file... */
-        if (leftInFile == 0)
+        for (auto* piece : done)
         {
-            if (fd != TR_BAD_SYS_FILE)
+            changed |= applyPiece(tor, piece);
+            idle.push_back(piece);
+            --in_flight;
+        }
+    };
+
+    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
+    tr_torrentSetChecked(tor, 0);
+
+    for (tr_piece_index_t i = 0; !*stopFlag && i < tor->info.pieceCount; ++i)
+    {
+        if (std::empty(idle))
+        {
+            if (std::size(pieces) < max_in_flight)
             {
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+                pieces.push_back(std::make_unique<verify_piece>());
+                idle.push_back(pieces.back().get());
+            }
+            else
+            {
+                reap();
             }
-
-            fileIndex++;
-            filePos = 0;
         }
+
+        auto* const piece = idle.back();
+        idle.pop_back();
+
+        piece->index = i;
+        piece->had_piece = tr_torrentPieceIsComplete(tor, i);
+        piece->batch = &batch;
+        memcpy(piece->expected_hash, tor->info.pieces[i].hash, SHA_DIGEST_LENGTH);
+        piece->buf.resize(tr_torPieceCountBytes(tor, i));
+        piece->read_ok = readNext(tor, cursor, std::data(piece->buf), std::size(piece->buf));
+
+        pool->submit(piece);
+        ++in_flight;
+
+        throttleRead(tor->session, throttle, std::size(piece->buf), stopFlag);
     }
 
-    /* cleanup */
-    if (fd != TR_BAD_SYS_FILE)
+    while (in_flight > 0)
     {
-        tr_sys_file_close(fd, nullptr);
+        reap();
     }
 
-    tr_sha1_final(sha, nullptr);
-    free(buffer);
+    closeCursorFile(cursor);
 
     /* stopwatch */
     time_t const end = tr_time();
@@ -177,6 +435,7 @@ struct verify_node
     tr_verify_done_func callback_func;
     void* callback_data;
     uint64_t current_size;
+    uint64_t device;
 
     int compare(verify_node const& that) const
     {
@@ -203,11 +462,17 @@ struct verify_node
     }
 };
 
-static struct verify_node currentNode;
-// TODO: refactor s.t. this doesn't leak
+/* a torrent that one of the reader threads is verifying right now */
+struct verify_active
+{
+    verify_node node;
+    bool stop;
+};
+
+// TODO: refactor s.t. these don't leak
 static auto& verifyList{ *new std::set<verify_node>{} };
-static tr_thread* verifyThread = nullptr;
-static bool stopCurrent = false;
+static auto& activeList{ *new std::list<verify_active>{} };
+static size_t readerCount = 0;
 
 static tr_lock* getVerifyLock(void)
 {
@@ -221,45 +486,89 @@ static tr_lock* getVerifyLock(void)
     return lock;
 }
 
+/* Torrents on the same disk are verified one at a time so that their
+ * readers don't make the disk seek back and forth between them, but
+ * torrents on different disks are verified in parallel. */
+static auto findStartableNode()
+{
+    return std::find_if(
+        std::begin(verifyList),
+        std::end(verifyList),
+        [](auto const& node)
+        {
+            return std::none_of(
+                std::begin(activeList),
+                std::end(activeList),
+                [&node](auto const& active) { return active.node.device == node.device; });
+        });
+}
+
+static void verifyThreadFunc(void* user_data);
+
+/* called with the verify lock held */
+static void maybeStartReader()
+{
+    if (readerCount == std::size(activeList) && findStartableNode() != std::end(verifyList))
+    {
+        ++readerCount;
+        tr_threadNew(verifyThreadFunc, nullptr);
+    }
+}
+
 static void verifyThreadFunc([[maybe_unused]] void* user_data)
 {
+    tr_lock* lock = getVerifyLock();
+    tr_lockLock(lock);
+
     for (;;)
     {
-        bool changed = false;
-
-        tr_lockLock(getVerifyLock());
-        stopCurrent = false;
-        if (std::empty(verifyList))
+        auto const it = findStartableNode();
+        if (it == std::end(verifyList))
         {
-            currentNode.torrent = nullptr;
-            break; // FIXME: unbalanced lock?
+            break;
         }
 
-        auto const it = std::begin(verifyList);
-        currentNode = *it;
+        auto& active = activeList.emplace_back(verify_active{ *it, false });
         verifyList.erase(it);
-        tr_lockUnlock(getVerifyLock());
 
-        tr_torrent* tor = currentNode.torrent;
+        tr_torrent* tor = active.node.torrent;
+
+        if (hashPool == nullptr)
+        {
+            hashPool = new verify_hash_pool(size_t(std::max(tor->session->verifyThreads, 1)));
+        }
+
+        // there may be work waiting on another disk
+        maybeStartReader();
+        tr_lockUnlock(lock);
+
         tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
         tr_torrentSetVerifyState(tor, TR_VERIFY_NOW);
-        changed = verifyTorrent(tor, &stopCurrent);
+        bool const changed = verifyTorrent(tor, &active.stop);
         tr_torrentSetVerifyState(tor, TR_VERIFY_NONE);
         TR_ASSERT(tr_isTorrent(tor));
 
-        if (!stopCurrent && changed)
+        if (!active.stop && changed)
         {
             tr_torrentSetDirty(tor);
         }
 
-        if (currentNode.callback_func != nullptr)
+        if (active.node.callback_func != nullptr)
         {
-            (*currentNode.callback_func)(tor, stopCurrent, currentNode.callback_data);
+            (*active.node.callback_func)(tor, active.stop, active.node.callback_data);
         }
+
+        tr_lockLock(lock);
+        activeList.remove_if([&active](auto const& a) { return &a == &active; });
     }
 
-    verifyThread = nullptr;
-    tr_lockUnlock(getVerifyLock());
+    if (--readerCount == 0)
+    {
+        delete hashPool;
+        hashPool = nullptr;
+    }
+
+    tr_lockUnlock(lock);
 }
 
 void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* callback_data)
@@ -273,15 +582,14 @@ void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* call
     node.callback_data = callback_data;
     node.current_size = tr_torrentGetCurrentSizeOnDisk(tor);
 
+    auto info = tr_sys_path_info{};
+    char const* const dir = tr_torrentGetCurrentDir(tor);
+    node.device = dir != nullptr && tr_sys_path_get_info(dir, 0, &info, nullptr) ? info.device : 0;
+
     tr_lockLock(getVerifyLock());
     tr_torrentSetVerifyState(tor, TR_VERIFY_WAIT);
     verifyList.insert(node);
-
-    if (verifyThread == nullptr)
-    {
-        verifyThread = tr_threadNew(verifyThreadFunc, nullptr);
-    }
-
+    maybeStartReader();
     tr_lockUnlock(getVerifyLock());
 }
 
@@ -292,11 +600,25 @@ void tr_verifyRemove(tr_torrent* tor)
     tr_lock* lock = getVerifyLock();
     tr_lockLock(lock);
 
-    if (tor == currentNode.torrent)
+    auto const is_active = [tor]()
     {
-        stopCurrent = true;
+        return std::find_if(
+                   std::begin(activeList),
+                   std::end(activeList),
+                   [tor](auto const& active) { return tor == active.node.torrent; }) != std::end(activeList);
+    };
 
-        while (stopCurrent)
+    if (is_active())
+    {
+        for (auto& active : activeList)
+        {
+            if (active.node.torrent == tor)
+            {
+                active.stop = true;
+            }
+        }
+
+        while (is_active())
         {
             tr_lockUnlock(lock);
             tr_wait_msec(100);
@@ -330,7 +652,11 @@ void tr_verifyClose([[maybe_unused]] tr_session* session)
 {
     tr_lockLock(getVerifyLock());
 
-    stopCurrent = true;
+    for (auto& active : activeList)
+    {
+        active.stop = true;
+    }
+
     verifyList.clear();
 
     tr_lockUnlock(getVerifyLock());
@@ -0,0 +1,209 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "bandwidth.h"
+
+#include "gtest/gtest.h"
+
+// These tests pass their own timestamps, so they don't depend on the clock.
+
+namespace
+{
+
+auto constexpr Start = uint64_t{ 1000000 };
+auto constexpr Plenty = 1000000U;
+
+void consume(Bandwidth& b, tr_direction dir, size_t n, uint64_t now)
+{
+    b.notifyBandwidthConsumed(dir, n, true, now);
+}
+
+} // namespace
+
+TEST(Bandwidth, unlimited)
+{
+    auto b = Bandwidth{};
+    EXPECT_EQ(Plenty, b.clamp(Start, TR_UP, Plenty));
+    EXPECT_EQ(Plenty, b.clamp(Start, TR_DOWN, Plenty));
+}
+
+TEST(Bandwidth, refillsAtTheDesiredSpeed)
+{
+    auto b = Bandwidth{};
+    b.setLimited(TR_DOWN, true);
+    b.setDesiredSpeed_Bps(TR_DOWN, 10000);
+
+    // a new bucket starts out with a burst's worth of tokens
+    EXPECT_EQ(1000U, b.getBurst_Bytes(TR_DOWN));
+    EXPECT_EQ(1000U, b.clamp(Start, TR_DOWN, Plenty));
+
+    consume(b, TR_DOWN, 1000, Start);
+    EXPECT_EQ(0U, b.clamp(Start, TR_DOWN, Plenty));
+
+    EXPECT_EQ(100U, b.clamp(Start + 10, TR_DOWN, Plenty));
+    EXPECT_EQ(250U, b.clamp(Start + 25, TR_DOWN, Plenty));
+
+    // an idle bucket doesn't fill past its burst size
+    EXPECT_EQ(1000U, b.clamp(Start + 60000, TR_DOWN, Plenty));
+
+    // the clock going backwards doesn't earn or lose anything
+    consume(b, TR_DOWN, 200, Start + 60000);
+    EXPECT_EQ(800U, b.clamp(Start, TR_DOWN, Plenty));
+    EXPECT_EQ(900U, b.clamp(Start + 10, TR_DOWN, Plenty));
+}
+
+TEST(Bandwidth, keepsFractionsOfBytes)
+{
+    auto b = Bandwidth{};
+    b.setLimited(TR_UP, true);
+    b.setDesiredSpeed_Bps(TR_UP, 10);
+    b.setBurst_Bytes(TR_UP, 100);
+
+    EXPECT_EQ(100U, b.clamp(Start, TR_UP, Plenty));
+    consume(b, TR_UP, 100, Start);
+
+    // checking every 70 msec mustn't round each 0.7 byte down to nothing
+    for (uint64_t now = Start; now <= Start + 1000; now += 70)
+    {
+        (void)b.clamp(now, TR_UP, Plenty);
+    }
+
+    EXPECT_EQ(10U, b.clamp(Start + 1000, TR_UP, Plenty));
+}
+
+TEST(Bandwidth, directionsAreSeparate)
+{
+    auto b = Bandwidth{};
+    b.setLimited(TR_DOWN, true);
+    b.setDesiredSpeed_Bps(TR_DOWN, 1000);
+    consume(b, TR_DOWN, 100, Start);
+
+    // the upload side isn't limited by what's been downloaded
+    EXPECT_EQ(0U, b.clamp(Start, TR_DOWN, Plenty));
+    EXPECT_EQ(Plenty, b.clamp(Start, TR_UP, Plenty));
+
+    b.setLimited(TR_UP, true);
+    b.setDesiredSpeed_Bps(TR_UP, 4000);
+    EXPECT_EQ(400U, b.clamp(Start, TR_UP, Plenty));
+}
+
+TEST(Bandwidth, onlyPieceDataCounts)
+{
+    auto b = Bandwidth{};
+    b.setLimited(TR_UP, true);
+    b.setDesiredSpeed_Bps(TR_UP, 1000);
+
+    b.notifyBandwidthConsumed(TR_UP, 300, false, Start);
+    EXPECT_EQ(100U, b.clamp(Start, TR_UP, Plenty));
+    EXPECT_EQ(150U, b.getRawSpeed_Bps(Start, TR_UP));
+}
+
+TEST(Bandwidth, childrenShareTheirParentsBucket)
+{
+    auto session = Bandwidth{};
+    auto busy = Bandwidth{ &session };
+    auto idle = Bandwidth{ &session };
+    session.setLimited(TR_UP, true);
+    session.setDesiredSpeed_Bps(TR_UP, 10000);
+
+    // a busy child can use what an idle sibling leaves unused...
+    EXPECT_EQ(1000U, busy.clamp(Start, TR_UP, Plenty));
+    consume(busy, TR_UP, 1000, Start);
+    EXPECT_EQ(0U, busy.clamp(Start, TR_UP, Plenty));
+    EXPECT_EQ(0U, idle.clamp(Start, TR_UP, Plenty));
+
+    // ...and the siblings take turns as it refills
+    consume(busy, TR_UP, 100, Start + 20);
+    EXPECT_EQ(100U, idle.clamp(Start + 20, TR_UP, Plenty));
+    EXPECT_EQ(550U, session.getPieceSpeed_Bps(Start + 20, TR_UP));
+}
+
+TEST(Bandwidth, childLimits)
+{
+    auto session = Bandwidth{};
+    auto torrent = Bandwidth{ &session };
+    auto peer = Bandwidth{ &torrent };
+    session.setLimited(TR_DOWN, true);
+    session.setDesiredSpeed_Bps(TR_DOWN, 10000);
+    torrent.setLimited(TR_DOWN, true);
+    torrent.setDesiredSpeed_Bps(TR_DOWN, 2000);
+
+    // the tightest bucket on the way up wins
+    EXPECT_EQ(200U, peer.clamp(Start, TR_DOWN, Plenty));
+
+    consume(peer, TR_DOWN, 200, Start);
+    EXPECT_EQ(0U, peer.clamp(Start, TR_DOWN, Plenty));
+    EXPECT_EQ(800U, session.clamp(Start, TR_DOWN, Plenty));
+
+    // unless the torrent ignores the session's limits
+    session.setDesiredSpeed_Bps(TR_DOWN, 100);
+    EXPECT_EQ(10U, peer.clamp(Start + 1000, TR_DOWN, Plenty));
+
+    torrent.honorParentLimits(TR_DOWN, false);
+    EXPECT_EQ(200U, peer.clamp(Start + 1000, TR_DOWN, Plenty));
+}
+
+TEST(Bandwidth, effectiveLimit)
+{
+    auto session = Bandwidth{};
+    auto torrent = Bandwidth{ &session };
+    auto peer = Bandwidth{ &torrent };
+    EXPECT_EQ(0U, peer.getLimit_Bps(TR_UP));
+
+    session.setLimited(TR_UP, true);
+    session.setDesiredSpeed_Bps(TR_UP, 10000);
+    torrent.setLimited(TR_UP, true);
+    torrent.setDesiredSpeed_Bps(TR_UP, 2000);
+    EXPECT_EQ(2000U, peer.getLimit_Bps(TR_UP));
+    EXPECT_EQ(0U, peer.getLimit_Bps(TR_DOWN));
+
+    torrent.setLimited(TR_UP, false);
+    EXPECT_EQ(10000U, peer.getLimit_Bps(TR_UP));
+
+    torrent.honorParentLimits(TR_UP, false);
+    EXPECT_EQ(0U, peer.getLimit_Bps(TR_UP));
+}
+
+TEST(Bandwidth, limitedInSubtree)
+{
+    auto session = Bandwidth{};
+    auto torrent = Bandwidth{ &session };
+    auto peer = Bandwidth{ &torrent };
+    EXPECT_FALSE(session.isLimitedInSubtree(TR_UP));
+
+    torrent.setLimited(TR_UP, true);
+    EXPECT_TRUE(session.isLimitedInSubtree(TR_UP));
+    EXPECT_FALSE(session.isLimitedInSubtree(TR_DOWN));
+    EXPECT_FALSE(peer.isLimitedInSubtree(TR_UP));
+
+    torrent.setLimited(TR_UP, false);
+    session.setLimited(TR_DOWN, true);
+    EXPECT_FALSE(session.isLimitedInSubtree(TR_UP));
+    EXPECT_TRUE(session.isLimitedInSubtree(TR_DOWN));
+}
+
+TEST(Bandwidth, reparenting)
+{
+    auto session = Bandwidth{};
+    auto a = Bandwidth{ &session };
+    auto b = Bandwidth{ &session };
+    auto peer = Bandwidth{ &a };
+
+    a.setLimited(TR_UP, true);
+    a.setDesiredSpeed_Bps(TR_UP, 1000);
+    EXPECT_EQ(100U, peer.clamp(Start, TR_UP, Plenty));
+
+    peer.setParent(&b);
+    EXPECT_EQ(Plenty, peer.clamp(Start, TR_UP, Plenty));
+
+    peer.setParent(nullptr);
+    b.setParent(nullptr);
+    a.setLimited(TR_UP, false);
+    EXPECT_EQ(Plenty, peer.clamp(Start, TR_UP, Plenty));
+}
@@ -13,6 +13,8 @@
 
 #include "gtest/gtest.h"
 
+#include <vector>
+
 TEST(Bitfield, countRange)
 {
     auto constexpr IterCount = int{ 10000 };
@@ -215,3 +217,236 @@ TEST(Bitfields, hasAllNone)
 
     tr_bitfieldDestruct(&field);
 }
+
+TEST(Bitfields, counts)
+{
+    // odd sizes so that there's a partial byte at the end
+    for (size_t const bit_count : { 1, 7, 9, 31, 1001, 4099 })
+    {
+        auto field = tr_bitfield{};
+        tr_bitfieldConstruct(&field, bit_count);
+
+        for (size_t i = 0; i < bit_count; ++i)
+        {
+            if (tr_rand_int_weak(3) == 0)
+            {
+                tr_bitfieldAdd(&field, i);
+            }
+        }
+
+        // a counter past the end of the bitfield mustn't be touched
+        auto counts = std::vector<uint16_t>(bit_count + 1, 5);
+        auto expected = counts;
+
+        for (size_t i = 0; i < bit_count; ++i)
+        {
+            expected[i] += tr_bitfieldHas(&field, i) ? 1 : 0;
+        }
+
+        tr_bitfieldIncrCounts(&field, std::data(counts), bit_count);
+        EXPECT_EQ(expected, counts);
+
+        tr_bitfieldDecrCounts(&field, std::data(counts), bit_count);
+        EXPECT_EQ(std::vector<uint16_t>(bit_count + 1, 5), counts);
+
+        // haves and have-nones
+        tr_bitfieldSetHasAll(&field);
+        tr_bitfieldIncrCounts(&field, std::data(counts), bit_count);
+        EXPECT_EQ(6, counts.front());
+        EXPECT_EQ(6, counts[bit_count - 1]);
+        EXPECT_EQ(5, counts.back());
+
+        tr_bitfieldSetHasNone(&field);
+        tr_bitfieldDecrCounts(&field, std::data(counts), bit_count);
+        EXPECT_EQ(6, counts.front());
+
+        tr_bitfieldDestruct(&field);
+    }
+}
+
+TEST(Bitfields, findNext)
+{
+    auto constexpr BitCount = size_t{ 300 };
+
+    auto field = tr_bitfield{};
+    tr_bitfieldConstruct(&field, BitCount);
+
+    EXPECT_EQ(BitCount, tr_bitfieldFindNextSet(&field, 0, BitCount));
+    EXPECT_EQ(5, tr_bitfieldFindNextUnset(&field, 5, BitCount));
+
+    tr_bitfieldAdd(&field, 3);
+    tr_bitfieldAdd(&field, 130);
+    tr_bitfieldAddRange(&field, 200, BitCount);
+
+    EXPECT_EQ(3, tr_bitfieldFindNextSet(&field, 0, BitCount));
+    EXPECT_EQ(3, tr_bitfieldFindNextSet(&field, 3, BitCount));
+    EXPECT_EQ(130, tr_bitfieldFindNextSet(&field, 4, BitCount));
+    EXPECT_EQ(100, tr_bitfieldFindNextSet(&field, 4, 100));
+    EXPECT_EQ(200, tr_bitfieldFindNextSet(&field, 131, BitCount));
+
+    EXPECT_EQ(0, tr_bitfieldFindNextUnset(&field, 0, BitCount));
+    EXPECT_EQ(4, tr_bitfieldFindNextUnset(&field, 3, BitCount));
+    EXPECT_EQ(BitCount, tr_bitfieldFindNextUnset(&field, 200, BitCount));
+    EXPECT_EQ(BitCount, tr_bitfieldFindNextUnset(&field, 250, BitCount));
+
+    // compare against walking the bits one at a time
+    for (size_t begin = 0; begin < BitCount; begin += 7)
+    {
+        auto next_set = begin;
+        while (next_set < BitCount && !tr_bitfieldHas(&field, next_set))
+        {
+            ++next_set;
+        }
+
+        auto next_unset = begin;
+        while (next_unset < BitCount && tr_bitfieldHas(&field, next_unset))
+        {
+            ++next_unset;
+        }
+
+        EXPECT_EQ(next_set, tr_bitfieldFindNextSet(&field, begin, BitCount));
+        EXPECT_EQ(next_unset, tr_bitfieldFindNextUnset(&field, begin, BitCount));
+    }
+
+    tr_bitfieldSetHasAll(&field);
+    EXPECT_EQ(10, tr_bitfieldFindNextSet(&field, 10, BitCount));
+    EXPECT_EQ(BitCount, tr_bitfieldFindNextUnset(&field, 10, BitCount));
+
+    tr_bitfieldDestruct(&field);
+}
+
+TEST(Bitfields, hasAnyNotIn)
+{
+    auto constexpr BitCount = size_t{ 1000 };
+
+    auto a = tr_bitfield{};
+    auto b = tr_bitfield{};
+    tr_bitfieldConstruct(&a, BitCount);
+    tr_bitfieldConstruct(&b, BitCount);
+
+    EXPECT_FALSE(tr_bitfieldHasAnyNotIn(&a, &b));
+
+    tr_bitfieldAdd(&a, 999);
+    EXPECT_TRUE(tr_bitfieldHasAnyNotIn(&a, &b));
+    EXPECT_FALSE(tr_bitfieldHasAnyNotIn(&b, &a));
+
+    tr_bitfieldAddRange(&b, 900, BitCount);
+    EXPECT_FALSE(tr_bitfieldHasAnyNotIn(&a, &b));
+    EXPECT_TRUE(tr_bitfieldHasAnyNotIn(&b, &a));
+
+    tr_bitfieldSetHasAll(&a);
+    EXPECT_TRUE(tr_bitfieldHasAnyNotIn(&a, &b));
+
+    tr_bitfieldAddRange(&b, 0, BitCount);
+    EXPECT_FALSE(tr_bitfieldHasAnyNotIn(&a, &b));
+
+    tr_bitfieldSetHasNone(&a);
+    EXPECT_FALSE(tr_bitfieldHasAnyNotIn(&a, &b));
+
+    tr_bitfieldDestruct(&b);
+    tr_bitfieldDestruct(&a);
+}
+
+TEST(Bitfields, remBitfield)
+{
+    auto constexpr BitCount = size_t{ 500 };
+
+    auto field = tr_bitfield{};
+    auto other = tr_bitfield{};
+    tr_bitfieldConstruct(&field, BitCount);
+    tr_bitfieldConstruct(&other, BitCount);
+
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        if (i % 3 == 0)
+        {
+            tr_bitfieldAdd(&other, i);
+        }
+    }
+
+    tr_bitfieldSetHasAll(&field);
+    tr_bitfieldRemBitfield(&field, &other);
+
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        EXPECT_EQ(i % 3 != 0, tr_bitfieldHas(&field, i));
+    }
+
+    EXPECT_EQ(BitCount - tr_bitfieldCountTrueBits(&other), tr_bitfieldCountTrueBits(&field));
+
+    tr_bitfieldSetHasAll(&other);
+    tr_bitfieldRemBitfield(&field, &other);
+    EXPECT_TRUE(tr_bitfieldHasNone(&field));
+
+    tr_bitfieldDestruct(&other);
+    tr_bitfieldDestruct(&field);
+}
+
+/**
+ * Counts ranges of a large, half-full bitfield, such as a torrent's blocks
+ * when summing up its files, and checks it against the byte lookup table we
+ * used to count with. It's slow, so it only runs with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(Bitfields, DISABLED_benchmarkCountRange)
+{
+    auto constexpr BitCount = size_t{ 1 } << 20;
+    auto constexpr RangeSize = size_t{ 4096 };
+    auto constexpr Rounds = size_t{ 20 };
+
+    auto raw = std::vector<uint8_t>(BitCount / 8);
+
+    for (auto& byte : raw)
+    {
+        byte = tr_rand_int_weak(256);
+    }
+
+    auto field = tr_bitfield{};
+    tr_bitfieldConstruct(&field, BitCount);
+    tr_bitfieldSetRaw(&field, std::data(raw), std::size(raw), true);
+
+    // the old way
+    auto table = std::vector<uint8_t>(256);
+
+    for (size_t i = 0; i < std::size(table); ++i)
+    {
+        table[i] = (i & 1) + table[i / 2];
+    }
+
+    auto table_count = size_t{};
+
+    for (size_t round = 0; round < Rounds; ++round)
+    {
+        for (size_t begin = round; begin + RangeSize <= BitCount; begin += RangeSize)
+        {
+            auto const end = begin + RangeSize;
+            auto const first_byte = begin / 8;
+            auto const last_byte = (end - 1) / 8;
+
+            table_count += table[uint8_t(field.bits[first_byte] << (begin % 8)) >> (begin % 8)];
+
+            for (size_t i = first_byte + 1; i < last_byte; ++i)
+            {
+                table_count += table[field.bits[i]];
+            }
+
+            auto const last_shift = (last_byte + 1) * 8 - end;
+            table_count += table[uint8_t(field.bits[last_byte] >> last_shift << last_shift)];
+        }
+    }
+
+    // the new way
+    auto word_count = size_t{};
+
+    for (size_t round = 0; round < Rounds; ++round)
+    {
+        for (size_t begin = round; begin + RangeSize <= BitCount; begin += RangeSize)
+        {
+            word_count += tr_bitfieldCountRange(&field, begin, begin + RangeSize);
+        }
+    }
+
+    EXPECT_EQ(table_count, word_count);
+
+    tr_bitfieldDestruct(&field);
+}
@@ -0,0 +1,246 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h"
+#include "crypto-utils.h" // SHA_DIGEST_LENGTH
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using CacheTest = SessionTest;
+
+TEST_F(CacheTest, takePieceHash)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_LT(tor->blockSize, tor->info.pieceSize);
+
+    struct TestData
+    {
+        tr_torrent* tor = {};
+        bool in_order = {};
+        bool out_of_order = {};
+        bool unfinished = {};
+        bool overwritten = {};
+        std::array<uint8_t, SHA_DIGEST_LENGTH> in_order_hash = {};
+        std::array<uint8_t, SHA_DIGEST_LENGTH> out_of_order_hash = {};
+        bool done = {};
+    };
+
+    auto const test_func = [](void* vdata) noexcept
+    {
+        auto* data = static_cast<TestData*>(vdata);
+        auto* const torrent = data->tor;
+        auto* const cache = torrent->session->cache;
+        auto const zeroes = std::vector<char>(torrent->blockSize);
+        auto* const buf = evbuffer_new();
+
+        auto const write_block = [&](tr_piece_index_t piece, uint32_t offset)
+        {
+            evbuffer_add(buf, std::data(zeroes), torrent->blockSize);
+            tr_cacheWriteBlock(cache, torrent, piece, offset, torrent->blockSize, buf);
+        };
+
+        auto const n_blocks = torrent->info.pieceSize / torrent->blockSize;
+        uint8_t hash[SHA_DIGEST_LENGTH];
+
+        // blocks that arrive in order get hashed
+        for (uint32_t i = 0; i < n_blocks; ++i)
+        {
+            write_block(0, i * torrent->blockSize);
+        }
+
+        data->in_order = tr_cacheTakePieceHash(cache, torrent, 0, std::data(data->in_order_hash));
+
+        // blocks that arrive ahead get picked up once the gap is filled
+        for (uint32_t i = n_blocks; i-- > 0;)
+        {
+            write_block(1, i * torrent->blockSize);
+        }
+
+        data->out_of_order = tr_cacheTakePieceHash(cache, torrent, 1, std::data(data->out_of_order_hash));
+
+        // an unfinished piece has no hash
+        write_block(2, 0);
+        data->unfinished = tr_cacheTakePieceHash(cache, torrent, 2, hash);
+
+        // neither does one whose hashed blocks were overwritten
+        for (uint32_t i = 0; i < n_blocks; ++i)
+        {
+            write_block(3, i * torrent->blockSize);
+        }
+
+        write_block(3, torrent->blockSize);
+        data->overwritten = tr_cacheTakePieceHash(cache, torrent, 3, hash);
+
+        evbuffer_free(buf);
+        data->done = true;
+    };
+
+    auto data = TestData{};
+    data.tor = tor;
+    tr_runInEventThread(session_, test_func, &data);
+
+    auto const test = [&data]()
+    {
+        return data.done;
+    };
+    EXPECT_TRUE(waitFor(test, 2000));
+
+    // the zero torrent's pieces are all zeroes
+    EXPECT_TRUE(data.in_order);
+    EXPECT_EQ(0, memcmp(std::data(data.in_order_hash), tor->info.pieces[0].hash, SHA_DIGEST_LENGTH));
+    EXPECT_TRUE(data.out_of_order);
+    EXPECT_EQ(0, memcmp(std::data(data.out_of_order_hash), tor->info.pieces[1].hash, SHA_DIGEST_LENGTH));
+    EXPECT_FALSE(data.unfinished);
+    EXPECT_FALSE(data.overwritten);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, readBlockToBuffer)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    struct TestData
+    {
+        tr_torrent* tor = {};
+        bool is_shared = {};
+        bool is_copied = {};
+        bool old_copy_kept = {};
+        bool new_copy_read = {};
+        bool done = {};
+    };
+
+    auto const test_func = [](void* vdata) noexcept
+    {
+        auto* data = static_cast<TestData*>(vdata);
+        auto* const torrent = data->tor;
+        auto* const cache = torrent->session->cache;
+        auto const len = torrent->blockSize;
+        auto const zeroes = std::vector<uint8_t>(len);
+        auto const ones = std::vector<uint8_t>(len, 0xFF);
+        auto* const a = evbuffer_new();
+        auto* const b = evbuffer_new();
+        auto* const c = evbuffer_new();
+        auto* const d = evbuffer_new();
+
+        // peers that get the block by reference share one copy of it
+        tr_cacheReadBlockToBuffer(cache, torrent, 0, 0, len, a, true);
+        tr_cacheReadBlockToBuffer(cache, torrent, 0, 0, len, b, true);
+        tr_cacheReadBlockToBuffer(cache, torrent, 0, 0, len, c, false);
+        auto const* const pa = evbuffer_pullup(a, -1);
+        auto const* const pc = evbuffer_pullup(c, -1);
+        data->is_shared = pa == evbuffer_pullup(b, -1);
+        data->is_copied = pa != pc && memcmp(pa, pc, len) == 0;
+
+        // overwriting the block doesn't change the copy that's waiting to be sent
+        evbuffer_add(d, std::data(ones), len);
+        tr_cacheWriteBlock(cache, torrent, 0, 0, len, d);
+        tr_cacheReadBlockToBuffer(cache, torrent, 0, 0, len, d, true);
+        data->old_copy_kept = memcmp(evbuffer_pullup(a, -1), std::data(zeroes), len) == 0;
+        data->new_copy_read = memcmp(evbuffer_pullup(d, -1), std::data(ones), len) == 0;
+
+        for (auto* buf : { a, b, c, d })
+        {
+            evbuffer_free(buf);
+        }
+
+        data->done = true;
+    };
+
+    auto data = TestData{};
+    data.tor = tor;
+    tr_runInEventThread(session_, test_func, &data);
+
+    auto const test = [&data]()
+    {
+        return data.done;
+    };
+    EXPECT_TRUE(waitFor(test, 2000));
+    EXPECT_TRUE(data.is_shared);
+    EXPECT_TRUE(data.is_copied);
+    EXPECT_TRUE(data.old_copy_kept);
+    EXPECT_TRUE(data.new_copy_read);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, readBlockAsync)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    struct TestData
+    {
+        tr_torrent* tor = {};
+        bool needed_read = {};
+        int queued = -1;
+        int n_done = {};
+        int err = -1;
+        bool still_needs_read = true;
+    };
+
+    auto const test_func = [](void* vdata) noexcept
+    {
+        auto* data = static_cast<TestData*>(vdata);
+        auto* const torrent = data->tor;
+        auto* const cache = torrent->session->cache;
+        auto const on_read = [](tr_torrent* done_tor, int err, void* vdone_data) noexcept
+        {
+            auto* done_data = static_cast<TestData*>(vdone_data);
+            done_data->err = err;
+            done_data->still_needs_read = tr_cacheBlockNeedsRead(done_tor->session->cache, done_tor, 0, 0, done_tor->blockSize);
+            ++done_data->n_done;
+        };
+
+        data->needed_read = tr_cacheBlockNeedsRead(cache, torrent, 0, 0, torrent->blockSize);
+        data->queued = tr_cacheReadBlockAsync(cache, torrent, 0, 0, torrent->blockSize, on_read, data);
+
+        // a second read of the same block waits on the first one
+        tr_cacheReadBlockAsync(cache, torrent, 0, 0, torrent->blockSize, on_read, data);
+    };
+
+    auto data = TestData{};
+    data.tor = tor;
+    tr_runInEventThread(session_, test_func, &data);
+
+    auto const test = [&data]()
+    {
+        return data.n_done == 2;
+    };
+    EXPECT_TRUE(waitFor(test, 2000));
+    EXPECT_TRUE(data.needed_read);
+    EXPECT_EQ(0, data.queued);
+    EXPECT_EQ(0, data.err);
+    EXPECT_FALSE(data.still_needs_read);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
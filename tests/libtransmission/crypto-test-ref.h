@@ -16,6 +16,7 @@
 #define KEY_LEN KEY_LEN_
 
 #define tr_sha1_ctx_t tr_sha1_ctx_t_
+#define tr_rc4_ctx_t tr_rc4_ctx_t_
 #define tr_dh_ctx_t tr_dh_ctx_t_
 #define tr_dh_secret_t tr_dh_secret_t_
 #define tr_ssl_ctx_t tr_ssl_ctx_t_
@@ -38,6 +39,10 @@
 #define tr_sha1_init tr_sha1_init_
 #define tr_sha1_update tr_sha1_update_
 #define tr_sha1_final tr_sha1_final_
+#define tr_rc4_new tr_rc4_new_
+#define tr_rc4_free tr_rc4_free_
+#define tr_rc4_set_key tr_rc4_set_key_
+#define tr_rc4_process tr_rc4_process_
 #define tr_dh_new tr_dh_new_
 #define tr_dh_free tr_dh_free_
 #define tr_dh_make_key tr_dh_make_key_
@@ -75,6 +80,7 @@
 #undef KEY_LEN_
 
 #undef tr_sha1_ctx_t
+#undef tr_rc4_ctx_t
 #undef tr_dh_ctx_t
 #undef tr_dh_secret_t
 #undef tr_ssl_ctx_t
@@ -97,6 +103,10 @@
 #undef tr_sha1_init
 #undef tr_sha1_update
 #undef tr_sha1_final
+#undef tr_rc4_new
+#undef tr_rc4_free
+#undef tr_rc4_set_key
+#undef tr_rc4_process
 #undef tr_dh_new
 #undef tr_dh_free
 #undef tr_dh_make_key
@@ -19,6 +19,7 @@
 #include <cstring>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 TEST(Crypto, torrentHash)
 {
@@ -100,6 +101,108 @@ TEST(Crypto, encryptDecrypt)
     tr_cryptoDestruct(&a);
 }
 
+TEST(Crypto, rc4)
+{
+    struct LocalTest
+    {
+        std::string key;
+        std::string plaintext;
+        std::array<uint8_t, 16> ciphertext;
+    };
+
+    auto const tests = std::array<LocalTest, 2>{
+        LocalTest{ "Key", "Plaintext", { 0xBB, 0xF3, 0x16, 0xE8, 0xD9, 0x40, 0xAF, 0x0A, 0xD3 } },
+        LocalTest{ "Secret",
+                   "Attack at dawn",
+                   { 0x45, 0xA0, 0x1F, 0x64, 0x5F, 0xC3, 0x5B, 0x38, 0x35, 0x52, 0x54, 0x4B, 0x9B, 0xF5 } },
+    };
+
+    for (auto const& test : tests)
+    {
+        auto const* const key = reinterpret_cast<uint8_t const*>(test.key.data());
+        auto encrypted = std::array<uint8_t, 16>{};
+
+        tr_rc4_ctx_t rc4 = tr_rc4_new();
+        tr_rc4_set_key(rc4, key, test.key.size());
+        tr_rc4_process(rc4, test.plaintext.data(), encrypted.data(), test.plaintext.size());
+        EXPECT_EQ(0, memcmp(test.ciphertext.data(), encrypted.data(), test.plaintext.size()));
+
+        // the keystream carries on between calls, and works in place
+        auto pieces = std::array<uint8_t, 16>{};
+        memcpy(pieces.data(), test.plaintext.data(), test.plaintext.size());
+        tr_rc4_set_key(rc4, key, test.key.size());
+        tr_rc4_process(rc4, pieces.data(), pieces.data(), 1);
+        tr_rc4_process(rc4, pieces.data() + 1, pieces.data() + 1, test.plaintext.size() - 1);
+        EXPECT_EQ(encrypted, pieces);
+
+        tr_rc4_free(rc4);
+    }
+}
+
+TEST(Crypto, encryptBlockInPlace)
+{
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, hash.data(), false);
+    auto b = tr_crypto_{};
+    tr_cryptoConstruct_(&b, hash.data(), true);
+    auto public_key_length = int{};
+    EXPECT_TRUE(tr_cryptoComputeSecret(&a, tr_cryptoGetMyPublicKey_(&b, &public_key_length)));
+    EXPECT_TRUE(tr_cryptoComputeSecret_(&b, tr_cryptoGetMyPublicKey(&a, &public_key_length)));
+    tr_cryptoEncryptInit(&a);
+    tr_cryptoDecryptInit_(&b);
+
+    // a whole block, as the peer-io encrypts them, decrypted by the reference code
+    auto block = std::vector<uint8_t>(16384);
+
+    for (auto& byte : block)
+    {
+        byte = uint8_t(tr_rand_int_weak(256));
+    }
+
+    auto const plaintext = block;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        tr_cryptoEncrypt(&a, std::size(block), std::data(block), std::data(block));
+        EXPECT_NE(plaintext, block);
+        tr_cryptoDecrypt_(&b, std::size(block), std::data(block), std::data(block));
+        EXPECT_EQ(plaintext, block);
+    }
+
+    tr_cryptoDestruct_(&b);
+    tr_cryptoDestruct(&a);
+}
+
+/**
+ * Encrypts 256 MiB in block-sized pieces, to time with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(Crypto, DISABLED_benchmarkEncrypt)
+{
+    auto constexpr BlockSize = size_t{ 16384 };
+    auto constexpr TotalSize = size_t{ 256 } * 1024 * 1024;
+
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, hash.data(), false);
+    auto b = tr_crypto{};
+    tr_cryptoConstruct(&b, hash.data(), true);
+    auto public_key_length = int{};
+    EXPECT_TRUE(tr_cryptoComputeSecret(&a, tr_cryptoGetMyPublicKey(&b, &public_key_length)));
+    tr_cryptoEncryptInit(&a);
+
+    auto block = std::vector<uint8_t>(BlockSize);
+
+    for (size_t done = 0; done < TotalSize; done += BlockSize)
+    {
+        tr_cryptoEncrypt(&a, std::size(block), std::data(block), std::data(block));
+    }
+
+    tr_cryptoDestruct(&b);
+    tr_cryptoDestruct(&a);
+}
+
 TEST(Crypto, sha1)
 {
     auto hash1 = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
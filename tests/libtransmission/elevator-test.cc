@@ -0,0 +1,111 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "elevator.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+namespace
+{
+
+std::vector<int> popAll(tr_elevator<int, int>& elevator)
+{
+    auto popped = std::vector<int>{};
+
+    while (auto item = elevator.pop())
+    {
+        popped.push_back(*item);
+    }
+
+    return popped;
+}
+
+} // namespace
+
+TEST(Elevator, sweepsUpwardThenWraps)
+{
+    auto elevator = tr_elevator<int, int>{};
+
+    for (int const key : { 50, 10, 30 })
+    {
+        elevator.push(key, key);
+    }
+
+    EXPECT_EQ(10, *elevator.pop());
+    EXPECT_EQ(30, *elevator.pop());
+
+    // things behind the elevator wait for the next sweep
+    elevator.push(20, 20);
+    elevator.push(40, 40);
+    EXPECT_EQ((std::vector<int>{ 40, 50, 20 }), popAll(elevator));
+    EXPECT_EQ(1U, elevator.sweeps());
+    EXPECT_TRUE(elevator.empty());
+    EXPECT_FALSE(elevator.pop());
+}
+
+TEST(Elevator, equalKeysAreFifo)
+{
+    auto elevator = tr_elevator<int, int>{};
+
+    for (int i = 0; i < 3; ++i)
+    {
+        elevator.push(7, i);
+    }
+
+    EXPECT_EQ((std::vector<int>{ 0, 1, 2 }), popAll(elevator));
+}
+
+TEST(Elevator, popSkipsRefusedItems)
+{
+    auto elevator = tr_elevator<int, std::string>{};
+    elevator.push(1, "a");
+    elevator.push(2, "b");
+    elevator.push(3, "c");
+
+    auto const not_b = [](int /*key*/, std::string const& item)
+    {
+        return item != "b";
+    };
+
+    EXPECT_EQ("a", *elevator.pop(not_b));
+    EXPECT_EQ("c", *elevator.pop(not_b));
+    EXPECT_FALSE(elevator.pop(not_b));
+    EXPECT_EQ(1U, elevator.size());
+    EXPECT_EQ("b", *elevator.pop());
+}
+
+TEST(Elevator, popNextDoesNotWrap)
+{
+    auto elevator = tr_elevator<int, int>{};
+
+    for (int const key : { 1, 2, 3, 5 })
+    {
+        elevator.push(key, key);
+    }
+
+    EXPECT_EQ(2, *elevator.pop([](int key, int /*item*/) { return key == 2; }));
+
+    auto prev = 2;
+    auto const is_neighbor = [&prev](int key, int /*item*/)
+    {
+        return key == prev + 1;
+    };
+
+    EXPECT_EQ(3, *elevator.pop_next(is_neighbor));
+    prev = 3;
+    EXPECT_FALSE(elevator.pop_next(is_neighbor));
+
+    // 1 is behind the elevator, so only pop() gets to it
+    prev = 0;
+    EXPECT_FALSE(elevator.pop_next(is_neighbor));
+    EXPECT_EQ((std::vector<int>{ 5, 1 }), popAll(elevator));
+}
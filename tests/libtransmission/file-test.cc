@@ -1164,6 +1164,111 @@ TEST_F(FileTest, fileReadWriteSeek)
     tr_free(path1);
 }
 
+TEST_F(FileTest, fileDup)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto* path1 = tr_buildPath(test_dir.data(), "a", nullptr);
+    auto const fd = tr_sys_file_open(path1, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    tr_error* err = nullptr;
+    auto const fd2 = tr_sys_file_dup(fd, &err);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd2);
+    EXPECT_EQ(nullptr, err);
+
+    // the duplicate outlives the original
+    tr_sys_file_close(fd, nullptr);
+
+    uint64_t n;
+    EXPECT_TRUE(tr_sys_file_write_at(fd2, "test", 4, 0, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(4, n);
+
+    tr_sys_file_close(fd2, nullptr);
+
+    auto info = tr_sys_path_info{};
+    EXPECT_TRUE(tr_sys_path_get_info(path1, 0, &info, nullptr));
+    EXPECT_EQ(4, info.size);
+
+    tr_sys_path_remove(path1, nullptr);
+
+    tr_free(path1);
+}
+
+TEST_F(FileTest, fileWriteAtV)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto* path1 = tr_buildPath(test_dir.data(), "a", nullptr);
+    auto const fd = tr_sys_file_open(path1, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    char part1[] = "tE";
+    char part2[] = "st";
+    char part3[] = " ok";
+    auto iov = std::array<tr_sys_file_iovec, 3>{ { { part1, 2 }, { part2, 2 }, { part3, 3 } } };
+
+    uint64_t n;
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_file_write_at_v(fd, iov.data(), iov.size(), 2, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(7, n);
+
+    // an empty list of buffers is a no-op
+    EXPECT_TRUE(tr_sys_file_write_at_v(fd, nullptr, 0, 0, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(0, n);
+
+    auto buf = std::array<char, 100>{};
+    EXPECT_TRUE(tr_sys_file_read_at(fd, buf.data(), buf.size(), 2, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(7, n);
+
+    EXPECT_EQ(0, memcmp("tEst ok", buf.data(), 7));
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1, nullptr);
+
+    tr_free(path1);
+}
+
+TEST_F(FileTest, fileReadAtV)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto* path1 = tr_buildPath(test_dir.data(), "a", nullptr);
+    auto const fd = tr_sys_file_open(path1, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+    EXPECT_TRUE(tr_sys_file_write(fd, "xxtEst ok", 9, nullptr, nullptr));
+
+    auto part1 = std::array<char, 2>{};
+    auto part2 = std::array<char, 2>{};
+    auto part3 = std::array<char, 10>{};
+    auto iov = std::array<tr_sys_file_iovec, 3>{
+        { { part1.data(), part1.size() }, { part2.data(), part2.size() }, { part3.data(), part3.size() } }
+    };
+
+    // reading past the end of the file comes up short
+    uint64_t n;
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_file_read_at_v(fd, iov.data(), iov.size(), 2, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(7, n);
+    EXPECT_EQ(0, memcmp("tE", part1.data(), 2));
+    EXPECT_EQ(0, memcmp("st", part2.data(), 2));
+    EXPECT_EQ(0, memcmp(" ok", part3.data(), 3));
+
+    // an empty list of buffers is a no-op
+    EXPECT_TRUE(tr_sys_file_read_at_v(fd, nullptr, 0, 0, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(0, n);
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1, nullptr);
+
+    tr_free(path1);
+}
+
 TEST_F(FileTest, fileTruncate)
 {
     auto const test_dir = createTestDir(currentTestName());
@@ -15,7 +15,9 @@
 
 #include "gtest/gtest.h"
 
+#include <chrono>
 #include <clocale> // setlocale()
+#include <cstdio> // printf()
 #include <cstring> // strlen()
 #include <string>
 
@@ -248,6 +250,105 @@ TEST_P(JSONTest, unescape)
     tr_variantFree(&top);
 }
 
+TEST_P(JSONTest, longStrings)
+{
+    // move the escapes across several 16-byte blocks
+    for (size_t offset = 0; offset < 40; ++offset)
+    {
+        auto const prefix = std::string(offset, 'a');
+        auto const in = "{ \"key\": \"" + prefix + "\\\"" + std::string(20, 'b') + "\\n\" }";
+
+        tr_variant top;
+        auto const err = tr_variantFromJson(&top, in.data(), in.size());
+        EXPECT_EQ(0, err);
+
+        char const* str;
+        EXPECT_TRUE(tr_variantDictFindStr(&top, tr_quark_new("key", 3), &str, nullptr));
+        EXPECT_EQ(prefix + "\"" + std::string(20, 'b') + "\n", str);
+
+        tr_variantFree(&top);
+
+        // raw control characters aren't allowed in a string
+        auto bad = in;
+        bad[std::size("{ \"key\": \"") - 1 + offset] = '\x01';
+        top.type = 0;
+        EXPECT_NE(0, tr_variantFromJson(&top, bad.data(), bad.size()));
+        if (top.type != 0)
+        {
+            tr_variantFree(&top);
+        }
+    }
+}
+
+/**
+ * Parses and frees a torrent-get response for 10,000 torrents over and over,
+ * with the tree on the heap and in an arena, and prints the throughput.
+ * It only runs with --gtest_also_run_disabled_tests.
+ */
+TEST_P(JSONTest, DISABLED_benchmarkParse)
+{
+    auto constexpr NumTorrents = 10000;
+    auto constexpr Rounds = 50;
+
+    tr_variant response;
+    tr_variantInitDict(&response, 2);
+    tr_variantDictAddStr(&response, TR_KEY_result, "success");
+    auto* const args = tr_variantDictAddDict(&response, TR_KEY_arguments, 1);
+    auto* const torrents = tr_variantDictAddList(args, TR_KEY_torrents, NumTorrents);
+
+    for (int i = 0; i < NumTorrents; ++i)
+    {
+        auto* const tor = tr_variantListAddDict(torrents, 13);
+        tr_variantDictAddInt(tor, TR_KEY_id, i);
+        tr_variantDictAddStr(tor, TR_KEY_name, ("Some.Torrent.Name." + std::to_string(i) + ".1080p \"quoted\"").c_str());
+        tr_variantDictAddStr(tor, TR_KEY_hashString, std::string(40, char('a' + i % 6)).c_str());
+        tr_variantDictAddInt(tor, TR_KEY_status, i % 7);
+        tr_variantDictAddReal(tor, TR_KEY_percentDone, (i % 1000) / 1000.0);
+        tr_variantDictAddInt(tor, TR_KEY_rateDownload, i * 37);
+        tr_variantDictAddInt(tor, TR_KEY_totalSize, int64_t{ i } * 123456789);
+        tr_variantDictAddStr(tor, TR_KEY_errorString, "");
+        tr_variantDictAddInt(tor, TR_KEY_eta, -1);
+        tr_variantDictAddReal(tor, TR_KEY_uploadRatio, i / 3.0);
+        tr_variantDictAddStr(tor, TR_KEY_downloadDir, "/home/user/Downloads/complete");
+        tr_variantDictAddInt(tor, TR_KEY_peersConnected, i % 50);
+        auto* const labels = tr_variantDictAddList(tor, TR_KEY_labels, 2);
+        tr_variantListAddStr(labels, "movies");
+        tr_variantListAddStr(labels, "hd");
+    }
+
+    auto len = size_t{};
+    auto* const json = tr_variantToStr(&response, TR_VARIANT_FMT_JSON_LEAN, &len);
+    tr_variantFree(&response);
+
+    auto const run = [json, len](bool use_arena)
+    {
+        auto const begin = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < Rounds; ++i)
+        {
+            auto arena = tr_variant_arena{};
+            tr_variant top;
+
+            if (use_arena)
+            {
+                tr_variantInitArena(&top, &arena);
+            }
+
+            EXPECT_EQ(0, tr_variantFromJson(&top, json, len));
+            tr_variantFree(&top);
+        }
+
+        auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+        return len * Rounds / 1e6 / elapsed.count();
+    };
+
+    auto const heap_mbps = run(false);
+    auto const arena_mbps = run(true);
+    std::printf("parsing %.1f MB of JSON: heap %.0f MB/s, arena %.0f MB/s\n", len / 1e6, heap_mbps, arena_mbps);
+
+    tr_free(json);
+}
+
 INSTANTIATE_TEST_SUITE_P( //
     JSON,
     JSONTest,
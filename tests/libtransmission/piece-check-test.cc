@@ -0,0 +1,160 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h"
+#include "piece-check.h"
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using PieceCheckTest = SessionTest;
+
+namespace
+{
+
+// -1 until the piece has been checked, then 1 if it passed or 0 if it didn't
+std::array<std::atomic<int>, 2> results;
+
+} // namespace
+
+TEST_F(PieceCheckTest, checkPieces)
+{
+    // the test zero_torrent will be missing its first piece.
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, false);
+
+    for (auto& result : results)
+    {
+        result = -1;
+    }
+
+    auto const add_checks = [](void* vtor) noexcept
+    {
+        auto* const torrent = static_cast<tr_torrent*>(vtor);
+        auto const on_checked = [](tr_torrent*, tr_piece_index_t piece, bool pass) noexcept
+        {
+            results[piece] = pass ? 1 : 0;
+        };
+
+        for (tr_piece_index_t piece = 0; piece < std::size(results); ++piece)
+        {
+            tr_pieceCheckerAdd(torrent->session->pieceChecker, torrent, piece, on_checked);
+        }
+    };
+    tr_runInEventThread(session_, add_checks, tor);
+
+    auto const test = []()
+    {
+        return results[0] != -1 && results[1] != -1;
+    };
+    EXPECT_TRUE(waitFor(test, 2000));
+    EXPECT_EQ(0, results[0]);
+    EXPECT_EQ(1, results[1]);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(PieceCheckTest, stopTorrentWhileChecking)
+{
+    // the test zero_torrent will be missing its first piece.
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, false);
+
+    struct TestData
+    {
+        tr_torrent* tor = {};
+        bool verified_while_pending = true;
+        bool complete_after_stop = true;
+        size_t pending_after_stop = 1;
+        bool done = {};
+    };
+
+    auto const test_func = [](void* vdata) noexcept
+    {
+        auto* data = static_cast<TestData*>(vdata);
+        auto* const torrent = data->tor;
+        auto const zeroes = std::vector<char>(torrent->blockSize);
+        auto* const buf = evbuffer_new();
+
+        auto const write_block = [&](uint32_t offset)
+        {
+            evbuffer_add(buf, std::data(zeroes), torrent->blockSize);
+            tr_cacheWriteBlock(torrent->session->cache, torrent, 0, offset, torrent->blockSize, buf);
+        };
+
+        // download the missing piece. Rewriting one of its blocks keeps the
+        // cache from hashing it on the way in, so it goes to the piece checker
+        tr_block_index_t first;
+        tr_block_index_t last;
+        tr_torGetPieceBlockRange(torrent, 0, &first, &last);
+
+        for (auto block = first; block <= last; ++block)
+        {
+            write_block((block - first) * torrent->blockSize);
+        }
+
+        write_block(0);
+
+        for (auto block = first; block <= last; ++block)
+        {
+            tr_torrentGotBlock(torrent, block);
+        }
+
+        data->verified_while_pending = tr_torrentHasVerifiedPiece(torrent, 0);
+
+        // stop it before the check can come back
+        tr_torrentStop(torrent);
+        data->complete_after_stop = tr_torrentPieceIsComplete(torrent, 0);
+        data->pending_after_stop = std::size(torrent->pendingPieceChecks);
+
+        evbuffer_free(buf);
+        data->done = true;
+    };
+
+    auto data = TestData{};
+    data.tor = tor;
+    tr_runInEventThread(session_, test_func, &data);
+
+    auto const test = [&data]()
+    {
+        return data.done;
+    };
+    EXPECT_TRUE(waitFor(test, 2000));
+    EXPECT_FALSE(data.verified_while_pending);
+    EXPECT_FALSE(data.complete_after_stop);
+    EXPECT_EQ(0U, data.pending_after_stop);
+
+    // the cancelled check doesn't mark the piece complete later on
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_FALSE(tr_torrentPieceIsComplete(tor, 0));
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
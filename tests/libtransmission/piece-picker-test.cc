@@ -0,0 +1,379 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "piece-picker.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+
+using State = tr_piece_picker::State;
+
+std::vector<tr_piece_index_t> pickAll(tr_piece_picker const& picker)
+{
+    auto pieces = std::vector<tr_piece_index_t>{};
+    picker.forEach(
+        [&pieces](tr_piece_index_t piece)
+        {
+            pieces.push_back(piece);
+            return true;
+        });
+    return pieces;
+}
+
+std::vector<tr_piece_index_t> pickAll(tr_piece_picker const& picker, tr_bitfield const* have)
+{
+    auto pieces = std::vector<tr_piece_index_t>{};
+    picker.forEach(
+        have,
+        [&pieces](tr_piece_index_t piece)
+        {
+            pieces.push_back(piece);
+            return true;
+        });
+    return pieces;
+}
+
+} // namespace
+
+TEST(PiecePicker, order)
+{
+    auto picker = tr_piece_picker{ 6 };
+    picker.add(0, TR_PRI_NORMAL, 5, State::Untouched);
+    picker.add(1, TR_PRI_NORMAL, 2, State::Untouched);
+    picker.add(2, TR_PRI_HIGH, 9, State::Untouched);
+    picker.add(3, TR_PRI_LOW, 9, State::Partial);
+    picker.add(4, TR_PRI_HIGH, 0, State::Requested);
+    EXPECT_EQ(5U, std::size(picker));
+    EXPECT_FALSE(picker.isWanted(5));
+
+    // started pieces first, then priority, then rarest first
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 3, 2, 1, 0, 4 }), pickAll(picker));
+
+    // moving pieces between buckets
+    picker.setReplication(0, 1);
+    picker.setState(4, State::Partial);
+    picker.setPriority(3, TR_PRI_HIGH);
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 4, 3, 2, 0, 1 }), pickAll(picker));
+
+    picker.remove(3);
+    picker.remove(3);
+    picker.setReplication(3, 0); // not wanted, so ignored
+    EXPECT_EQ(4U, std::size(picker));
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 4, 2, 0, 1 }), pickAll(picker));
+
+    // stops when asked to
+    auto first = std::vector<tr_piece_index_t>{};
+    picker.forEach(
+        [&first](tr_piece_index_t piece)
+        {
+            first.push_back(piece);
+            return std::size(first) < 2;
+        });
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 4, 2 }), first);
+
+    picker.clear();
+    EXPECT_TRUE(picker.empty());
+    EXPECT_TRUE(std::empty(pickAll(picker)));
+}
+
+TEST(PiecePicker, partialPiecesWithFewestBlocksLeftFirst)
+{
+    auto picker = tr_piece_picker{ 1000 };
+    picker.add(0, TR_PRI_NORMAL, 3, State::Partial, 12);
+    picker.add(1, TR_PRI_NORMAL, 3, State::Partial, 2);
+    picker.add(2, TR_PRI_NORMAL, 3, State::Partial, 7);
+    picker.add(3, TR_PRI_NORMAL, 1, State::Partial, 40);
+    picker.add(4, TR_PRI_HIGH, 3, State::Partial, 30);
+    picker.add(5, TR_PRI_NORMAL, 3, State::Untouched, 1); // only matters for started pieces
+
+    // priority and rarity still come first
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 4, 3, 1, 2, 0, 5 }), pickAll(picker));
+
+    // requesting blocks moves a piece up within its bucket
+    picker.setState(0, State::Partial, 1);
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 4, 3, 0, 1, 2, 5 }), pickAll(picker));
+
+    picker.setState(1, State::Partial, 9);
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 4, 3, 0, 2, 1, 5 }), pickAll(picker));
+
+    // and so does the walk for a peer with only a few of the pieces
+    for (tr_piece_index_t i = 6; i < 1000; ++i)
+    {
+        picker.add(i, TR_PRI_LOW, 0, State::Untouched);
+    }
+
+    auto have = tr_bitfield{};
+    tr_bitfieldConstruct(&have, 1000);
+    tr_bitfieldAdd(&have, 1);
+    tr_bitfieldAdd(&have, 2);
+    tr_bitfieldAdd(&have, 0);
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 0, 2, 1 }), pickAll(picker, &have));
+    tr_bitfieldDestruct(&have);
+}
+
+TEST(PiecePicker, setAllReplication)
+{
+    auto picker = tr_piece_picker{ 4 };
+    picker.add(0, TR_PRI_NORMAL, 1, State::Untouched);
+    picker.add(1, TR_PRI_NORMAL, 2, State::Untouched);
+    picker.add(2, TR_PRI_NORMAL, 3, State::Untouched);
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 0, 1, 2 }), pickAll(picker));
+
+    auto const replication = std::array<uint16_t, 4>{ 4, 2, 0, 7 };
+    picker.setReplication(std::data(replication));
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 2, 1, 0 }), pickAll(picker));
+    EXPECT_FALSE(picker.isWanted(3));
+}
+
+TEST(PiecePicker, onlyPiecesThePeerHas)
+{
+    auto constexpr PieceCount = tr_piece_index_t{ 10000 };
+    auto picker = tr_piece_picker{ PieceCount };
+
+    for (tr_piece_index_t i = 0; i < PieceCount; ++i)
+    {
+        picker.add(i, TR_PRI_NORMAL, uint16_t((PieceCount - i) % 7), i % 3 == 0 ? State::Partial : State::Untouched);
+    }
+
+    auto const expected = [&picker](tr_bitfield const* have)
+    {
+        auto pieces = pickAll(picker);
+        pieces.erase(
+            std::remove_if(
+                std::begin(pieces),
+                std::end(pieces),
+                [have](tr_piece_index_t piece) { return !tr_bitfieldHas(have, piece); }),
+            std::end(pieces));
+        return pieces;
+    };
+
+    auto const buckets = [&picker](std::vector<tr_piece_index_t> const& pieces)
+    {
+        auto keys = std::vector<std::tuple<State, tr_piece_index_t>>{};
+
+        for (auto const piece : pieces)
+        {
+            keys.emplace_back(picker.state(piece), (PieceCount - piece) % 7);
+        }
+
+        return keys;
+    };
+
+    // a peer with most of the pieces is walked in the picker's order
+    auto have = tr_bitfield{};
+    tr_bitfieldConstruct(&have, PieceCount);
+    tr_bitfieldAddRange(&have, 0, PieceCount);
+    tr_bitfieldRem(&have, 10);
+    EXPECT_EQ(expected(&have), pickAll(picker, &have));
+
+    // a peer with a few pieces gets them sorted into the same buckets
+    tr_bitfieldSetHasNone(&have);
+    tr_bitfieldConstruct(&have, PieceCount);
+
+    for (tr_piece_index_t i = 0; i < PieceCount; i += 997)
+    {
+        tr_bitfieldAdd(&have, i);
+    }
+
+    auto const sparse = pickAll(picker, &have);
+    EXPECT_EQ(std::size(expected(&have)), std::size(sparse));
+    EXPECT_EQ(buckets(expected(&have)), buckets(sparse));
+
+    tr_bitfieldSetHasNone(&have);
+    EXPECT_TRUE(std::empty(pickAll(picker, &have)));
+
+    tr_bitfieldDestruct(&have);
+}
+
+/**
+ * Simulates a big swarm: peers with random bitfields keep connecting while
+ * the others ask for pieces, and compares the picker against sorting the
+ * whole piece list whenever a bitfield arrives, which is what we used to do.
+ * It's slow, so it only runs with --gtest_also_run_disabled_tests.
+ */
+TEST(PiecePicker, DISABLED_benchmarkSwarm)
+{
+    auto constexpr PieceCount = tr_piece_index_t{ 100000 };
+    auto constexpr PeerCount = size_t{ 200 };
+    auto constexpr Rounds = size_t{ 20 };
+    auto constexpr PicksPerRound = size_t{ 100 };
+    auto constexpr PiecesPerPick = size_t{ 4 };
+
+    auto rng = std::mt19937{ 12345 };
+    auto peers = std::vector<tr_bitfield>(PeerCount);
+    auto replication = std::vector<uint16_t>(PieceCount);
+
+    auto const connect = [&rng](tr_bitfield& have, std::vector<uint16_t>& counts)
+    {
+        // most peers are nearly done; some are partway; some have just started
+        static auto constexpr PerMille = std::array<int, 4>{ 2, 50, 900, 900 };
+        auto const odds = PerMille[std::uniform_int_distribution<size_t>{ 0, std::size(PerMille) - 1 }(rng)];
+        auto flags = std::make_unique<bool[]>(PieceCount);
+
+        for (tr_piece_index_t i = 0; i < PieceCount; ++i)
+        {
+            flags[i] = std::uniform_int_distribution<int>{ 0, 999 }(rng) < odds;
+            counts[i] += flags[i] ? 1 : 0;
+        }
+
+        tr_bitfieldConstruct(&have, PieceCount);
+        tr_bitfieldSetFromFlags(&have, flags.get(), PieceCount);
+    };
+
+    for (auto& have : peers)
+    {
+        connect(have, replication);
+    }
+
+    // the order each round's peers connect and ask for pieces in
+    auto script = std::vector<std::vector<size_t>>(Rounds);
+
+    for (auto& picks : script)
+    {
+        for (size_t i = 0; i < PicksPerRound; ++i)
+        {
+            picks.push_back(std::uniform_int_distribution<size_t>{ 0, PeerCount - 1 }(rng));
+        }
+    }
+
+    // and the peers that connect at the start of each round
+    auto new_peers = std::vector<tr_bitfield>(Rounds);
+    auto new_replication = replication;
+
+    for (auto& have : new_peers)
+    {
+        connect(have, new_replication);
+    }
+
+    // the picker
+    auto picker = tr_piece_picker{ PieceCount };
+    auto picker_replication = replication;
+    auto picker_picks = size_t{};
+
+    for (tr_piece_index_t i = 0; i < PieceCount; ++i)
+    {
+        picker.add(i, TR_PRI_NORMAL, picker_replication[i], State::Untouched);
+    }
+
+    for (size_t round = 0; round < Rounds; ++round)
+    {
+        for (tr_piece_index_t i = 0; i < PieceCount; ++i)
+        {
+            if (tr_bitfieldHas(&new_peers[round], i))
+            {
+                picker.setReplication(i, ++picker_replication[i]);
+            }
+        }
+
+        for (auto const peer : script[round])
+        {
+            auto picked = std::vector<tr_piece_index_t>{};
+            picker.forEach(
+                &peers[peer],
+                [&picker, &picked](tr_piece_index_t piece)
+                {
+                    if (picker.state(piece) == State::Requested)
+                    {
+                        return false;
+                    }
+
+                    picked.push_back(piece);
+                    return std::size(picked) < PiecesPerPick;
+                });
+
+            for (auto const piece : picked)
+            {
+                picker.setState(piece, State::Requested);
+            }
+
+            picker_picks += std::size(picked);
+        }
+    }
+
+    // sorting everything
+    struct sorted_piece
+    {
+        tr_piece_index_t index;
+        bool requested;
+    };
+
+    auto sorted = std::vector<sorted_piece>{};
+    auto sorted_replication = replication;
+    auto sorted_picks = size_t{};
+    auto const by_weight = [&sorted_replication](sorted_piece const& a, sorted_piece const& b)
+    {
+        return std::tie(a.requested, sorted_replication[a.index], a.index) <
+            std::tie(b.requested, sorted_replication[b.index], b.index);
+    };
+
+    for (tr_piece_index_t i = 0; i < PieceCount; ++i)
+    {
+        sorted.push_back({ i, false });
+    }
+
+    for (size_t round = 0; round < Rounds; ++round)
+    {
+        for (tr_piece_index_t i = 0; i < PieceCount; ++i)
+        {
+            if (tr_bitfieldHas(&new_peers[round], i))
+            {
+                ++sorted_replication[i];
+            }
+        }
+
+        std::sort(std::begin(sorted), std::end(sorted), by_weight);
+
+        for (auto const peer : script[round])
+        {
+            auto picked = std::vector<sorted_piece>{};
+
+            for (auto it = std::begin(sorted); it != std::end(sorted) && std::size(picked) < PiecesPerPick;)
+            {
+                if (!it->requested && tr_bitfieldHas(&peers[peer], it->index))
+                {
+                    picked.push_back({ it->index, true });
+                    it = sorted.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            // put them back where they belong now, like the old insertion sort did
+            for (auto const& piece : picked)
+            {
+                sorted.insert(std::lower_bound(std::begin(sorted), std::end(sorted), piece, by_weight), piece);
+            }
+
+            sorted_picks += std::size(picked);
+        }
+    }
+
+    EXPECT_EQ(sorted_picks, picker_picks);
+    EXPECT_EQ(new_replication, picker_replication);
+
+    for (auto* bitfields : { &peers, &new_peers })
+    {
+        for (auto& have : *bitfields)
+        {
+            tr_bitfieldDestruct(&have);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "request-table.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+struct FakePeer
+{
+};
+
+using Table = tr_request_table<FakePeer>;
+
+std::vector<FakePeer*> peersOf(Table const& table, tr_block_index_t block)
+{
+    auto const peers = table.peers(block);
+    return { std::begin(peers), std::end(peers) };
+}
+
+} // namespace
+
+TEST(RequestTable, addAndRemove)
+{
+    auto a = FakePeer{};
+    auto b = FakePeer{};
+    auto c = FakePeer{};
+    auto table = Table{};
+
+    EXPECT_TRUE(table.add(10, &a, 100));
+    EXPECT_TRUE(table.add(11, &a, 100));
+    EXPECT_TRUE(table.add(10, &b, 101));
+    EXPECT_EQ(3U, std::size(table));
+    EXPECT_EQ(2U, table.count(&a));
+    EXPECT_EQ(1U, table.count(&b));
+    EXPECT_TRUE(table.has(10, &a));
+    EXPECT_TRUE(table.has(10, &b));
+    EXPECT_FALSE(table.has(11, &b));
+    EXPECT_EQ((std::vector<FakePeer*>{ &a, &b }), peersOf(table, 10));
+
+    // no duplicates, and no more than two peers per block
+    EXPECT_FALSE(table.add(10, &a, 102));
+    EXPECT_FALSE(table.add(10, &c, 102));
+    EXPECT_EQ(3U, std::size(table));
+
+    // a freed slot can be reused
+    EXPECT_TRUE(table.remove(10, &a));
+    EXPECT_FALSE(table.remove(10, &a));
+    EXPECT_EQ((std::vector<FakePeer*>{ &b }), peersOf(table, 10));
+    EXPECT_TRUE(table.add(10, &c, 103));
+    EXPECT_EQ((std::vector<FakePeer*>{ &c, &b }), peersOf(table, 10));
+
+    EXPECT_TRUE(table.remove(10, &b));
+    EXPECT_TRUE(table.remove(10, &c));
+    EXPECT_TRUE(table.remove(11, &a));
+    EXPECT_TRUE(table.empty());
+    EXPECT_TRUE(std::empty(table.peers(10)));
+    EXPECT_EQ(0U, table.count(&a));
+}
+
+TEST(RequestTable, removePeer)
+{
+    auto a = FakePeer{};
+    auto b = FakePeer{};
+    auto table = Table{};
+
+    for (tr_block_index_t block = 0; block < 100; ++block)
+    {
+        table.add(block, &a, block);
+        table.add(block, &b, block);
+    }
+
+    // a's requests come back in the order they were made
+    table.remove(50, &a);
+    auto removed = std::vector<tr_block_index_t>{};
+    table.remove(&a, [&removed](auto const& request) { removed.push_back(request.block); });
+    EXPECT_EQ(99U, std::size(removed));
+    EXPECT_EQ(0U, removed.front());
+    EXPECT_EQ(99U, removed.back());
+    EXPECT_EQ(49U, removed[49]);
+    EXPECT_EQ(51U, removed[50]);
+
+    EXPECT_EQ(0U, table.count(&a));
+    EXPECT_EQ(100U, table.count(&b));
+    EXPECT_EQ(100U, std::size(table));
+    EXPECT_EQ((std::vector<FakePeer*>{ &b }), peersOf(table, 0));
+}
+
+TEST(RequestTable, forEachSentBy)
+{
+    auto a = FakePeer{};
+    auto b = FakePeer{};
+    auto table = Table{};
+
+    table.add(1, &a, 100);
+    table.add(2, &a, 200);
+    table.add(3, &a, 300);
+    table.add(4, &b, 150);
+    table.add(5, &b, 250);
+
+    auto old = std::vector<std::pair<tr_block_index_t, FakePeer*>>{};
+    table.forEachSentBy(200, [&old](auto const& request) { old.emplace_back(request.block, request.peer); });
+    std::sort(std::begin(old), std::end(old));
+
+    auto const expected = std::vector<std::pair<tr_block_index_t, FakePeer*>>{ { 1, &a }, { 2, &a }, { 4, &b } };
+    EXPECT_EQ(expected, old);
+}
@@ -190,6 +190,80 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr);
 }
 
+TEST_F(RpcTest, torrentGetSince)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    // ask for the torrents' changes since `since'
+    auto const torrent_get = [this, &rpc_response_func](int64_t since, tr_variant* response)
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 2);
+        tr_variantDictAddStr(&request, TR_KEY_method, "torrent-get");
+        tr_variant* args = tr_variantDictAddDict(&request, TR_KEY_arguments, 2);
+        tr_variantDictAddInt(args, TR_KEY_since, since);
+        tr_variant* fields = tr_variantDictAddList(args, TR_KEY_fields, 2);
+        tr_variantListAddStr(fields, "name");
+        tr_variantListAddStr(fields, "uploadLimit");
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, response);
+        tr_variantFree(&request);
+    };
+
+    // the first call gets everything
+    tr_variant response;
+    torrent_get(0, &response);
+    tr_variant* args;
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    int64_t revision = 0;
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_revision, &revision));
+    tr_variant* torrents;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(1, tr_variantListSize(torrents));
+    tr_variant* t = tr_variantListChild(torrents, 0);
+    int64_t i;
+    EXPECT_TRUE(tr_variantDictFindInt(t, TR_KEY_id, &i));
+    EXPECT_EQ(tr_torrentId(tor), i);
+    EXPECT_NE(nullptr, tr_variantDictFind(t, TR_KEY_name));
+    EXPECT_NE(nullptr, tr_variantDictFind(t, TR_KEY_uploadLimit));
+    tr_variantFree(&response);
+
+    // nothing changed since then
+    torrent_get(revision, &response);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    int64_t next_revision = 0;
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_revision, &next_revision));
+    EXPECT_LT(revision, next_revision);
+    revision = next_revision;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(0, tr_variantListSize(torrents));
+    tr_variantFree(&response);
+
+    // change one field and get only that field
+    tr_torrentSetSpeedLimit_KBps(tor, TR_UP, tr_torrentGetSpeedLimit_KBps(tor, TR_UP) + 1);
+    torrent_get(revision, &response);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_revision, &revision));
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(1, tr_variantListSize(torrents));
+    t = tr_variantListChild(torrents, 0);
+    EXPECT_TRUE(tr_variantDictFindInt(t, TR_KEY_id, &i));
+    EXPECT_EQ(tr_torrentId(tor), i);
+    EXPECT_EQ(nullptr, tr_variantDictFind(t, TR_KEY_name));
+    EXPECT_TRUE(tr_variantDictFindInt(t, TR_KEY_uploadLimit, &i));
+    EXPECT_EQ(tr_torrentGetSpeedLimit_KBps(tor, TR_UP), i);
+    tr_variantFree(&response);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
 } // namespace test
 
 } // namespace libtransmission
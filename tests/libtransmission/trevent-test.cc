@@ -0,0 +1,121 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using EventTest = SessionTest;
+
+namespace
+{
+
+struct Producer
+{
+    int next = 0;
+    bool in_order = true;
+    std::atomic<int> n_run = {};
+};
+
+void countCall(void* vproducer)
+{
+    auto* const producer = static_cast<Producer*>(vproducer);
+    producer->in_order = producer->in_order && producer->n_run == producer->next;
+    ++producer->next;
+    ++producer->n_run;
+}
+
+template<size_t NumThreads>
+void postFromThreads(tr_session* session, std::array<Producer, NumThreads>& producers, int n_calls)
+{
+    auto threads = std::vector<std::thread>{};
+
+    for (auto& producer : producers)
+    {
+        threads.emplace_back(
+            [session, &producer, n_calls]()
+            {
+                for (int i = 0; i < n_calls; ++i)
+                {
+                    tr_runInEventThread(session, countCall, &producer);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+template<size_t NumThreads>
+bool allRun(std::array<Producer, NumThreads> const& producers, int n_calls)
+{
+    return std::all_of(
+        std::begin(producers),
+        std::end(producers),
+        [n_calls](Producer const& producer) { return producer.n_run == n_calls; });
+}
+
+} // namespace
+
+TEST_F(EventTest, runInEventThreadFromManyThreads)
+{
+    auto constexpr NumCalls = 50000;
+    auto producers = std::array<Producer, 4>{};
+
+    postFromThreads(session_, producers, NumCalls);
+    EXPECT_TRUE(waitFor([&producers]() { return allRun(producers, NumCalls); }, 30000));
+
+    // each thread's calls are run in the order they were made
+    for (auto const& producer : producers)
+    {
+        EXPECT_TRUE(producer.in_order);
+    }
+}
+
+/**
+ * Measures how many calls per second four threads can get run on the
+ * libevent thread. It only runs with --gtest_also_run_disabled_tests.
+ */
+TEST_F(EventTest, DISABLED_benchmarkRunInEventThread)
+{
+    auto constexpr NumCalls = 1000000;
+    auto producers = std::array<Producer, 4>{};
+    auto const begin = std::chrono::steady_clock::now();
+
+    postFromThreads(session_, producers, NumCalls);
+    EXPECT_TRUE(waitFor([&producers]() { return allRun(producers, NumCalls); }, 120000));
+
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+    std::printf(
+        "%zu threads x %d calls: %.3f s, %.0f calls/sec\n",
+        std::size(producers),
+        NumCalls,
+        elapsed.count(),
+        std::size(producers) * NumCalls / elapsed.count());
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,113 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "net.h"
+#include "session.h"
+#include "tr-udp.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using UdpTest = SessionTest;
+
+TEST_F(UdpTest, sendToDeliversBatchedDatagrams)
+{
+    if (session_->udp_socket == TR_BAD_SOCKET)
+    {
+        GTEST_SKIP();
+    }
+
+    // a socket on the loopback interface to send to
+    auto const sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(TR_BAD_SOCKET, sock);
+    auto to = sockaddr_in{};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&to), sizeof(to)));
+    auto to_len = socklen_t{ sizeof(to) };
+    ASSERT_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&to), &to_len));
+
+#ifdef _WIN32
+    auto const timeout = DWORD{ 2000 };
+#else
+    auto const timeout = timeval{ 2, 0 };
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char const*>(&timeout), sizeof(timeout));
+
+    // runs of same-sized datagrams, which may be sent as one segmented
+    // message, broken up by odd-sized ones that can't be
+    struct TestData
+    {
+        tr_session* session = {};
+        sockaddr_in to = {};
+        std::vector<std::string> datagrams;
+        bool done = {};
+    };
+
+    auto data = TestData{};
+    data.session = session_;
+    data.to = to;
+
+    for (int i = 0; i < 64; ++i)
+    {
+        auto datagram = std::string(i % 10 == 9 ? 100 + i : 1200, char('a' + i % 26));
+        datagram.front() = char(i);
+        data.datagrams.push_back(datagram);
+    }
+
+    // queue them all up in one go, so that they're flushed together
+    auto const send_all = [](void* vdata) noexcept
+    {
+        auto* const test_data = static_cast<TestData*>(vdata);
+
+        for (auto const& datagram : test_data->datagrams)
+        {
+            tr_udpSendTo(
+                test_data->session,
+                std::data(datagram),
+                std::size(datagram),
+                reinterpret_cast<sockaddr const*>(&test_data->to),
+                sizeof(test_data->to));
+        }
+
+        test_data->done = true;
+    };
+    tr_runInEventThread(session_, send_all, &data);
+
+    auto const test = [&data]()
+    {
+        return data.done;
+    };
+    EXPECT_TRUE(waitFor(test, 2000));
+
+    // every datagram arrives whole, by itself, and in order
+    for (auto const& expected : data.datagrams)
+    {
+        auto buf = std::array<char, 4096>{};
+        auto const n = recv(sock, std::data(buf), std::size(buf), 0);
+        ASSERT_EQ(int(std::size(expected)), int(n));
+        EXPECT_EQ(expected, std::string(std::data(buf), n));
+    }
+
+    tr_netCloseSocket(sock);
+}
+
+} // namespace test
+
+} // namespace libtransmission
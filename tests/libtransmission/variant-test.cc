@@ -17,8 +17,12 @@
 #include <array>
 #include <cmath> // lrint()
 #include <cctype> // isspace()
+#include <chrono>
+#include <cstdio> // printf()
 #include <string>
 
+#include <event2/buffer.h>
+
 #include "gtest/gtest.h"
 
 class VariantTest : public ::testing::Test
@@ -340,6 +344,223 @@ TEST_F(VariantTest, bencMalformedIncompleteString)
     EXPECT_EQ(EILSEQ, tr_variantFromBenc(&val, in.data(), in.size()));
 }
 
+TEST_F(VariantTest, bencManyKeys)
+{
+    // more distinct keys than the parser's key cache can hold
+    auto constexpr N = 500;
+    auto in = std::string{ "l" };
+    for (int i = 0; i < N; ++i)
+    {
+        auto const key = "key-" + std::to_string(i);
+        in += "d" + std::to_string(std::size(key)) + ":" + key + "i" + std::to_string(i) + "e6:lengthi1ee";
+    }
+    in += "e";
+
+    tr_variant top;
+    EXPECT_EQ(0, tr_variantFromBenc(&top, in.data(), in.size()));
+    EXPECT_EQ(size_t{ N }, tr_variantListSize(&top));
+
+    for (int i = 0; i < N; ++i)
+    {
+        auto const key = "key-" + std::to_string(i);
+        auto* const child = tr_variantListChild(&top, i);
+        auto val = int64_t{};
+        EXPECT_TRUE(tr_variantIsDict(child));
+        EXPECT_TRUE(tr_variantDictFindInt(child, tr_quark_new(key.data(), std::size(key)), &val));
+        EXPECT_EQ(i, val);
+        EXPECT_TRUE(tr_variantDictFindInt(child, tr_quark_new("length", 6), &val));
+        EXPECT_EQ(1, val);
+    }
+
+    tr_variantFree(&top);
+}
+
+TEST_F(VariantTest, arena)
+{
+    auto const long_str = std::string{ "a string that is too long to fit in a tr_variant" };
+    auto const huge_str = std::string(10000, 'x');
+    auto const key_list = tr_quark_new("list", 4);
+    auto const key_sub = tr_quark_new("sub", 3);
+    auto const key_stolen = tr_quark_new("stolen", 6);
+
+    auto const build = [&](tr_variant* top)
+    {
+        auto const in = std::string{ "d4:listli1ei2ee4:name" } + std::to_string(std::size(long_str)) + ':' + long_str + 'e';
+        EXPECT_EQ(0, tr_variantFromBenc(top, in.data(), in.size()));
+
+        // grow the parsed containers and add to them
+        tr_variant* list = nullptr;
+        EXPECT_TRUE(tr_variantDictFindList(top, key_list, &list));
+        for (int i = 0; i < 100; ++i)
+        {
+            tr_variantListAddStr(list, long_str.c_str());
+        }
+
+        auto* const sub = tr_variantDictAddDict(top, key_sub, 0);
+        tr_variantInitRaw(tr_variantDictAdd(sub, key_sub), huge_str.data(), huge_str.size());
+        tr_variantListAddInt(tr_variantDictAddList(sub, key_list, 0), 3);
+
+        // take over a value from a tree that's allocated elsewhere
+        tr_variant heap;
+        tr_variantInitList(&heap, 1);
+        tr_variantListAddStr(&heap, long_str.c_str());
+        tr_variantDictSteal(top, key_stolen, &heap);
+        tr_variantFree(&heap);
+    };
+
+    tr_variant expected;
+    build(&expected);
+    auto* const expected_str = tr_variantToStr(&expected, TR_VARIANT_FMT_BENC, nullptr);
+    tr_variantFree(&expected);
+
+    auto arena = tr_variant_arena{};
+    tr_variant top;
+    tr_variantInitArena(&top, &arena);
+    build(&top);
+    auto* const str = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, nullptr);
+    EXPECT_STREQ(expected_str, str);
+    tr_variantFree(&top);
+
+    tr_free(str);
+    tr_free(expected_str);
+}
+
+/**
+ * Parses and frees a .torrent-sized bencoded document over and over, with
+ * the tree on the heap and in an arena, and prints the throughput. It only
+ * runs with --gtest_also_run_disabled_tests.
+ */
+TEST_F(VariantTest, DISABLED_benchmarkParse)
+{
+    auto constexpr NumFiles = 20000;
+    auto constexpr NumPieces = 50000;
+    auto constexpr Rounds = 100;
+
+    // a multi-file torrent with long paths and a big `pieces' string
+    tr_variant torrent;
+    tr_variantInitDict(&torrent, 2);
+    tr_variantDictAddStr(&torrent, TR_KEY_announce, "http://tracker.example.com:6969/announce");
+    auto* const info = tr_variantDictAddDict(&torrent, TR_KEY_info, 4);
+    auto* const files = tr_variantDictAddList(info, TR_KEY_files, NumFiles);
+
+    for (int i = 0; i < NumFiles; ++i)
+    {
+        auto* const file = tr_variantListAddDict(files, 2);
+        tr_variantDictAddInt(file, TR_KEY_length, 1000000 + i);
+        auto* const path = tr_variantDictAddList(file, TR_KEY_path, 2);
+        tr_variantListAddStr(path, ("Disc " + std::to_string(i / 1000)).c_str());
+        tr_variantListAddStr(path, ("Track " + std::to_string(i) + " - a file name of a typical length.flac").c_str());
+    }
+
+    tr_variantDictAddStr(info, TR_KEY_name, "Some Collection");
+    tr_variantDictAddInt(info, TR_KEY_piece_length, 1 << 20);
+    auto const pieces = std::string(NumPieces * 20, 'p');
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(&torrent, TR_VARIANT_FMT_BENC, &len);
+    tr_variantFree(&torrent);
+
+    auto const run = [benc, len](bool use_arena)
+    {
+        auto const begin = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < Rounds; ++i)
+        {
+            auto arena = tr_variant_arena{};
+            tr_variant top;
+
+            if (use_arena)
+            {
+                tr_variantInitArena(&top, &arena);
+            }
+
+            EXPECT_EQ(0, tr_variantFromBenc(&top, benc, len));
+            tr_variantFree(&top);
+        }
+
+        auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+        return len * Rounds / 1e6 / elapsed.count();
+    };
+
+    auto const heap_mbps = run(false);
+    auto const arena_mbps = run(true);
+    std::printf("parsing %.1f MB of benc: heap %.0f MB/s, arena %.0f MB/s\n", len / 1e6, heap_mbps, arena_mbps);
+
+    tr_free(benc);
+}
+
+TEST_F(VariantTest, dictIndex)
+{
+    // enough keys for the dict to be indexed on its first search
+    auto constexpr N = 200;
+    auto const key = [](int i)
+    {
+        auto const str = "key-" + std::to_string(i);
+        return tr_quark_new(str.data(), std::size(str));
+    };
+    auto const key_dup = tr_quark_new("dup", 3);
+
+    auto const check = [&](tr_variant* top)
+    {
+        // duplicate keys: the first one wins, as with a linear search
+        auto in = std::string{ "d3:dupi1e" };
+        for (int i = 0; i < N; ++i)
+        {
+            auto const str = "key-" + std::to_string(i);
+            in += std::to_string(std::size(str)) + ":" + str + "i" + std::to_string(i) + "e";
+        }
+        in += "3:dupi2ee";
+        EXPECT_EQ(0, tr_variantFromBenc(top, in.data(), in.size()));
+
+        auto val = int64_t{};
+        EXPECT_TRUE(tr_variantDictFindInt(top, key_dup, &val));
+        EXPECT_EQ(1, val);
+        for (int i = 0; i < N; ++i)
+        {
+            EXPECT_TRUE(tr_variantDictFindInt(top, key(i), &val));
+            EXPECT_EQ(i, val);
+        }
+
+        // remove some keys, then add enough new ones to grow the dict
+        for (int i = 0; i < N; i += 3)
+        {
+            EXPECT_TRUE(tr_variantDictRemove(top, key(i)));
+        }
+        EXPECT_FALSE(tr_variantDictFind(top, key(0)));
+        for (int i = N; i < N * 3; ++i)
+        {
+            tr_variantDictAddInt(top, key(i), i);
+            EXPECT_TRUE(tr_variantDictFindInt(top, key(i), &val));
+            EXPECT_EQ(i, val);
+        }
+
+        for (int i = 0; i < N * 3; ++i)
+        {
+            bool const expected = i >= N || i % 3 != 0;
+            EXPECT_EQ(expected, tr_variantDictFindInt(top, key(i), &val));
+            if (expected)
+            {
+                EXPECT_EQ(i, val);
+            }
+        }
+
+        // the first "dup" was removed, so the second one shows through
+        EXPECT_TRUE(tr_variantDictRemove(top, key_dup));
+        EXPECT_TRUE(tr_variantDictFindInt(top, key_dup, &val));
+        EXPECT_EQ(2, val);
+    };
+
+    tr_variant top;
+    check(&top);
+    tr_variantFree(&top);
+
+    auto arena = tr_variant_arena{};
+    tr_variantInitArena(&top, &arena);
+    check(&top);
+    tr_variantFree(&top);
+}
+
 TEST_F(VariantTest, bencToJson)
 {
     struct LocalTest
@@ -369,6 +590,51 @@ TEST_F(VariantTest, bencToJson)
     }
 }
 
+TEST_F(VariantTest, jsonFlush)
+{
+    tr_variant top;
+    tr_variantInitDict(&top, 2);
+    tr_variant* ints = tr_variantDictAddList(&top, TR_KEY_files, 1000);
+    tr_variant* strs = tr_variantDictAddList(&top, TR_KEY_name, 1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        tr_variantListAddInt(ints, i);
+        tr_variantListAddStr(strs, std::to_string(i).c_str());
+    }
+
+    struct FlushData
+    {
+        std::string flushed;
+        int flushCount = 0;
+    };
+
+    auto const flush_func = [](struct evbuffer* buf, void* vdata)
+    {
+        auto* data = static_cast<FlushData*>(vdata);
+        auto const len = evbuffer_get_length(buf);
+        data->flushed.append(reinterpret_cast<char const*>(evbuffer_pullup(buf, -1)), len);
+        evbuffer_drain(buf, len);
+        ++data->flushCount;
+    };
+
+    auto data = FlushData{};
+    auto* buf = evbuffer_new();
+    auto const flush_size = size_t{ 256 };
+    tr_variantToBufFunc(&top, TR_VARIANT_FMT_JSON_LEAN, buf, flush_size, flush_func, &data);
+    EXPECT_LT(1, data.flushCount);
+    EXPECT_GT(flush_size, evbuffer_get_length(buf));
+
+    // the flushed pieces plus the leftovers should match the unflushed output
+    data.flushed.append(reinterpret_cast<char const*>(evbuffer_pullup(buf, -1)), evbuffer_get_length(buf));
+    auto len = size_t{};
+    auto* str = tr_variantToStr(&top, TR_VARIANT_FMT_JSON_LEAN, &len);
+    EXPECT_EQ(stripWhitespace(std::string(str, len)), stripWhitespace(data.flushed));
+
+    tr_free(str);
+    evbuffer_free(buf);
+    tr_variantFree(&top);
+}
+
 TEST_F(VariantTest, merge)
 {
     auto const i1 = tr_quark_new("i1", 2);